@@ -0,0 +1,19 @@
+#!/bin/bash
+# Time usher-sampled placement of a fixed sample set with 1 to 128 threads.
+# Usage: benchPlacementScaling.sh [tree.pb] [samples.vcf]
+# Without arguments, places ../test/new_samples.vcf on the tree built from ../test/global_phylo.nh.
+outdir=$(mktemp -d)
+pb=$1
+vcf=${2:-../test/new_samples.vcf}
+if [ -z "$pb" ]; then
+    pb=$outdir/global_assignments.pb
+    ../build/usher -t ../test/global_phylo.nh -v ../test/global_samples.vcf -o $pb -d $outdir > /dev/null 2>&1 || exit 1
+fi
+echo -e "threads\tseconds"
+for threads in 1 2 4 8 16 32 64 128; do
+    start=$(date +%s.%N)
+    ../build/usher-sampled -i $pb -v $vcf -d $outdir -T $threads --optimization_radius 0 > /dev/null 2>&1 || exit 1
+    end=$(date +%s.%N)
+    echo -e "$threads\t$(echo "$end - $start" | bc)"
+done
+rm -rf $outdir
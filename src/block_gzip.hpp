@@ -0,0 +1,317 @@
+#pragma once
+// Blocked gzip (BGZF) for .pb.gz MAT files, compressed and decompressed in parallel.
+//
+// A BGZF file is a series of independent gzip members, each holding at most 64 KB
+// of input and recording its own compressed size in a 'BC' extra subfield of the
+// gzip header, followed by an empty end-of-file member. It stays a valid gzip
+// file for gzip -d (and for htslib's bgzip), but member boundaries can be found
+// from the headers alone, so members can be inflated concurrently.
+//   Writer  std::streambuf that collects BATCH_BLOCKS blocks of input and deflates
+//           them in parallel before writing them out in order
+//   Reader  protobuf ZeroCopyInputStream over a mapped BGZF file that inflates the
+//           next batch of members in the background while the current one is parsed
+// Files that are plain (single member) gzip are not BGZF and still go through the
+// sequential gzip_decompressor path of the loaders.
+#include <google/protobuf/io/zero_copy_stream.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_group.h>
+#include <zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Block_Gzip {
+//uncompressed bytes per member, as in BGZF, so a member never exceeds MAX_BLOCK_SIZE
+static const size_t BLOCK_SIZE = 0xff00;
+static const size_t MAX_BLOCK_SIZE = 0x10000;
+static const size_t HEADER_SIZE = 18;
+static const size_t FOOTER_SIZE = 8;
+//members compressed or decompressed in one parallel batch
+static const size_t BATCH_BLOCKS = 256;
+static const uint8_t EOF_BLOCK[28] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 27, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+inline void put_le32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+inline uint32_t get_le32(const uint8_t* in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+//Size of the BGZF member starting at in, 0 if it is not a BGZF member header
+inline size_t block_size(const uint8_t* in, size_t available) {
+    if ((available < HEADER_SIZE) || (in[0] != 31) || (in[1] != 139) || (in[2] != 8) || !(in[3] & 4)) {
+        return 0;
+    }
+    size_t xlen = in[10] | (in[11] << 8);
+    if (available < 12 + xlen) {
+        return 0;
+    }
+    for (size_t pos = 12; pos + 4 <= 12 + xlen;) {
+        size_t subfield_len = in[pos + 2] | (in[pos + 3] << 8);
+        if ((in[pos] == 'B') && (in[pos + 1] == 'C') && (subfield_len == 2)) {
+            return (in[pos + 4] | (in[pos + 5] << 8)) + 1;
+        }
+        pos += 4 + subfield_len;
+    }
+    return 0;
+}
+
+inline bool is_block_gzip(const std::string& filename) {
+    uint8_t buf[HEADER_SIZE];
+    FILE* fh = fopen(filename.c_str(), "rb");
+    if (!fh) {
+        return false;
+    }
+    bool ret = (fread(buf, 1, HEADER_SIZE, fh) == HEADER_SIZE) && (block_size(buf, HEADER_SIZE) != 0);
+    fclose(fh);
+    return ret;
+}
+
+//Deflate in_size (at most BLOCK_SIZE) bytes into one BGZF member
+inline void compress_block(const char* in, size_t in_size, std::string& out) {
+    out.resize(MAX_BLOCK_SIZE);
+    auto out_start = (uint8_t*) &out[0];
+    size_t compressed_size = 0;
+    //incompressible input may not fit at the default level, storing it always does
+    for (int level : {Z_DEFAULT_COMPRESSION, 0}) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        zs.next_in = (Bytef*) in;
+        zs.avail_in = in_size;
+        zs.next_out = out_start + HEADER_SIZE;
+        zs.avail_out = MAX_BLOCK_SIZE - HEADER_SIZE - FOOTER_SIZE;
+        auto ret = deflate(&zs, Z_FINISH);
+        compressed_size = zs.total_out;
+        deflateEnd(&zs);
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+    }
+    size_t total_size = HEADER_SIZE + compressed_size + FOOTER_SIZE;
+    memcpy(out_start, EOF_BLOCK, HEADER_SIZE);
+    out_start[16] = (total_size - 1) & 0xff;
+    out_start[17] = (total_size - 1) >> 8;
+    put_le32(out_start + HEADER_SIZE + compressed_size, crc32(crc32(0, NULL, 0), (const Bytef*) in, in_size));
+    put_le32(out_start + HEADER_SIZE + compressed_size + 4, in_size);
+    out.resize(total_size);
+}
+
+class Writer : public std::streambuf {
+    FILE* fh;
+    std::vector<char> buffer;
+    std::vector<std::string> compressed;
+    bool ok;
+
+    void write_batch() {
+        size_t size = pptr() - pbase();
+        size_t num_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, num_blocks),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t idx = r.begin(); idx < r.end(); idx++) {
+                auto start = idx * BLOCK_SIZE;
+                compress_block(pbase() + start, std::min(BLOCK_SIZE, size - start), compressed[idx]);
+            }
+        });
+        for (size_t idx = 0; idx < num_blocks; idx++) {
+            ok = ok && (fwrite(compressed[idx].data(), 1, compressed[idx].size(), fh) == compressed[idx].size());
+        }
+        setp(buffer.data(), buffer.data() + buffer.size());
+    }
+
+  protected:
+    int_type overflow(int_type c) override {
+        write_batch();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return ok ? traits_type::not_eof(c) : traits_type::eof();
+    }
+
+  public:
+    Writer(const std::string& filename): buffer(BLOCK_SIZE * BATCH_BLOCKS), compressed(BATCH_BLOCKS) {
+        fh = fopen(filename.c_str(), "wb");
+        ok = (fh != NULL);
+        setp(buffer.data(), buffer.data() + buffer.size());
+    }
+    ~Writer() {
+        close();
+    }
+    //Writes the remaining input and the end-of-file member, returns false if any write failed
+    bool close() {
+        if (fh == NULL) {
+            return ok;
+        }
+        write_batch();
+        ok = ok && (fwrite(EOF_BLOCK, 1, sizeof(EOF_BLOCK), fh) == sizeof(EOF_BLOCK));
+        ok = (fclose(fh) == 0) && ok;
+        fh = NULL;
+        return ok;
+    }
+};
+
+class Reader : public google::protobuf::io::ZeroCopyInputStream {
+    uint8_t* map_start;
+    size_t mapped_size;
+    //offset of the first member not yet handed to a batch
+    size_t next_block;
+    std::vector<char> current;
+    std::vector<char> prefetched;
+    //read position in current
+    size_t position;
+    int64_t byte_count;
+    bool failed;
+    bool prefetch_failed;
+    tbb::task_group prefetch_group;
+
+    //Inflate the next BATCH_BLOCKS members into out, sets failed on a malformed member
+    void read_batch(std::vector<char>& out, bool& batch_failed) {
+        std::vector<std::pair<size_t, size_t>> blocks;
+        std::vector<size_t> out_offsets(1, 0);
+        while ((blocks.size() < BATCH_BLOCKS) && (next_block < mapped_size)) {
+            auto size = block_size(map_start + next_block, mapped_size - next_block);
+            if ((size < HEADER_SIZE + FOOTER_SIZE) || (size > mapped_size - next_block)) {
+                batch_failed = true;
+                break;
+            }
+            blocks.emplace_back(next_block, size);
+            out_offsets.push_back(out_offsets.back() + get_le32(map_start + next_block + size - 4));
+            if (out_offsets.back() - out_offsets[out_offsets.size() - 2] > BLOCK_SIZE * 2) {
+                batch_failed = true;
+                break;
+            }
+            next_block += size;
+        }
+        out.resize(out_offsets.back());
+        std::atomic_bool inflate_failed(false);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, blocks.size()),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t idx = r.begin(); idx < r.end(); idx++) {
+                auto block = map_start + blocks[idx].first;
+                size_t xlen = block[10] | (block[11] << 8);
+                auto out_size = out_offsets[idx + 1] - out_offsets[idx];
+                //zlib rejects a NULL output buffer even for the empty end-of-file member
+                Bytef empty_out;
+                auto out_start = (out_size > 0) ? (Bytef*) out.data() + out_offsets[idx] : &empty_out;
+                z_stream zs;
+                memset(&zs, 0, sizeof(zs));
+                inflateInit2(&zs, -15);
+                zs.next_in = block + 12 + xlen;
+                zs.avail_in = blocks[idx].second - 12 - xlen - FOOTER_SIZE;
+                zs.next_out = out_start;
+                zs.avail_out = out_size;
+                auto ret = inflate(&zs, Z_FINISH);
+                inflateEnd(&zs);
+                auto crc = get_le32(block + blocks[idx].second - 8);
+                if ((ret != Z_STREAM_END) || (zs.total_out != out_size) || (crc32(crc32(0, NULL, 0), out_start, out_size) != crc)) {
+                    inflate_failed = true;
+                }
+            }
+        });
+        if (inflate_failed) {
+            batch_failed = true;
+        }
+    }
+
+    void start_prefetch() {
+        if (next_block < mapped_size) {
+            prefetch_group.run([this] {
+                read_batch(prefetched, prefetch_failed);
+            });
+        }
+    }
+
+  public:
+    Reader(const std::string& filename): map_start(NULL), mapped_size(0), next_block(0), position(0),
+        byte_count(0), failed(false), prefetch_failed(false) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        struct stat stat_buf;
+        if ((fd < 0) || (fstat(fd, &stat_buf) != 0)) {
+            failed = true;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return;
+        }
+        mapped_size = stat_buf.st_size;
+        if (mapped_size > 0) {
+            map_start = (uint8_t*) mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map_start == MAP_FAILED) {
+                map_start = NULL;
+                mapped_size = 0;
+                failed = true;
+            } else {
+                madvise(map_start, mapped_size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+        start_prefetch();
+    }
+    ~Reader() noexcept {
+        prefetch_group.wait();
+        if (map_start != NULL) {
+            munmap(map_start, mapped_size);
+        }
+    }
+    //true if the file could not be read or a member was malformed
+    bool error() const {
+        return failed;
+    }
+    bool Next(const void** data, int* size) override {
+        while (position == current.size()) {
+            prefetch_group.wait();
+            if (failed || prefetch_failed) {
+                failed = true;
+                return false;
+            }
+            if (prefetched.empty() && (next_block >= mapped_size)) {
+                return false;
+            }
+            current.swap(prefetched);
+            prefetched.clear();
+            position = 0;
+            start_prefetch();
+        }
+        *data = current.data() + position;
+        *size = current.size() - position;
+        byte_count += *size;
+        position = current.size();
+        return true;
+    }
+    void BackUp(int count) override {
+        position -= count;
+        byte_count -= count;
+    }
+    bool Skip(int count) override {
+        const void* data;
+        int size;
+        while (count > 0) {
+            if (!Next(&data, &size)) {
+                return false;
+            }
+            if (size > count) {
+                BackUp(size - count);
+                return true;
+            }
+            count -= size;
+        }
+        return true;
+    }
+    int64_t ByteCount() const override {
+        return byte_count;
+    }
+};
+}
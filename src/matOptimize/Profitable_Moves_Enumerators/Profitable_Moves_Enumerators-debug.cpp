@@ -6,12 +6,10 @@
 namespace MAT = Mutation_Annotated_Tree;
 #include "../Fitch_Sankoff.hpp"
 #include "../check_samples.hpp"
+#include "../mutated_positions.hpp"
 #include <unordered_set>
 
-extern std::unordered_map<MAT::Mutation,
-       std::unordered_map<std::string, nuc_one_hot> *,
-       Mutation_Pos_Only_Hash, Mutation_Pos_Only_Comparator>
-       mutated_positions;
+extern Mutated_Positions mutated_positions;
 
 struct Mutation_Count {
     int position;
@@ -149,10 +147,15 @@ int get_parsimmony_score_only(MAT::Node *src, MAT::Node *dst, MAT::Node *LCA,con
         nuc_one_hot LCA_parent_state = get_parent_state(LCA, position);
         std::vector<uint8_t> boundary1_major_allele(
             new_bfs_ordered_nodes.size() + 8);
-        MAT::Mutation mut(position);
-        const auto& non_ref_muts = mutated_positions[mut];
+        std::unordered_map<std::string, nuc_one_hot> non_ref_muts;
+        auto pos_idx = mutated_positions.find(position);
+        if (pos_idx != mutated_positions.size()) {
+            for (auto iter = mutated_positions.samples_begin(pos_idx); iter != mutated_positions.samples_end(pos_idx); iter++) {
+                non_ref_muts.emplace(ori_tree->get_node_name(iter->node_id), iter->allele);
+            }
+        }
         FS_backward_pass(new_bfs_ordered_nodes, boundary1_major_allele,
-                         *non_ref_muts, MAT::Mutation::refs[position]);
+                         non_ref_muts, MAT::Mutation::refs[position]);
         std::vector<uint8_t> states_out(new_bfs_ordered_nodes.size());
         std::vector<std::vector<MAT::Node *>> mutation_count(
                                                new_bfs_ordered_nodes.size());
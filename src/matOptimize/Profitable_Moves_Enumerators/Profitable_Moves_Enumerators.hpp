@@ -7,7 +7,6 @@
 #include <cstdio>
 #include <vector>
 #include <array>
-#include "../stack_allocator.hpp"
 typedef std::vector<std::array<std::vector<unsigned int>, 4>> mutated_node_dfs_idx_t;
 extern mutated_node_dfs_idx_t mutated_node_dfs_idx;
 namespace MAT = Mutation_Annotated_Tree;
@@ -114,7 +113,6 @@ class Mutation_Count_Change {
 static bool operator<(const MAT::Mutation &lhs, const Mutation_Count_Change &rhs) {
     return lhs.get_position() < rhs.get_position();
 }
-typedef std::vector<Mutation_Count_Change,stack_allocator<Mutation_Count_Change>> Mutation_Count_Change_Collection_FIFO;
 
 typedef std::vector<Mutation_Count_Change> Mutation_Count_Change_Collection;
 typedef Mutation_Count_Change_Collection::const_iterator Mut_Change_Iter;
@@ -151,18 +151,8 @@ static void clean_tree_load(MAT::Tree& t,std::unordered_set<size_t>& changed_nod
     compare_mutation_tree(t, new_tree);
 #endif
 }
-char get_state(char* sample,int position) {
-    auto iter=mutated_positions.find(position);
-    if (iter==mutated_positions.end()) {
-        return MAT::Mutation::refs[position].get_nuc_no_check();
-    } else {
-        auto sample_iter=iter->second->find(sample);
-        if (iter->second->end()==sample_iter) {
-            return MAT::Mutation::refs[position].get_nuc_no_check();
-        } else {
-            return sample_iter->second.get_nuc_no_check();
-        }
-    }
+char get_state(size_t sample_node_id,int position) {
+    return mutated_positions.get_allele(sample_node_id, position).get_nuc_no_check();
 }
 void recondense_tree(MAT::Tree& t) {
     std::unordered_set<size_t> changed_nodes;
@@ -15,15 +15,17 @@ MAT::Tree reassign_state_full(MAT::Tree &tree_in) {
         new_tree.breadth_first_expansion();
     std::vector<tbb::concurrent_vector<Mutation_Annotated_Tree::Mutation>>
             output(bfs_ordered_nodes.size());
-    tbb::parallel_for_each(
-        mutated_positions.begin(), mutated_positions.end(),
-        [&bfs_ordered_nodes, &output,&tree_in](
-            const std::pair<MAT::Mutation,
-            std::unordered_map<std::string, nuc_one_hot> *>
-    &pos) {
-        std::unordered_map<std::string, nuc_one_hot> *mutated = pos.second;
-        Fitch_Sankoff_Whole_Tree(bfs_ordered_nodes, pos.first, *mutated,
-                                 output,&tree_in);
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, mutated_positions.size()),
+    [&bfs_ordered_nodes, &output,&tree_in](tbb::blocked_range<size_t> r) {
+        for (size_t idx = r.begin(); idx < r.end(); idx++) {
+            std::unordered_map<std::string, nuc_one_hot> mutated;
+            for (auto iter = mutated_positions.samples_begin(idx); iter != mutated_positions.samples_end(idx); iter++) {
+                mutated.emplace(tree_in.get_node_name(iter->node_id), iter->allele);
+            }
+            Fitch_Sankoff_Whole_Tree(bfs_ordered_nodes, mutated_positions.mutations[idx], mutated,
+                                     output,&tree_in);
+        }
     });
     tbb::affinity_partitioner ap;
     tbb::parallel_for(
@@ -8,10 +8,7 @@
 #include <random>
 #include <chrono>
 #include <vector>
-std::unordered_map<MAT::Mutation,
-    std::unordered_map<std::string, nuc_one_hot> *,
-    Mutation_Pos_Only_Hash, Mutation_Pos_Only_Comparator>
-    mutated_positions;
+Mutated_Positions mutated_positions;
 static Profitable_Moves_ptr_t make_move(MAT::Node* src,MAT::Node* dst) {
     std::vector<MAT::Node*> src_to_LCA;
     std::vector<MAT::Node*> dst_to_LCA;
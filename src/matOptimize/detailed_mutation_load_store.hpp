@@ -1,4 +1,7 @@
 #define BLOCK_SIZE 0x1000000
+//first word broadcasted by MPI_send_tree_delta
+#define TREE_SYNC_FULL 0
+#define TREE_SYNC_DELTA 1
 #include "mutation_detailed.pb.h"
 #include <climits>
 #include <cstddef>
@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
 #include <mpi.h>
 #include <sys/mman.h>
 #include <tbb/flow_graph.h>
@@ -222,12 +223,16 @@ struct Load_Subtree_pararllel {
             out->children.resize(child_size);
             MAT::Mutations_Collection mutation_so_far;
             load_mutations(out, node, ignored_size, parent_mutations, mutation_so_far);
+            // copy out of this loader, it is gone by the time deferred children run
+            MAT::Node *this_node = out;
+            const uint8_t *file_start = this->file_start;
+            MAT::Tree::condensed_node_t &condensed_nodes = this->condensed_nodes;
             for (size_t child_idx = 0; child_idx < child_size; child_idx++) {
-                tg.run([=, &tg]() {
+                tg.run([=, &tg, &condensed_nodes]() {
                     Load_Subtree_pararllel child_loader(
-                        out, file_start, node.children_offsets(child_idx),
+                        this_node, file_start, node.children_offsets(child_idx),
                         node.children_lengths(child_idx),
-                        out->children[child_idx], condensed_nodes,
+                        this_node->children[child_idx], condensed_nodes,
                         mutation_so_far);
                     child_loader.execute(tg);
                 });
@@ -367,10 +372,229 @@ void Mutation_Annotated_Tree::Tree::load_detatiled_mutations(
     fputs("Finished loading intermediate protobuf\n", stderr);
 }
 // main load function
+//Last version received by MPI_receive_tree_delta, and the tree it went into
+static uint64_t synced_version=0;
+static const MAT::Tree *synced_tree=nullptr;
 void Mutation_Annotated_Tree::Tree::MPI_receive_tree() {
+    if (synced_tree==this) {
+        synced_version=0;
+    }
     fputs("Loading intermediate protobuf\n", stderr);
     auto uncompressed = receive_mpi_uncompress();
     deserialize_common<no_deserialize_condensed_nodes>(uncompressed, this);
     fputs("Finished loading intermediate protobuf\n", stderr);
     fprintf(stderr, "node list zize %zu\n",all_nodes.size());
-}
\ No newline at end of file
+}
+//Ancestral valid mutations merged with the valid mutations of node, ends with INT_MAX like root_muts
+static void merge_valid_mutations(const MAT::Mutations_Collection &parent_mutations,
+                                  const MAT::Node *node,
+                                  MAT::Mutations_Collection &mutation_out) {
+    mutation_out.reserve(parent_mutations.size() + node->mutations.size());
+    auto par_iter = parent_mutations.begin();
+    for (const auto &mut : node->mutations) {
+        if (mut.get_all_major_allele() == 0xf) {
+            continue;
+        }
+        while (par_iter->get_position() < mut.get_position()) {
+            mutation_out.mutations.push_back(*par_iter);
+            par_iter++;
+        }
+        if (par_iter->get_position() == mut.get_position()) {
+            par_iter++;
+        }
+        mutation_out.mutations.push_back(mut);
+    }
+    mutation_out.mutations.insert(mutation_out.mutations.end(), par_iter,
+                                  parent_mutations.end());
+}
+//Regenerate mutations at ignored positions the same way as Load_Subtree_pararllel,
+//their state come from the closest ancestral valid mutation
+static void refill_ignored_mutations(MAT::Node *node,
+                                     const MAT::Mutations_Collection &parent_mutations) {
+    std::vector<MAT::Mutation> valid_mutations;
+    valid_mutations.reserve(node->mutations.size());
+    for (const auto &mut : node->mutations) {
+        if (mut.get_all_major_allele() != 0xf) {
+            valid_mutations.push_back(mut);
+        }
+    }
+    node->mutations.clear();
+    auto par_iter = parent_mutations.begin();
+    auto valid_iter = valid_mutations.begin();
+    for (const auto &ignored_one : node->ignore) {
+        if (ignored_one.first == INT_MAX) {
+            break;
+        }
+        for (int position = ignored_one.first; position <= ignored_one.second;
+                position++) {
+            while (valid_iter != valid_mutations.end() &&
+                    valid_iter->get_position() < position) {
+                node->mutations.push_back(*valid_iter);
+                valid_iter++;
+            }
+            while (par_iter->get_position() < position) {
+                par_iter++;
+            }
+            if (par_iter->get_position() == position) {
+                node->mutations.mutations.emplace_back(
+                    0, position, par_iter->get_mut_one_hot(),
+                    par_iter->get_mut_one_hot(), MAT::Mutation::ignored());
+            } else {
+                node->mutations.mutations.emplace_back(
+                    0, position, MAT::Mutation::refs[position],
+                    MAT::Mutation::refs[position], MAT::Mutation::ignored());
+            }
+        }
+    }
+    node->mutations.mutations.insert(node->mutations.end(), valid_iter,
+                                     valid_mutations.end());
+}
+//Walk subtrees containing dirty nodes (changed nodes and their descendants),
+//refilling ignored mutations of dirty nodes, skipping untouched subtrees
+static void refill_dirty(MAT::Node *node,
+                         const MAT::Mutations_Collection &parent_mutations,
+                         bool dirty, const std::vector<uint8_t> &is_record,
+                         const std::vector<uint8_t> &has_record_below,
+                         tbb::task_group &tg) {
+    dirty |= is_record[node->node_id];
+    if (dirty && !node->ignore.empty()) {
+        refill_ignored_mutations(node, parent_mutations);
+    }
+    if (node->children.empty() || !(dirty || has_record_below[node->node_id])) {
+        return;
+    }
+    auto mutation_so_far = std::make_shared<MAT::Mutations_Collection>();
+    merge_valid_mutations(parent_mutations, node, *mutation_so_far);
+    for (auto child : node->children) {
+        if (dirty || has_record_below[child->node_id]) {
+            tg.run([=, &is_record, &has_record_below, &tg]() {
+                refill_dirty(child, *mutation_so_far, dirty, is_record,
+                             has_record_below, tg);
+            });
+        }
+    }
+}
+static void apply_delta(MAT::Tree *tree, const Mutation_Detailed::tree_delta &delta) {
+    // nodes are created first, so children can be linked regardless of record order
+    for (const auto &record : delta.nodes()) {
+        if (!tree->get_node(record.node_id())) {
+            tree->register_node_serial(new MAT::Node(record.node_id()));
+        }
+    }
+    for (auto removed_id : delta.removed_node_ids()) {
+        delete tree->get_node(removed_id);
+        tree->erase_node(removed_id);
+    }
+    std::vector<uint8_t> is_record(tree->all_nodes.size(), false);
+    std::vector<uint8_t> has_record_below(tree->all_nodes.size(), false);
+    for (auto &record : delta.nodes()) {
+        auto node = tree->get_node(record.node_id());
+        is_record[node->node_id] = true;
+        node->ignore.clear();
+        size_t ignore_range_size = record.ignored_range_end_size();
+        if (ignore_range_size) {
+            node->ignore.reserve(ignore_range_size + 1);
+            for (size_t ignore_idx = 0; ignore_idx < ignore_range_size;
+                    ignore_idx++) {
+                node->ignore.emplace_back(record.ignored_range_start(ignore_idx),
+                                          record.ignored_range_end(ignore_idx));
+            }
+            node->ignore.emplace_back(INT_MAX, INT_MAX);
+        }
+        node->mutations.clear();
+        node->mutations.reserve(record.mutation_positions_size());
+        for (int mut_idx = 0; mut_idx < record.mutation_positions_size();
+                mut_idx++) {
+            MAT::Mutation mut;
+            mut.position = record.mutation_positions(mut_idx);
+            *((uint32_t *)(&mut) + 1) = record.mutation_other_fields(mut_idx);
+            node->mutations.push_back(mut);
+        }
+        node->children.clear();
+        node->children.reserve(record.children_ids_size());
+        for (auto child_id : record.children_ids()) {
+            auto child = tree->get_node(child_id);
+            child->parent = node;
+            node->children.push_back(child);
+        }
+        auto existing_name = tree->node_names.find(node->node_id);
+        if (existing_name != tree->node_names.end()) {
+            tree->node_name_to_idx_map.erase(existing_name->second);
+            tree->node_names.erase(existing_name);
+        }
+    }
+    for (const auto &name_map : delta.node_idx_map()) {
+        tree->node_names.emplace(name_map.node_id(), name_map.node_name());
+        tree->node_name_to_idx_map.emplace(name_map.node_name(),
+                                           name_map.node_id());
+    }
+    tree->root = tree->get_node(delta.root_id());
+    tree->root->parent = nullptr;
+    tree->node_idx = delta.nodes_idx_next();
+    const auto &changed = delta.changed();
+    for (auto node : tree->all_nodes) {
+        if (node && node->node_id < changed.size()) {
+            node->changed = changed[node->node_id];
+        }
+    }
+    for (auto &record : delta.nodes()) {
+        for (auto node = tree->get_node(record.node_id()); node && !has_record_below[node->node_id]; node = node->parent) {
+            has_record_below[node->node_id] = true;
+        }
+    }
+    MAT::Mutations_Collection root_muts;
+    root_muts.mutations.emplace_back(INT_MAX);
+    tbb::task_group tg;
+    refill_dirty(tree->root, root_muts, false, is_record, has_record_below, tg);
+    tg.wait();
+}
+void Mutation_Annotated_Tree::Tree::MPI_receive_tree_delta() {
+    uint64_t header[2];
+    MPI_Bcast(header, 2, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
+    int in_sync = root && synced_tree == this && synced_version + 1 == header[1];
+    if (header[0] == TREE_SYNC_DELTA) {
+        MPI_Allreduce(MPI_IN_PLACE, &in_sync, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    }
+    bool applied = false;
+    if (header[0] == TREE_SYNC_DELTA && in_sync) {
+        uint64_t sizes[2];
+        MPI_Bcast(sizes, 2, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
+        Mutation_Detailed::tree_delta delta;
+        // A compressed size of 0 means the sender could not compress the delta
+        int decoded = sizes[0] != 0;
+        if (decoded) {
+            uint8_t *compressed = (uint8_t *)malloc(sizes[0]);
+            MPI_Bcast(compressed, sizes[0], MPI_BYTE, 0, MPI_COMM_WORLD);
+            std::string serialized(sizes[1], 0);
+            unsigned long uncompressed_size = sizes[1];
+            decoded = uncompress((uint8_t *)&serialized[0], &uncompressed_size,
+                                 compressed, sizes[0]) == Z_OK &&
+                      uncompressed_size == sizes[1] &&
+                      delta.ParseFromString(serialized);
+            free(compressed);
+        }
+        // Every rank has to decode the delta, otherwise all of them fall back
+        // to the full tree so that no rank is left out of sync
+        MPI_Allreduce(MPI_IN_PLACE, &decoded, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+        if (decoded) {
+            apply_delta(this, delta);
+            applied = true;
+            fprintf(stderr, "Applied tree delta version %zu with %d changed nodes\n",
+                    header[1], delta.nodes_size());
+        } else {
+            fprintf(stderr, "Tree delta version %zu is corrupted, receiving full tree\n",
+                    header[1]);
+        }
+    }
+    if (!applied) {
+        delete_nodes();
+        all_nodes.clear();
+        node_names.clear();
+        node_name_to_idx_map.clear();
+        MAT::Mutation::chromosomes.clear();
+        MAT::Mutation::refs.clear();
+        MPI_receive_tree();
+    }
+    synced_version = header[1];
+    synced_tree = this;
+}
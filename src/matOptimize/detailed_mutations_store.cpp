@@ -5,7 +5,9 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <tbb/blocked_range.h>
 #include <tbb/flow_graph.h>
+#include <tbb/parallel_for.h>
 #include <unistd.h>
 #include <mpi.h>
 #include <sys/time.h>
@@ -312,3 +314,128 @@ void Mutation_Annotated_Tree::Tree::MPI_send_tree() const {
     MPI_Bcast(&uncompressed_length, 1, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
     fprintf(stderr, "main node list zize %zu\n",all_nodes.size());
 }
+//What rank 0 broadcasted last time, fingerprints are indexed by node_id, 0 for absent nodes
+static std::vector<uint64_t> synced_fingerprints;
+static uint64_t synced_version=0;
+static uint64_t fingerprint_mix(uint64_t hash, uint64_t value) {
+    value*=0x9e3779b97f4a7c15ULL;
+    value^=value>>29;
+    return (hash^value)*0x100000001b3ULL;
+}
+//Hash of everything a delta record carries for this node. The sensitive allele
+//byte of mutations is left out, as followers recompute it with adjust_all anyway
+static uint64_t node_fingerprint(const MAT::Node *node, const MAT::Tree &tree) {
+    uint64_t hash=fingerprint_mix(0xcbf29ce484222325ULL, node->children.size());
+    for (const auto child : node->children) {
+        hash=fingerprint_mix(hash, child->node_id);
+    }
+    hash=fingerprint_mix(hash, node->mutations.size());
+    for (const auto &mut : node->mutations) {
+        if (mut.get_all_major_allele() != 0xf) {
+            uint64_t other_fields=*((uint32_t *)(&mut) + 1)&0xffffff;
+            hash=fingerprint_mix(hash, ((uint64_t)(uint32_t)mut.get_position()<<32)|other_fields);
+        }
+    }
+    for (const auto &ignored_one : node->ignore) {
+        hash=fingerprint_mix(hash, ((uint64_t)(uint32_t)ignored_one.first<<32)|(uint32_t)ignored_one.second);
+    }
+    hash=fingerprint_mix(hash, std::hash<std::string>()(tree.get_node_name(node->node_id)));
+    return hash|1;
+}
+static void collect_nodes(const MAT::Node *root,std::vector<const MAT::Node *> &out) {
+    out.push_back(root);
+    for (const auto child : root->children) {
+        collect_nodes(child, out);
+    }
+}
+void Mutation_Annotated_Tree::Tree::MPI_send_tree_delta() const {
+    std::vector<const MAT::Node *> nodes;
+    nodes.reserve(all_nodes.size());
+    collect_nodes(root, nodes);
+    std::vector<uint64_t> fingerprints(all_nodes.size(),0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0,nodes.size()),[&](tbb::blocked_range<size_t> r) {
+        for (size_t idx=r.begin(); idx<r.end(); idx++) {
+            fingerprints[nodes[idx]->node_id]=node_fingerprint(nodes[idx], *this);
+        }
+    });
+    std::vector<const MAT::Node *> records;
+    for (const auto node : nodes) {
+        auto id=node->node_id;
+        if (id>=synced_fingerprints.size()||synced_fingerprints[id]!=fingerprints[id]) {
+            records.push_back(node);
+        }
+    }
+    std::vector<uint64_t> removed;
+    for (size_t id=0; id<synced_fingerprints.size(); id++) {
+        if (synced_fingerprints[id]&&(id>=fingerprints.size()||!fingerprints[id])) {
+            removed.push_back(id);
+        }
+    }
+    //a delta touching a large part of the tree is not worth it over the streamed full tree
+    uint64_t header[2];
+    header[0]=(synced_version&&(records.size()+removed.size())*4<nodes.size())?TREE_SYNC_DELTA:TREE_SYNC_FULL;
+    header[1]=synced_version+1;
+    MPI_Bcast(header, 2, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
+    int in_sync=1;
+    if (header[0]==TREE_SYNC_DELTA) {
+        MPI_Allreduce(MPI_IN_PLACE, &in_sync, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    }
+    if (header[0]==TREE_SYNC_DELTA&&in_sync) {
+        Mutation_Detailed::tree_delta delta;
+        delta.set_version(header[1]);
+        delta.set_nodes_idx_next(node_idx);
+        delta.set_root_id(root->node_id);
+        for (auto id : removed) {
+            delta.add_removed_node_ids(id);
+        }
+        delta.mutable_nodes()->Reserve(records.size());
+        for (const auto node : records) {
+            auto this_node=delta.add_nodes();
+            serialize_node(*this_node, node, *this);
+            this_node->mutable_children_ids()->Reserve(node->children.size());
+            for (const auto child : node->children) {
+                this_node->add_children_ids(child->node_id);
+            }
+            auto name_iter=node_names.find(node->node_id);
+            if (name_iter!=node_names.end()) {
+                auto next_idx=delta.add_node_idx_map();
+                next_idx->set_node_id(name_iter->first);
+                next_idx->set_node_name(name_iter->second);
+            }
+        }
+        std::string changed(all_nodes.size(),0);
+        for (const auto node : nodes) {
+            changed[node->node_id]=node->changed;
+        }
+        delta.set_changed(std::move(changed));
+        std::string serialized;
+        delta.SerializeToString(&serialized);
+        uint64_t sizes[2];
+        sizes[0]=compressBound(serialized.size());
+        sizes[1]=serialized.size();
+        uint8_t* compressed=(uint8_t*)malloc(sizes[0]);
+        //a compressed size of 0 tells the receivers that there is no delta to read
+        int decoded=compress(compressed, &sizes[0], (const uint8_t*)serialized.data(), serialized.size())==Z_OK;
+        if (!decoded) {
+            sizes[0]=0;
+        }
+        MPI_Bcast(sizes, 2, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
+        if (sizes[0]) {
+            MPI_Bcast(compressed, sizes[0], MPI_BYTE, 0, MPI_COMM_WORLD);
+        }
+        free(compressed);
+        //every rank has to apply the delta, otherwise all of them get the full tree
+        MPI_Allreduce(MPI_IN_PLACE, &decoded, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+        if (decoded) {
+            fprintf(stderr, "Sent tree delta version %zu with %zu changed and %zu removed nodes out of %zu, %zu bytes\n",
+                    header[1],records.size(),removed.size(),nodes.size(),sizes[0]);
+        } else {
+            fprintf(stderr, "Tree delta version %zu failed, sending full tree\n",header[1]);
+            MPI_send_tree();
+        }
+    } else {
+        MPI_send_tree();
+    }
+    synced_fingerprints.swap(fingerprints);
+    synced_version=header[1];
+}
@@ -608,11 +608,10 @@ int main(int argc, char **argv) {
             if(radius==0) {
                 break;
             }
-            t.MPI_receive_tree();
+            t.MPI_receive_tree_delta();
             adjust_all(t);
             use_bound=true;
             optimize_tree_worker_thread(t, radius,do_drift,search_all_dir, Move_Found_Callback::default_instance());
-            t.delete_nodes();
         }
         if (reduce_back_mutations) {
             std::vector<mutated_t> to_recieve;
@@ -620,12 +619,7 @@ int main(int argc, char **argv) {
             MPI_min_back_reassign_states(t, to_recieve, pos);
         }
     }
-    for(auto& pos:mutated_positions) {
-        delete pos.second;
-    }
-    if (this_rank==0) {
-        t.delete_nodes();
-    }
+    t.delete_nodes();
     fprintf(stderr, "Maximum memory usage from %d: %zu kb \n",this_rank,get_memory());
     MPI_Finalize();
 }
@@ -20,31 +20,51 @@
 #include "tree_rearrangement_internal.hpp"
 #include "apply_move/apply_move.hpp"
 #include <tbb/queuing_rw_mutex.h>
+#include <atomic>
 
 namespace MAT=Mutation_Annotated_Tree;
-void populate_mutated_pos(const Original_State_t& origin_state,MAT::Tree& tree) {
+void Mutated_Positions::build(const Original_State_t& origin_state) {
+    clear();
+    //count samples with a non-reference allele at each position
+    std::vector<std::atomic<size_t>> cursors(MAT::Mutation::refs.size()+1);
     tbb::parallel_for_each(origin_state.begin(),origin_state.end(),[&](const std::pair<size_t, Mutation_Set>& sample_mutations) {
         for (const MAT::Mutation &m : sample_mutations.second) {
-            //reader lock to find this position if it is already inserted
-            auto iter=mutated_positions.find(m);
-            tbb::concurrent_unordered_map<std::string, nuc_one_hot>* samples;
-            if (iter==mutated_positions.end()) {
-                //not found, need to insert, with writer lock
-                samples=new tbb::concurrent_unordered_map<std::string, nuc_one_hot>;
-                auto emplace_result=mutated_positions.emplace(m,samples);
-                if (!emplace_result.second) {
-                    delete samples;
-                    samples=emplace_result.first->second;
-                }
-            } else {
-                samples=iter->second;
+            cursors[m.get_position()].fetch_add(1,std::memory_order_relaxed);
+        }
+    });
+    //lay out slices of mutated positions, then turn counts into insertion cursors
+    std::vector<uint32_t> pos_idx(cursors.size(),UINT32_MAX);
+    size_t total=0;
+    offsets.push_back(0);
+    for (size_t pos=0; pos<cursors.size(); pos++) {
+        auto count=cursors[pos].load(std::memory_order_relaxed);
+        if (count) {
+            pos_idx[pos]=mutations.size();
+            mutations.emplace_back();
+            cursors[pos].store(total,std::memory_order_relaxed);
+            total+=count;
+            offsets.push_back(total);
+        }
+    }
+    alleles.resize(total);
+    tbb::parallel_for_each(origin_state.begin(),origin_state.end(),[&](const std::pair<size_t, Mutation_Set>& sample_mutations) {
+        for (const MAT::Mutation &m : sample_mutations.second) {
+            auto slot=cursors[m.get_position()].fetch_add(1,std::memory_order_relaxed);
+            auto idx=pos_idx[m.get_position()];
+            if (slot==offsets[idx]) {
+                mutations[idx]=m;
             }
-            //add sample to mutation mapping
-            samples->emplace(tree.get_node_name(sample_mutations.first),
-                             m.get_all_major_allele());
+            alleles[slot]=Sample_Allele{(uint32_t)sample_mutations.first,m.get_all_major_allele()};
+        }
+    });
+    tbb::parallel_for(tbb::blocked_range<size_t>(0,mutations.size()),[this](const tbb::blocked_range<size_t>& range) {
+        for (size_t idx=range.begin(); idx<range.end(); idx++) {
+            std::sort(alleles.begin()+offsets[idx],alleles.begin()+offsets[idx+1]);
         }
     });
-    //clean up all mutexes
+}
+void populate_mutated_pos(const Original_State_t& origin_state,MAT::Tree& tree) {
+    mutated_positions.build(origin_state);
 }
 
 //load from usher compatible pb
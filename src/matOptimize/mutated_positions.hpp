@@ -0,0 +1,67 @@
+#pragma once
+#include "mutation_annotated_tree.hpp"
+#include "check_samples.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+namespace MAT=Mutation_Annotated_Tree;
+struct Sample_Allele {
+    uint32_t node_id;
+    nuc_one_hot allele;
+    bool operator<(const Sample_Allele& other) const {
+        return node_id<other.node_id;
+    }
+};
+//Non-reference alleles of samples, position major (CSR): the samples with a non-reference allele at
+//mutations[idx].get_position() are alleles[offsets[idx],offsets[idx+1]), sorted by node id
+struct Mutated_Positions {
+    //one representative mutation per mutated position (chromosome, position, reference), sorted by position
+    std::vector<MAT::Mutation> mutations;
+    std::vector<size_t> offsets;
+    std::vector<Sample_Allele> alleles;
+
+    typedef std::vector<Sample_Allele>::const_iterator iterator;
+    void build(const Original_State_t& origin_state);
+    void clear() {
+        mutations.clear();
+        mutations.shrink_to_fit();
+        offsets.clear();
+        offsets.shrink_to_fit();
+        alleles.clear();
+        alleles.shrink_to_fit();
+    }
+    size_t size() const {
+        return mutations.size();
+    }
+    bool empty() const {
+        return mutations.empty();
+    }
+    iterator samples_begin(size_t idx) const {
+        return alleles.begin()+offsets[idx];
+    }
+    iterator samples_end(size_t idx) const {
+        return alleles.begin()+offsets[idx+1];
+    }
+    //index of position in mutations, size() if no sample is mutated there
+    size_t find(int position) const {
+        auto iter=std::lower_bound(mutations.begin(),mutations.end(),MAT::Mutation(position));
+        if (iter==mutations.end()||iter->get_position()!=position) {
+            return mutations.size();
+        }
+        return iter-mutations.begin();
+    }
+    //allele of a sample at position, the reference allele if it is not mutated
+    nuc_one_hot get_allele(size_t node_id,int position) const {
+        auto idx=find(position);
+        if (idx!=mutations.size()) {
+            auto iter=std::lower_bound(samples_begin(idx),samples_end(idx),node_id,[](const Sample_Allele& sample,size_t node_id) {
+                return sample.node_id<node_id;
+            });
+            if (iter!=samples_end(idx)&&iter->node_id==node_id) {
+                return iter->allele;
+            }
+        }
+        return MAT::Mutation::refs[position];
+    }
+};
@@ -68,14 +68,22 @@ static void depth_first_expansion_helper(Mutation_Annotated_Tree::Node* node, st
     assert(std::find(vec.begin(),vec.end(),node)==vec.end());
 #endif
     vec.push_back(node);
-    node->level=level;
+    //only store indices that changed, so traversing a tree shared with forked processes
+    //does not dirty its pages
+    if (node->level!=level) {
+        node->level=level;
+    }
     //assert(vec.size()-1==index);
-    node->dfs_index=index;
+    if (node->dfs_index!=index) {
+        node->dfs_index=index;
+    }
     index++;
     for (auto c: node->children) {
         depth_first_expansion_helper(c, vec,index,level+1);
     }
-    node->dfs_end_index=index-1;
+    if (node->dfs_end_index!=index-1) {
+        node->dfs_end_index=index-1;
+    }
 }
 
 std::vector<Mutation_Annotated_Tree::Node*> depth_first_expansion_no_tree(Mutation_Annotated_Tree::Node* node)  {
@@ -657,6 +657,10 @@ class Tree {
     friend class Node;
     void MPI_send_tree() const;
     void MPI_receive_tree();
+    //Same as above, but only broadcast nodes changed since the last call when
+    //followers are still in sync, used between optimization rounds
+    void MPI_send_tree_delta() const;
+    void MPI_receive_tree_delta();
     void delete_nodes();
     void write_newick_string (std::iostream::basic_ostream& ss, Node* node, bool b1, bool b2, bool b3=false, bool b4=false) const;
     std::string get_newick_string(bool b1, bool b2, bool b3=false, bool b4=false) const ;
@@ -685,6 +689,9 @@ void get_random_sample_subtrees(const Mutation_Annotated_Tree::Tree &T,
                                 std::vector<Node*> anchor_samples = std::vector<Node*>());
 bool load_mutation_annotated_tree (std::string filename,Tree& tree);
 void save_mutation_annotated_tree (const Tree& tree, std::string filename);
+//flat mmap-able snapshot (see ../mat_snapshot.hpp), also picked up by load_mutation_annotated_tree
+bool load_mutation_annotated_tree_snapshot (std::string filename,Tree& tree);
+void save_mutation_annotated_tree_snapshot (const Tree& tree, std::string filename);
 void get_sample_mutation_paths (Mutation_Annotated_Tree::Tree* T, std::vector<Node*> samples, std::string mutation_paths_filename);
 Mutation_Annotated_Tree::Node*
 get_subtree_root(const Mutation_Annotated_Tree::Tree &tree,
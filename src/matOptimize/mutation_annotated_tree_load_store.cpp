@@ -8,6 +8,10 @@
 #include <iostream>
 #include <boost/iostreams/filter/gzip.hpp>
 #include "parsimony.pb.h"
+#include "../mat_snapshot.hpp"
+#include "../parsimony_stream.hpp"
+#include "../block_gzip.hpp"
+#include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <istream>
 #include <stack>
 #include <fstream>
@@ -277,79 +281,85 @@ Mutation_Annotated_Tree::Tree Mutation_Annotated_Tree::create_tree_from_newick (
 
 bool Mutation_Annotated_Tree::load_mutation_annotated_tree (std::string filename,Tree& tree) {
     TIMEIT();
+    if (MAT_Snapshot::is_snapshot(filename)) {
+        return load_mutation_annotated_tree_snapshot(filename, tree);
+    }
 
-    Parsimony::data data;
     boost::iostreams::filtering_istream instream;
     std::ifstream inpfile(filename, std::ios::in | std::ios::binary);
     if (!inpfile) {
         fprintf(stderr, "ERROR: Could not load the mutation-annotated tree object from file: %s!\n", filename.c_str());
         return false;
     }
+    std::unique_ptr<Block_Gzip::Reader> block_reader;
     if (filename.find(".gz\0") != std::string::npos) {
-        try {
-            instream.push(boost::iostreams::gzip_decompressor());
-            instream.push(inpfile);
-        } catch(const boost::iostreams::gzip_error& e) {
-            std::cout << e.what() << '\n';
+        if (Block_Gzip::is_block_gzip(filename)) {
+            block_reader.reset(new Block_Gzip::Reader(filename));
+        } else {
+            // Single member gzip written before block gzip was used
+            try {
+                instream.push(boost::iostreams::gzip_decompressor());
+                instream.push(inpfile);
+            } catch(const boost::iostreams::gzip_error& e) {
+                std::cout << e.what() << '\n';
+            }
         }
     } else {
         instream.push(inpfile);
     }
-    if(!data.ParseFromIstream(&instream)) {
+    google::protobuf::io::IstreamInputStream istream_input(&instream);
+    google::protobuf::io::ZeroCopyInputStream* stream = &istream_input;
+    if (block_reader) {
+        stream = block_reader.get();
+    }
+    std::vector<Node*> dfs;
+    bool hasmeta = false;
+    bool parsed = Parsimony_Stream::read_data(stream, hasmeta,
+    [&](const std::string& newick) {
+        tree.load_from_newick(newick);
+        dfs = tree.depth_first_expansion();
+        return dfs.size();
+    },
+    [&](size_t idx, const Parsimony::mutation_list& mutation_list) {
+        auto node = dfs[idx];
+        for (int k = 0; k < mutation_list.mutation_size(); k++) {
+            const auto& mut = mutation_list.mutation(k);
+            if (mut.position()<0) {
+                node->have_masked=true;
+                continue;
+            }
+            char mut_one_hot=1<<mut.mut_nuc(0);
+            char all_major_alleles=mut_one_hot;
+            for (int n = 1; n < mut.mut_nuc_size(); n++) {
+                all_major_alleles|= (1<<mut.mut_nuc(n));
+            }
+            Mutation m(mut.chromosome(),mut.position(),nuc_one_hot(mut_one_hot),two_bit_to_one_hot(mut.par_nuc()),all_major_alleles,two_bit_to_one_hot(mut.ref_nuc()));
+            node->add_mutation(m);
+        }
+        if (!std::is_sorted(node->mutations.begin(), node->mutations.end())) {
+            fprintf(stderr, "WARNING: Mutations not sorted!\n");
+            std::sort(node->mutations.begin(), node->mutations.end());
+        }
+    },
+    [&](size_t idx, const Parsimony::node_metadata& metadata) {
+        for (int k = 0; k < metadata.clade_annotations_size(); k++) {
+            dfs[idx]->clade_annotations.emplace_back(metadata.clade_annotations(k));
+        }
+    },
+    [&](const Parsimony::condensed_node& cn) {
+        tree.condensed_nodes[tree.get_node(cn.node_name())->node_id].assign(cn.condensed_leaves().begin(), cn.condensed_leaves().end());
+    });
+    if (block_reader && block_reader->error()) {
+        parsed = false;
+    }
+    if (!parsed) {
         fprintf(stderr, "ERROR: Failed to parse: %s!\n", filename.c_str());
         return false;
     }
     //check if the pb has a metadata field
-    bool hasmeta = (data.metadata_size()>0);
     if (!hasmeta) {
         fprintf(stderr, "WARNING: This pb does not include any metadata. Filling in default values\n");
     }
-    tree.load_from_newick(data.newick());
-    auto dfs = tree.depth_first_expansion();
-    static tbb::affinity_partitioner ap;
-    tbb::parallel_for( tbb::blocked_range<size_t>(0, dfs.size()),
-    [&](tbb::blocked_range<size_t> r) {
-        for (size_t idx = r.begin(); idx < r.end(); idx++) {
-            auto node = dfs[idx];
-            auto mutation_list = data.node_mutations(idx);
-            if (hasmeta) {
-                for (int k = 0; k < data.metadata(idx).clade_annotations_size(); k++) {
-                    node->clade_annotations.emplace_back(data.metadata(idx).clade_annotations(k));
-                }
-            }
-            for (int k = 0; k < mutation_list.mutation_size(); k++) {
-                auto mut = mutation_list.mutation(k);
-                if (mut.position()<0) {
-                    node->have_masked=true;
-                    continue;
-                }
-                char mut_one_hot=1<<mut.mut_nuc(0);
-                char all_major_alleles=mut_one_hot;
-                for (int n = 1; n < mut.mut_nuc_size(); n++) {
-                    all_major_alleles|= (1<<mut.mut_nuc(n));
-                }
-                Mutation m(mut.chromosome(),mut.position(),nuc_one_hot(mut_one_hot),two_bit_to_one_hot(mut.par_nuc()),all_major_alleles,two_bit_to_one_hot(mut.ref_nuc()));
-                node->add_mutation(m);
-            }
-            if (!std::is_sorted(node->mutations.begin(), node->mutations.end())) {
-                fprintf(stderr, "WARNING: Mutations not sorted!\n");
-                std::sort(node->mutations.begin(), node->mutations.end());
-            }
-        }
-    }, ap);
-
-    size_t num_condensed_nodes = static_cast<size_t>(data.condensed_nodes_size());
-    tbb::parallel_for( tbb::blocked_range<size_t>(0, num_condensed_nodes),
-    [&](tbb::blocked_range<size_t> r) {
-        for (size_t idx = r.begin(); idx < r.end(); idx++) {
-            auto cn = data.condensed_nodes(idx);
-            tree.condensed_nodes.insert(std::pair<size_t, std::vector<std::string>>(tree.get_node(cn.node_name())->node_id, std::vector<std::string>(cn.condensed_leaves_size())));
-            auto cn_idx=tree.node_name_to_node_idx(cn.node_name());
-            for (int k = 0; k < cn.condensed_leaves_size(); k++) {
-                tree.condensed_nodes[cn_idx][k] = cn.condensed_leaves(k);
-            }
-        }
-    }, ap);
 
     return true;
 }
@@ -423,28 +433,152 @@ void Mutation_Annotated_Tree::save_mutation_annotated_tree (const Mutation_Annot
         }
     }
 
-    // Boost library used to stream the contents to the output protobuf file in
-    // uncompressed or compressed .gz format
-    std::ofstream outfile(filename, std::ios::out | std::ios::binary);
-    boost::iostreams::filtering_streambuf< boost::iostreams::output> outbuf;
-
+    // .gz output is block gzip (BGZF), compressed in parallel and still readable
+    // by gzip -d
     if (filename.find(".gz\0") != std::string::npos) {
-        try {
-            outbuf.push(boost::iostreams::gzip_compressor());
-            outbuf.push(outfile);
-            std::ostream outstream(&outbuf);
-            data.SerializeToOstream(&outstream);
-            boost::iostreams::close(outbuf);
-            outfile.close();
-        } catch(const boost::iostreams::gzip_error& e) {
-            std::cout << e.what() << '\n';
+        Block_Gzip::Writer writer(filename);
+        std::ostream outstream(&writer);
+        data.SerializeToOstream(&outstream);
+        if (!writer.close()) {
+            fprintf(stderr, "ERROR: Could not write the mutation-annotated tree object to file: %s!\n", filename.c_str());
         }
     } else {
+        std::ofstream outfile(filename, std::ios::out | std::ios::binary);
         data.SerializeToOstream(&outfile);
         outfile.close();
     }
 }
 
+// matOptimize edits the tree it loads, so the snapshot view is materialized into nodes
+// (serially, as node ids are handed out in order) instead of being used in place
+bool Mutation_Annotated_Tree::load_mutation_annotated_tree_snapshot (std::string filename,Tree& tree) {
+    TIMEIT();
+    MAT_Snapshot::View view;
+    if (!view.open(filename)) {
+        return false;
+    }
+    view.prefetch();
+    size_t num_nodes = view.num_nodes();
+    std::vector<Node*> nodes(num_nodes);
+    for (size_t idx = 0; idx < num_nodes; idx++) {
+        Node* node = (view.name_idx(idx) == MAT_Snapshot::NO_IDX) ? tree.create_node() : tree.create_node(std::string(view.name(idx)));
+        node->branch_length = view.branch_length(idx);
+        auto par_idx = view.parent(idx);
+        if (par_idx == MAT_Snapshot::NO_IDX) {
+            tree.root = node;
+        } else {
+            nodes[par_idx]->add_child(node);
+        }
+        nodes[idx] = node;
+    }
+    if (tree.root == NULL) {
+        fprintf(stderr, "WARNING: Tree found empty!\n");
+    }
+
+    //register chromosomes and reference alleles once, instead of per mutation under lock
+    std::vector<uint8_t> chrom_idx_map(view.num_chromosomes());
+    for (size_t k = 0; k < view.num_chromosomes(); k++) {
+        Mutation m(std::string(view.chromosome(k)), 0, 0, 0, 0);
+        chrom_idx_map[k] = m.get_chromIdx();
+    }
+    int max_pos = 0;
+    for (size_t idx = 0; idx < num_nodes; idx++) {
+        for (auto mut = view.mutations_begin(idx); mut < view.mutations_end(idx); mut++) {
+            max_pos = std::max(max_pos, mut->position);
+        }
+    }
+    Mutation::refs.resize(std::max((int)Mutation::refs.size(), max_pos + 1), 0);
+    for (size_t idx = 0; idx < num_nodes; idx++) {
+        for (auto mut = view.mutations_begin(idx); mut < view.mutations_end(idx); mut++) {
+            if (mut->position >= 0 && mut->ref_nuc) {
+                Mutation::refs[mut->position] = mut->ref_nuc;
+            }
+        }
+    }
+
+    static tbb::affinity_partitioner ap;
+    tbb::parallel_for( tbb::blocked_range<size_t>(0, num_nodes),
+    [&](tbb::blocked_range<size_t> r) {
+        for (size_t idx = r.begin(); idx < r.end(); idx++) {
+            auto node = nodes[idx];
+            node->clade_annotations.resize(view.num_annotations());
+            for (uint32_t k = 0; k < view.num_annotations(); k++) {
+                node->clade_annotations[k] = std::string(view.annotation(idx, k));
+            }
+            auto end = view.mutations_end(idx);
+            node->mutations.reserve(end - view.mutations_begin(idx));
+            for (auto mut = view.mutations_begin(idx); mut < end; mut++) {
+                if (mut->position < 0) {
+                    node->have_masked = true;
+                    continue;
+                }
+                //first allele is the mutation, all of them are the major alleles, as when loading from protobuf
+                //a mutation with no allele (mut_nuc 0) has no lowest bit to take
+                uint8_t mut_one_hot = (mut->mut_nuc == 0) ? 0 : (1 << __builtin_ctz(mut->mut_nuc));
+                Mutation m(chrom_idx_map[mut->chrom_idx], mut->position, mut->par_nuc, mut_one_hot);
+                m.set_auxillary(mut->mut_nuc, 0);
+                node->mutations.mutations.push_back(m);
+            }
+        }
+    }, ap);
+
+    for (size_t idx = 0; idx < view.num_condensed(); idx++) {
+        std::vector<std::string> leaves;
+        leaves.reserve(view.num_condensed_leaves(idx));
+        view.for_each_condensed_leaf(idx, [&](std::string_view leaf) {
+            leaves.emplace_back(leaf);
+        });
+        auto cn_idx = tree.node_name_to_node_idx(std::string(view.condensed_node_name(idx)));
+        tree.condensed_nodes.emplace(cn_idx, std::move(leaves));
+    }
+    return true;
+}
+
+void Mutation_Annotated_Tree::save_mutation_annotated_tree_snapshot (const Mutation_Annotated_Tree::Tree& tree, std::string filename) {
+    TIMEIT();
+    auto dfs = tree.depth_first_expansion();
+    MAT_Snapshot::Builder builder(dfs.size(), tree.get_num_annotations());
+
+    for (size_t idx = 0; idx < dfs.size(); idx++) {
+        auto node = dfs[idx];
+        uint32_t par_idx = (node == dfs[0]) ? MAT_Snapshot::NO_IDX : node->parent->dfs_index;
+        auto name = tree.get_node_name(node->node_id);
+        builder.add_node(par_idx, node->branch_length, name == "" ? MAT_Snapshot::NO_IDX : builder.intern(name));
+        for (size_t k = 0; k < node->clade_annotations.size(); k++) {
+            builder.set_annotation(idx, k, node->clade_annotations[k]);
+        }
+        if (node->have_masked) {
+            MAT_Snapshot::Packed_Mutation mut {-1, 0, 0, 0, 0};
+            builder.add_mutation(mut);
+        }
+        for (const auto& m : node->mutations) {
+            if (m.get_par_one_hot() == m.get_mut_one_hot()) {
+                continue;
+            }
+            MAT_Snapshot::Packed_Mutation mut;
+            mut.position = m.get_position();
+            mut.chrom_idx = builder.chromosome(m.get_chromosome());
+            mut.ref_nuc = m.get_ref_one_hot();
+            mut.par_nuc = m.get_par_one_hot();
+            mut.mut_nuc = m.get_mut_one_hot();
+            builder.add_mutation(mut);
+        }
+    }
+
+    for (const auto& cn : tree.condensed_nodes) {
+        auto node_name = tree.get_node_name(cn.first);
+        if (node_name == "") {
+            fprintf(stderr, "Condensed node %zu not found \n", cn.first);
+            raise(SIGTRAP);
+        }
+        builder.add_condensed(node_name, cn.second);
+    }
+
+    if (!builder.write(filename)) {
+        exit(EXIT_FAILURE);
+    }
+}
+
 Mutation_Annotated_Tree::Mutation::Mutation(const std::string &chromosome,
         int position, nuc_one_hot mut,
         nuc_one_hot par, nuc_one_hot tie,
@@ -45,7 +45,7 @@ size_t optimize_inner_loop(std::vector<MAT::Node*>& nodes_to_search,MAT::Tree& t
                     fprintf(stderr, "Sent radius\n");
                     MPI_Wait(&req, MPI_STATUS_IGNORE);
                     fprintf(stderr, "Start Send tree\n");
-                    t.MPI_send_tree();
+                    t.MPI_send_tree_delta();
                 }
                 adjust_all(t);
                 use_bound=true;
@@ -31,7 +31,6 @@ extern bool changing_radius;
 float update_rate=0.01;
 #define MAX_MOVE_SIZE ((size_t)0x1000)
 #define MAX_MOVE_MSG_SIZE (1+4*MAX_MOVE_SIZE)
-thread_local allocator_state<Mutation_Count_Change> FIFO_allocator_state;
 extern tbb::task_group_context search_context;
 size_t nodes_per_min_per_thread=100;
 float target_fetch_period=0.5;
@@ -418,7 +417,4 @@ void optimize_tree_worker_thread(MAT::Tree &t,int radius,bool do_drift,bool sear
     fprintf(stderr, "%d finished",this_rank);
 }
 
-tbb::concurrent_unordered_map<MAT::Mutation,
-    tbb::concurrent_unordered_map<std::string, nuc_one_hot> *,
-    Mutation_Pos_Only_Hash, Mutation_Pos_Only_Comparator>
-    mutated_positions;
+Mutated_Positions mutated_positions;
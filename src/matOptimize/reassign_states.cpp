@@ -131,13 +131,8 @@ void reassign_states(MAT::Tree& t, Original_State_t& origin_states) {
     //get mutation vector
     std::vector<backward_pass_range> child_idx_range;
     std::vector<forward_pass_range> parent_idx;
-    std::vector<std::pair<MAT::Mutation,tbb::concurrent_vector<std::pair<size_t,char>>>> pos_mutated(MAT::Mutation::refs.size());
-    tbb::parallel_for_each(origin_states.begin(),origin_states.end(),[&pos_mutated,&t](const std::pair<size_t, Mutation_Set>& sample_mutations) {
-        for (const MAT::Mutation &m : sample_mutations.second) {
-            pos_mutated[m.get_position()].first=m;
-            pos_mutated[m.get_position()].second.emplace_back(t.get_node(sample_mutations.first)->bfs_index,m.get_all_major_allele());
-        }
-    });
+    Mutated_Positions pos_mutated;
+    pos_mutated.build(origin_states);
     Fitch_Sankoff_prep(bfs_ordered_nodes,child_idx_range, parent_idx);
     auto prep_end=std::chrono::steady_clock::now();
     auto prep_dur=std::chrono::duration_cast<std::chrono::milliseconds>(prep_end-start_time).count();
@@ -145,17 +140,18 @@ void reassign_states(MAT::Tree& t, Original_State_t& origin_states) {
     FS_result_per_thread_t FS_result;
     tbb::parallel_for(
         tbb::blocked_range<size_t>(0,pos_mutated.size()),
-    [&FS_result,&child_idx_range,&parent_idx,&pos_mutated](const tbb::blocked_range<size_t>& in) {
+    [&FS_result,&child_idx_range,&parent_idx,&pos_mutated,&t](const tbb::blocked_range<size_t>& in) {
         auto& this_result=FS_result.local();
         this_result.init(child_idx_range.size());
         for (size_t idx=in.begin(); idx<in.end(); idx++) {
-            if (pos_mutated[idx].second.empty()) {
-                continue;
+            mutated_t mutated_nodes_idx;
+            mutated_nodes_idx.reserve(pos_mutated.offsets[idx+1]-pos_mutated.offsets[idx]+1);
+            for (auto iter=pos_mutated.samples_begin(idx); iter!=pos_mutated.samples_end(idx); iter++) {
+                mutated_nodes_idx.emplace_back(t.get_node(iter->node_id)->bfs_index,iter->allele);
             }
-            mutated_t mutated_nodes_idx(pos_mutated[idx].second.begin(),pos_mutated[idx].second.end());
             std::sort(mutated_nodes_idx.begin(),mutated_nodes_idx.end(),mutated_t_comparator());
             mutated_nodes_idx.emplace_back(0,0xf);
-            Fitch_Sankoff_Whole_Tree(child_idx_range,parent_idx, pos_mutated[idx].first, mutated_nodes_idx,
+            Fitch_Sankoff_Whole_Tree(child_idx_range,parent_idx, pos_mutated.mutations[idx], mutated_nodes_idx,
                                      this_result);
 
         }
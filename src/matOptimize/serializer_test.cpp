@@ -17,9 +17,7 @@ FILE* movalbe_src_log;
 bool interrupted;
 std::condition_variable progress_bar_cv;
 bool timed_print_progress;
-tbb::concurrent_unordered_map<MAT::Mutation, tbb::concurrent_unordered_map<std::string, nuc_one_hot>*,Mutation_Pos_Only_Hash,
-    Mutation_Pos_Only_Comparator>
-    mutated_positions;
+Mutated_Positions mutated_positions;
 #undef NDEBUG
 #include <cassert>
 int main(int argc,char** argv) {
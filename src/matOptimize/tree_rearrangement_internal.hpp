@@ -10,6 +10,7 @@
 #include <vector>
 #include <condition_variable>
 #include "check_samples.hpp"
+#include "mutated_positions.hpp"
 #include <random>
 #pragma once
 #define LEVEL_T uint8_t
@@ -29,9 +30,7 @@ void make_output_path(std::string& path_template) ;
 extern uint32_t num_threads;
 namespace MAT = Mutation_Annotated_Tree;
 extern std::atomic_bool interrupted;
-extern tbb::concurrent_unordered_map<MAT::Mutation, tbb::concurrent_unordered_map<std::string, nuc_one_hot>*,Mutation_Pos_Only_Hash,
-       Mutation_Pos_Only_Comparator>
-       mutated_positions;
+extern Mutated_Positions mutated_positions;
 struct Profitable_Moves {
     int score_change;
     MAT::Node* src;
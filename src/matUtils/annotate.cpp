@@ -470,7 +470,7 @@ void get_freq_overlap(MAT::Tree& T, MAT::Node* node, std::vector<MAT::Node*>clad
     tbb::parallel_for(tbb::blocked_range<size_t>(0, clade_samples.size()),
     [&](const tbb::blocked_range<size_t> r) {
         for (size_t i=r.begin(); i<r.end(); ++i) {
-            if (T.is_ancestor(node->identifier, clade_samples[i]->identifier)) {
+            if (T.is_ancestor(node, clade_samples[i])) {
                 __sync_fetch_and_add(&num_desc, 1.0);
             }
         }
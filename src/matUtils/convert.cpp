@@ -1,4 +1,5 @@
 #include "convert.hpp"
+#include "select.hpp"
 #include "nlohmann_json.hpp"
 #include "tbb/parallel_pipeline.h"
 #include <algorithm>
@@ -42,75 +43,113 @@ int8_t *new_gt_array(int size, int8_t ref) {
     }
     return gt_array;
 }
-struct Leaf_Genotype{
-    uint leaf_ix;
+//Genotypes of one position, stored column-compressed: sample leaves are numbered in DFS order,
+//so every mutation sets the genotype of a contiguous range of leaves. Intervals are kept
+//in DFS pre-order, so they are either nested or disjoint, and the innermost one wins.
+struct Genotype_Interval {
+    uint leaf_start;
+    uint leaf_end;
     int8_t genotype;
+    int8_t par_nuc;
 };
-struct Pos_Data{
-    std::vector<Leaf_Genotype> leaf_genotypes;
-    uint8_t ref;
+struct Pos_Genotypes {
+    uint pos;
+    std::vector<Genotype_Interval> intervals;
 };
-uint r_add_genotypes(MAT::Node *node,
-                     std::unordered_map<std::string, std::unordered_map<uint, Pos_Data>> &info,
-                     uint leaf_count, uint leaf_ix, std::vector<struct MAT::Mutation *> mut_stack, const std::set<std::string>* samples_to_use) {
-    // Traverse tree, adding leaf/sample genotypes for mutations annotated on path from root to node
-    // to chrom_pos_genotypes (and reference allele to chrom_pos_ref).
-    for (auto &mut: node->mutations) {
-        if (mut.is_masked()) {
-            continue;
+struct Chrom_Genotypes {
+    std::string chrom;
+    std::unordered_map<uint, size_t> pos_idx;
+    std::vector<Pos_Genotypes> positions;
+};
+struct Genotype_Matrix {
+    std::unordered_map<std::string, size_t> chrom_idx;
+    std::vector<Chrom_Genotypes> chroms;
+    uint leaf_count;
+    //open an interval starting at leaf_start, returns the chromosome and position index it was appended to
+    std::pair<size_t,size_t> add(const MAT::Mutation& mut, uint leaf_start) {
+        auto chrom_res=chrom_idx.emplace(mut.chrom,chroms.size());
+        if (chrom_res.second) {
+            if (mut.chrom.empty()) {
+                fprintf(stderr, "mut->chrom is empty std::string at position %d\n",mut.position);
+            }
+            chroms.emplace_back();
+            chroms.back().chrom=mut.chrom;
         }
-        mut_stack.push_back(&mut);
+        auto& chrom_info=chroms[chrom_res.first->second];
+        auto pos_res=chrom_info.pos_idx.emplace(mut.position,chrom_info.positions.size());
+        if (pos_res.second) {
+            chrom_info.positions.emplace_back(Pos_Genotypes{(uint)mut.position,{}});
+        }
+        chrom_info.positions[pos_res.first->second].intervals.emplace_back(Genotype_Interval{leaf_start,leaf_start,mut.mut_nuc,mut.par_nuc});
+        return std::make_pair(chrom_res.first->second,pos_res.first->second);
     }
-    // if (node->is_leaf()) {
-    if (samples_to_use->find(node->identifier) != samples_to_use->end()) {
-        // Store genotypes in this leaf's column for all mutations on the path from root to leaf
-        for (auto mut: mut_stack) {
-            std::string chrom = mut->chrom;
-            uint pos = (uint)mut->position;
-            if (chrom.empty()) {
-                fprintf(stderr, "mut->chrom is empty std::string at node '%s', position %u\n",
-                        node->identifier.c_str(), pos);
-            }
-            auto chrom_res=info.insert(std::make_pair(chrom,std::unordered_map<uint, Pos_Data>()));
-            auto& all_pos_info=chrom_res.first->second;
-            auto pos_res= all_pos_info.insert(std::make_pair(pos,Pos_Data()));
-            auto& pos_info=pos_res.first->second;
-            if (pos_res.second) {
-                pos_info.ref=mut->par_nuc;
-            }
-            if (pos_info.leaf_genotypes.empty()||pos_info.leaf_genotypes.back().leaf_ix<leaf_ix) {
-                pos_info.leaf_genotypes.emplace_back(Leaf_Genotype{leaf_ix,mut->mut_nuc});            
-            }else {
-                #ifndef NDEBUG
-                if (pos_info.leaf_genotypes.back().leaf_ix>leaf_ix) {
-                    raise(SIGTRAP);
-                }
-                #endif
-                pos_info.leaf_genotypes.back().genotype=mut->mut_nuc;
-            }
+    std::vector<Genotype_Interval>& get(std::pair<size_t,size_t> idx) {
+        return chroms[idx.first].positions[idx.second].intervals;
+    }
+};
+static uint r_add_genotypes(const MAT::Node *node, Genotype_Matrix &out, uint leaf_ix,
+                            const std::set<std::string>* samples_to_use) {
+    // Traverse tree once, recording for each mutation the range of sample leaves below it.
+    // Intervals are opened before visiting children to keep them in pre-order, and closed after.
+    uint leaf_start=leaf_ix;
+    std::vector<std::pair<std::pair<size_t,size_t>,size_t>> opened;
+    opened.reserve(node->mutations.size());
+    for (const auto &mut: node->mutations) {
+        if (!mut.is_masked()) {
+            auto idx=out.add(mut, leaf_start);
+            opened.emplace_back(idx,out.get(idx).size()-1);
         }
+    }
+    if (samples_to_use->find(node->identifier) != samples_to_use->end()) {
         leaf_ix++;
     }
     for (auto child: node->children) {
-        leaf_ix = r_add_genotypes(child, info, leaf_count, leaf_ix,
-                                  mut_stack, samples_to_use);
+        leaf_ix = r_add_genotypes(child, out, leaf_ix, samples_to_use);
     }
-    for (auto mut: node->mutations) {
-        mut_stack.pop_back();
+    for (auto iter=opened.rbegin(); iter!=opened.rend(); iter++) {
+        auto& intervals=out.get(iter->first);
+        if (leaf_ix==leaf_start) {
+            //no sample below, so nothing below added intervals that stayed either
+            intervals.pop_back();
+        } else {
+            intervals[iter->second].leaf_end=leaf_ix;
+        }
     }
     return leaf_ix;
 }
+//Resolve nested intervals of a position into disjoint runs, leaves outside them keep the reference allele
+static void flatten_intervals(const std::vector<Genotype_Interval>& intervals,std::vector<Genotype_Interval>& runs) {
+    std::vector<Genotype_Interval> stack;
+    uint cursor=0;
+    auto emit=[&runs](uint start,uint end,int8_t genotype) {
+        if (start<end) {
+            runs.emplace_back(Genotype_Interval{start,end,genotype,0});
+        }
+    };
+    for (const auto& interval : intervals) {
+        while (!stack.empty()&&stack.back().leaf_end<=interval.leaf_start) {
+            emit(cursor,stack.back().leaf_end,stack.back().genotype);
+            cursor=std::max(cursor,stack.back().leaf_end);
+            stack.pop_back();
+        }
+        if (!stack.empty()) {
+            emit(cursor,interval.leaf_start,stack.back().genotype);
+        }
+        cursor=interval.leaf_start;
+        stack.push_back(interval);
+    }
+    while (!stack.empty()) {
+        emit(cursor,stack.back().leaf_end,stack.back().genotype);
+        cursor=std::max(cursor,stack.back().leaf_end);
+        stack.pop_back();
+    }
+}
 
-std::unordered_map<int8_t, uint>count_alleles(const std::vector<Leaf_Genotype>& gt_array)  {
-    // Tally up the count of each allele (both ref and alts) from sample genotypes.
+std::unordered_map<int8_t, uint>count_alleles(const std::vector<Genotype_Interval>& runs)  {
+    // Tally up the count of each non-default allele from the genotype runs of a position.
     std::unordered_map<int8_t, uint> allele_counts;
-    for (const auto& mut:gt_array) {
-        int8_t allele = mut.genotype;
-        if (allele_counts.find(allele) == allele_counts.end()) {
-            allele_counts.insert({allele, 1});
-        } else {
-            allele_counts[allele]++;
-        }
+    for (const auto& run:runs) {
+        allele_counts[run.genotype]+=run.leaf_end-run.leaf_start;
     }
     return allele_counts;
 }
@@ -186,24 +225,22 @@ void make_allele_codes(int8_t ref, std::map<int8_t, uint> &alts,int *al_codes) {
         al_codes[itr.first] = altIx++;
     }
 }
-typedef std::pair<uint,Pos_Data> Pos_Genotype_t;
 struct VCF_Line_Writer {
-    std::vector<Pos_Genotype_t>& pos_genotypes;
+    const std::vector<Pos_Genotypes>& pos_genotypes;
     uint leaf_count;
     bool print_genotypes;
     const std::string& chrom;
     std::string* operator()(uint idx) const {
-        auto & pos_info=pos_genotypes[idx].second;
-        auto pos=pos_genotypes[idx].first;
-        int8_t ref = pos_info.ref;
-        auto& gt_array = pos_info.leaf_genotypes;
-        #ifndef NDEBUG
-        if(!std::is_sorted(gt_array.begin(),gt_array.end(),[](Leaf_Genotype& left,Leaf_Genotype& right){
-            return left.leaf_ix<right.leaf_ix;
-        })) raise(SIGTRAP);
-        #endif
-        std::unordered_map<int8_t, uint>allele_counts = count_alleles(gt_array);
-        gt_array.push_back(Leaf_Genotype{leaf_count+10,0});
+        const auto & pos_info=pos_genotypes[idx];
+        if (pos_info.intervals.empty()) {
+            return nullptr;
+        }
+        auto pos=pos_info.pos;
+        // the outermost mutation seen first in DFS order gives the reference allele
+        int8_t ref = pos_info.intervals.front().par_nuc;
+        std::vector<Genotype_Interval> runs;
+        flatten_intervals(pos_info.intervals, runs);
+        std::unordered_map<int8_t, uint>allele_counts = count_alleles(runs);
         std::map<int8_t, uint>alts = make_alts(allele_counts, ref);
         if (alts.size() == 0) {
             fprintf(stderr, "WARNING: no-alternative site encountered in vcf output; skipping\n");
@@ -212,47 +249,35 @@ struct VCF_Line_Writer {
         std::string id = make_id(ref, pos, alts);
         std::string alt_str = make_alt_str(alts);
         std::string info = make_info(alts, leaf_count);
-        //fprintf(vcf_file, "%s\t%d\t%s\t%c\t%s\t.\t.\t%s",
-        //   chrom.c_str(), pos, id .c_str(), MAT::get_nuc(ref), alt_str.c_str(),
-        //   info.c_str());
         std::string* out=new std::string(boost::str(boost::format("%s\t%d\t%s\t%c\t%s\t.\t.\t%s")
                                          % chrom.c_str() % pos % id .c_str() % MAT::get_nuc(ref) % alt_str.c_str() % info.c_str()));
         if (print_genotypes) {
-            out->reserve(leaf_count*2);
             int allele_codes[256];
             make_allele_codes(ref, alts,allele_codes);
-            auto leaf_iter=gt_array.begin();
-            //fprintf(vcf_file, "\tGT");
+            std::string ref_code="\t"+std::to_string(allele_codes[(uint8_t)ref]);
+            out->reserve(out->size()+leaf_count*(ref_code.size()+1)+4);
             out ->append("\tGT");
-            for (uint i = 0;  i < leaf_count;  i++) {
-                int8_t allele = ref;
-                if (leaf_iter->leaf_ix==i) {
-                    allele=leaf_iter->genotype;
-                    leaf_iter++;
+            uint leaf_ix=0;
+            for (const auto& run : runs) {
+                for (; leaf_ix<run.leaf_start; leaf_ix++) {
+                    out->append(ref_code);
                 }
-                #ifndef NDEBUG
-                if (leaf_iter->leaf_ix<=i) {
-                    raise(SIGTRAP);
+                std::string code="\t"+std::to_string(allele_codes[(uint8_t)run.genotype]);
+                for (; leaf_ix<run.leaf_end; leaf_ix++) {
+                    out->append(code);
                 }
-                #endif
-                out->append("\t");
-                out->append(std::to_string(allele_codes[allele]));
-                //fprintf(vcf_file, "\t%d", allele_codes[allele]);
             }
-                #ifndef NDEBUG
-            if (leaf_iter->leaf_ix<=leaf_count) {
-                raise(SIGTRAP);
+            for (; leaf_ix<leaf_count; leaf_ix++) {
+                out->append(ref_code);
             }
-                #endif
         }
-        //fputc('\n', vcf_file);
         out->append("\n");
         return out;
     }
 };
 struct Pos_Finder {
     uint& pos;
-    const std::vector<Pos_Genotype_t>& pos_genotypes;
+    const std::vector<Pos_Genotypes>& pos_genotypes;
     uint operator()(tbb::flow_control& fc) const {
         if (pos<pos_genotypes.size()) {
             auto to_return=pos;
@@ -264,34 +289,33 @@ struct Pos_Finder {
     }
 };
 
-void write_vcf_rows(std::ostream& vcf_file, MAT::Tree T, bool print_genotypes, const std::set<std::string>* samples_to_include) {
-    // Fill in a matrix of genomic positions and sample genotypes in the same order as the
-    // sample names in the header, compute allele counts, and output VCF rows.
-    uint leaf_count = samples_to_include->size();
-    // The int8_t here is mutation_annotated_tree.hpp's binary encoding of IUPAC nucleotide bases.
-    std::unordered_map<std::string, std::unordered_map<uint, Pos_Data>> chrom_pos_genotypes;
-    std::vector<struct MAT::Mutation *> mut_stack;
-    r_add_genotypes(T.root, chrom_pos_genotypes, leaf_count, 0, mut_stack, samples_to_include);
-    // Write row of VCF for each variant in chrom_pos_genotypes[chrom]
-    for (auto itr = chrom_pos_genotypes.begin();  itr != chrom_pos_genotypes.end();  ++itr) {
-        std::string chrom = itr->first;
-        std::vector<Pos_Genotype_t> pos_genotypes(itr->second.begin(),itr->second.end());
-        tbb::parallel_sort(pos_genotypes.begin(),pos_genotypes.end(),[](Pos_Genotype_t& left,Pos_Genotype_t& right){
-            return left.first<right.first;
+void write_vcf_rows(std::ostream& vcf_file, const MAT::Tree& T, bool print_genotypes, const std::set<std::string>* samples_to_include) {
+    // Collect the genotype intervals of every position in one pass over the tree, in the same
+    // sample order as the header, then compute allele counts and output VCF rows.
+    Genotype_Matrix genotypes;
+    genotypes.leaf_count = r_add_genotypes(T.root, genotypes, 0, samples_to_include);
+    // Write row of VCF for each variant of each chromosome, in position order
+    for (auto& chrom_info : genotypes.chroms) {
+        chrom_info.pos_idx.clear();
+        auto& pos_genotypes=chrom_info.positions;
+        tbb::parallel_sort(pos_genotypes.begin(),pos_genotypes.end(),[](const Pos_Genotypes& left,const Pos_Genotypes& right) {
+            return left.pos<right.pos;
         });
         uint pos=0;
         tbb::parallel_pipeline(tbb::info::default_concurrency()*2,tbb::make_filter<void,uint>(tbb::filter_mode::serial_in_order,Pos_Finder{pos,pos_genotypes})&
-                               tbb::make_filter<uint,std::string*>(tbb::filter_mode::parallel,VCF_Line_Writer{pos_genotypes,leaf_count,print_genotypes,chrom})
+                               tbb::make_filter<uint,std::string*>(tbb::filter_mode::parallel,VCF_Line_Writer{pos_genotypes,genotypes.leaf_count,print_genotypes,chrom_info.chrom})
         &tbb::make_filter<std::string*,void>(tbb::filter_mode::serial_in_order,[&vcf_file](std::string* to_write) {
             if (to_write) {
                 vcf_file<<*to_write;
                 delete to_write;
             }
         }));
+        //rows of this chromosome are written, release them before the next one
+        std::vector<Pos_Genotypes>().swap(pos_genotypes);
     }
 }
 
-void make_vcf (MAT::Tree T, std::string vcf_filepath, bool no_genotypes, std::vector<std::string> samples_vec) {
+void make_vcf (MAT::Tree& T, std::string vcf_filepath, bool no_genotypes, std::vector<std::string> samples_vec) {
     std::set<std::string> samples_to_include;
     if (samples_vec.size() == 0) {
         auto tv = T.get_leaves_ids();
@@ -686,6 +710,8 @@ void get_minimum_subtrees(MAT::Tree* T, std::vector<std::string> samples, size_t
     /// record trees here
     std::vector<std::vector<std::string> > subtree_sample_sets ;
 
+    Select_Index select_index(T) ;
+
     for ( size_t i = 0 ; i < samples.size() ; i ++ ) {
 
         auto check_sample = samples_we_have_seen.find( samples[i] ) ;
@@ -694,7 +720,7 @@ void get_minimum_subtrees(MAT::Tree* T, std::vector<std::string> samples, size_t
         }
 
         /// get the nearby tree of size nearest_subtree_size
-        std::vector<std::string> leaves_to_keep = get_nearby( T, samples[i], nearest_subtree_size ) ;
+        std::vector<std::string> leaves_to_keep = get_nearby( select_index, samples[i], nearest_subtree_size ) ;
 
         if ( leaves_to_keep.size() == 0 ) {
             samples_we_have_seen.insert({samples[i],-1}) ;
@@ -796,3 +822,62 @@ void get_minimum_subtrees(MAT::Tree* T, std::vector<std::string> samples, size_t
     }
     tracker.close();
 }
+
+po::variables_map parse_convert_command(po::parsed_options parsed) {
+
+    po::variables_map vm;
+    po::options_description conv_desc("convert options");
+    conv_desc.add_options()
+    ("input-mat,i", po::value<std::string>()->required(),
+     "Input mutation-annotated tree file, protobuf or snapshot [REQUIRED]")
+    ("output-mat,o", po::value<std::string>()->required(),
+     "Path to output mutation-annotated tree file [REQUIRED]")
+    ("output-format,f", po::value<std::string>()->default_value("snapshot"),
+     "Format of the output file, either snapshot (flat file that can be memory-mapped and loaded without parsing) or protobuf")
+    ("help,h", "Print help messages");
+    // Collect all the unrecognized options from the first pass. This will include the
+    // (positional) command name, so we need to erase that.
+    std::vector<std::string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+    opts.erase(opts.begin());
+
+    // Run the parser, with try/catch for help
+    try {
+        po::store(po::command_line_parser(opts)
+                  .options(conv_desc)
+                  .run(), vm);
+        po::notify(vm);
+    } catch(std::exception &e) {
+        std::cerr << conv_desc << std::endl;
+        // Return with error code 1 unless the user specifies help
+        if (vm.count("help"))
+            exit(0);
+        else
+            exit(1);
+    }
+    return vm;
+}
+
+void convert_main(po::parsed_options parsed) {
+    po::variables_map vm = parse_convert_command(parsed);
+    std::string input_mat_filename = vm["input-mat"].as<std::string>();
+    std::string output_mat_filename = vm["output-mat"].as<std::string>();
+    std::string output_format = vm["output-format"].as<std::string>();
+    if (output_format != "snapshot" && output_format != "protobuf") {
+        fprintf(stderr, "ERROR: unknown output format %s, valid options are snapshot and protobuf\n", output_format.c_str());
+        exit(1);
+    }
+
+    timer.Start();
+    fprintf(stderr, "Loading input MAT file %s.\n", input_mat_filename.c_str());
+    MAT::Tree T = MAT::load_mutation_annotated_tree(input_mat_filename);
+    fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
+
+    timer.Start();
+    fprintf(stderr, "Saving output MAT file %s as %s.\n", output_mat_filename.c_str(), output_format.c_str());
+    if (output_format == "snapshot") {
+        MAT::save_mutation_annotated_tree_snapshot(T, output_mat_filename);
+    } else {
+        MAT::save_mutation_annotated_tree(T, output_mat_filename);
+    }
+    fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
+}
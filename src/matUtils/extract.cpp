@@ -1,5 +1,6 @@
 #include <tbb/info.h>
 #include "extract.hpp"
+#include "../mat_snapshot.hpp"
 
 po::variables_map parse_extract_command(po::parsed_options parsed) {
 
@@ -242,13 +243,13 @@ usher_single_subtree_size == 0 && usher_minimum_subtrees_size == 0) {
     fprintf(stderr, "Loading input MAT file %s.\n", input_mat_filename.c_str());
     // Load input MAT and uncondense tree
     MAT::Tree T;
-    if (input_mat_filename.find(".pb\0") != std::string::npos) {
+    if (input_mat_filename.find(".pb\0") != std::string::npos || MAT_Snapshot::is_snapshot(input_mat_filename)) {
         T = MAT::load_mutation_annotated_tree(input_mat_filename);
         T.uncondense_leaves();
     } else if (input_mat_filename.find(".json\0") != std::string::npos) {
         T = load_mat_from_json(input_mat_filename);
     } else {
-        fprintf(stderr, "ERROR: Input file ending not recognized. Must be .json or .pb\n");
+        fprintf(stderr, "ERROR: Input file ending not recognized. Must be .json or .pb, or a MAT snapshot\n");
         exit(1);
     }
     fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
@@ -261,6 +262,14 @@ usher_single_subtree_size == 0 && usher_minimum_subtrees_size == 0) {
     timer.Start();
     fprintf(stderr, "Checking for and applying sample selection arguments\n");
     std::vector<std::string> samples;
+    //shared by the selections which need it, T is not edited until they are done
+    std::unique_ptr<Select_Index> select_index;
+    auto get_select_index = [&]() -> const Select_Index& {
+        if (select_index == nullptr) {
+            select_index.reset(new Select_Index(&T));
+        }
+        return *select_index;
+    };
     if (input_samples_file != "") {
         samples = read_sample_names(input_samples_file);
         if (samples.size() == 0) {
@@ -282,7 +291,7 @@ usher_single_subtree_size == 0 && usher_minimum_subtrees_size == 0) {
             fprintf(stderr, "ERROR: Invalid neighborhood size. Please choose a positive nonzero integer.\n");
             exit(1);
         }
-        auto nk_samples = get_nearby(&T, sample_id, nk);
+        auto nk_samples = get_nearby(get_select_index(), sample_id, nk);
         assert ( nk_samples.size() > 0 ) ;
         if (samples.size() == 0) {
             samples = nk_samples;
@@ -315,7 +324,7 @@ usher_single_subtree_size == 0 && usher_minimum_subtrees_size == 0) {
         std::unordered_set<std::string> samples_in_clade;
         for (auto cname: clades) {
             fprintf(stderr, "Getting member samples of clade %s\n", cname.c_str());
-            auto csamples = get_clade_samples(&T, cname);
+            auto csamples = get_clade_samples(get_select_index(), cname);
             if (csamples.size() == 0) {
                 //warning because they may want the other clade they indicated and it can proceed with that
                 //itll error down the line if this was the only one they passed in and it leaves them with no samples
@@ -347,7 +356,7 @@ usher_single_subtree_size == 0 && usher_minimum_subtrees_size == 0) {
         std::unordered_set<std::string> samples_with_mutation;
         for (auto mname: mutations) {
             fprintf(stderr, "Getting samples with mutation %s\n", mname.c_str());
-            auto msamples = get_mutation_samples(&T, mname);
+            auto msamples = get_mutation_samples(get_select_index(), mname);
             if (msamples.size() == 0) {
                 fprintf(stderr, "WARNING: No samples with mutation %s found in tree!\n", mname.c_str());
             }
@@ -386,7 +395,7 @@ usher_single_subtree_size == 0 && usher_minimum_subtrees_size == 0) {
         }
     }
     if (max_path >= 0) {
-        samples = get_short_paths(&T, samples, max_path);
+        samples = get_short_paths(get_select_index(), samples, max_path);
         if (samples.size() == 0) {
             fprintf(stderr, "ERROR: No samples fulfill selected criteria. Change arguments and try again\n");
             exit(1);
@@ -433,7 +442,7 @@ usher_single_subtree_size == 0 && usher_minimum_subtrees_size == 0) {
         not_nearest.insert(samples.begin(), samples.end());
         std::unordered_set<std::string> nsamples;
         for (auto s: samples) {
-            auto nearest = get_nearby(&T, s, select_nearest);
+            auto nearest = get_nearby(get_select_index(), s, select_nearest);
             nsamples.insert(nearest.begin(), nearest.end());
         }
         samples.assign(nsamples.begin(), nsamples.end());
@@ -744,23 +753,39 @@ usher_single_subtree_size == 0 && usher_minimum_subtrees_size == 0) {
         }
         auto batch_samples = read_sample_names(sample_file);
         timer.Start();
+        Select_Index batch_index(&T);
+        //samples sharing a nearby root share their context, so each context is selected, filtered and written once
+        //and copied for the other samples of its group.
+        auto groups = group_nearby_samples(batch_index, batch_samples, nk);
+        //remove forward slashes from the sample names, replacing them with underscores, so that they work for file names
+        for (auto& sample: batch_samples) {
+            size_t pos = 0;
+            while ((pos = sample.find("/")) != std::string::npos) {
+                sample.replace(pos, 1, "_");
+            }
+        }
         static tbb::affinity_partitioner ap;
 
-        tbb::parallel_for(tbb::blocked_range<size_t>(0, batch_samples.size() ),
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, groups.size() ),
         [&](const tbb::blocked_range<size_t> r) {
 
-            for (auto s = r.begin() ; s < r.end() ; ++s ) {
-                auto cs = get_nearby(&T, batch_samples[s], nk);
+            for (auto g = r.begin() ; g < r.end() ; ++g ) {
+                auto cs = get_nearby_leaves(batch_index, groups[g].first, nk);
                 if ( cs.size() == 0 ) {
                     continue ;
                 }
                 MAT::Tree subt = filter_master(T, cs, false);
-                //remove forward slashes from the string, replacing them with underscores, so that it works for file names
-                size_t pos = 0;
-                while ((pos = batch_samples[s].find("/")) != std::string::npos) {
-                    batch_samples[s].replace(pos, 1, "_");
+                const auto& queries = groups[g].second;
+                std::string context_filename = batch_samples[queries[0]] + "_context.json";
+                write_json_from_mat(&subt, context_filename, &catmeta, tax_title);
+                for (size_t q = 1; q < queries.size(); q++) {
+                    std::string copy_filename = batch_samples[queries[q]] + "_context.json";
+                    if (copy_filename != context_filename) {
+                        std::ifstream context_in(context_filename, std::ios::binary);
+                        std::ofstream context_out(copy_filename, std::ios::binary);
+                        context_out << context_in.rdbuf();
+                    }
                 }
-                write_json_from_mat(&subt, batch_samples[s] + "_context.json", &catmeta, tax_title);
             }
         }, ap) ;
         fprintf(stderr, "%ld batch sample jsons written in %ld msec.\n\n", batch_samples.size(), timer.Stop());
@@ -232,6 +232,7 @@ void reroot_tree(MAT::Tree* T, const std::string& rnid, const std::string& input
         T->root->mutations.clear();
     }
     std::reverse(norder.begin(), norder.end()); //reverse so the root is first.
+    T->invalidate_index();
     for (size_t i = 0; i < norder.size() - 1; i++) {
 
         MAT::Node* source = norder[i];
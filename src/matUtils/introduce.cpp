@@ -1,6 +1,7 @@
 #include "introduce.hpp"
 #include "select.hpp"
 #include <tbb/info.h>
+#include <tbb/global_control.h>
 
 po::variables_map parse_introduce_command(po::parsed_options parsed) {
 
@@ -105,7 +106,7 @@ std::unordered_map<std::string, std::vector<std::string>> read_two_column (std::
     return amap;
 }
 
-float get_association_index(MAT::Tree* T, std::unordered_map<std::string, float> assignments, bool permute, MAT::Node* subroot) {
+float get_association_index(MAT::Tree* T, const Region_Assignments& region_assignments, size_t region, bool permute, MAT::Node* subroot) {
     /*
     The association index was introduced by Wang et al 2005 for the estimation of phylogeny and trait correlation. Parker et al 2008 has a good summary.
     It's an index that is small for strong correlation and large for weak correlation, with non-integer values.
@@ -115,9 +116,11 @@ float get_association_index(MAT::Tree* T, std::unordered_map<std::string, float>
     My implementation is an efficient one that relies on dynamic programming and useful ordering of node traversal.
     This searches over a reverse breadth first order. For each internal node, check the children.
     Count the number of direct leaf children which are in/out and get the records for the counts for in/out
-    from the internal_tracker map. Add these up to get the total number of in/out leaves associated with a node.
+    from the internal_tracker array. Add these up to get the total number of in/out leaves associated with a node.
     This avoids repeatedly traversing the tree to identify leaves for each internal node, since reverse breadth-first search order
     means that all children of a node will necessarily be traversed over before the node itself is.
+    The breadth-first order of the full tree is computed once with the assignments and shared by every call on it,
+    including permutations, and the children of a node are found by position, as they are contiguous in that order.
 
     The permute boolean, when true, sets a mode where in/out traits are randomly assigned on a uniform distribution based on
     the baseline frequency of the trait across the tree instead of actually checking membership. Used to evaluate the results with
@@ -125,12 +128,23 @@ float get_association_index(MAT::Tree* T, std::unordered_map<std::string, float>
     */
     //timer.Start();
     float total_ai = 0.0;
-    std::unordered_map<std::string,std::pair<size_t,size_t>> internal_tracker;
-    std::vector<MAT::Node*> bfs;
+    const auto& dfs = region_assignments.dfs;
+    const auto& assignments = region_assignments.assignments[region];
+    const std::vector<size_t>* bfs = &region_assignments.bfs;
+    const std::vector<size_t>* first_child = &region_assignments.bfs_first_child;
+    std::vector<size_t> subtree_bfs;
+    std::vector<size_t> subtree_first_child;
     if (subroot != NULL) {
-        bfs = T->breadth_first_expansion(subroot->identifier);
-    } else {
-        bfs = T->breadth_first_expansion();
+        for (auto n: T->breadth_first_expansion(subroot->identifier)) {
+            subtree_bfs.push_back(region_assignments.index(n));
+        }
+        size_t next_child = 1;
+        for (auto idx: subtree_bfs) {
+            subtree_first_child.push_back(next_child);
+            next_child += dfs[idx]->children.size();
+        }
+        bfs = &subtree_bfs;
+        first_child = &subtree_first_child;
     }
 
     srand(time(nullptr));
@@ -138,26 +152,26 @@ float get_association_index(MAT::Tree* T, std::unordered_map<std::string, float>
     size_t permuted_inc = 0;
     size_t sample_count = 0;
     if (permute) {
-        for (auto b: bfs) {
-            if (b->is_leaf()) {
+        for (auto idx: *bfs) {
+            if (dfs[idx]->is_leaf()) {
                 leaf_count++;
-                auto search = assignments.find(b->identifier);
-                if (search != assignments.end()) {
-                    if (search->second > 0.5) {
-                        sample_count++;
-                    }
+                if (assignments[idx] > 0.5) {
+                    sample_count++;
                 }
             }
         }
     }
 
-    std::reverse(bfs.begin(), bfs.end());
-    for (auto n: bfs) {
+    //in/out leaf counts of each internal node, by position in the breadth-first order
+    std::vector<std::pair<size_t,size_t>> internal_tracker(bfs->size());
+    for (size_t pos = bfs->size(); pos-- > 0;) {
+        auto n = dfs[(*bfs)[pos]];
         if (!n->is_leaf()) {
             size_t in_c = 0;
             size_t out_c = 0;
-            for (auto c: n->children) {
-                if (c->is_leaf()) {
+            for (size_t cpos = (*first_child)[pos]; cpos < (*first_child)[pos] + n->children.size(); cpos++) {
+                auto cidx = (*bfs)[cpos];
+                if (dfs[cidx]->is_leaf()) {
                     if (permute) {
                         int random = rand()%leaf_count;
                         if (random <= static_cast<float>(sample_count)) {
@@ -167,29 +181,19 @@ float get_association_index(MAT::Tree* T, std::unordered_map<std::string, float>
                             out_c++;
                         }
                     } else {
-                        auto search = assignments.find(c->identifier);
-                        if (search != assignments.end()) {
-                            if (search->second > 0.5) {
-                                in_c++;
-                            } else {
-                                out_c++;
-                            }
+                        if (assignments[cidx] > 0.5) {
+                            in_c++;
+                        } else {
+                            out_c++;
                         }
                     }
                 } else {
-                    //check to see if we've recorded the internal child- we definitely should have in reverse BFS
-                    auto search = internal_tracker.find(c->identifier);
-                    if (search != internal_tracker.end()) {
-                        in_c += search->second.first;
-                        out_c += search->second.second;
-                    } else {
-                        //this SHOULD not happen, logically...
-                        fprintf(stderr, "ERROR: AI calculation encountered mystery internal child node\n");
-                        exit(1);
-                    }
+                    //internal children come later in breadth-first order, so they are already recorded
+                    in_c += internal_tracker[cpos].first;
+                    out_c += internal_tracker[cpos].second;
                 }
             }
-            internal_tracker[n->identifier] = std::make_pair(in_c,out_c);
+            internal_tracker[pos] = std::make_pair(in_c,out_c);
             size_t total_leaves = in_c + out_c;
             total_ai += ((1 - std::max(in_c,out_c)/total_leaves) / (pow(2, (total_leaves-1))));
         }
@@ -197,7 +201,7 @@ float get_association_index(MAT::Tree* T, std::unordered_map<std::string, float>
     return total_ai;
 }
 
-size_t get_monophyletic_cladesize(MAT::Tree* T, std::unordered_map<std::string, float> assignments, MAT::Node* subroot) {
+size_t get_monophyletic_cladesize(const Region_Assignments& region_assignments, size_t region, MAT::Node* subroot) {
     /*
     The monophyletic clade statistic was introduced by Salemi et al 2005. Parker et al 2008 has a good summary.
     MC is bigger for strong correlations, bounded 1 to N where N is the number of samples in the subtree.
@@ -208,25 +212,27 @@ size_t get_monophyletic_cladesize(MAT::Tree* T, std::unordered_map<std::string,
     clade subtree which is entirely IN.
     */
     size_t biggest = 0;
-    std::vector<std::string> acls;
     //depth-first search order is required for this implementation.
-    for (auto n: T->depth_first_expansion(subroot)) {
-        if (n->is_leaf()) {
-            acls.push_back(n->identifier);
-        }
+    //the subtree of a node is a contiguous range of it.
+    size_t start = 0;
+    size_t end = region_assignments.dfs.size();
+    if (subroot != NULL) {
+        start = region_assignments.index(subroot);
+        end = region_assignments.dfs_end[start];
     }
+    const auto& assignments = region_assignments.assignments[region];
     size_t current = 0;
-    for (auto l: acls) {
-        auto search = assignments.find(l);
-        if (search != assignments.end()) {
-            if (search->second >= 0.5) {
-                current++;
-            } else {
-                if (current > biggest) {
-                    biggest = current;
-                }
-                current = 0;
+    for (size_t idx = start; idx < end; idx++) {
+        if (!region_assignments.dfs[idx]->is_leaf()) {
+            continue;
+        }
+        if (assignments[idx] >= 0.5) {
+            current++;
+        } else {
+            if (current > biggest) {
+                biggest = current;
             }
+            current = 0;
         }
     }
     if (current > biggest) {
@@ -235,31 +241,27 @@ size_t get_monophyletic_cladesize(MAT::Tree* T, std::unordered_map<std::string,
     return biggest;
 }
 
-void record_clade_regions(MAT::Tree* T, std::unordered_map<std::string, std::unordered_map<std::string, float>> region_assignments, std::string filename) {
+void record_clade_regions(const Region_Assignments& region_assignments, std::string filename) {
     //record a tsv with a column for each annotated region (single will have label default)
     //and a row for each clade label. The contents are the assignment support for that specific clade root being IN the indicated region
     std::ofstream of;
     of.open(filename);
     //write the header line
-    //save the regions into an explicit vector just to make sure we don't get scrambled (iteration over hash maps...)
     of << "clade\t";
-    std::vector<std::string> region_order;
-    for (auto r: region_assignments) {
-        of << r.first << "\t";
-        region_order.push_back(r.first);
+    for (auto r: region_assignments.regions) {
+        of << r << "\t";
     }
     of << "\n";
 
-    for (auto n: T->depth_first_expansion()) {
-        for (auto ca: n->clade_annotations) {
+    for (size_t idx = 0; idx < region_assignments.dfs.size(); idx++) {
+        for (auto ca: region_assignments.dfs[idx]->clade_annotations) {
             if (ca.size() > 0) {
                 //we have a clade root here
                 std::stringstream rowstr;
                 rowstr << ca << "\t";
-                for (auto r: region_order) {
-                    auto search = region_assignments[r].find(n->identifier);
+                for (const auto& assignments: region_assignments.assignments) {
                     //this can be anything from 0 to 1.
-                    rowstr << search->second << "\t";
+                    rowstr << assignments[idx] << "\t";
                 }
                 of << rowstr.str() << "\n";
             }
@@ -267,7 +269,7 @@ void record_clade_regions(MAT::Tree* T, std::unordered_map<std::string, std::uno
     }
 }
 
-std::unordered_map<std::string, float> get_assignments(MAT::Tree* T, std::unordered_set<std::string> sample_set, bool eval_uncertainty) {
+Region_Assignments get_assignments(MAT::Tree* T, const std::vector<std::string>& regions, const std::unordered_map<std::string, std::vector<std::string>>& sample_regions, bool eval_uncertainty) {
     /*
     This function applies a heuristic series of steps to label internal nodes as in or out of a geographic area
     based on their relationship to the samples in the input list. The rules are:
@@ -280,93 +282,134 @@ std::unordered_map<std::string, float> get_assignments(MAT::Tree* T, std::unorde
     5. On a tie, the node is assigned to the state of its parent
 
     Introductions are identified as locations where assignments in an rsearch from an IN sample shift from IN to OUT.
+
+    Every region is assigned in the same traversal, which visits the children of each node before the node itself
+    (depth-first order backwards). The leaf counts and distances of nodes whose parent has not been visited yet
+    are kept on a stack with one entry per region, as the children of the current node are always the topmost ones.
     */
+    Region_Assignments region_assignments;
+    region_assignments.regions = regions;
+    region_assignments.dfs = T->depth_first_expansion();
+    const auto& dfs = region_assignments.dfs;
+    size_t num_nodes = dfs.size();
+    size_t num_regions = regions.size();
+    region_assignments.dfs_end.resize(num_nodes);
+    region_assignments.node_idx.reserve(num_nodes);
+    for (size_t idx = 0; idx < num_nodes; idx++) {
+        region_assignments.dfs_end[idx] = dfs[idx]->dfs_end_idx;
+        region_assignments.node_idx.emplace(dfs[idx], idx);
+    }
+    size_t next_child = 1;
+    for (auto n: T->breadth_first_expansion()) {
+        region_assignments.bfs.push_back(region_assignments.index(n));
+        region_assignments.bfs_first_child.push_back(next_child);
+        next_child += n->children.size();
+    }
+    //regions each leaf is a sample of, in increasing order
+    std::vector<std::vector<size_t>> leaf_regions(num_nodes);
+    for (size_t r = 0; r < num_regions; r++) {
+        for (const auto& s: sample_regions.find(regions[r])->second) {
+            auto search = region_assignments.node_idx.find(T->get_node(s));
+            if (search != region_assignments.node_idx.end()) {
+                auto& lr = leaf_regions[search->second];
+                if (lr.empty() || lr.back() != r) {
+                    lr.push_back(r);
+                }
+            }
+        }
+    }
 
-    std::unordered_map<std::string, float> assignments;
-    std::unordered_map<std::string, size_t[4]> stored_params;
-    auto bfs = T->breadth_first_expansion();
-    std::reverse(bfs.begin(), bfs.end());
-    for (auto n: bfs) {
+    auto& assignments = region_assignments.assignments;
+    assignments.assign(num_regions, std::vector<float>(num_nodes, 0));
+    //initialize distances at large numbers.
+    const size_t far = 10000000;
+    std::vector<size_t> in_stack;
+    std::vector<size_t> out_stack;
+    std::vector<size_t> min_to_in_stack;
+    std::vector<size_t> min_to_out_stack;
+    std::vector<size_t> in_leaves(num_regions);
+    std::vector<size_t> out_leaves(num_regions);
+    std::vector<size_t> min_to_in(num_regions);
+    std::vector<size_t> min_to_out(num_regions);
+    for (size_t idx = num_nodes; idx-- > 0;) {
+        auto n = dfs[idx];
         if (n->is_leaf()) {
             //rule 1
-            if (sample_set.find(n->identifier) != sample_set.end()) {
-                assignments[n->identifier] = 1;
-            } else {
-                assignments[n->identifier] = 0;
+            size_t next_region = 0;
+            for (size_t r = 0; r < num_regions; r++) {
+                bool in = (next_region < leaf_regions[idx].size()) && (leaf_regions[idx][next_region] == r);
+                if (in) {
+                    next_region++;
+                }
+                assignments[r][idx] = in ? 1 : 0;
+                in_stack.push_back(in ? 1 : 0);
+                out_stack.push_back(in ? 0 : 1);
+                min_to_in_stack.push_back(in ? 0 : far);
+                min_to_out_stack.push_back(in ? far : 0);
             }
-        } else {
-            size_t in_leaves = 0;
-            size_t out_leaves = 0;
-            //initialize these at large numbers.
-            size_t min_to_in = 10000000;
-            size_t min_to_out = 10000000;
-            for (auto c: n->children) {
-                if (!c->is_leaf()) {
-                    //this should be present in the stored_params map, if traversal is working correctly
-                    auto search = stored_params.find(c->identifier);
-                    if (search != stored_params.end()) {
-                        in_leaves += search->second[0];
-                        out_leaves += search->second[1];
-                        if (search->second[2] + c->mutations.size() < min_to_in) {
-                            min_to_in = search->second[2] + c->mutations.size();
-                        }
-                        if (search->second[3] + c->mutations.size() < min_to_out) {
-                            min_to_out = search->second[3] + c->mutations.size();
-                        }
-                    } else {
-                        fprintf(stderr, "ERROR: traversal order failure, stored data unavailable\n");
-                        exit(1);
-                    }
-                } else {
-                    if (sample_set.find(c->identifier) != sample_set.end()) {
-                        in_leaves++;
-                        if (c->mutations.size() < min_to_in) {
-                            min_to_in = c->mutations.size();
-                        }
-                    } else {
-                        out_leaves++;
-                        if (c->mutations.size() < min_to_out) {
-                            min_to_out = c->mutations.size();
-                        }
-                    }
+            continue;
+        }
+        std::fill(in_leaves.begin(), in_leaves.end(), 0);
+        std::fill(out_leaves.begin(), out_leaves.end(), 0);
+        std::fill(min_to_in.begin(), min_to_in.end(), far);
+        std::fill(min_to_out.begin(), min_to_out.end(), far);
+        size_t stack_top = in_stack.size();
+        for (auto c: n->children) {
+            //the first child is on top of the stack
+            stack_top -= num_regions;
+            size_t muts = c->mutations.size();
+            for (size_t r = 0; r < num_regions; r++) {
+                in_leaves[r] += in_stack[stack_top + r];
+                out_leaves[r] += out_stack[stack_top + r];
+                if (min_to_in_stack[stack_top + r] + muts < min_to_in[r]) {
+                    min_to_in[r] = min_to_in_stack[stack_top + r] + muts;
+                }
+                if (min_to_out_stack[stack_top + r] + muts < min_to_out[r]) {
+                    min_to_out[r] = min_to_out_stack[stack_top + r] + muts;
                 }
             }
-            stored_params[n->identifier][0] = in_leaves;
-            stored_params[n->identifier][1] = out_leaves;
-            stored_params[n->identifier][2] = min_to_in;
-            stored_params[n->identifier][3] = min_to_out;
-            // fprintf(stderr, "DEBUG: min %ld, mout %ld, ols %ld, ils %ld\n", min_to_in, min_to_out, out_leaves, in_leaves);
-            if (out_leaves == 0) {
+        }
+        in_stack.resize(stack_top);
+        out_stack.resize(stack_top);
+        min_to_in_stack.resize(stack_top);
+        min_to_out_stack.resize(stack_top);
+        in_stack.insert(in_stack.end(), in_leaves.begin(), in_leaves.end());
+        out_stack.insert(out_stack.end(), out_leaves.begin(), out_leaves.end());
+        min_to_in_stack.insert(min_to_in_stack.end(), min_to_in.begin(), min_to_in.end());
+        min_to_out_stack.insert(min_to_out_stack.end(), min_to_out.begin(), min_to_out.end());
+        for (size_t r = 0; r < num_regions; r++) {
+            // fprintf(stderr, "DEBUG: min %ld, mout %ld, ols %ld, ils %ld\n", min_to_in[r], min_to_out[r], out_leaves[r], in_leaves[r]);
+            if (out_leaves[r] == 0) {
                 //rule 2
-                assignments[n->identifier] = 1;
-            } else if (in_leaves == 0) {
+                assignments[r][idx] = 1;
+            } else if (in_leaves[r] == 0) {
                 //rule 3
-                assignments[n->identifier] = 0;
+                assignments[r][idx] = 0;
             } else {
                 //rule 4- 1 is IN, 0 is OUT, but we want to have in-between numbers to represent relative confidence.
                 //we calculate the balance by computing C=1/(1+((OUT_MD/OUT_LEAVES)/(IN_MD/IN_LEAVES)))
                 //C is near 0 when OUT is large, C is near 1 when IN is large, C is 0.5 when they are the same
                 //now we complete rule 4 by checking the balance.
-                if (min_to_in == 0) {
+                if (min_to_in[r] == 0) {
                     //this calculation is unnecessary in these cases.
                     //tiebreaker for both being 0 is IN with this ordering.
                     //identical IN sample, its IN, because logically this ancestor did exist there at that time (just maybe elsewhere also)
-                    assignments[n->identifier] = 1;
-                } else if (min_to_out == 0) {
-                    assignments[n->identifier] = 0;
+                    assignments[r][idx] = 1;
+                } else if (min_to_out[r] == 0) {
+                    assignments[r][idx] = 0;
                 } else {
                     //not strictly necessary variable declarations, but makes debugging a bit easier
-                    float vor = (static_cast<float>(min_to_out) / static_cast<float>(out_leaves));
-                    float vir = (static_cast<float>(min_to_in) / static_cast<float>(in_leaves));
-                    float r = (vir/vor);
-                    float c = (1/(1+r));
+                    float vor = (static_cast<float>(min_to_out[r]) / static_cast<float>(out_leaves[r]));
+                    float vir = (static_cast<float>(min_to_in[r]) / static_cast<float>(in_leaves[r]));
+                    float ratio = (vir/vor);
+                    float c = (1/(1+ratio));
                     if (isnan(c)) {
                         fprintf(stderr, "ERROR: Invalid introduction assignment calculation. Debug information follows.\n");
-                        fprintf(stderr, "min %ld, mout %ld, ols %ld, ils %ld,", min_to_in, min_to_out, out_leaves, in_leaves);
-                        fprintf(stderr, " vor %f, vir %f, r %f\n", vor, vir, r);
+                        fprintf(stderr, "min %ld, mout %ld, ols %ld, ils %ld,", min_to_in[r], min_to_out[r], out_leaves[r], in_leaves[r]);
+                        fprintf(stderr, " vor %f, vir %f, r %f\n", vor, vir, ratio);
                         exit(1);
                     }
-                    assignments[n->identifier] = c;
+                    assignments[r][idx] = c;
                 }
             }
         }
@@ -374,22 +417,39 @@ std::unordered_map<std::string, float> get_assignments(MAT::Tree* T, std::unorde
     if (eval_uncertainty) {
         timer.Start();
         fprintf(stderr, "Leaf label uncertainty estimate requested; calculating...\n");
+        std::vector<size_t> parent_idx(num_nodes, 0);
+        for (size_t idx = 1; idx < num_nodes; idx++) {
+            parent_idx[idx] = region_assignments.index(dfs[idx]->parent);
+        }
         //update the assignments for specific leaves against the rest of the dataset
-        for (auto l: T->get_leaves()) {
-            float total_conf = 0.0;
-            float max_conf = 0.0;
-            float traversed = static_cast<float>(l->mutations.size());
-            for (auto anc: T->rsearch(l->identifier, false)) {
-                float acv = assignments.find(anc->identifier)->second;
-                total_conf += (acv / ((1+traversed) * (1+traversed)));
-                max_conf += (1 / ((1+traversed) * (1+traversed)));
-                traversed += static_cast<float>(anc->mutations.size());
+        //ancestors are internal nodes, so leaves can be updated concurrently
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, num_nodes),
+        [&](const tbb::blocked_range<size_t> range) {
+            std::vector<float> total_conf(num_regions);
+            for (size_t idx = range.begin(); idx < range.end(); idx++) {
+                auto l = dfs[idx];
+                if (!l->is_leaf()) {
+                    continue;
+                }
+                std::fill(total_conf.begin(), total_conf.end(), 0.0);
+                float max_conf = 0.0;
+                float traversed = static_cast<float>(l->mutations.size());
+                for (size_t anc = idx; anc != 0;) {
+                    anc = parent_idx[anc];
+                    for (size_t r = 0; r < num_regions; r++) {
+                        total_conf[r] += (assignments[r][anc] / ((1+traversed) * (1+traversed)));
+                    }
+                    max_conf += (1 / ((1+traversed) * (1+traversed)));
+                    traversed += static_cast<float>(dfs[anc]->mutations.size());
+                }
+                for (size_t r = 0; r < num_regions; r++) {
+                    assignments[r][idx] = total_conf[r] / max_conf;
+                }
             }
-            assignments[l->identifier] = total_conf / max_conf;
-        }
+        });
         fprintf(stderr, "All leaves processed in %ld msec.\n", timer.Stop());
     }
-    return assignments;
+    return region_assignments;
 }
 
 std::pair<boost::gregorian::date,boost::gregorian::date> daterange_from_list(std::vector<std::string> sample_list, std::unordered_map<std::string, std::string> datemeta) {
@@ -457,7 +517,6 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
     //and save these assignments into a map of maps
     //so we can check membership of introduction points in each of the other groups
     //this allows us to look for migrant flow between regions
-    std::unordered_map<std::string, std::unordered_map<std::string, float>> region_assignments;
     boost::gregorian::date recency_filter;
     boost::gregorian::date early_filter;
     std::vector<std::string> bycluster_output;
@@ -473,38 +532,35 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
         fprintf(stderr, "ERROR: Minimum earliest date argument (-L) could not be parsed. Check that it is formatted year-month-day and try again.\n");
         exit(1);
     }
-    //I also suspect I could use pointers for the assignment maps to make this more memory efficient
     std::vector<std::string> regions ;
-    for ( auto r : sample_regions ) regions.push_back( r.first ) ;
-    static tbb::affinity_partitioner ap;
-    tbb::parallel_for(tbb::blocked_range<size_t>( 0, regions.size() ),
-    [&](const tbb::blocked_range<size_t> r) {
-        for ( size_t l = r.begin() ; l < r.end() ; l ++ ) {
-            std::string region = regions[l] ;
-            std::vector<std::string> samples = sample_regions[regions[l]] ;
-            fprintf(stderr, "Processing region %s with %ld total samples\n", region.c_str(), samples.size());
-            std::unordered_set<std::string> sample_set(samples.begin(), samples.end());
-            auto assignments = get_assignments(T, sample_set, eval_uncertainty);
-            if (add_info) {
-                size_t global_mc = get_monophyletic_cladesize(T, assignments);
-                float global_ai = get_association_index(T, assignments);
-                fprintf(stderr, "Region largest monophyletic clade: %ld, regional association index: %f\n", global_mc, global_ai);
+    for ( auto r : sample_regions ) {
+        fprintf(stderr, "Processing region %s with %ld total samples\n", r.first.c_str(), r.second.size());
+        regions.push_back( r.first ) ;
+    }
+    auto region_assignments = get_assignments(T, regions, sample_regions, eval_uncertainty);
+    size_t num_regions = regions.size();
+    if (add_info) {
+        static tbb::affinity_partitioner ap;
+        tbb::parallel_for(tbb::blocked_range<size_t>( 0, num_regions ),
+        [&](const tbb::blocked_range<size_t> r) {
+            for ( size_t l = r.begin() ; l < r.end() ; l ++ ) {
+                size_t global_mc = get_monophyletic_cladesize(region_assignments, l);
+                float global_ai = get_association_index(T, region_assignments, l);
+                fprintf(stderr, "Region %s largest monophyletic clade: %ld, regional association index: %f\n", regions[l].c_str(), global_mc, global_ai);
                 std::vector<float> permvec;
                 for (int i = 0; i < 100; i++) {
-                    float perm = get_association_index(T, assignments, true);
+                    float perm = get_association_index(T, region_assignments, l, true);
                     permvec.push_back(perm);
                 }
                 std::sort(permvec.begin(), permvec.end());
                 fprintf(stderr, "Real value %f. Quantiles of random expected AI for this sample size: %f, %f, %f, %f, %f\n", global_ai, permvec[5],permvec[25],permvec[50],permvec[75],permvec[95]);
             }
-
-            region_assignments[region] = assignments;
-        }
-    }, ap);
+        }, ap);
+    }
     //if requested, record the clade output
     if (clade_output.size() > 0) {
         fprintf(stderr, "Clade root region support requested; recording...\n");
-        record_clade_regions(T, region_assignments, clade_output);
+        record_clade_regions(region_assignments, clade_output);
     }
     //there are some significant runtime issues when checking assignment states repeatedly for different groups
     //so I'm going to generate a series of sets of nodes which are 1 for any given assignment
@@ -513,13 +569,15 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
 
     //this structure holds the ID of every node which is 1 in at least one region
     //and all corresponding regions it is 1 for.
-    std::unordered_map<std::string, std::vector<float>> region_cons;
-    std::unordered_map<std::string, std::vector<std::string>> region_ins;
-    for (auto ra: region_assignments) {
-        for (auto ass: ra.second) {
-            if (ass.second > minimum_reporting) {
-                region_ins[ass.first].push_back(ra.first);
-                region_cons[ass.first].push_back(ass.second);
+    //both are indexed like the assignment arrays, and hold region indices
+    std::vector<std::vector<float>> region_cons(region_assignments.dfs.size());
+    std::vector<std::vector<size_t>> region_ins(region_assignments.dfs.size());
+    for (size_t ridx = 0; ridx < num_regions; ridx++) {
+        const auto& assignments = region_assignments.assignments[ridx];
+        for (size_t idx = 0; idx < assignments.size(); idx++) {
+            if (assignments[idx] > minimum_reporting) {
+                region_ins[idx].push_back(ridx);
+                region_cons[idx].push_back(assignments[idx]);
             }
         }
     }
@@ -528,7 +586,7 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
     //looking for introductions.
     std::vector<std::string> outstrs;
     std::string header = "sample\tintroduction_node\tintroduction_rank\tgrowth_score\tearliest_date\tlatest_date\tcluster_size\tcluster_span\tintro_confidence\tparent_confidence\tdistance\torigin_gap";
-    if (region_assignments.size() > 1) {
+    if (num_regions > 1) {
         header += "\tregion\torigins\torigins_confidence";
     }
     size_t nann = T->get_num_annotations();
@@ -552,9 +610,8 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
     //    std::string region = regions[l] ;
     //    std::vector<std::string> samples = sample_regions[regions[l]] ;
     //    auto assignments = region_assignments[region];
-    for (auto ra: region_assignments) {
-        std::string region = ra.first;
-        auto assignments = ra.second;
+    for (size_t ridx = 0; ridx < num_regions; ridx++) {
+        std::string region = regions[ridx];
         std::vector<std::string> samples = sample_regions[region];
         std::set<std::string> sampleset (samples.begin(), samples.end());
         std::unordered_map<std::string, size_t> recorded_mc;
@@ -589,7 +646,7 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
                 } else {
                     //every node should be in assignments at this point.
                     // fprintf(stderr, "DEBUG: checking ancestor %s\n", a->identifier.c_str());
-                    anc_state = assignments.find(a->identifier)->second;
+                    anc_state = region_assignments.get(ridx, a);
                 }
                 if (anc_state < min_origin_confidence) {
                     //adding a new filter routine- looking ahead X nodes along the path to see if any have HIGHER confidence than the
@@ -599,14 +656,9 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
                     if (!a->is_root()) { //filter doesn't apply to roots, of course.
                         for (size_t i = 0; i < look_ahead; i++) {
                             cnode = a->parent;
-                            auto cnsc = assignments.find(cnode->identifier);
-                            if (cnsc != assignments.end()) {
-                                if (cnsc->second > anc_state) {
-                                    lookahead_skip = true;
-                                    break;
-                                }
-                            } else {
-                                fprintf(stderr, "DEBUG: Node is missing from assignments\n");
+                            if (region_assignments.get(ridx, cnode) > anc_state) {
+                                lookahead_skip = true;
+                                break;
                             }
                             if (cnode->is_root()) {
                                 break;
@@ -628,24 +680,25 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
                     std::string origins;
                     std::stringstream origins_cons;
                     //can't assign region of origin if introduction point is root (no information about parent)
-                    if ((region_assignments.size() > 1) & (!a->is_root())) {
-                        auto assign_search = region_ins.find(a->identifier);
+                    if ((num_regions > 1) & (!a->is_root())) {
+                        auto aidx = region_assignments.index(a);
+                        const auto& a_ins = region_ins[aidx];
                         //instead of immediately reporting each that pass a high threshold,
                         //collect the set of all that pass a low threshold, sort by confidence, and store only the top Z scores and associated strings.
                         //use of the greater comparator means that the top() element is the smallest value. 
                         std::priority_queue<std::pair<float,std::string>, std::vector<std::pair<float,std::string>>, std::greater<std::pair<float,std::string>>> oriscores;
-                        if (assign_search != region_ins.end()) {
-                            size_t count = assign_search->second.size();
+                        if (!a_ins.empty()) {
+                            size_t count = a_ins.size();
                             if (num_to_report > 0) {
                                 count = num_to_report;
                             }
-                            for (size_t i = 0; i < assign_search->second.size(); i++) {
+                            for (size_t i = 0; i < a_ins.size(); i++) {
                                 //vectors for confidence and region tags were generated in parallel and should remain aligned
-                                if (assign_search->second[i] == region) {
+                                if (a_ins[i] == ridx) {
                                     //don't allow it to be its own point of origin, that's silly.
                                     continue;
                                 }
-                                std::pair<float,std::string> dpair = std::make_pair(region_cons.find(a->identifier)->second[i], assign_search->second[i]);
+                                std::pair<float,std::string> dpair = std::make_pair(region_cons[aidx][i], regions[a_ins[i]]);
                                 oriscores.push(dpair);
                                 if ((oriscores.size() > count) && (oriscores.top().first < 1)) {
                                     //drop the lowest member if we're over count and if the lowest member is less than 1
@@ -734,14 +787,14 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
                         if (mc_s != recorded_mc.end()) {
                             mc = mc_s->second;
                         } else {
-                            mc = get_monophyletic_cladesize(T, assignments, last_node);
+                            mc = get_monophyletic_cladesize(region_assignments, ridx, last_node);
                             recorded_mc[a->identifier] = mc;
                         }
                         auto ai_s = recorded_ai.find(a->identifier);
                         if (ai_s != recorded_ai.end()) {
                             ai = ai_s->second;
                         } else {
-                            ai = get_association_index(T, assignments, false, last_node);
+                            ai = get_association_index(T, region_assignments, ridx, false, last_node);
                             recorded_ai[a->identifier] = ai;
                         }
                     }
@@ -758,11 +811,11 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
                         //remove those mutations from the traversal so that it's consistent with span
                         traversed -= muts_of_last_encountered;
                     }
-                    if (region_assignments.size() == 1) {
+                    if (num_regions == 1) {
                         ostr << "\t" << last_anc_state << "\t" << anc_state << "\t" << traversed << "\t" << mgap << intro_clades << "\t" << intro_mut_path;
                         mcl << last_anc_state << "\t" << anc_state << "\t" << mgap << intro_clades << "\t" << intro_mut_path;
                         if (eval_uncertainty) {
-                            ostr << "\t" << assignments.find(s)->second;
+                            ostr << "\t" << region_assignments.get(ridx, node);
                         }
                         if (add_info) {
                             ostr << "\t" << mc << "\t" << ai << "\n";
@@ -774,7 +827,7 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
                         ostr << "\t" << last_anc_state << "\t" << anc_state << "\t" << traversed << "\t" << mgap << "\t" << region << "\t" << origins << "\t" << origins_cons.str() << intro_clades << "\t" << intro_mut_path;
                         mcl << last_anc_state << "\t" << anc_state << "\t" << mgap << "\t" << region << "\t" << origins << "\t" << origins_cons.str() << intro_clades << "\t" << intro_mut_path;
                         if (eval_uncertainty) {
-                            ostr << "\t" << assignments.find(s)->second;
+                            ostr << "\t" << region_assignments.get(ridx, node);
                         }
                         if (add_info) {
                             ostr << "\t" << mc << "\t" << ai << "\n";
@@ -874,7 +927,7 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
                     continue;
                 }
                 std::stringstream clo;
-                clo << ra.first << '_' << cid << "\t" << clusters[cid].size() << "\t" << date_tracker[cid] << "\t" << gv << "\t" << span << "\t" << clustermeta[cid] << "\t";
+                clo << region << '_' << cid << "\t" << clusters[cid].size() << "\t" << date_tracker[cid] << "\t" << gv << "\t" << span << "\t" << clustermeta[cid] << "\t";
                 rankr++;
                 bool first = true;
                 for (auto ss: clusters[cid]) {
@@ -888,7 +941,7 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
                     //in order, first seven columns are
                     //sample id, cluster id, cluster rank, cluster growth score, earliest date, latest date, cluster size
                     //then the rest are the by-sample information (path, distance of this specific sample, yadda yadda)
-                    cout << ss.first << "\t" << ra.first << '_' << cid << "\t" << rankr << "\t" << gv << "\t" << date_tracker[cid] << "\t" << clusters[cid].size() << "\t" << span << ss.second;
+                    cout << ss.first << "\t" << region << '_' << cid << "\t" << rankr << "\t" << gv << "\t" << date_tracker[cid] << "\t" << clusters[cid].size() << "\t" << span << ss.second;
                     outstrs.push_back(cout.str());
                 }
                 clo << "\n";
@@ -903,13 +956,14 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
             fprintf(stderr, "Creating output directory to dump region assignments.\n\n");
             boost::filesystem::create_directory(dump_assignments);
         }
-        for (auto ra: region_assignments) {
-            std::ofstream rof(dump_assignments + "/" + ra.first + "_assignments.tsv");
+        for (size_t ridx = 0; ridx < num_regions; ridx++) {
+            std::ofstream rof(dump_assignments + "/" + regions[ridx] + "_assignments.tsv");
             rof << "sample\tconfidence_continuous\n";
-            for (auto ass: ra.second) {
+            const auto& assignments = region_assignments.assignments[ridx];
+            for (size_t idx = 0; idx < assignments.size(); idx++) {
                 //only save nodes with non-zero confidence values for the sake of file size.
-                if (ass.second > 0) {
-                    rof << ass.first << "\t" << ass.second << "\n";
+                if (assignments[idx] > 0) {
+                    rof << region_assignments.dfs[idx]->identifier << "\t" << assignments[idx] << "\n";
                 }
             }
             rof.close();
@@ -921,7 +975,7 @@ std::vector<std::string> find_introductions(MAT::Tree* T, std::unordered_map<std
         if (add_info) {
             cof << "\tmonophyletic_cladesize\tassociation_index";
         }
-        if (region_assignments.size() == 1) {
+        if (num_regions == 1) {
             for (size_t i = 1; i <= nann; i++) {
                 cof << "\tannotation_" + std::to_string(i);
             }
@@ -962,8 +1016,7 @@ void introduce_main(po::parsed_options parsed) {
     // Load input MAT and uncondense tree
     uint32_t num_threads = vm["threads"].as<uint32_t>();
     fprintf(stderr, "Initializing %u worker threads.\n\n", num_threads);
-    // TBB automatically manages threads in modern versions
-    // tbb::task_scheduler_init init(num_threads);
+    tbb::global_control global_limit(tbb::global_control::max_allowed_parallelism, num_threads);
     MAT::Tree T = MAT::load_mutation_annotated_tree(input_mat_filename);
     //T here is the actual object.
     if (T.condensed_nodes.size() > 0) {
@@ -4,9 +4,34 @@
 
 po::variables_map parse_introduce_command(po::parsed_options parsed);
 std::unordered_map<std::string, std::vector<std::string>> read_two_column (std::string sample_filename);
-void record_clade_regions(MAT::Tree* T, std::unordered_map<std::string, std::unordered_map<std::string, float>> region_assignments, std::string filename);
-size_t get_monophyletic_cladesize(MAT::Tree* T, std::unordered_map<std::string, float> assignments, MAT::Node* subroot = NULL);
-float get_association_index(MAT::Tree* T, std::unordered_map<std::string, float> assignments, bool permute = false, MAT::Node* subroot = NULL);
+
+//IN/OUT assignments of every node for all regions, computed together by get_assignments.
+//Nodes are indexed by their position in depth-first order, and each region has one dense array of confidences.
+struct Region_Assignments {
+    std::vector<std::string> regions;
+    std::vector<MAT::Node*> dfs;
+    //end (exclusive) of the subtree of each node in dfs
+    std::vector<size_t> dfs_end;
+    std::unordered_map<const MAT::Node*, size_t> node_idx;
+    //nodes in breadth-first order as dfs indices, and the position of the first child of each of them,
+    //as the children of a node are contiguous in breadth-first order
+    std::vector<size_t> bfs;
+    std::vector<size_t> bfs_first_child;
+    //assignments[r][i] is the confidence (0 OUT to 1 IN) that dfs[i] is in regions[r]
+    std::vector<std::vector<float>> assignments;
+
+    size_t index(const MAT::Node* node) const {
+        return node_idx.find(node)->second;
+    }
+    float get(size_t region, const MAT::Node* node) const {
+        return assignments[region][index(node)];
+    }
+};
+
+void record_clade_regions(const Region_Assignments& region_assignments, std::string filename);
+size_t get_monophyletic_cladesize(const Region_Assignments& region_assignments, size_t region, MAT::Node* subroot = NULL);
+float get_association_index(MAT::Tree* T, const Region_Assignments& region_assignments, size_t region, bool permute = false, MAT::Node* subroot = NULL);
+std::pair<boost::gregorian::date,boost::gregorian::date> daterange_from_list(std::vector<std::string> sample_list, std::unordered_map<std::string, std::string> datemeta = {});
 std::pair<boost::gregorian::date,boost::gregorian::date> get_nearest_date(MAT::Tree* T, MAT::Node* n, std::set<std::string>* in_samples, std::unordered_map<std::string, std::string> datemeta = {});
-std::unordered_map<std::string, float> get_assignments(MAT::Tree* T, std::unordered_set<std::string> sample_set, bool eval_uncertainty = false);
+Region_Assignments get_assignments(MAT::Tree* T, const std::vector<std::string>& regions, const std::unordered_map<std::string, std::vector<std::string>>& sample_regions, bool eval_uncertainty = false);
 void introduce_main(po::parsed_options parsed);
\ No newline at end of file
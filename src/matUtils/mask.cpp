@@ -3,6 +3,11 @@
 #include <random>
 #include <algorithm>
 #include <tbb/info.h>
+#include <tbb/global_control.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <atomic>
 
 //#include <omp.h>
 
@@ -217,80 +222,25 @@ std::map<std::string, std::map<int, int>> readDiff (const std::string& diff_file
     return data;
 }
 
-void nodeComp(Mutation_Annotated_Tree::Node* node, Mutation_Annotated_Tree::Node* leaf, std::map<std::string, std::map<int, int>>& diff_data, std::list<std::pair<int, int>>& missing_data) {
+void masked_positions(Mutation_Annotated_Tree::Node* node, const std::list<std::pair<int, int>>& missing_data, std::vector<std::pair<size_t, int>>& masked) {
     /*
     compare each node in path between two neighbors to the combined missing data of those two neighbors
-    delete mutations that are found in missing regions 
+    collect (dfs index, position) of mutations that are found in missing regions, they are deleted once all pairs are compared
     */
-    //variables for keeping track of location in data structures
-    //start iterators at end to prevent indexing errors
-    int node_len = node->mutations.size();
-    auto leaf_len = missing_data.size();
-    auto leaf_counter = missing_data.end();  
-    auto node_it = node->mutations.end();
-    //decrement to start in the right place
-    node_it --;
-    leaf_counter --;
-    while (true) {        
-        //no mutations or missing info, end now dont waste time
-        if (node_len == 0 || leaf_len == 0) {
+    //mutations are sorted by position and missing regions are sorted and merged, so both can be walked once
+    auto missing_it = missing_data.begin();
+    for (const auto& mut : node->mutations) {
+        //skip missing regions that end before the mutation
+        while (missing_it != missing_data.end() && missing_it->first + missing_it->second < mut.position) {
+            missing_it++;
+        }
+        if (missing_it == missing_data.end()) {
             break;
         }
-        //retrieve mutation
-        std::string mutation = node_it->get_string();
-        //find position of snp, convert to int
-        int mut_pos = stoi(mutation.substr(1, mutation.length() - 2));
-        //get position for missing block
-        int missing_start = leaf_counter->first;
-        int missing_end = missing_start + leaf_counter->second;
-        //check if mutation is inside missing
-        //if so, delete mutation from node
-        if (mut_pos >= missing_start && mut_pos <= missing_end) {
-            //store mutations in a list for records?
-            node->mutations.erase(node_it);
-            //make sure iterator isnt decremented past beginning
-            if (node_it != node->mutations.begin()) {
-                node_it --;
-            }
-            else {
-                //std::cout << "end of mutations!!!! break " << std::endl;
-                break;
-            }
-        }  
-        //figure out if mutation is before or after missing
-        //if after i need to decrement node_it to get it closer to missing, do nothing to missing
-        else if (mut_pos > missing_end) {
-            // might have to make this fancier later 
-            //std::cout << "mut is fully after missing: node: " << node->identifier << std::endl;
-            //std::cout << "mut is fully after missing: leaf: " << leaf->identifier << std::endl;
-            //make sure youre not decrementing into nothing
-            if (node_it != node->mutations.begin()) {
-                node_it --;
-            }
-            else {
-                //need to do something first?
-                //std::cout << "end of mutations!!!! break " << std::endl;
-                break;
-            }
-        }   
-        //if mut is before missing, missing needs to decrement to get closer to mut 
-        else if (mut_pos < missing_start){
-            //std::cout << "mut is fully before missing" << std::endl;
-            
-            if (leaf_counter != missing_data.begin()) {
-                leaf_counter --;
-            }
-            else {
-                //need to do something first?
-                //std::cout << "end of missing!!!! break " << std::endl;
-                break;
-            }
-            //std::cout << "made it here?" << std::endl;
+        if (mut.position >= missing_it->first) {
+            masked.emplace_back(node->dfs_idx, mut.position);
         }
-        else {
-            //std::cout << "stuck here" << std::endl;
-        }     
-    }         
+    }
 }
 
 bool prev_check(std::pair<int, int>& prev, std::pair<int, int> line) {
@@ -326,21 +276,21 @@ bool prev_check(std::pair<int, int>& prev, std::pair<int, int> line) {
 //note this could be written slightly differently, would require more reworking though
 }
 
-void combine_missing(Mutation_Annotated_Tree::Node* node, Mutation_Annotated_Tree::Node* leaf, std::list<std::pair<int, int>>& missing_data, std::map<std::string, std::map<int, int>>& diff_data) {
+void combine_missing(const std::map<int, int>& node_missing, const std::map<int, int>& leaf_missing, std::list<std::pair<int, int>>& missing_data) {
     /*
     Combine missing data from leaf and neighbor, collect into missing_data variable and use it for comparing mutations in each node to missing data for the leaves
     */
     //get missing list lens for iterating 
-    auto node_len = diff_data[node->identifier].size();
-    auto node_iterator = diff_data[node->identifier].begin();
-    auto leaf_len = diff_data[leaf->identifier].size();
-    auto leaf_iterator = diff_data[leaf->identifier].begin();
+    auto node_len = node_missing.size();
+    auto node_iterator = node_missing.begin();
+    auto leaf_len = leaf_missing.size();
+    auto leaf_iterator = leaf_missing.begin();
     //initialize prev variable, will track previous element in missing_data
     std::pair<int, int> prev = {-1, -1};
     //while one list is still going
-    while (node_iterator != diff_data[node->identifier].end() || leaf_iterator != diff_data[leaf->identifier].end()) {
+    while (node_iterator != node_missing.end() || leaf_iterator != leaf_missing.end()) {
             //while two lists are still going 
-            if (node_iterator != diff_data[node->identifier].end() && leaf_iterator != diff_data[leaf->identifier].end()) {
+            if (node_iterator != node_missing.end() && leaf_iterator != leaf_missing.end()) {
                 //get positions for both lists
                 int node_start = node_iterator->first;
                 int node_end = node_start + node_iterator->second;
@@ -495,7 +445,7 @@ void combine_missing(Mutation_Annotated_Tree::Node* node, Mutation_Annotated_Tre
                 */
             }
             //if only node list is still going
-            else if (node_iterator != diff_data[node->identifier].end()) {
+            else if (node_iterator != node_missing.end()) {
                 int node_start = node_iterator->first;
                 int node_end = node_start + node_iterator->second;
                 if (prev.first == -1) {
@@ -517,7 +467,7 @@ void combine_missing(Mutation_Annotated_Tree::Node* node, Mutation_Annotated_Tre
                 node_iterator ++;
             } 
             //if only leaf list is still going 
-            else if (leaf_iterator != diff_data[leaf->identifier].end()) {
+            else if (leaf_iterator != leaf_missing.end()) {
                 int leaf_start = leaf_iterator->first;
                 int leaf_end = leaf_start + leaf_iterator->second;
                 if (prev.first == -1) {
@@ -546,87 +496,130 @@ void combine_missing(Mutation_Annotated_Tree::Node* node, Mutation_Annotated_Tre
     missing_data.emplace_back(prev.first, prev.second);
 }
 
-void getDistance(Mutation_Annotated_Tree::Node* leaf, Mutation_Annotated_Tree::Node* node, Mutation_Annotated_Tree::Node* mrca, std::map<std::string, std::map<int, int>>& diff_data, std::map<std::string, std::set<std::string>>& comparisons) {
+void local_neighbors_dfs(Mutation_Annotated_Tree::Node* node, size_t path_length, size_t max_path_length, Mutation_Annotated_Tree::Node* lca, std::vector<std::pair<Mutation_Annotated_Tree::Node*, Mutation_Annotated_Tree::Node*>>& neighbors) {
     /*
-    Traverses path between leaf and neighbor looking for mutations in path that need to be masked because they overlap with missing data
-    in the leaf. 
+    collect leaves below node (inclusive) within max_path_length mutations, path_length includes the mutations of node
     */
-    //set node to current_node
-    auto current_node = node; 
-    //before comparing nodes, check if theyve already been compared
-    //EFFICIENCY FLAG: if I come back to this in the future, find a faster check than this
-    if ( comparisons[leaf->identifier].find(current_node->identifier) == comparisons[leaf->identifier].end() ) {
-        //add leaf-node comparison to comparisons to skip redundant comparisons in future
-        comparisons[leaf->identifier].insert(node->identifier);
-        comparisons[node->identifier].insert(leaf->identifier);
-        //combine missing data from leaf and its neighbor (current_node)
-        std::list<std::pair<int, int>> missing_data;
-        combine_missing(node, leaf, missing_data, diff_data);
-        //traverse the path from node to mrca
-        while (current_node->identifier != mrca->identifier ) {
-            //compare current node mutations to the missing data   
-            nodeComp(current_node, leaf, diff_data, missing_data);
-            //update current_node to parent
-            current_node = current_node->parent;
-        } 
-        //when we hit the mrca, we move to the other side, the leaf side 
-        //we dont need to include the leaf bc those mutations already dont exist?? not true? 
-        current_node = leaf; 
-        //traverse path from leaf to mrca
-        while (current_node->identifier != mrca->identifier ) {
-            //compare current node to missing data
-            nodeComp(current_node, leaf, diff_data,missing_data);
-            current_node = current_node->parent;
-        } 
-        //do the mrca last
-        nodeComp(mrca, leaf, diff_data,missing_data);
-        //change comparisons here?
+    if (path_length > max_path_length) {
+        return;
     }
-    else {
-        //this is for when the comparison has already been done 
-        //std::cout <<   "SKIPPED BC RENDUNDY" << leaf->identifier << node->identifier << std::endl;
+    if (node->is_leaf()) {
+        neighbors.emplace_back(node, lca);
+        return;
+    }
+    for (auto child : node->children) {
+        local_neighbors_dfs(child, path_length + child->mutations.size(), max_path_length, lca, neighbors);
     }
-    //this code assumes that all mutations entered are snps, will not work if mutations are longer than 1bp (which is currently usher's capability) 
 }
 
+void get_local_neighbors(Mutation_Annotated_Tree::Node* leaf, size_t max_snp_distance, std::vector<std::pair<Mutation_Annotated_Tree::Node*, Mutation_Annotated_Tree::Node*>>& neighbors) {
+    /*
+    find all leaves within max_snp_distance mutations of leaf (the same set as get_closest_samples with fixed_k), along with
+    the mrca of each pair, which is the ancestor the walk turned down at
+    */
+    auto prev = leaf;
+    //mutations between leaf and the current ancestor
+    size_t dist_to_ancestor = leaf->mutations.size();
+    for (auto ancestor = leaf->parent; ancestor && dist_to_ancestor <= max_snp_distance; ancestor = ancestor->parent) {
+        for (auto child : ancestor->children) {
+            if (child != prev) {
+                local_neighbors_dfs(child, dist_to_ancestor + child->mutations.size(), max_snp_distance, ancestor, neighbors);
+            }
+        }
+        dist_to_ancestor += ancestor->mutations.size();
+        prev = ancestor;
+    }
+}
 
 void localMask (uint32_t max_snp_distance, MAT::Tree& T, std::string diff_file, std::string filename, uint32_t num_threads) {
     /*
     main function for post-placement local masking. finds nearest neighbors within max 
     SNP distance and checks for mutations that overlap with missing datta in nearby samples
     */
-
+    tbb::global_control global_limit(tbb::global_control::max_allowed_parallelism, num_threads);
     //collect all missing data for each leaf
     std::map<std::string, std::map<int, int>> diff_data = readDiff(diff_file);
-    auto all_leaves = T.get_leaves();
-    //track comparisons to prevent redundancy
-    std::map<std::string, std::set<std::string>> comparisons;
-    for (auto l: all_leaves) {
-        std::string samp = l->identifier;
-        int bl = l->branch_length;
-        MAT::Node* current_node = l;
-        //determine if branchlen immediately disqualifies leaf from masking
-        if (l->branch_length < max_snp_distance && diff_data.find(samp) != diff_data.end() ) {
-            //get nearest neighbors of leaf
-            std::pair<std::vector<std::string>, size_t> neighbors = get_closest_samples(&T, l->identifier, true, max_snp_distance);  
-            
-            // iterate through nearest neighbors, figure out last common ancestor between them
-            for (const auto& neigh : neighbors.first) {
-                //get mrca for neighbor and leaf so we can find path between
-                auto mrca = MAT::LCA(T, l->identifier, neigh);
-
-                //send leaf node and neighbor node to next function; leaf node has missing data neighbor node has mutations we want to check
-                getDistance(l, T.get_node(neigh), mrca, diff_data, comparisons);
+    const std::map<int, int> no_missing;
+    auto dfs = T.depth_first_expansion();
+    //missing data of each node by dfs index, NULL for nodes not in the diff file
+    std::vector<const std::map<int, int>*> node_missing(dfs.size(), NULL);
+    //leaves whose missing data is checked against their neighbors, in dfs order so that leaves
+    //of the same subtree are handled together
+    std::vector<MAT::Node*> masking_leaves;
+    for (auto node : dfs) {
+        if (node->is_leaf()) {
+            auto iter = diff_data.find(node->identifier);
+            if (iter != diff_data.end()) {
+                node_missing[node->dfs_idx] = &iter->second;
+                //determine if branchlen immediately disqualifies leaf from masking
+                if (node->branch_length < max_snp_distance) {
+                    masking_leaves.push_back(node);
+                }
+            }
+        }
+    }
+    fprintf(stderr, "Comparing %zu samples to their neighbors...\n", masking_leaves.size());
+    //neighbors are found on the tree as loaded, mutations are only deleted once every pair is compared,
+    //so the result does not depend on the order samples are processed in
+    tbb::enumerable_thread_specific<std::vector<std::pair<size_t, int>>> thread_masked;
+    std::atomic<size_t> num_pairs(0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, masking_leaves.size()),
+    [&](tbb::blocked_range<size_t> r) {
+        auto& masked = thread_masked.local();
+        std::vector<std::pair<MAT::Node*, MAT::Node*>> neighbors;
+        for (size_t idx = r.begin(); idx < r.end(); idx++) {
+            auto leaf = masking_leaves[idx];
+            neighbors.clear();
+            get_local_neighbors(leaf, max_snp_distance, neighbors);
+            for (const auto& neighbor_mrca : neighbors) {
+                auto neighbor = neighbor_mrca.first;
+                auto mrca = neighbor_mrca.second;
+                auto neighbor_missing = node_missing[neighbor->dfs_idx];
+                //a pair of two masking leaves is found from both sides, compare it only from the first one in dfs order
+                if (neighbor_missing && neighbor->branch_length < max_snp_distance && neighbor->dfs_idx < leaf->dfs_idx) {
+                    continue;
+                }
+                num_pairs++;
+                //combine missing data from leaf and its neighbor
+                std::list<std::pair<int, int>> missing_data;
+                combine_missing(neighbor_missing ? *neighbor_missing : no_missing, *node_missing[leaf->dfs_idx], missing_data);
+                //traverse the path from neighbor to mrca, then from leaf to mrca, and do the mrca last
+                for (auto node = neighbor; node != mrca; node = node->parent) {
+                    masked_positions(node, missing_data, masked);
                 }
+                for (auto node = leaf; node != mrca; node = node->parent) {
+                    masked_positions(node, missing_data, masked);
+                }
+                masked_positions(mrca, missing_data, masked);
+            }
         }
-        /*
-        #this is if the leaf has a branch len longer than -D, don't need this but good for error checking
-        else {
-            //std::cout <<   " " << l->identifier << std::endl; 
-            //std::cout << "branch length" << bl << std::endl; 
+    });
+    std::vector<std::pair<size_t, int>> all_masked;
+    for (const auto& masked : thread_masked) {
+        all_masked.insert(all_masked.end(), masked.begin(), masked.end());
+    }
+    tbb::parallel_sort(all_masked.begin(), all_masked.end());
+    all_masked.erase(std::unique(all_masked.begin(), all_masked.end()), all_masked.end());
+    //start of the masked positions of each node
+    std::vector<size_t> node_starts;
+    for (size_t idx = 0; idx < all_masked.size(); idx++) {
+        if (idx == 0 || all_masked[idx].first != all_masked[idx - 1].first) {
+            node_starts.push_back(idx);
         }
-        */
     }
+    node_starts.push_back(all_masked.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, node_starts.size() - 1),
+    [&](tbb::blocked_range<size_t> r) {
+        for (size_t idx = r.begin(); idx < r.end(); idx++) {
+            auto start = all_masked.begin() + node_starts[idx];
+            auto end = all_masked.begin() + node_starts[idx + 1];
+            auto& mutations = dfs[start->first]->mutations;
+            mutations.erase(std::remove_if(mutations.begin(), mutations.end(), [&](const MAT::Mutation& mut) {
+                return std::binary_search(start, end, std::make_pair(start->first, mut.position));
+            }), mutations.end());
+        }
+    });
+    fprintf(stderr, "Masked %zu mutations over %zu pairs of neighboring samples\n", all_masked.size(), num_pairs.load());
 //end of masking iterations, save modified MAT  
 MAT::save_mutation_annotated_tree(T, filename);
 }
@@ -15,7 +15,8 @@ std::map<std::string, std::map<int, int>> readDiff (const std::string& diff_file
 //void traverseToMRCA(Mutation_Annotated_Tree::Node* leaf, Mutation_Annotated_Tree::Node* node, Mutation_Annotated_Tree::Node* mrca, std::map<std::string, std::map<int, int>>& diff_data, std::list<std::pair<int, int>>& missing_data);
 //void traverseFromLeafParentToMRCA(Mutation_Annotated_Tree::Node* leaf, Mutation_Annotated_Tree::Node* node, Mutation_Annotated_Tree::Node* mrca, std::map<std::string, std::map<int, int>>& diff_data, std::list<std::pair<int, int>>& missing_data);
 
-void nodeComp(Mutation_Annotated_Tree::Node* node, Mutation_Annotated_Tree::Node* leaf, std::map<std::string, std::map<int, int>>& diff_data, std::list<std::pair<int, int>>& missing_data);
+void masked_positions(Mutation_Annotated_Tree::Node* node, const std::list<std::pair<int, int>>& missing_data, std::vector<std::pair<size_t, int>>& masked);
 bool prev_check(std::pair<int, int>& prev, std::pair<int, int> line);
-void combine_missing(Mutation_Annotated_Tree::Node* node, Mutation_Annotated_Tree::Node* leaf, std::list<std::pair<int, int>>& missing_data, std::map<std::string, std::map<int, int>>& diff_data); 
-void getDistance(Mutation_Annotated_Tree::Node* leaf, Mutation_Annotated_Tree::Node* node, Mutation_Annotated_Tree::Node* mrca, std::map<std::string, std::map<int, int>>& diff_data, std::map<std::string, std::set<std::string>>& comparisons);
+void combine_missing(const std::map<int, int>& node_missing, const std::map<int, int>& leaf_missing, std::list<std::pair<int, int>>& missing_data);
+void local_neighbors_dfs(Mutation_Annotated_Tree::Node* node, size_t path_length, size_t max_path_length, Mutation_Annotated_Tree::Node* lca, std::vector<std::pair<Mutation_Annotated_Tree::Node*, Mutation_Annotated_Tree::Node*>>& neighbors);
+void get_local_neighbors(Mutation_Annotated_Tree::Node* leaf, size_t max_snp_distance, std::vector<std::pair<Mutation_Annotated_Tree::Node*, Mutation_Annotated_Tree::Node*>>& neighbors);
@@ -1,5 +1,8 @@
 #include "merge.hpp"
+#include <atomic>
 #include <tbb/info.h>
+#include <tbb/task_arena.h>
+#include <unordered_set>
 
 po::variables_map parse_merge_command(po::parsed_options parsed) {
     uint32_t num_cores = tbb::info::default_concurrency();
@@ -38,90 +41,280 @@ po::variables_map parse_merge_command(po::parsed_options parsed) {
     return vm;
 }
 
-std::string get_first_leaf(MAT::Node* n) {
-    auto ret = n;
-    while (ret->children.size() > 0) {
-        ret = ret->children[0];
-    }
-    return ret->identifier;
-}
-
 /**
- * Checks for consistency between both MAT files to ensure that they are able to merge
+ * Checks for consistency between both MAT files to ensure that they are able to merge.
+ * Maps each node of B that corresponds to a node of the subtree of A spanned by the
+ * leaves shared with B (leaves, and nodes with at least 2 children holding shared leaves)
+ * to its counterpart in A. Neither tree is copied or modified.
  **/
-bool consistent(MAT::Tree A, MAT::Tree B, concurMap& consistNodes) {
-    //vectors of all leaves in both input trees
-    std::vector<std::string> A_leaves = A.get_leaves_ids();
-    std::vector<std::string> B_leaves = B.get_leaves_ids();
-    tbb::parallel_sort(A_leaves.begin(), A_leaves.end());
-    tbb::parallel_sort(B_leaves.begin(), B_leaves.end());
-
-    //creates a vector of common_leaves between two input trees
-    std::vector<std::string> common_leaves;
-    set_intersection(B_leaves.begin(), B_leaves.end(), A_leaves.begin(), A_leaves.end(), std::back_inserter(common_leaves));
-    tbb::parallel_sort(common_leaves.begin(), common_leaves.end());
-    fprintf(stderr, "%zu common leaves.\n", common_leaves.size());
-
+bool consistent(const MAT::Tree& A, const MAT::Tree& B, concurMap& consistNodes) {
+    auto Adfs = A.depth_first_expansion();
 
-    if (common_leaves.size() == 0) {
-        return true;
+    //next_common[k] is the dfs index of the first leaf shared with B at or after Adfs[k]
+    std::vector<uint32_t> is_common(Adfs.size() + 1, 0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, Adfs.size()), [&](tbb::blocked_range<size_t> r) {
+        for (size_t k = r.begin(); k < r.end(); ++k) {
+            if (Adfs[k]->is_leaf()) {
+                auto B_node = B.get_node(Adfs[k]->identifier);
+                is_common[k] = (B_node != NULL) && B_node->is_leaf();
+            }
+        }
+    });
+    std::vector<uint32_t> next_common(Adfs.size() + 1, Adfs.size());
+    size_t num_common = 0;
+    for (size_t k = Adfs.size(); k-- > 0;) {
+        next_common[k] = is_common[k] ? k : next_common[k + 1];
+        num_common += is_common[k];
     }
+    is_common.clear();
+    is_common.shrink_to_fit();
+    fprintf(stderr, "%zu common leaves.\n", num_common);
 
-    //creates two subtrees using the common_leaves
-    std::vector<std::string> A_to_remove, B_to_remove;
-
-    auto Asub = get_tree_copy(A);
-    std::set_difference(A_leaves.begin(), A_leaves.end(), common_leaves.begin(), common_leaves.end(), std::back_inserter(A_to_remove));
-
-    for (auto l : A_to_remove) {
-        Asub.remove_node(l, false);
+    if (num_common == 0) {
+        return true;
     }
-    Asub.remove_single_child_nodes();
-
-    auto Adfs = Asub.depth_first_expansion();
 
     bool ret = true;
-    static tbb::affinity_partitioner ap;
+    std::atomic<size_t> num_sub_nodes(0);
     /**
      * Parallel loop that parses through the depth first expansion of
-     * both subtrees and compares each node's mutations
+     * A and maps each node of the shared subtree to the LCA in B of one
+     * shared leaf from each of its first two branches
      **/
-    tbb::mutex m;
     tbb::parallel_for(
         tbb::blocked_range<size_t>(0, Adfs.size()),
     [&](tbb::blocked_range<size_t> r) {
         for (size_t k = r.begin(); k < r.end(); ++k) {
-
             auto n = Adfs[k];
-            if (n->children.size() > 1) {
-                auto c1 = n->children[0];
-                auto c2 = n->children[1];
-                auto l1 = get_first_leaf(c1);
-                auto l2 = get_first_leaf(c2);
-                auto lca1 = MAT::LCA(A, l1, l2);
-                auto lca2 = MAT::LCA(B, l1, l2);
-
-                if ((lca1 != NULL) && (lca2!= NULL)) {
-                    consistNodes.emplace(std::pair<std::string, std::string> (lca2->identifier, lca1->identifier));
-                } else {
-                    fprintf(stderr, "NULL found!\n");
+            if (n->is_leaf()) {
+                if (next_common[k] == k) {
+                    num_sub_nodes++;
+                    consistNodes.emplace(std::pair<std::string, std::string> (n->identifier, n->identifier));
                 }
+                continue;
             }
-
-            if (n->children.size() == 0) {
-                consistNodes.emplace(std::pair<std::string, std::string> (n->identifier, n->identifier));
+            MAT::Node* branch_leaves[2];
+            int num_branches = 0;
+            for (auto c: n->children) {
+                auto first_common = next_common[c->dfs_idx];
+                if (first_common < c->dfs_end_idx) {
+                    branch_leaves[num_branches++] = B.get_node(Adfs[first_common]->identifier);
+                    if (num_branches == 2) {
+                        break;
+                    }
+                }
+            }
+            if (num_branches == 2) {
+                num_sub_nodes++;
+                auto lca2 = B.LCA(branch_leaves[0], branch_leaves[1]);
+                consistNodes.emplace(std::pair<std::string, std::string> (lca2->identifier, n->identifier));
             }
         }
-    },
-    ap);
+    });
 
-    if (consistNodes.size() != Adfs.size()) {
+    if (consistNodes.size() != num_sub_nodes) {
         fprintf (stderr, "WARNING: MATs not completely consistent!\n");
     }
-    fprintf (stderr, "%zu of %zu nodes consistent.\n", consistNodes.size(), Adfs.size());
+    fprintf (stderr, "%zu of %zu nodes consistent.\n", consistNodes.size(), num_sub_nodes.load());
     return ret;
 }
 
+//Best placement of a new sample found on the merged tree
+struct Merge_Placement {
+    std::string sample;
+    //node of the merged tree under which the search is restricted
+    std::string search_root;
+    std::vector<MAT::Mutation> sample_mutations;
+    MAT::Node* best_node;
+    bool best_node_has_unique;
+    std::vector<MAT::Mutation> excess_mutations;
+};
+
+/**
+ * Searches the subtree of the merged tree rooted at the closest consistent node
+ * for the placement of a sample, without modifying the tree
+ **/
+static void find_placement(MAT::Tree& finalMat, uint32_t max_levels, Merge_Placement& p) {
+    //Roots bfs at closest consistent node identified in previous loop
+    //Restricts tree search to a smaller subtree
+    auto bfs = finalMat.breadth_first_expansion(p.search_root);
+
+    std::vector<std::vector<MAT::Mutation> > node_excess_mutations(bfs.size());
+    std::vector<std::vector<MAT::Mutation> > node_imputed_mutations(bfs.size());
+    size_t best_node_num_leaves = 0;
+    int best_set_difference = p.sample_mutations.size() + bfs[0]->mutations.size() + 1;
+    size_t best_j = 0;
+    size_t num_best = 1;
+    bool best_node_has_unique = false;
+    MAT::Node *best_node = bfs[0];
+    std::vector<bool> node_has_unique(bfs.size(), false);
+    std::vector<size_t> best_j_vec;
+    best_j_vec.emplace_back(0);
+
+    //Isolated so a thread waiting on this search does not pick up the search
+    //of another sample, which bounds the number of searches in flight
+    tbb::this_task_arena::isolate([&] {
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0, bfs.size()),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t k = r.begin(); k < r.end(); k++) {
+                if (bfs[k]->level - bfs[0]->level > max_levels) {
+                    continue;
+                }
+
+                mapper2_input inp;
+
+                inp.T = &finalMat;
+                inp.node = bfs[k];
+                inp.missing_sample_mutations = &p.sample_mutations;
+                inp.excess_mutations = &node_excess_mutations[k];
+                inp.imputed_mutations = &node_imputed_mutations[k];
+
+                inp.best_node_num_leaves = &best_node_num_leaves;
+                inp.best_set_difference = &best_set_difference;
+                inp.best_node = &best_node;
+                inp.best_j = &best_j;
+                inp.num_best = &num_best;
+                inp.j = k;
+                inp.has_unique = &best_node_has_unique;
+                inp.best_j_vec = &best_j_vec;
+                inp.node_has_unique = &(node_has_unique);
+                mapper2_body(inp, false);
+            }
+        });
+    });
+
+    p.best_node = best_node;
+    p.best_node_has_unique = best_node_has_unique;
+    p.excess_mutations = std::move(node_excess_mutations[best_j]);
+}
+
+/**
+ * Adds a sample to the merged tree at a placement found by find_placement.
+ * Returns the node whose subtree changed.
+ **/
+static MAT::Node* apply_placement(MAT::Tree& finalMat, const Merge_Placement& p) {
+    const auto& x = p.sample;
+    auto best_node = p.best_node;
+    // Is placement as sibling
+    if (best_node->is_leaf() || p.best_node_has_unique) {
+        std::string nid = finalMat.new_internal_node_id();
+        finalMat.create_node(nid, best_node->parent->identifier);
+        finalMat.create_node(x, nid);
+        finalMat.move_node(best_node->identifier, nid);
+        // common_mut stores mutations common to the
+        // best node branch and the sample, l1_mut
+        // stores mutations unique to best node branch
+        // and l2_mut stores mutations unique to the
+        // sample not in best node branch
+        std::vector<MAT::Mutation> common_mut, l1_mut, l2_mut;
+        std::vector<MAT::Mutation> curr_l1_mut;
+
+        // Compute current best node branch mutations
+        for (auto m1 : best_node->mutations) {
+            MAT::Mutation m = m1.copy();
+            curr_l1_mut.emplace_back(m);
+        }
+        // Clear mutations on the best node branch which
+        // will be later replaced by l1_mut
+        best_node->clear_mutations();
+
+        // Compute l1_mut
+        for (auto m1 : curr_l1_mut) {
+            bool found = false;
+            for (auto m2 : p.excess_mutations) {
+                if (m1.is_masked()) {
+                    break;
+                }
+                if (m1.position == m2.position) {
+                    if (m1.mut_nuc == m2.mut_nuc) {
+                        found = true;
+                        break;
+                    }
+                }
+            }
+            if (!found) {
+                MAT::Mutation m = m1.copy();
+                l1_mut.emplace_back(m);
+            }
+        }
+        // Compute l2_mut
+        for (auto m1 : p.excess_mutations) {
+            bool found = false;
+            for (auto m2 : curr_l1_mut) {
+                if (m1.is_masked()) {
+                    break;
+                }
+                if (m1.position == m2.position) {
+                    if (m1.mut_nuc == m2.mut_nuc) {
+                        found = true;
+                        MAT::Mutation m = m1.copy();
+                        common_mut.emplace_back(m);
+                        break;
+                    }
+                }
+            }
+            if (!found) {
+                MAT::Mutation m = m1.copy();
+                l2_mut.emplace_back(m);
+            }
+        }
+
+        // Add mutations to new node using common_mut
+        for (auto m : common_mut) {
+            finalMat.get_node(nid)->add_mutation(m);
+        }
+        // Add mutations to best node using l1_mut
+        for (auto m : l1_mut) {
+            finalMat.get_node(best_node->identifier)->add_mutation(m);
+        }
+        // Add new sample mutations using l2_mut
+
+        for (auto m : l2_mut) {
+            finalMat.get_node(x)->add_mutation(m);
+        }
+        return finalMat.get_node(nid);
+    }
+    // Else placement as child
+    else {
+        finalMat.create_node(x, best_node->identifier);
+        MAT::Node *node = finalMat.get_node(x);
+        std::vector<MAT::Mutation> node_mut;
+
+        std::vector<MAT::Mutation> curr_l1_mut;
+
+        for (auto m1 : best_node->mutations) {
+            MAT::Mutation m = m1.copy();
+            curr_l1_mut.emplace_back(m);
+        }
+
+        for (auto m1 : p.excess_mutations) {
+            bool found = false;
+            for (auto m2 : curr_l1_mut) {
+                if (m1.is_masked()) {
+                    break;
+                }
+                if (m1.position == m2.position) {
+                    if (m1.mut_nuc == m2.mut_nuc) {
+                        found = true;
+                        break;
+                    }
+                }
+            }
+            if (!found) {
+                MAT::Mutation m = m1.copy();
+                node_mut.emplace_back(m);
+            }
+        }
+
+        for (auto m : node_mut) {
+
+            node->add_mutation(m);
+        }
+        return best_node;
+    }
+}
+
 void merge_main(po::parsed_options parsed) {
     timer.Start();
     //Takes user input and loads the specified MAT files
@@ -154,8 +347,6 @@ void merge_main(po::parsed_options parsed) {
 
     timer.Start();
     fprintf(stderr, "Checking MAT consistency.\n");
-    MAT::Tree baseMat;
-    MAT::Tree otherMat;
     concurMap consistNodes;
 
     //uncondenses nodes of both MAT files
@@ -166,13 +357,10 @@ void merge_main(po::parsed_options parsed) {
         mat2.uncondense_leaves();
     }
     //Assigns largest MAT to baseMat and smaller one to otherMat
-    if (mat1.get_num_leaves() > mat2.get_num_leaves()) {
-        baseMat = mat1;
-        otherMat = mat2;
-    } else {
-        baseMat = mat2;
-        otherMat = mat1;
-    }
+    //New samples are added to baseMat in place
+    bool mat1_larger = mat1.get_num_leaves() > mat2.get_num_leaves();
+    MAT::Tree& baseMat = mat1_larger ? mat1 : mat2;
+    MAT::Tree& otherMat = mat1_larger ? mat2 : mat1;
 
     //Checks for consistency in mutation paths between the two trees
     consistent(baseMat, otherMat, consistNodes);
@@ -180,8 +368,7 @@ void merge_main(po::parsed_options parsed) {
 
     timer.Start();
     fprintf(stderr, "Finding new samples to merge\n");
-    //Makes a copy of the baseMat files to add the samples to later
-    MAT::Tree finalMat = get_tree_copy(baseMat);
+    MAT::Tree& finalMat = baseMat;
     std::vector<std::string> samples;
 
     auto otherLeaves = otherMat.get_leaves_ids();
@@ -192,216 +379,89 @@ void merge_main(po::parsed_options parsed) {
 
     //creates vector of new samples to be added
     std::set_difference(otherLeaves.begin(), otherLeaves.end(), baseLeaves.begin(), baseLeaves.end(), std::back_inserter(samples));
+    otherLeaves.clear();
+    otherLeaves.shrink_to_fit();
+    baseLeaves.clear();
+    baseLeaves.shrink_to_fit();
     fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
 
     timer.Start();
 
-    static tbb::affinity_partitioner ap;
     fprintf(stderr, "Merging %lu new samples\n", samples.size());
 
-    tbb::mutex m;
-    size_t num_mutex = 8*num_threads;
-    std::vector<tbb::mutex> m_vec(num_mutex);
-
-    std::map<std::string, size_t> node_to_first_sample;
-
-    //parallel loop that concurrently parses through all the new samples
-    int i = 0;
-    for (size_t k = 0; k < samples.size(); k++) {
-
-        std::string x = samples[k];
-        auto ancestors = otherMat.rsearch(x, true);
-        std::string curr = finalMat.root->identifier;
-
-        /**
-         * Parses through the the ancestors of each sample on otherMat and finds
-         * Closest consistent node on baseMat
-         **/
-        for (auto anc: ancestors) {
-            if (consistNodes.find(anc->identifier) != consistNodes.end()) {
-                curr = consistNodes[anc->identifier];
-                break;
-            }
-        }
-
-        MAT::Node s(x, -1);
-        s.mutations.clear();
-        for (int y = ancestors.size()-1; y >= 0; y--) {
-            for (auto m: ancestors[y]->mutations) {
-                s.add_mutation(m);
-            }
-        }
-        std::sort(s.mutations.begin(), s.mutations.end());
-
-        //Roots bfs at closest consistent node identified in previous loop
-        //Restricts tree search to a smaller subtree
-        auto bfs = finalMat.breadth_first_expansion(curr);
-
-        std::vector<std::vector<MAT::Mutation> > node_excess_mutations(bfs.size());
-        std::vector<std::vector<MAT::Mutation> > node_imputed_mutations(bfs.size());
-        size_t best_node_num_leaves = 0;
-        int best_set_difference = s.mutations.size() + bfs[0]->mutations.size() + 1;
-        size_t best_j = 0;
-        size_t num_best = 1;
-        bool best_node_has_unique = false;
-        MAT::Node *best_node = bfs[0];
-        std::vector<bool> node_has_unique(bfs.size(), false);
-        std::vector<size_t> best_j_vec;
-        best_j_vec.emplace_back(0);
-
-
+    /**
+     * Samples are merged in batches. Placements of a batch are searched in
+     * parallel on the tree as it was before the batch, then applied in order.
+     * A sample whose search subtree was changed by an earlier sample of the
+     * same batch is searched again before being applied, so the result is
+     * the same as adding samples one at a time.
+     **/
+    size_t batch_size = 4*num_threads;
+    std::vector<Merge_Placement> batch;
+    size_t i = 0;
+    for (size_t batch_start = 0; batch_start < samples.size(); batch_start += batch_size) {
+        size_t batch_end = std::min(samples.size(), batch_start + batch_size);
+        batch.clear();
+        batch.resize(batch_end - batch_start);
         tbb::parallel_for(
-            tbb::blocked_range<size_t>(0, bfs.size()),
+            tbb::blocked_range<size_t>(batch_start, batch_end),
         [&](tbb::blocked_range<size_t> r) {
             for (size_t k = r.begin(); k < r.end(); k++) {
-                if (bfs[k]->level - bfs[0]->level > max_levels) {
-                    continue;
-                }
-
-                mapper2_input inp;
-
-                inp.T = &finalMat;
-                inp.node = bfs[k];
-                inp.missing_sample_mutations = &s.mutations;
-                inp.excess_mutations = &node_excess_mutations[k];
-                inp.imputed_mutations = &node_imputed_mutations[k];
-
-                inp.best_node_num_leaves = &best_node_num_leaves;
-                inp.best_set_difference = &best_set_difference;
-                inp.best_node = &best_node;
-                inp.best_j = &best_j;
-                inp.num_best = &num_best;
-                inp.j = k;
-                inp.has_unique = &best_node_has_unique;
-                inp.best_j_vec = &best_j_vec;
-                inp.node_has_unique = &(node_has_unique);
-                mapper2_body(inp, false);
-            }
-        }, ap);
-
-        if (finalMat.get_node(x) == NULL) {
-            // Is placement as sibling
-            if (best_node->is_leaf() || best_node_has_unique) {
-                m.lock();
-                std::string nid = finalMat.new_internal_node_id();
-                finalMat.create_node(nid, best_node->parent->identifier);
-                finalMat.create_node(x, nid);
-                finalMat.move_node(best_node->identifier, nid);
-                m.unlock();
-                // common_mut stores mutations common to the
-                // best node branch and the sample, l1_mut
-                // stores mutations unique to best node branch
-                // and l2_mut stores mutations unique to the
-                // sample not in best node branch
-                std::vector<MAT::Mutation> common_mut, l1_mut, l2_mut;
-                std::vector<MAT::Mutation> curr_l1_mut;
-
-                // Compute current best node branch mutations
-                for (auto m1 : best_node->mutations) {
-                    MAT::Mutation m = m1.copy();
-                    curr_l1_mut.emplace_back(m);
-                }
-                // Clear mutations on the best node branch which
-                // will be later replaced by l1_mut
-                best_node->clear_mutations();
-
-                // Compute l1_mut
-                for (auto m1 : curr_l1_mut) {
-                    bool found = false;
-                    for (auto m2 : node_excess_mutations[best_j]) {
-                        if (m1.is_masked()) {
-                            break;
-                        }
-                        if (m1.position == m2.position) {
-                            if (m1.mut_nuc == m2.mut_nuc) {
-                                found = true;
-                                break;
-                            }
-                        }
-                    }
-                    if (!found) {
-                        MAT::Mutation m = m1.copy();
-                        l1_mut.emplace_back(m);
+                auto& p = batch[k - batch_start];
+                p.sample = samples[k];
+                auto ancestors = otherMat.rsearch(p.sample, true);
+                p.search_root = finalMat.root->identifier;
+
+                /**
+                 * Parses through the the ancestors of each sample on otherMat and finds
+                 * Closest consistent node on baseMat
+                 **/
+                for (auto anc: ancestors) {
+                    auto iter = consistNodes.find(anc->identifier);
+                    if (iter != consistNodes.end()) {
+                        p.search_root = iter->second;
+                        break;
                     }
                 }
-                // Compute l2_mut
-                for (auto m1 : node_excess_mutations[best_j]) {
-                    bool found = false;
-                    for (auto m2 : curr_l1_mut) {
-                        if (m1.is_masked()) {
-                            break;
-                        }
-                        if (m1.position == m2.position) {
-                            if (m1.mut_nuc == m2.mut_nuc) {
-                                found = true;
-                                MAT::Mutation m = m1.copy();
-                                common_mut.emplace_back(m);
-                                break;
-                            }
-                        }
-                    }
-                    if (!found) {
-                        MAT::Mutation m = m1.copy();
-                        l2_mut.emplace_back(m);
-                    }
-                }
-
-                // Add mutations to new node using common_mut
-                for (auto m : common_mut) {
-                    finalMat.get_node(nid)->add_mutation(m);
-                }
-                // Add mutations to best node using l1_mut
-                for (auto m : l1_mut) {
-                    finalMat.get_node(best_node->identifier)->add_mutation(m);
-                }
-                // Add new sample mutations using l2_mut
-
-                for (auto m : l2_mut) {
-                    finalMat.get_node(x)->add_mutation(m);
-                }
-            }
-            // Else placement as child
-            else {
-                m.lock();
-                finalMat.create_node(x, best_node->identifier);
-                MAT::Node *node = finalMat.get_node(x);
-                m.unlock();
-                std::vector<MAT::Mutation> node_mut;
-
-                std::vector<MAT::Mutation> curr_l1_mut;
-
-                for (auto m1 : best_node->mutations) {
-                    MAT::Mutation m = m1.copy();
-                    curr_l1_mut.emplace_back(m);
-                }
 
-                for (auto m1 : node_excess_mutations[best_j]) {
-                    bool found = false;
-                    for (auto m2 : curr_l1_mut) {
-                        if (m1.is_masked()) {
-                            break;
-                        }
-                        if (m1.position == m2.position) {
-                            if (m1.mut_nuc == m2.mut_nuc) {
-                                found = true;
-                                break;
-                            }
-                        }
-                    }
-                    if (!found) {
-                        MAT::Mutation m = m1.copy();
-                        node_mut.emplace_back(m);
+                MAT::Node s(p.sample, -1);
+                s.mutations.clear();
+                for (int y = ancestors.size()-1; y >= 0; y--) {
+                    for (auto m: ancestors[y]->mutations) {
+                        s.add_mutation(m);
                     }
                 }
-
-                for (auto m : node_mut) {
-
-                    node->add_mutation(m);
+                std::sort(s.mutations.begin(), s.mutations.end());
+                p.sample_mutations = std::move(s.mutations);
+                find_placement(finalMat, max_levels, p);
+            }
+        });
+
+        //changed: nodes whose mutations or children were changed by this batch,
+        //touched: their ancestors, whose subtrees contain a change
+        std::unordered_set<MAT::Node*> changed, touched;
+        for (auto& p : batch) {
+            if (finalMat.get_node(p.sample) != NULL) {
+                continue;
+            }
+            auto search_root = finalMat.get_node(p.search_root);
+            bool stale = touched.count(search_root);
+            for (auto anc = search_root; (anc != NULL) && !stale; anc = anc->parent) {
+                stale = changed.count(anc);
+            }
+            if (stale) {
+                find_placement(finalMat, max_levels, p);
+            }
+            auto changed_node = apply_placement(finalMat, p);
+            changed.insert(changed_node);
+            changed.insert(p.best_node);
+            for (auto anc = changed_node; anc != NULL; anc = anc->parent) {
+                if (!touched.insert(anc).second) {
+                    break;
                 }
             }
+            fprintf(stderr, "\rAdded %zu of %zu samples", ++i, samples.size());
         }
-
-        fprintf(stderr, "\rAdded %d of %zu samples", ++i, samples.size());
     }
 
     fprintf(stderr, "\n");
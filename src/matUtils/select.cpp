@@ -1,4 +1,5 @@
 #include "select.hpp"
+#include <queue>
 #include <random>
 /*
 Functions in this module take a variety of arguments, usually including a MAT
@@ -35,76 +36,87 @@ std::vector<std::string> read_sample_names (std::string sample_filename) {
     return sample_names;
 }
 
-std::vector<std::string> get_clade_samples (MAT::Tree* T, std::string clade_name) {
-    //fetch the set of sample names associated with a clade name to pass downstream in lieu of reading in a sample file.
-
-    std::vector<std::string> csamples;
-    auto dfs = T->depth_first_expansion();
-    for (auto s: dfs) {
-        std::vector<std::string> canns = s->clade_annotations;
-        if (canns.size() > 0) {
-            if (canns.size() > 1 || canns[0] != "") {
-                //the empty string is the default clade identifier attribute
-                //skip entries which are annotated with 1 clade but that clade is empty
-                //but don't skip entries which are annotated with 1 clade and its not empty
-                //check if this clade root matches the clade name.
-                for (auto c: canns) {
-                    if (c == clade_name) {
-                        //this is the root of the input clade (first one encountered in tree)
-                        //get the set of samples descended from this clade root
-                        csamples = T->get_leaves_ids(s->identifier);
-                        //and break out by returning
-                        return csamples;
-                    }
-                }
+Select_Index::Select_Index(MAT::Tree* T): T(T) {
+    const auto& tree_index = T->get_index();
+    size_t num_nodes = tree_index.size();
+    dfs.resize(num_nodes);
+    dfs_end.resize(num_nodes);
+    first_leaf.resize(num_nodes + 1);
+    path_mutations.resize(num_nodes);
+    for (size_t idx = 0; idx < num_nodes; idx++) {
+        auto node = tree_index.get_dfs_node(idx);
+        dfs[idx] = node;
+        dfs_end[idx] = idx + tree_index.get_num_descendants(node) + 1;
+        first_leaf[idx] = leaves.size();
+        if (node->is_leaf()) {
+            leaves.push_back(node);
+        }
+        if (idx > 0) {
+            path_mutations[idx] = path_mutations[node->parent->index_dfs_idx] + node->mutations.size();
+        }
+        for (const auto& m: node->mutations) {
+            mutation_nodes[m.position].emplace_back(idx, m.mut_nuc);
+        }
+        const auto& canns = node->clade_annotations;
+        //the empty string is the default clade identifier attribute
+        //skip entries which are annotated with 1 clade but that clade is empty
+        if ((canns.size() > 1) || ((canns.size() == 1) && (canns[0] != ""))) {
+            for (const auto& c: canns) {
+                //only the first (and shallowest) root of a clade is kept
+                clade_roots.emplace(c, idx);
             }
         }
     }
+    first_leaf[num_nodes] = leaves.size();
+}
+
+std::vector<std::string> get_clade_samples (const Select_Index& index, std::string clade_name) {
+    //fetch the set of sample names associated with a clade name to pass downstream in lieu of reading in a sample file.
+    //these are the samples descended from the root of the input clade (first one encountered in tree)
+    std::vector<std::string> csamples;
+    auto search = index.clade_roots.find(clade_name);
+    if (search != index.clade_roots.end()) {
+        index.add_leaf_ids(search->second, csamples);
+    }
     //if it was never found, return an empty vector.
     return csamples;
 }
 
-std::vector<std::string> get_mutation_samples (MAT::Tree* T, std::string mutation_id) {
+std::vector<std::string> get_mutation_samples (const Select_Index& index, std::string mutation_id) {
     //fetch the set of sample names which contain a given mutation.
-    //this is a naive implementation parallel to describe::mutation_paths
+    //"having the mutation" specifically means that it mutated to this base at this location
+    //at the most recent time this location mutated, i.e. on the closest node at or above the sample mutating this location.
+    //the nodes mutating this location are nested ranges of the depth-first order, so the samples are the leaves
+    //of each of those with the right base, except for the leaves below a nested one.
     std::vector<std::string> good_samples;
     MAT::Mutation* mutobj = MAT::mutation_from_string(mutation_id);
-    for (auto node: T->get_leaves()) {
-        bool assigned = false;
-        //first, check if this specific sample has the mutation
-        //"having the mutation" specifically means that it mutated to this base at this location
-        //at the most recent time this location mutated
-        for (auto m: node->mutations) {
-            if (mutobj->position == m.position) {
-                if (mutobj->mut_nuc == m.mut_nuc) {
-                    good_samples.push_back(node->identifier);
-                }
-                assigned = true;
-                break;
+    auto search = index.mutation_nodes.find(mutobj->position);
+    if (search == index.mutation_nodes.end()) {
+        return good_samples;
+    }
+    //enclosing nodes mutating this location and whether they have the base, innermost last
+    std::vector<std::pair<size_t, bool>> open;
+    //position in leaves up to which leaves have been checked
+    size_t next_leaf = 0;
+    auto check_until = [&](size_t leaf_pos) {
+        if (!open.empty() && open.back().second) {
+            for (size_t pos = next_leaf; pos < leaf_pos; pos++) {
+                good_samples.push_back(index.leaves[pos]->identifier);
             }
         }
-        if (!assigned) {
-            std::vector<MAT::Node*> path = T->rsearch(node->identifier);
-            //for every ancestor up to the root, check if they have the mutation
-            //if they do, break, save the name, move to the next sample
-            for (auto anc_node: path) {
-                if (!assigned) {
-                    for (auto m: anc_node->mutations) {
-                        if (mutobj->position == m.position) {
-                            //if there's a mutation at this position, break out of the loop regardless
-                            //but only store it if its the correct base
-                            if (mutobj->mut_nuc == m.mut_nuc) {
-                                good_samples.push_back(node->identifier);
-                            }
-                            assigned = true;
-                            break;
-                        }
-                    }
-                } else {
-                    break;
-                }
-            }
+        next_leaf = leaf_pos;
+    };
+    for (const auto& mn: search->second) {
+        while (!open.empty() && (mn.first >= index.dfs_end[open.back().first])) {
+            check_until(index.first_leaf[index.dfs_end[open.back().first]]);
+            open.pop_back();
         }
+        check_until(index.first_leaf[mn.first]);
+        open.emplace_back(mn.first, mn.second == mutobj->mut_nuc);
+    }
+    while (!open.empty()) {
+        check_until(index.first_leaf[index.dfs_end[open.back().first]]);
+        open.pop_back();
     }
     // fprintf(stderr, "# of good samples %ld\n", good_samples.size());
     return good_samples;
@@ -143,6 +155,7 @@ std::vector<std::string> get_clade_representatives(MAT::Tree* T, size_t samples_
     static std::random_device rd;
     static std::mt19937 gen(rd());
 
+    Select_Index index(T);
     auto bfs = T->breadth_first_expansion();
     for (auto n: bfs) {
         std::string curpath;
@@ -152,20 +165,24 @@ std::vector<std::string> get_clade_representatives(MAT::Tree* T, size_t samples_
                 //the first time any new annotation is encountered in an expansion, its the root of that lineage
                 if (clades_seen.find(ann) == clades_seen.end()) {
                     clades_seen.insert(ann);
-                    std::vector<std::string> leaf_ids = T->get_leaves_ids(n->identifier);
-                    if (leaf_ids.size() <= samples_per_clade) {
+                    //the leaves of the clade root are a contiguous range of the indexed leaves
+                    size_t num_leaves = index.get_num_leaves(index.index(n));
+                    auto leaf_ids = index.leaves.begin() + index.first_leaf[index.index(n)];
+                    if (num_leaves <= samples_per_clade) {
                         // Add all leaves
-                        rep_samples.insert(leaf_ids.begin(), leaf_ids.end());
+                        for (size_t ix = 0; ix < num_leaves; ix++) {
+                            rep_samples.insert(leaf_ids[ix]->identifier);
+                        }
                     } else {
                         // Randomly select leaves; keep trying if a leaf has already been selected,
                         // but don't keep trying forever in case there just aren't enough
                         // unselected leaves.
                         size_t added = 0, already_selected = 0;
-                        std::uniform_int_distribution<> distrib(0, leaf_ids.size() - 1);
+                        std::uniform_int_distribution<> distrib(0, num_leaves - 1);
                         while (added < samples_per_clade && already_selected < samples_per_clade) {
                             int ix = distrib(gen);
-                            if (rep_samples.find(leaf_ids[ix]) == rep_samples.end()) {
-                                rep_samples.insert(leaf_ids[ix]);
+                            if (rep_samples.find(leaf_ids[ix]->identifier) == rep_samples.end()) {
+                                rep_samples.insert(leaf_ids[ix]->identifier);
                                 added++;
                             } else {
                                 already_selected++;
@@ -203,76 +220,88 @@ std::vector<std::string> sample_intersect (std::unordered_set<std::string> sampl
     return inter_samples;
 }
 
-std::vector<std::string> get_nearby (MAT::Tree* T, std::string sample_id, int number_to_get) {
+MAT::Node* get_nearby_root (const Select_Index& index, MAT::Node* node, int number_to_get) {
+    //the largest ancestral clade of node (or node itself) which has at most number_to_get leaves.
+    //if node has more than that, it is its own nearby root.
+    MAT::Node* nearby_root = node;
+    for (auto anc = node; anc != NULL; anc = anc->parent) {
+        if (index.get_num_leaves(index.index(anc)) > static_cast<size_t>(number_to_get)) {
+            break;
+        }
+        nearby_root = anc;
+    }
+    return nearby_root;
+}
+
+std::vector<std::string> get_nearby_leaves (const Select_Index& index, MAT::Node* nearby_root, int number_to_get) {
+    //the leaves of the nearby root, then the closest of the remaining leaves of its parent.
+    //those are found by a best-first search below the parent over path lengths, which stops once enough leaves are found;
+    //ties are taken in depth-first order.
+    std::vector<std::string> leaves_to_keep;
+    MAT::Node* anc = nearby_root;
+    if (index.get_num_leaves(index.index(nearby_root)) <= static_cast<size_t>(number_to_get)) {
+        anc = nearby_root->parent;
+        if (anc == NULL) {
+            return leaves_to_keep;
+        }
+        index.add_leaf_ids(index.index(nearby_root), leaves_to_keep);
+    }
+    //path length from the root and index of the nodes to search, closest first
+    std::priority_queue<std::pair<size_t, size_t>, std::vector<std::pair<size_t, size_t>>, std::greater<std::pair<size_t, size_t>>> to_search;
+    for (auto c: anc->children) {
+        if (c != nearby_root) {
+            to_search.emplace(index.path_mutations[index.index(c)], index.index(c));
+        }
+    }
+    while ((static_cast<int>(leaves_to_keep.size()) < number_to_get) && !to_search.empty()) {
+        auto n = index.dfs[to_search.top().second];
+        to_search.pop();
+        if (n->is_leaf()) {
+            leaves_to_keep.emplace_back(n->identifier);
+        }
+        for (auto c: n->children) {
+            to_search.emplace(index.path_mutations[index.index(c)], index.index(c));
+        }
+    }
+    return leaves_to_keep;
+}
+
+std::vector<std::string> get_nearby (const Select_Index& index, std::string sample_id, int number_to_get) {
     //get the nearest X neighbors to sample_id and return them as a vector
     //the simple indexing method is not guaranteed to get the very closest neighbors when the query sample is out near the edge of a large clade
-    //unfortunately. so we have to brute force it.
-    MAT::Node* last_anc = T->get_node(sample_id);
+    //so we take the largest ancestral clade that fits, then the closest of the remaining leaves of the next ancestor.
     assert (number_to_get > 0);
-    if (last_anc == NULL) {
+    MAT::Node* node = index.get_node(sample_id);
+    if (node == NULL) {
         fprintf(stderr, "ERROR: %s is not present in the tree!\n", sample_id.c_str() );
+        return std::vector<std::string>();
     }
-    std::vector<std::string> leaves_to_keep;
-    for (auto anc: T->rsearch(sample_id, true)) {
-        int num_leaves = static_cast<int>(T->get_num_leaves(anc));
-        if (num_leaves <= number_to_get) {
-            last_anc = anc;
-            continue;
-        }
-
-        if (num_leaves > number_to_get) {
-            struct NodeDist {
-                MAT::Node* node;
-                uint32_t num_mut;
-
-                NodeDist(MAT::Node* n, uint32_t d) {
-                    node = n;
-                    num_mut = d;
-                }
-
-                inline bool operator< (const NodeDist& n) const {
-                    return ((*this).num_mut < n.num_mut);
-                }
-            };
-
-            for (auto l: T->get_leaves(last_anc->identifier)) {
-                leaves_to_keep.emplace_back(l->identifier);
-            }
-
-            std::vector<NodeDist> node_distances;
-            for (auto l: T->get_leaves(anc->identifier)) {
-                if (T->is_ancestor(last_anc->identifier, l->identifier)) {
-                    continue;
-                }
-
-                uint32_t dist = 0;
-                for (auto a: T->rsearch(l->identifier, true)) {
-                    if (a == anc) {
-                        break;
-                    }
-                    dist += a->mutations.size();
-                }
-
-                node_distances.emplace_back(NodeDist(l, dist));
-            }
+    return get_nearby_leaves(index, get_nearby_root(index, node, number_to_get), number_to_get);
+}
 
-            std::sort(node_distances.begin(), node_distances.end());
-            for (auto n: node_distances) {
-                if ((int)leaves_to_keep.size() == number_to_get) {
-                    break;
-                }
-                leaves_to_keep.emplace_back(n.node->identifier);
-            }
-        } else {
-            for (auto l: T->get_leaves(anc->identifier)) {
-                leaves_to_keep.emplace_back(l->identifier);
-            }
+std::vector<std::pair<MAT::Node*, std::vector<size_t>>> group_nearby_samples (const Select_Index& index, const std::vector<std::string>& sample_ids, int number_to_get) {
+    //group the positions of the samples in sample_ids by their nearby root, in depth-first order of the roots.
+    //get_nearby returns the same neighbors for every sample of a group, so they only need to be found once.
+    assert (number_to_get > 0);
+    std::unordered_map<MAT::Node*, size_t> group_of_root;
+    std::vector<std::pair<MAT::Node*, std::vector<size_t>>> groups;
+    for (size_t i = 0; i < sample_ids.size(); i++) {
+        MAT::Node* node = index.get_node(sample_ids[i]);
+        if (node == NULL) {
+            fprintf(stderr, "ERROR: %s is not present in the tree!\n", sample_ids[i].c_str() );
+            continue;
         }
-        if (static_cast<int>(leaves_to_keep.size()) >= number_to_get) {
-            break;
+        auto nearby_root = get_nearby_root(index, node, number_to_get);
+        auto search = group_of_root.emplace(nearby_root, groups.size());
+        if (search.second) {
+            groups.emplace_back(nearby_root, std::vector<size_t>());
         }
+        groups[search.first->second].second.push_back(i);
     }
-    return leaves_to_keep;
+    std::sort(groups.begin(), groups.end(), [&](const std::pair<MAT::Node*, std::vector<size_t>>& a, const std::pair<MAT::Node*, std::vector<size_t>>& b) {
+        return index.index(a.first) < index.index(b.first);
+    });
+    return groups;
 }
 
 std::vector<std::string> get_short_steppers(MAT::Tree* T, std::vector<std::string> samples_to_check, int max_mutations) {
@@ -306,28 +335,17 @@ std::vector<std::string> get_short_steppers(MAT::Tree* T, std::vector<std::strin
     return good_samples;
 }
 
-std::vector<std::string> get_short_paths (MAT::Tree* T, std::vector<std::string> samples_to_check, int max_path) {
+std::vector<std::string> get_short_paths (const Select_Index& index, std::vector<std::string> samples_to_check, int max_path) {
+    //get samples whose total path length from the root is at most max_path mutations.
     std::vector<std::string> good_samples;
     std::unordered_set<std::string> sampleset;
     if (samples_to_check.size() != 0) {
         sampleset.insert(samples_to_check.begin(), samples_to_check.end());
     }
-    std::unordered_map<std::string, size_t> path_lengths;
-    for (auto n: T->depth_first_expansion()) {
-        if (!n->is_leaf()) {
-            //if its an internal node, add it to the tracker. Path length is the length to its parent plus its mutations.
-            //path length to the root is 0.
-            if (n->is_root()) {
-                path_lengths[n->identifier] = 0;
-            } else {
-                path_lengths[n->identifier] = path_lengths[n->parent->identifier] + n->mutations.size();
-            }
-        } else {
-            //if its not an internal node, check to see if the length to its parent plus the length to the leaf is under the maximum.
-            if (path_lengths[n->parent->identifier] + n->mutations.size() <= max_path) {
-                if (samples_to_check.size() == 0 || sampleset.find(n->identifier) != sampleset.end()) {
-                    good_samples.push_back(n->identifier);
-                }
+    for (auto n: index.leaves) {
+        if (index.path_mutations[index.index(n)] <= static_cast<size_t>(max_path)) {
+            if (samples_to_check.size() == 0 || sampleset.find(n->identifier) != sampleset.end()) {
+                good_samples.push_back(n->identifier);
             }
         }
     }
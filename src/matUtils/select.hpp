@@ -1,15 +1,53 @@
+#pragma once
 #include "common.hpp"
 #include <regex>
 
+// Leaf ranges, path lengths and mutation postings of a tree for repeated sample selection.
+// Nodes are numbered like the Tree_Index (Node::index_dfs_idx), so the leaves below a node
+// are a contiguous range of leaves. Valid until the tree or its mutations are edited.
+struct Select_Index {
+    MAT::Tree* T;
+    std::vector<MAT::Node*> dfs;
+    std::vector<size_t> dfs_end;
+    //leaves in depth-first order, and the position in it of the first leaf at or after each node
+    std::vector<MAT::Node*> leaves;
+    std::vector<size_t> first_leaf;
+    //number of mutations on the path from the root to each node, not counting the root's own
+    std::vector<size_t> path_mutations;
+    //nodes with a mutation at each position in depth-first order, with the base they mutate to
+    std::unordered_map<int, std::vector<std::pair<size_t, int8_t>>> mutation_nodes;
+    //first node in depth-first order annotated with each clade
+    std::unordered_map<std::string, size_t> clade_roots;
+
+    Select_Index(MAT::Tree* T);
+    MAT::Node* get_node(const std::string& identifier) const {
+        return T->get_node(identifier);
+    }
+    size_t index(const MAT::Node* node) const {
+        return node->index_dfs_idx;
+    }
+    size_t get_num_leaves(size_t idx) const {
+        return first_leaf[dfs_end[idx]] - first_leaf[idx];
+    }
+    void add_leaf_ids(size_t idx, std::vector<std::string>& ids) const {
+        for (size_t pos = first_leaf[idx]; pos < first_leaf[dfs_end[idx]]; pos++) {
+            ids.push_back(leaves[pos]->identifier);
+        }
+    }
+};
+
 std::vector<std::string> read_sample_names (std::string sample_filename);
-std::vector<std::string> get_clade_samples (MAT::Tree* T, std::string clade_name);
-std::vector<std::string> get_mutation_samples (MAT::Tree* T, std::string mutation_id);
+std::vector<std::string> get_clade_samples (const Select_Index& index, std::string clade_name);
+std::vector<std::string> get_mutation_samples (const Select_Index& index, std::string mutation_id);
 std::vector<std::string> get_parsimony_samples (MAT::Tree* T, std::vector<std::string> samples_to_check, int max_parsimony);
 std::vector<std::string> get_clade_representatives(MAT::Tree* T, size_t samples_per_clade);
 std::vector<std::string> sample_intersect (std::unordered_set<std::string> samples, std::vector<std::string> nsamples);
-std::vector<std::string> get_nearby (MAT::Tree* T, std::string sample_id, int number_to_get);
+std::vector<std::string> get_nearby (const Select_Index& index, std::string sample_id, int number_to_get);
+MAT::Node* get_nearby_root (const Select_Index& index, MAT::Node* node, int number_to_get);
+std::vector<std::string> get_nearby_leaves (const Select_Index& index, MAT::Node* nearby_root, int number_to_get);
+std::vector<std::pair<MAT::Node*, std::vector<size_t>>> group_nearby_samples (const Select_Index& index, const std::vector<std::string>& sample_ids, int number_to_get);
 std::vector<std::string> get_short_steppers(MAT::Tree* T, std::vector<std::string> samples_to_check, int max_mutations);
-std::vector<std::string> get_short_paths(MAT::Tree* T, std::vector<std::string> samples_to_check, int max_path);
+std::vector<std::string> get_short_paths(const Select_Index& index, std::vector<std::string> samples_to_check, int max_path);
 std::unordered_map<std::string,std::unordered_map<std::string,std::string>> read_metafile(std::string metainf, std::set<std::string> samples_to_use, bool load_all = false);
 std::vector<std::string> get_sample_match(MAT::Tree* T, std::vector<std::string> samples_to_check, std::string substring);
 std::vector<std::string> fill_random_samples(MAT::Tree* T, std::vector<std::string> current_samples, size_t target_size, bool lca_limit = false);
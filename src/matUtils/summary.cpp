@@ -4,6 +4,10 @@
 #include <array>
 #include <boost/date_time/gregorian/gregorian.hpp>
 #include <tbb/info.h>
+#include <tbb/global_control.h>
+#include <tbb/parallel_for.h>
+#include <limits>
+#include <unordered_map>
 
 po::variables_map parse_summary_command(po::parsed_options parsed) {
     uint32_t num_cores = tbb::info::default_concurrency();
@@ -361,145 +365,225 @@ void write_roho_table(MAT::Tree* T, std::string roho_file, bool get_dates) {
     } else {
         rhfile << "\n";
     }
-    for (auto n: T->depth_first_expansion()) {
-        //candidate mutations maps each mutation to its child where it occurred
-        //child counter maps the number of offspring of a given child
-        //together, they store the results we need.
-        std::map<std::string,std::string> candidate_mutations;
-        std::map<std::string,std::set<std::string>> child_counter;
-        //using a separate size tracker to speed things when extra columns are not requested and therefore
-        //set membership is irrelevant and wasteful to compute/store
-        std::map<std::string,size_t> child_increment;
-        std::set<std::string> parent_identical_samples;
-
-        //step one: collect all potential candidate nodes.
-        std::vector<std::string> ccheck;
-        std::map<std::string,size_t> blentracker;
-
-        for (auto c: n->children) {
-            if (!c->is_leaf()) {
-                //mutations occurring on any non-leaf child are potentially valid RoHo targets for this node.
-                ccheck.push_back(c->identifier);
-                blentracker[c->identifier] = c->mutations.size();
-                for (auto m: c->mutations) {
-                    //assumption each mutation only occurs for one child. This is a good assumption, as if its broken, the tree is malformed.
-                    candidate_mutations[m.get_string()] = c->identifier;
-                }
-            } else if (c->mutations.size() == 0) {
-                //leaf children with zero mutations are of interest for date tracking downstream.
-                parent_identical_samples.insert(c->identifier);
+    //everything below is computed once for the whole tree, indexed by dfs index, so each node
+    //can be processed independently instead of walking the subtree of each of its children.
+    auto dfs = T->depth_first_expansion();
+    size_t num_nodes = dfs.size();
+    std::vector<size_t> dfs_end(num_nodes);
+    std::vector<size_t> leaf_count(num_nodes, 0);
+    for (size_t idx = 0; idx < num_nodes; idx++) {
+        dfs_end[idx] = dfs[idx]->dfs_end_idx;
+    }
+    //post-order accumulation of the number of leaves below each node
+    for (size_t idx = num_nodes; idx-- > 0;) {
+        if (dfs[idx]->is_leaf()) {
+            leaf_count[idx]++;
+        }
+        if (idx > 0) {
+            leaf_count[dfs[idx]->parent->dfs_idx] += leaf_count[idx];
+        }
+    }
+    //integer ids for mutations, two mutations share an id iff they have the same get_string()
+    std::unordered_map<uint64_t, uint32_t> mutation_ids;
+    std::vector<size_t> node_mutation_offsets(num_nodes + 1, 0);
+    std::vector<uint32_t> node_mutations;
+    for (size_t idx = 0; idx < num_nodes; idx++) {
+        for (const auto& m: dfs[idx]->mutations) {
+            uint64_t key = std::numeric_limits<uint64_t>::max();
+            if (!m.is_masked()) {
+                key = ((uint64_t)(uint32_t)m.position << 16) | ((uint8_t)MAT::get_nuc(m.par_nuc) << 8) | (uint8_t)MAT::get_nuc(m.mut_nuc);
             }
+            auto ins = mutation_ids.emplace(key, mutation_ids.size());
+            node_mutations.push_back(ins.first->second);
         }
-        if (candidate_mutations.size() == 0) {
-            continue;
+        node_mutation_offsets[idx + 1] = node_mutations.size();
+    }
+    //dfs indices of the nodes each mutation occurs on, in increasing order
+    std::vector<size_t> occurrence_offsets(mutation_ids.size() + 1, 0);
+    for (auto mid: node_mutations) {
+        occurrence_offsets[mid + 1]++;
+    }
+    for (size_t mid = 0; mid < mutation_ids.size(); mid++) {
+        occurrence_offsets[mid + 1] += occurrence_offsets[mid];
+    }
+    std::vector<size_t> occurrences(node_mutations.size());
+    {
+        std::vector<size_t> fill(occurrence_offsets.begin(), occurrence_offsets.end() - 1);
+        for (size_t idx = 0; idx < num_nodes; idx++) {
+            for (size_t k = node_mutation_offsets[idx]; k < node_mutation_offsets[idx + 1]; k++) {
+                occurrences[fill[node_mutations[k]]++] = idx;
+            }
         }
-        //step two: remove candidates who do not 1. have at least two offspring associated with them 2. do not recur secondarily at any point after this parent
-        for (auto c: n->children) {
-            std::set<std::string> child_samples;
-            size_t ccount = 0;
-            if (c->is_leaf()) {
-                continue;
+    }
+    //rows for each parent node, written out in dfs order once all nodes are done
+    std::vector<std::string> node_rows(num_nodes);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_nodes),
+    [&](tbb::blocked_range<size_t> range) {
+        for (size_t nidx = range.begin(); nidx < range.end(); nidx++) {
+            auto n = dfs[nidx];
+            //candidate mutations maps each mutation to its child where it occurred
+            //child counter maps the number of offspring of a given child
+            //together, they store the results we need.
+            std::map<uint32_t,size_t> candidate_mutations;
+            //number of children carrying each candidate mutation, leaf children included
+            std::map<uint32_t,size_t> child_occurrences;
+            std::map<std::string,std::set<std::string>> child_counter;
+            //using a separate size tracker to speed things when extra columns are not requested and therefore
+            //set membership is irrelevant and wasteful to compute/store
+            std::map<std::string,size_t> child_increment;
+            std::set<std::string> parent_identical_samples;
+
+            //step one: collect all potential candidate nodes.
+            size_t ccheck = 0;
+            std::vector<size_t> children;
+            for (size_t cidx = nidx + 1; cidx < dfs_end[nidx]; cidx = dfs_end[cidx]) {
+                children.push_back(cidx);
             }
-            for (auto dn: T->depth_first_expansion(c)) {
-                if (dn->identifier == c->identifier) {
-                    continue;
+            for (auto cidx: children) {
+                auto c = dfs[cidx];
+                if (!c->is_leaf()) {
+                    //mutations occurring on any non-leaf child are potentially valid RoHo targets for this node.
+                    ccheck++;
+                    for (size_t k = node_mutation_offsets[cidx]; k < node_mutation_offsets[cidx + 1]; k++) {
+                        //assumption each mutation only occurs for one child. This is a good assumption, as if its broken, the tree is malformed.
+                        candidate_mutations[node_mutations[k]] = cidx;
+                    }
+                } else if (c->mutations.size() == 0) {
+                    //leaf children with zero mutations are of interest for date tracking downstream.
+                    parent_identical_samples.insert(c->identifier);
                 }
-                if (dn->is_leaf()) {
-                    ccount++;
-                    if (get_dates) {
-                        child_samples.insert(dn->identifier);
+            }
+            if (candidate_mutations.size() == 0) {
+                continue;
+            }
+            for (auto cidx: children) {
+                for (size_t k = node_mutation_offsets[cidx]; k < node_mutation_offsets[cidx + 1]; k++) {
+                    if (candidate_mutations.find(node_mutations[k]) != candidate_mutations.end()) {
+                        child_occurrences[node_mutations[k]]++;
                     }
                 }
-                for (auto m: dn->mutations) {
-                    candidate_mutations.erase(m.get_string());
+            }
+            //step two: remove candidates who do not 1. have at least two offspring associated with them 2. do not recur secondarily at any point after this parent
+            //a candidate recurs if it occurs anywhere below this node other than on its children
+            for (auto iter = candidate_mutations.begin(); iter != candidate_mutations.end();) {
+                auto start = occurrences.begin() + occurrence_offsets[iter->first];
+                auto end = occurrences.begin() + occurrence_offsets[iter->first + 1];
+                size_t below = std::lower_bound(start, end, dfs_end[nidx]) - std::upper_bound(start, end, nidx);
+                if (below > child_occurrences[iter->first]) {
+                    iter = candidate_mutations.erase(iter);
+                } else {
+                    iter++;
                 }
             }
-            //don't bother recording values of 0 or 1.
-            if (ccount > 1) {
-                child_increment[c->identifier] = ccount;
-                if (get_dates) {
-                    child_counter[c->identifier] = std::move(child_samples);
+            for (auto cidx: children) {
+                //don't bother recording values of 0 or 1.
+                if (!dfs[cidx]->is_leaf() && leaf_count[cidx] > 1) {
+                    child_increment[dfs[cidx]->identifier] = leaf_count[cidx];
                 }
             }
-        }
-        //we need at least one valid candidate and at least two non-leaf children to continue.
-        if ((candidate_mutations.size() == 0) || (child_increment.size() <= 1)) {
-            continue;
-        }
-        //step 2.5; prerecord date information for each child of node N if requested.
-        std::map<std::string, std::pair<boost::gregorian::date,boost::gregorian::date>> datemap;
-        std::pair<boost::gregorian::date,boost::gregorian::date> parent_identical_dates;
-        if (get_dates) {
-            for (auto cc: child_counter) {
-                auto cdates = get_nearest_date(T, n, &cc.second);
-                datemap[cc.first] = std::move(cdates);
+            //we need at least one valid candidate and at least two non-leaf children to continue.
+            if ((candidate_mutations.size() == 0) || (child_increment.size() <= 1)) {
+                continue;
             }
-            parent_identical_dates = get_nearest_date(T, n, &parent_identical_samples);
-        }
-
-        //step 3: actually record the results.
-        for (auto ms: candidate_mutations) {
-            //ignore mutations that don't have at least 5 descendents, filter the siblings in the same way
-            std::vector<size_t> all_non;
-            size_t sum_wit = 0;
-            for (auto cs: child_increment) {
-                if (cs.first != ms.second) {
-                    if (cs.second > 5) {
-                        all_non.push_back(cs.second);
+            //step 2.5; prerecord date information for each child of node N if requested.
+            std::map<std::string, std::pair<boost::gregorian::date,boost::gregorian::date>> datemap;
+            std::pair<boost::gregorian::date,boost::gregorian::date> parent_identical_dates;
+            if (get_dates) {
+                for (auto cidx: children) {
+                    auto c = dfs[cidx];
+                    if (child_increment.find(c->identifier) == child_increment.end()) {
+                        continue;
                     }
-                } else {
-                    if (cs.second > 5) {
-                        sum_wit += cs.second;
+                    std::vector<std::string> child_samples;
+                    for (size_t didx = cidx + 1; didx < dfs_end[cidx]; didx++) {
+                        if (dfs[didx]->is_leaf()) {
+                            child_samples.push_back(dfs[didx]->identifier);
+                        }
                     }
+                    datemap[c->identifier] = daterange_from_list(child_samples);
+                    child_counter[c->identifier].insert(child_samples.begin(), child_samples.end());
                 }
+                parent_identical_dates = daterange_from_list(std::vector<std::string>(parent_identical_samples.begin(), parent_identical_samples.end()));
             }
-            if ((all_non.size() == 0) || (sum_wit == 0)) {
-                continue;
-            }
-            float med_non;
-            std::sort(all_non.begin(), all_non.end());
-            if (all_non.size() %2 == 0) {
-                med_non = (all_non[all_non.size()/2-1] + all_non[all_non.size()/2]) / 2;
-            } else {
-                med_non = all_non[all_non.size()/2];
-            }
-            std::stringstream nonstrs;
-            std::stringstream nonearlydates;
-            std::stringstream nonlatedates;
-            if (get_dates) {
-                for (auto cc: child_counter) {
-                    //build all at once to assert same order
-                    //auto dates = get_nearest_date(&T, n, &cc.second);
-                    if (cc.first != ms.second) {
-                        nonstrs << cc.second.size() << ",";
-                        auto dates = datemap[cc.first];
-                        nonearlydates << dates.first << ",";
-                        nonlatedates << dates.second << ",";
+
+            //step 3: actually record the results, in the order of the mutation strings.
+            std::map<std::string,std::string> candidate_strings;
+            for (auto ms: candidate_mutations) {
+                auto cidx = ms.second;
+                for (size_t k = node_mutation_offsets[cidx]; k < node_mutation_offsets[cidx + 1]; k++) {
+                    if (node_mutations[k] == ms.first) {
+                        candidate_strings[dfs[cidx]->mutations[k - node_mutation_offsets[cidx]].get_string()] = dfs[cidx]->identifier;
+                        break;
                     }
                 }
             }
+            std::stringstream rows;
+            for (auto ms: candidate_strings) {
+                //ignore mutations that don't have at least 5 descendents, filter the siblings in the same way
+                std::vector<size_t> all_non;
+                size_t sum_wit = 0;
+                for (auto cs: child_increment) {
+                    if (cs.first != ms.second) {
+                        if (cs.second > 5) {
+                            all_non.push_back(cs.second);
+                        }
+                    } else {
+                        if (cs.second > 5) {
+                            sum_wit += cs.second;
+                        }
+                    }
+                }
+                if ((all_non.size() == 0) || (sum_wit == 0)) {
+                    continue;
+                }
+                float med_non;
+                std::sort(all_non.begin(), all_non.end());
+                if (all_non.size() %2 == 0) {
+                    med_non = (all_non[all_non.size()/2-1] + all_non[all_non.size()/2]) / 2;
+                } else {
+                    med_non = all_non[all_non.size()/2];
+                }
+                std::stringstream nonstrs;
+                std::stringstream nonearlydates;
+                std::stringstream nonlatedates;
+                if (get_dates) {
+                    for (auto cc: child_counter) {
+                        //build all at once to assert same order
+                        if (cc.first != ms.second) {
+                            nonstrs << cc.second.size() << ",";
+                            auto dates = datemap[cc.first];
+                            nonearlydates << dates.first << ",";
+                            nonlatedates << dates.second << ",";
+                        }
+                    }
+                }
 
-            rhfile << ms.first << "\t" << n->identifier << "\t" << ccheck.size() << "\t" << ms.second << "\t" << sum_wit << "\t" << med_non << "\t" << std::log10(sum_wit/med_non) << "\t";
-            if (get_dates) {
-                std::string ns = nonstrs.str();
-                ns.pop_back();
-                rhfile << ns << "\t" << parent_identical_samples.size() << "\t";
-                auto descendent_dates = datemap[ms.second];
-                rhfile << descendent_dates.first << "\t" << descendent_dates.second << "\t";
-                if (parent_identical_samples.size() > 0) {
-                    rhfile << parent_identical_dates.first << "\t" << parent_identical_dates.second << "\t";
+                rows << ms.first << "\t" << n->identifier << "\t" << ccheck << "\t" << ms.second << "\t" << sum_wit << "\t" << med_non << "\t" << std::log10(sum_wit/med_non) << "\t";
+                if (get_dates) {
+                    std::string ns = nonstrs.str();
+                    ns.pop_back();
+                    rows << ns << "\t" << parent_identical_samples.size() << "\t";
+                    auto descendent_dates = datemap[ms.second];
+                    rows << descendent_dates.first << "\t" << descendent_dates.second << "\t";
+                    if (parent_identical_samples.size() > 0) {
+                        rows << parent_identical_dates.first << "\t" << parent_identical_dates.second << "\t";
+                    } else {
+                        rows << "None\tNone\t";
+                    }
+                    std::string ned = nonearlydates.str();
+                    std::string nld = nonlatedates.str();
+                    ned.pop_back();
+                    nld.pop_back();
+                    rows << ned << "\t" << nld << "\n";
                 } else {
-                    rhfile << "None\tNone\t";
+                    rows << "\n";
                 }
-                std::string ned = nonearlydates.str();
-                std::string nld = nonlatedates.str();
-                ned.pop_back();
-                nld.pop_back();
-                rhfile << ned << "\t" << nld << "\n";
-            } else {
-                rhfile << "\n";
             }
+            node_rows[nidx] = rows.str();
         }
+    });
+    for (const auto& rows: node_rows) {
+        rhfile << rows;
     }
     fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
     rhfile.close();
@@ -669,8 +753,7 @@ void summary_main(po::parsed_options parsed) {
         mutations = dir_prefix + "mutations.tsv";
         aberrant = dir_prefix + "aberrant.tsv";
     }
-    // TBB automatically manages threads in modern versions
-    // tbb::task_scheduler_init init(num_threads);
+    tbb::global_control global_limit(tbb::global_control::max_allowed_parallelism, num_threads);
 
     timer.Start();
     fprintf(stderr, "Loading input MAT file %s.\n", input_mat_filename.c_str());
@@ -1,4 +1,7 @@
 #include "translate.hpp"
+#include <tbb/blocked_range.h>
+#include <tbb/info.h>
+#include <tbb/parallel_for.h>
 
 std::vector<std::string> split(const std::string &s, char delim) {
     std::vector<std::string> result;
@@ -39,8 +42,21 @@ char complement(char nt) {
 }
 
 // Maps a genomic coordinate to a list of codons it is part of
-std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> build_codon_map(std::ifstream &gtf_file, std::string reference) {
-    std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> codon_map;
+Codon_Map build_codon_map(std::ifstream &gtf_file, std::string reference) {
+    // codons of each position in the order they are added, flattened at the end
+    std::vector<std::vector<uint32_t>> pos_codons(reference.size());
+    std::vector<Codon> codons;
+    auto add_codon = [&](Codon c, int first_pos, int step) {
+        // The current pos and the next (or previous on the - strand) positions
+        // are associated with this codon
+        for (int pos = first_pos; pos != first_pos + 3 * step; pos += step) {
+            if (pos >= (int)pos_codons.size()) {
+                pos_codons.resize(pos + 1);
+            }
+            pos_codons[pos].push_back(codons.size());
+        }
+        codons.push_back(std::move(c));
+    };
     std::string gtf_line;
     std::vector<std::string> gtf_lines;
     std::vector<std::string> done;
@@ -88,31 +104,8 @@ std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> build_codon_map(std
                     };
 
                     // Coordinates are 0-based at this point
-                    std::shared_ptr<Codon> c(new Codon(gene_outer, codon_counter, pos, nt));
+                    add_codon(Codon(gene_outer, codon_counter, pos, nt), pos, 1);
                     codon_counter += 1;
-
-                    // The current pos and the next positions
-                    // are associated with this codon
-                    auto it = codon_map.find(pos);
-                    if (it == codon_map.end()) {
-                        codon_map.insert({pos, {c}});
-                    } else {
-                        (it->second).push_back(c);
-                    }
-
-                    it = codon_map.find(pos+1);
-                    if (it == codon_map.end()) {
-                        codon_map.insert({pos+1, {c}});
-                    } else {
-                        (it->second).push_back(c);
-                    }
-
-                    it = codon_map.find(pos+2);
-                    if (it == codon_map.end()) {
-                        codon_map.insert({pos+2, {c}});
-                    } else {
-                        (it->second).push_back(c);
-                    }
                 }
             } else {
                 for (int pos = first_cds_stop - 1; pos > first_cds_start; pos -= 3) {
@@ -124,31 +117,8 @@ std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> build_codon_map(std
                     };
 
                     // Coordinates are 0-based at this point
-                    std::shared_ptr<Codon> c(new Codon(gene_outer, codon_counter, pos, nt));
+                    add_codon(Codon(gene_outer, codon_counter, pos, nt), pos, -1);
                     codon_counter += 1;
-
-                    // The current pos and the next positions
-                    // are associated with this codon
-                    auto it = codon_map.find(pos);
-                    if (it == codon_map.end()) {
-                        codon_map.insert({pos, {c}});
-                    } else {
-                        (it->second).push_back(c);
-                    }
-
-                    it = codon_map.find(pos-1);
-                    if (it == codon_map.end()) {
-                        codon_map.insert({pos-1, {c}});
-                    } else {
-                        (it->second).push_back(c);
-                    }
-
-                    it = codon_map.find(pos-2);
-                    if (it == codon_map.end()) {
-                        codon_map.insert({pos-2, {c}});
-                    } else {
-                        (it->second).push_back(c);
-                    }
                 }
             }
             for (std::string line_inner : gtf_lines) { // find the rest of the CDS features, assuming they are in position order
@@ -171,29 +141,8 @@ std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> build_codon_map(std
                                     reference[pos+1],
                                     reference[pos+2]
                                 };
-                                std::shared_ptr<Codon> c(new Codon(gene_outer, codon_counter, pos, nt));
+                                add_codon(Codon(gene_outer, codon_counter, pos, nt), pos, 1);
                                 codon_counter += 1;
-
-                                auto it = codon_map.find(pos);
-                                if (it == codon_map.end()) {
-                                    codon_map.insert({pos, {c}});
-                                } else {
-                                    (it->second).push_back(c);
-                                }
-
-                                it = codon_map.find(pos+1);
-                                if (it == codon_map.end()) {
-                                    codon_map.insert({pos+1, {c}});
-                                } else {
-                                    (it->second).push_back(c);
-                                }
-
-                                it = codon_map.find(pos+2);
-                                if (it == codon_map.end()) {
-                                    codon_map.insert({pos+2, {c}});
-                                } else {
-                                    (it->second).push_back(c);
-                                }
                             }
                         }
                     } else {
@@ -204,29 +153,8 @@ std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> build_codon_map(std
                                     complement(reference[pos-1]),
                                     complement(reference[pos-2])
                                 };
-                                std::shared_ptr<Codon> c(new Codon(gene_outer, codon_counter, pos, nt));
+                                add_codon(Codon(gene_outer, codon_counter, pos, nt), pos, -1);
                                 codon_counter += 1;
-
-                                auto it = codon_map.find(pos);
-                                if (it == codon_map.end()) {
-                                    codon_map.insert({pos, {c}});
-                                } else {
-                                    (it->second).push_back(c);
-                                }
-
-                                it = codon_map.find(pos-1);
-                                if (it == codon_map.end()) {
-                                    codon_map.insert({pos-1, {c}});
-                                } else {
-                                    (it->second).push_back(c);
-                                }
-
-                                it = codon_map.find(pos-2);
-                                if (it == codon_map.end()) {
-                                    codon_map.insert({pos-2, {c}});
-                                } else {
-                                    (it->second).push_back(c);
-                                }
                             }
                         }
                     }
@@ -234,9 +162,114 @@ std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> build_codon_map(std
             }
         }
     }
+    Codon_Map codon_map;
+    codon_map.reference_codons = std::move(codons);
+    codon_map.pos_offsets.reserve(pos_codons.size() + 1);
+    codon_map.pos_offsets.push_back(0);
+    for (const auto &ids : pos_codons) {
+        codon_map.codon_ids.insert(codon_map.codon_ids.end(), ids.begin(), ids.end());
+        codon_map.pos_offsets.push_back(codon_map.codon_ids.size());
+    }
     return codon_map;
 }
 
+// Nucleotide last written at each coding position by the sequential traversal (0 if never)
+struct Written_Nucs {
+    std::vector<char> nucs;
+    std::vector<uint32_t> touched;
+    inline void write(const Codon_Map &codon_map, int pos, char nuc) {
+        if (!codon_map.is_coding(pos)) {
+            return;
+        }
+        if (!nucs[pos]) {
+            touched.push_back(pos);
+        }
+        nucs[pos] = nuc;
+    }
+};
+
+// Number of pieces translate_dfs cuts a traversal of dfs_size nodes into
+static size_t translate_chunk_count(size_t dfs_size) {
+    return std::min<size_t>(dfs_size, tbb::info::default_concurrency() * 4);
+}
+
+// Translate every node of dfs (pre-order), calling on_node(chunk_idx, dfs_idx, do_mutations result)
+// for each, in traversal order within a chunk.
+// The traversal is cut into contiguous chunks translated in parallel, each with its own codon
+// states. A first sequential pass replays only the nucleotide writes of the serial traversal
+// (mutating on the way down, reverting to the parent nucleotide when jumping across a branch),
+// so every chunk starts from exactly the codon states the serial traversal would have.
+// Mutations of every node are sorted by position in that pass, as do_mutations expects.
+template <typename Node_Callback>
+static void translate_dfs(const std::vector<MAT::Node *> &dfs, const Codon_Map &codon_map,
+                          bool taxodium_format, Node_Callback on_node) {
+    size_t num_chunks = translate_chunk_count(dfs.size());
+    std::vector<size_t> chunk_starts;
+    for (size_t chunk_idx = 0; chunk_idx <= num_chunks; chunk_idx++) {
+        chunk_starts.push_back(dfs.size() * chunk_idx / num_chunks);
+    }
+    std::vector<std::vector<std::pair<uint32_t, char>>> chunk_start_states(num_chunks);
+    Written_Nucs written;
+    written.nucs.resize(codon_map.num_positions(), 0);
+    size_t next_chunk = 0;
+    MAT::Node *last_visited = nullptr;
+    for (size_t dfs_idx = 0; dfs_idx < dfs.size(); dfs_idx++) {
+        auto node = dfs[dfs_idx];
+        std::sort(node->mutations.begin(), node->mutations.end());
+        // In pre-order, the parent of a node is the LCA of it and the last visited node
+        for (auto trace = last_visited; trace != node->parent; trace = trace->parent) {
+            for (const auto &m : trace->mutations) {
+                written.write(codon_map, m.position - 1, MAT::get_nuc(m.par_nuc));
+            }
+        }
+        if (next_chunk < num_chunks && chunk_starts[next_chunk] == dfs_idx) {
+            auto &state = chunk_start_states[next_chunk];
+            state.reserve(written.touched.size());
+            for (auto pos : written.touched) {
+                state.emplace_back(pos, written.nucs[pos]);
+            }
+            next_chunk++;
+        }
+        for (const auto &m : node->mutations) {
+            written.write(codon_map, m.position - 1, MAT::get_nuc(m.mut_nuc));
+        }
+        last_visited = node;
+    }
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_chunks, 1), [&](const tbb::blocked_range<size_t> &range) {
+        for (size_t chunk_idx = range.begin(); chunk_idx < range.end(); chunk_idx++) {
+            std::vector<Codon> codons = codon_map.reference_codons;
+            for (const auto &pos_nuc : chunk_start_states[chunk_idx]) {
+                for (auto codon_it = codon_map.codons_begin(pos_nuc.first); codon_it != codon_map.codons_end(pos_nuc.first); codon_it++) {
+                    codons[*codon_it].mutate(pos_nuc.first, pos_nuc.second);
+                }
+            }
+            MAT::Node *last_visited = dfs[chunk_starts[chunk_idx]]->parent;
+            for (size_t dfs_idx = chunk_starts[chunk_idx]; dfs_idx < chunk_starts[chunk_idx + 1]; dfs_idx++) {
+                auto node = dfs[dfs_idx];
+                // Jumping across a branch, revert codon mutations up to the parent of this node
+                for (auto trace = last_visited; trace != node->parent; trace = trace->parent) {
+                    undo_mutations(trace->mutations, codon_map, codons);
+                }
+                on_node(chunk_idx, dfs_idx, do_mutations(node->mutations, codon_map, codons, taxodium_format));
+                last_visited = node;
+            }
+        }
+    });
+}
+
+// Number of leaves under each node, indexed by dfs_idx, from one pass over the pre-order
+static std::vector<size_t> count_leaves(const std::vector<MAT::Node *> &dfs) {
+    std::vector<size_t> leaves_before(dfs.size() + 1, 0);
+    for (size_t dfs_idx = 0; dfs_idx < dfs.size(); dfs_idx++) {
+        leaves_before[dfs_idx + 1] = leaves_before[dfs_idx] + (dfs[dfs_idx]->is_leaf() ? 1 : 0);
+    }
+    std::vector<size_t> leaf_count(dfs.size());
+    for (size_t dfs_idx = 0; dfs_idx < dfs.size(); dfs_idx++) {
+        leaf_count[dfs_idx] = leaves_before[dfs[dfs_idx]->dfs_end_idx] - leaves_before[dfs_idx];
+    }
+    return leaf_count;
+}
+
 void translate_main(MAT::Tree *T, std::string output_filename, std::string gtf_filename, std::string fasta_filename) {
     std::ifstream fasta_file(fasta_filename);
     if (!fasta_file) {
@@ -262,32 +295,21 @@ void translate_main(MAT::Tree *T, std::string output_filename, std::string gtf_f
 
     output_file << "node_id\taa_mutations\tnt_mutations\tcodon_changes\tleaves_sharing_mutations" << '\n';
 
-    // This maps each position in the reference to a vector of codons.
-    // Some positions may be associated with multiple codons (frame shifts).
-    // The Codons in the map are updated as the tree is traversed
-    std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> codon_map = build_codon_map(gtf_file, reference);
+    Codon_Map codon_map = build_codon_map(gtf_file, reference);
 
     // Traverse the tree in depth-first order. As we descend the tree, mutations at
-    // each node are applied to the respective codon(s) in codon_map.
+    // each node are applied to the respective codon(s), output is gathered per chunk
+    // of the traversal and written in order.
     auto dfs = T->depth_first_expansion();
-    MAT::Node *last_visited = nullptr;
-    for (auto &node: dfs) {
-        std::string mutation_result = "";
-        if(last_visited != node->parent) {
-            // Jumping across a branch, so we need to revert codon mutations up to
-            // the LCA of this node and the last visited node
-            MAT::Node *last_common_ancestor = MAT::LCA(*T, node->identifier, last_visited->identifier);
-            MAT::Node *trace_to_lca = last_visited;
-            while (trace_to_lca != last_common_ancestor) {
-                undo_mutations(trace_to_lca->mutations, codon_map);
-                trace_to_lca = trace_to_lca->parent;
-            }
-        } // If we are visiting a child, we can continue mutating
-        mutation_result = do_mutations(node->mutations, codon_map, false);
+    auto leaf_count = count_leaves(dfs);
+    std::vector<std::string> chunk_output(translate_chunk_count(dfs.size()));
+    translate_dfs(dfs, codon_map, false, [&](size_t chunk_idx, size_t dfs_idx, const std::string &mutation_result) {
         if (mutation_result != "") {
-            output_file << node->identifier << '\t' << mutation_result << '\t' << T->get_leaves(node->identifier).size() << '\n';
+            chunk_output[chunk_idx] += dfs[dfs_idx]->identifier + '\t' + mutation_result + '\t' + std::to_string(leaf_count[dfs_idx]) + '\n';
         }
-        last_visited = node;
+    });
+    for (const auto &out : chunk_output) {
+        output_file << out;
     }
 }
 
@@ -310,10 +332,32 @@ void translate_and_populate_node_data(MAT::Tree *T, std::string gtf_filename, st
 
     T->rotate_for_display();
     std::string reference = build_reference(fasta_file);
-    std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> codon_map = build_codon_map(gtf_file, reference);
+    Codon_Map codon_map = build_codon_map(gtf_file, reference);
     auto dfs = T->depth_first_expansion();
+    auto leaf_count = count_leaves(dfs);
 
-    MAT::Node *last_visited = nullptr;
+    // First collect (syn and nonsyn) nucleotide mutations with a fake gene called nt,
+    // in their original order (translate_dfs sorts mutations by position)
+    std::vector<std::string> nt_mutations(dfs.size());
+    if (include_nt) {
+        for (size_t dfs_idx = 0; dfs_idx < dfs.size(); dfs_idx++) {
+            for (auto m : dfs[dfs_idx]->mutations) {
+                nt_mutations[dfs_idx] += "nt:";
+                nt_mutations[dfs_idx] += MAT::get_nuc(m.par_nuc);
+                nt_mutations[dfs_idx] +=  "_" + std::to_string(m.position) + "_";
+                nt_mutations[dfs_idx] += MAT::get_nuc(m.mut_nuc);
+                nt_mutations[dfs_idx] +=  ";";
+            }
+        }
+    }
+
+    // This string is a semicolon separated list of mutations in format
+    // [orf]:[orig aa]_[orf num]_[new aa]
+    // e.g. S:K_200_V;ORF1a:G_240_N
+    std::vector<std::string> aa_mutations(dfs.size());
+    translate_dfs(dfs, codon_map, true, [&](size_t, size_t dfs_idx, const std::string &mutation_result) {
+        aa_mutations[dfs_idx] = mutation_result;
+    });
 
     std::unordered_map<std::string, int32_t> seen_mutations_map;
     std::unordered_map<std::string, int32_t> index_map; // map node id to index in protobuf arrays
@@ -335,51 +379,32 @@ void translate_and_populate_node_data(MAT::Tree *T, std::string gtf_filename, st
         by_level[node->level].push_back(node); // store nodes by level for later step
         index_map[node->identifier] = count;
 
-        // If we are jumping across a branch relative to the last visited node, reset mutations
-        // and x-value to LCA of last node and this node
-        if(last_visited != node->parent) {
-            MAT::Node *last_common_ancestor = MAT::LCA(*T, node->identifier, last_visited->identifier);
-            MAT::Node *trace_to_lca = last_visited;
-            while (trace_to_lca != last_common_ancestor) {
-                undo_mutations(trace_to_lca->mutations, codon_map);
-                trace_to_lca = trace_to_lca->parent;
-            }
-            curr_x_value = branch_length_map[trace_to_lca->identifier] + node->mutations.size();
+        // If we are jumping across a branch relative to the last visited node, reset
+        // x-value to the parent of this node (the LCA of last node and this node)
+        if (node->is_root()) {
+            curr_x_value = node->mutations.size();
         } else {
-            curr_x_value += node->mutations.size();
+            curr_x_value = branch_length_map[node->parent->identifier] + node->mutations.size();
         }
         branch_length_map[node->identifier] = curr_x_value;
 
-        // First collect (syn and nonsyn) nucleotide mutations with a fake gene called nt
-        std::string mutation_result = "";
-        if (include_nt) {
-            for (auto m : node->mutations) {
-                mutation_result += "nt:";
-                mutation_result += MAT::get_nuc(m.par_nuc);
-                mutation_result +=  "_" + std::to_string(m.position) + "_";
-                mutation_result += MAT::get_nuc(m.mut_nuc);
-                mutation_result +=  ";";
-            }
-        }
-        // Do mutations
+        // (syn and nonsyn) nucleotide mutations with a fake gene called nt, then amino acid mutations
+        std::string mutation_result = nt_mutations[count] + aa_mutations[count];
         Taxodium::MutationList *mutation_list = node_data->add_mutations();
 
-        // This string is a semicolon separated list of mutations in format
-        // [orf]:[orig aa]_[orf num]_[new aa]
-        // e.g. S:K_200_V;ORF1a:G_240_N
-        mutation_result += do_mutations(node->mutations, codon_map, true);
-
-
         if (node->is_root()) {
             // For the root node, modify mutation_result with "fake" mutations,
             // to enable correct coloring by amino acid in Taxodium
             std::unordered_map<std::string, bool> done_codons = {}; // some codons are duplicated in codon_map, track them
             std::string root_mutations = ""; // add "mutations" at the root
+            std::vector<Codon> root_codons = codon_map.reference_codons;
+            do_mutations(node->mutations, codon_map, root_codons, true);
             for (int32_t pos = 0; pos < (int32_t) reference.length(); pos++) {
-                if (codon_map.find(pos) == codon_map.end()) {
+                if (!codon_map.is_coding(pos)) {
                     continue;
                 }
-                for (auto codon_ptr : codon_map[pos]) {
+                for (auto codon_it = codon_map.codons_begin(pos); codon_it != codon_map.codons_end(pos); codon_it++) {
+                    auto codon_ptr = &root_codons[*codon_it];
                     std::string codon_id = codon_ptr->orf_name + ":" + std::to_string(codon_ptr->codon_number+1);
                     if (done_codons.find(codon_id) != done_codons.end()) {
                         continue;
@@ -407,7 +432,7 @@ void translate_and_populate_node_data(MAT::Tree *T, std::string gtf_filename, st
         node_data->add_x(branch_length_map[node->identifier] * x_scale);
         node_data->add_y(0); // temp value, set later
         node_data->add_epi_isl_numbers(0); // not currently set
-        node_data->add_num_tips(T->get_leaves(node->identifier).size());
+        node_data->add_num_tips(leaf_count[count]);
 
         if (node->identifier.substr(0,5) == "node_") {
             //internal nodes don't have metadata, so populate with empty data
@@ -461,7 +486,6 @@ void translate_and_populate_node_data(MAT::Tree *T, std::string gtf_filename, st
             node_data->add_parents(index_map[node->parent->identifier]);
         }
 
-        last_visited = node;
         count++;
     }
 
@@ -495,27 +519,27 @@ void translate_and_populate_node_data(MAT::Tree *T, std::string gtf_filename, st
         }
     }
 }
-std::string do_mutations(std::vector<MAT::Mutation> &mutations, std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> &codon_map, bool taxodium_format) {
+// mutations must already be sorted by position, see translate_dfs
+std::string do_mutations(const std::vector<MAT::Mutation> &mutations, const Codon_Map &codon_map, std::vector<Codon> &codons, bool taxodium_format) {
     std::string prot_string = "";
     std::string nuc_string = "";
     std::string cchange_string = "";
-    std::sort(mutations.begin(), mutations.end());
     std::unordered_map<std::string, std::set<MAT::Mutation>> codon_to_nt_map;
     std::unordered_map<std::string, std::string> latest_codon_map;
     std::unordered_map<std::string, char> orig_proteins;
     std::unordered_map<std::string, std::string> orig_codons;
-    std::vector<std::shared_ptr<Codon>> affected_codons;
+    std::vector<uint32_t> affected_codons;
 
     for (auto &m : mutations) {
         char mutated_nuc = MAT::get_nuc(m.mut_nuc);
         char par_nuc = MAT::get_nuc(m.par_nuc);
         int pos = m.position - 1;
-        auto codon_map_it = codon_map.find(pos);
-        if (codon_map_it == codon_map.end()) {
+        if (!codon_map.is_coding(pos)) {
             continue; // Not a coding mutation
         } else {
             // Mutate each codon associated with this position
-            for (auto codon_ptr : codon_map_it->second) {
+            for (auto codon_id_it = codon_map.codons_begin(pos); codon_id_it != codon_map.codons_end(pos); codon_id_it++) {
+                auto codon_ptr = &codons[*codon_id_it];
                 std::string codon_id = codon_ptr->orf_name + ':' + std::to_string(codon_ptr->codon_number+1);
                 //first, update the codon to match the parent state instead of the reference state as part of the codon output
                 codon_ptr->mutate(pos, par_nuc);
@@ -523,8 +547,8 @@ std::string do_mutations(std::vector<MAT::Mutation> &mutations, std::unordered_m
                 if (orig_it == orig_proteins.end()) {
                     orig_proteins.insert({codon_id, codon_ptr->protein});
                 }
-                if (std::find(affected_codons.begin(), affected_codons.end(), codon_ptr) == affected_codons.end()) {
-                    affected_codons.push_back(codon_ptr);
+                if (std::find(affected_codons.begin(), affected_codons.end(), *codon_id_it) == affected_codons.end()) {
+                    affected_codons.push_back(*codon_id_it);
                 }
                 auto codon_it = orig_codons.find(codon_id);
                 if (codon_it == orig_codons.end()) {
@@ -546,7 +570,8 @@ std::string do_mutations(std::vector<MAT::Mutation> &mutations, std::unordered_m
         }
     }
 
-    for (auto codon_ptr : affected_codons) {
+    for (auto affected_id : affected_codons) {
+        auto codon_ptr = &codons[affected_id];
         std::string codon_id = codon_ptr->orf_name + ':' + std::to_string(codon_ptr->codon_number+1);
         char orig_protein = orig_proteins.find(codon_id)->second;
         if (taxodium_format) {
@@ -587,18 +612,17 @@ std::string do_mutations(std::vector<MAT::Mutation> &mutations, std::unordered_m
     }
 }
 
-void undo_mutations(std::vector<MAT::Mutation> &mutations, std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> &codon_map) {
+void undo_mutations(const std::vector<MAT::Mutation> &mutations, const Codon_Map &codon_map, std::vector<Codon> &codons) {
     for (auto &m: mutations) {
         char parent_nuc = MAT::get_nuc(m.par_nuc);
         int pos = m.position - 1;
-        auto it = codon_map.find(pos);
-        if (it == codon_map.end()) {
+        if (!codon_map.is_coding(pos)) {
             continue;
             // Not a coding mutation
         } else {
             // Revert the mutation by mutating to the parent nucleotide
-            for (auto codon_ptr : it->second) {
-                codon_ptr->mutate(pos, parent_nuc);
+            for (auto codon_it = codon_map.codons_begin(pos); codon_it != codon_map.codons_end(pos); codon_it++) {
+                codons[*codon_it].mutate(pos, parent_nuc);
             }
         }
     }
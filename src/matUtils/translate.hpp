@@ -93,11 +93,33 @@ struct Codon {
     }
 };
 
-std::string do_mutations(std::vector<MAT::Mutation> &mutations, std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> &codon_map, bool taxodium_format);
+// Codons of all ORFs, indexed by 0-based genome position. Some positions are associated with
+// multiple codons (frame shifts), the codons at pos are codon_ids[pos_offsets[pos]..pos_offsets[pos+1]).
+// Codon states are kept outside the map, so each thread can mutate its own copy of reference_codons.
+struct Codon_Map {
+    std::vector<Codon> reference_codons;
+    std::vector<uint32_t> pos_offsets;
+    std::vector<uint32_t> codon_ids;
+
+    inline size_t num_positions() const {
+        return pos_offsets.size() - 1;
+    }
+    inline bool is_coding(int pos) const {
+        return pos >= 0 && (size_t)pos < num_positions() && pos_offsets[pos] != pos_offsets[pos + 1];
+    }
+    inline const uint32_t *codons_begin(int pos) const {
+        return codon_ids.data() + pos_offsets[pos];
+    }
+    inline const uint32_t *codons_end(int pos) const {
+        return codon_ids.data() + pos_offsets[pos + 1];
+    }
+};
+
+Codon_Map build_codon_map(std::ifstream &gtf_file, std::string reference);
+std::string do_mutations(const std::vector<MAT::Mutation> &mutations, const Codon_Map &codon_map, std::vector<Codon> &codons, bool taxodium_format);
 void translate_main(MAT::Tree *T, std::string output_filename, std::string gff_filename, std::string fasta_filename);
 void translate_and_populate_node_data(MAT::Tree *T, std::string gtf_filename, std::string fasta_filename, Taxodium::AllNodeData *node_data, Taxodium::AllData *all_data, std::unordered_map<std::string, std::vector<std::string>> &metadata, MetaColumns fixed_columns, std::vector<GenericMetadata> &generic_metadata, float x_scale, bool include_nt);
-void cleanup_codon_map(std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> &codon_map);
-void undo_mutations(std::vector<MAT::Mutation> &mutations, std::unordered_map<int, std::vector<std::shared_ptr<Codon>>> &codon_map);
+void undo_mutations(const std::vector<MAT::Mutation> &mutations, const Codon_Map &codon_map, std::vector<Codon> &codons);
 char complement(char nt);
 void save_taxodium_tree (MAT::Tree &tree, std::string out_filename, std::vector<std::string> meta_filenames, std::string gtf_filename, std::string fasta_filename, std::string title, std::string description, std::vector<std::string> additional_meta_fields, float x_scale, bool include_nt);
 std::unordered_map<std::string, std::vector<std::string>> read_metafiles_tax(std::vector<std::string> filenames, Taxodium::AllData &all_data, Taxodium::AllNodeData *node_data, MetaColumns &columns, std::vector<GenericMetadata> &generic_metadata, std::vector<std::string> additional_meta_fields);
@@ -1,43 +1,6 @@
 #include "uncertainty.hpp"
 #include <tbb/info.h>
 
-std::vector<MAT::Node*> get_common_nodes (std::vector<std::vector<MAT::Node*>> nodepaths) {
-    //to identify common nodes, perform pairwise set intersections repeatedly for all path node vectors
-    std::vector<MAT::Node*> common_nodes = nodepaths[0];
-    //needs to be sorted for intersection. These are vectors of pointers, so there's not a problem with how to order them.
-    std::sort(common_nodes.begin(), common_nodes.end());
-    for (size_t s=1; s<nodepaths.size(); s++) {
-        std::vector<MAT::Node*> nextint;
-        std::vector<MAT::Node*> next = nodepaths[s];
-        std::sort(next.begin(), next.end());
-        std::set_intersection(common_nodes.begin(), common_nodes.end(), next.begin(), next.end(), std::back_inserter(nextint));
-        //store the intersected vector and move to the next node path vector
-        common_nodes = nextint;
-    }
-    //the final vector is the set of nodes which existed in every path vector
-    return common_nodes;
-}
-
-std::vector<float> get_all_distances(MAT::Node* target, std::vector<std::vector<MAT::Node*>> paths) {
-    std::vector<float> distvs;
-    for (size_t p=0; p<paths.size(); p++) {
-        //for this path to the target common ancestor, count up distances from the start until it is reached
-        float tdist = 0;
-        assert (paths[p].size() > 0);
-        for (size_t i=0; i<paths[p].size(); i++) {
-            if (paths[p][i]->identifier == target->identifier) {
-                //stop iterating when its reached the indicated common ancestor (remember, path is sorted nearest to root)
-                break;
-            }
-            tdist += paths[p][i]->mutations.size();
-
-            //then record the total distance in distvs
-            distvs.emplace_back(tdist);
-        }
-    }
-    return distvs;
-}
-
 size_t get_neighborhood_size(std::vector<MAT::Node*> nodes, MAT::Tree* T) {
     /*
     The basic concept behind neighborhood size is that it is the longest direct path
@@ -68,62 +31,36 @@ size_t get_neighborhood_size(std::vector<MAT::Node*> nodes, MAT::Tree* T) {
     number of equally parsimonious placements when evaluating sample placement quality.
     */
 
-    //first step for this is collecting the full paths back to the root for all nodes
+    //the longest path has to pass through a common ancestor of all nodes. Distances to common ancestors above
+    //the most recent one only grow, so only the most recent common ancestor needs to be considered
     assert (nodes.size() > 1);
-    std::vector<std::vector<MAT::Node*>> parentvecs;
-    for (size_t s=0; s<nodes.size(); s++) {
-        if (!nodes[s]->is_root()) {
-            std::vector<MAT::Node*> npath;
-            npath.emplace_back(nodes[s]); //include the node itself on the path so branch length is correctly accessed
-            for (auto& it: T->rsearch(nodes[s]->identifier)) {
-                npath.emplace_back(it);
+    MAT::Node* mrca = nodes[0];
+    for (size_t s=1; s<nodes.size(); s++) {
+        mrca = T->LCA(mrca, nodes[s]);
+    }
+    //the distances from each node to each of its ancestors below the common ancestor are compared,
+    //and the longest pair path is the sum of the two largest of them
+    float largest = 0.0;
+    float second_largest = 0.0;
+    size_t num_distances = 0;
+    for (auto n: nodes) {
+        float tdist = 0;
+        for (auto a = n; a != mrca; a = a->parent) {
+            tdist += a->mutations.size();
+            num_distances++;
+            if (tdist > largest) {
+                second_largest = largest;
+                largest = tdist;
+            } else if (tdist > second_largest) {
+                second_largest = tdist;
             }
-            parentvecs.emplace_back(npath);
-        } else {
-            //if one of the epps sites is directly off the root, then this doesn't make much sense
-            //instead, just construct a path of length 1 that contains the root node only
-            std::vector<MAT::Node*> npath;
-            npath.emplace_back(nodes[s]);
-            parentvecs.emplace_back(npath);
         }
     }
-    //then we need to identify all common elements to all node vectors
-    std::vector<MAT::Node*> common_nodes = get_common_nodes(parentvecs);
-    //bare minimum this will always include the root. therefore it is always > 0
-    assert (common_nodes.size() > 0);
-    //then for all common nodes, we need to calculate the largest sum of paired distances for all samples to that specific common ancestor
-    //the smallest of these largest sums is the best neighborhood size value
-
     //the parsimony score is bigger than the biggest maximum limit on neighborhood size.
-    //This is basically just a big number to compare to
-    //TODO: There's definitely a better way to bound this that doesn't involve as much adding.
     size_t best_size = T->get_parsimony_score();
-
-    for (size_t s=0; s<common_nodes.size(); s++) {
-        //get the set of distances between each placement to this common ancestor with the path vectors
-        std::vector<float> distances = get_all_distances(common_nodes[s], parentvecs);
-        float widest = 0.0;
-        for (size_t i=0; i<distances.size(); i++) {
-            for (size_t j=0; j<distances.size(); j++) {
-                if (i!=j) {
-                    float spairdist = distances[i] + distances[j];
-                    if (spairdist > widest) {
-                        widest = spairdist;
-                    }
-                }
-            }
-        }
-        //I now have a value which is the longest path going between any two nodes in the placement set
-        //which goes through this specific common ancestor
-        //admittedly this is probably not the fastest way to do this
-        //I should be able to eliminate common ancestors which are directly ancestral
-        //to common ancestors between the same complete set without counting them up
-        //but I'm focusing on results first here
-        //assign this longest pair path value to best_size if its smaller than any we've seen for other common ancestors
-        size_t size_widest = static_cast<size_t>(widest);
-        if (size_widest < best_size) {
-            best_size = size_widest;
-        }
+    size_t size_widest = (num_distances > 1) ? static_cast<size_t>(largest + second_largest) : 0;
+    if (size_widest < best_size) {
+        best_size = size_widest;
     }
     //at the end, we should be left with the proper neighborhood size value.
     return best_size;
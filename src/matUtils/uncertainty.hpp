@@ -1,8 +1,6 @@
 #include "common.hpp"
 #include "boost/math/distributions/hypergeometric.hpp"
 
-std::vector<MAT::Node*> get_common_nodes (std::vector<std::vector<MAT::Node*>> nodepaths);
-std::vector<float> get_all_distances(MAT::Node* target, std::vector<std::vector<MAT::Node*>> paths);
 size_t get_neighborhood_size(std::vector<MAT::Node*> nodes, MAT::Tree* T);
 std::vector<MAT::Node*> findEPPs (MAT::Tree* T, MAT::Node* node, size_t* nbest, size_t* nsize);
 void findEPPs_wrapper (MAT::Tree Tobj, std::string sample_file, std::string fepps, std::string flocs);
@@ -0,0 +1,387 @@
+#pragma once
+// Flat, memory-mappable snapshot of a mutation-annotated tree.
+//
+// The protobuf format stores topology as a newick string and every mutation as a
+// separate message, so loading it means gunzip + protobuf parse + newick parse +
+// rebuilding every node. A snapshot instead stores the tree as a handful of flat
+// arrays in DFS pre-order that can be mmap-ed and used in place:
+//   parent[i]        index of the parent of node i (NO_IDX for the root)
+//   dfs_end[i]       one past the last descendant of node i, so the subtree of i is [i, dfs_end[i])
+//   branch_length[i]
+//   name[i]          index into the interned string table (NO_IDX for unnamed nodes)
+//   mut_offset[i]    mutations of node i are mutations[mut_offset[i], mut_offset[i+1])
+//   annotations      num_annotations string ids per node (NO_IDX for empty annotation)
+//   condensed nodes  node name id + range of condensed leaf name ids
+// Children of node i are i+1, dfs_end[i+1], dfs_end[dfs_end[i+1]], ... while < dfs_end[i].
+// Integers are stored in native (little-endian) byte order.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace MAT_Snapshot {
+static const char MAGIC[8] = {'U', 'S', 'H', 'M', 'A', 'T', 'S', 'N'};
+static const uint32_t VERSION = 1;
+static const uint32_t NO_IDX = UINT32_MAX;
+
+enum Section {
+    PARENT,
+    DFS_END,
+    BRANCH_LENGTH,
+    NAME,
+    MUT_OFFSET,
+    MUTATIONS,
+    ANNOTATIONS,
+    CHROMOSOMES,
+    CONDENSED_NODE,
+    CONDENSED_OFFSET,
+    CONDENSED_LEAVES,
+    STRING_OFFSET,
+    STRING_DATA,
+    NUM_SECTIONS
+};
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_annotations;
+    uint64_t num_nodes;
+    uint64_t num_mutations;
+    uint64_t num_strings;
+    uint64_t num_chromosomes;
+    uint64_t num_condensed;
+    uint64_t num_condensed_leaves;
+    //value of the internal node counter of the saving tree, so new internal node names stay unique
+    uint64_t internal_node_counter;
+    uint64_t offsets[NUM_SECTIONS];
+    uint64_t file_size;
+};
+
+//nucleotides are one-hot encoded (A:1,C:2,G:4,T:8), mut_nuc may have several bits set for ambiguous calls,
+//masked mutations have negative position and all nucleotides 0
+struct Packed_Mutation {
+    int32_t position;
+    uint8_t chrom_idx;
+    uint8_t ref_nuc;
+    uint8_t par_nuc;
+    uint8_t mut_nuc;
+};
+static_assert(sizeof(Packed_Mutation) == 8, "Packed_Mutation must stay 8 bytes");
+
+inline bool is_snapshot(const std::string& filename) {
+    char buf[sizeof(MAGIC)];
+    FILE* fh = fopen(filename.c_str(), "rb");
+    if (!fh) {
+        return false;
+    }
+    bool ret = (fread(buf, 1, sizeof(MAGIC), fh) == sizeof(MAGIC)) && (memcmp(buf, MAGIC, sizeof(MAGIC)) == 0);
+    fclose(fh);
+    return ret;
+}
+
+// Accumulates a tree node by node (in DFS pre-order) and writes it out as a snapshot
+class Builder {
+    std::vector<uint32_t> parent;
+    std::vector<uint32_t> dfs_end;
+    std::vector<float> branch_length;
+    std::vector<uint32_t> name;
+    std::vector<uint64_t> mut_offset;
+    std::vector<Packed_Mutation> mutations;
+    std::vector<uint32_t> annotations;
+    std::vector<uint32_t> chromosomes;
+    std::unordered_map<std::string, uint8_t> chromosome_idx;
+    std::vector<uint32_t> condensed_node;
+    std::vector<uint64_t> condensed_offset;
+    std::vector<uint32_t> condensed_leaves;
+    std::vector<uint64_t> string_offset;
+    std::vector<char> string_data;
+    std::unordered_map<std::string, uint32_t> string_idx;
+    uint32_t num_annotations;
+    //set when more chromosomes are added than Packed_Mutation::chrom_idx can index
+    bool too_many_chromosomes;
+
+    //appends data 8-byte aligned, recording where it starts in section_offset
+    template<typename T>
+    static bool write_section(FILE* fh, const std::vector<T>& data, uint64_t& section_offset, uint64_t& offset) {
+        static const char zeros[8] = {0};
+        auto pad = (8 - (offset & 7)) & 7;
+        if (pad && fwrite(zeros, 1, pad, fh) != pad) {
+            return false;
+        }
+        offset += pad;
+        section_offset = offset;
+        if (!data.empty() && fwrite(data.data(), sizeof(T), data.size(), fh) != data.size()) {
+            return false;
+        }
+        offset += sizeof(T) * data.size();
+        return true;
+    }
+
+  public:
+    uint64_t internal_node_counter;
+    Builder(size_t num_nodes_hint, uint32_t num_annotations) : num_annotations(num_annotations), too_many_chromosomes(false), internal_node_counter(0) {
+        parent.reserve(num_nodes_hint);
+        dfs_end.reserve(num_nodes_hint);
+        branch_length.reserve(num_nodes_hint);
+        name.reserve(num_nodes_hint);
+        mut_offset.reserve(num_nodes_hint + 1);
+        mut_offset.push_back(0);
+        condensed_offset.push_back(0);
+        string_offset.push_back(0);
+    }
+
+    uint32_t intern(const std::string& str) {
+        auto ins_result = string_idx.emplace(str, string_offset.size() - 1);
+        if (ins_result.second) {
+            string_data.insert(string_data.end(), str.begin(), str.end());
+            string_offset.push_back(string_data.size());
+        }
+        return ins_result.first->second;
+    }
+
+    //at most 256 chromosomes can be stored, past that write() fails
+    uint8_t chromosome(const std::string& chrom) {
+        auto search = chromosome_idx.find(chrom);
+        if (search != chromosome_idx.end()) {
+            return search->second;
+        }
+        if (chromosomes.size() > UINT8_MAX) {
+            too_many_chromosomes = true;
+            return 0;
+        }
+        chromosome_idx.emplace(chrom, chromosomes.size());
+        chromosomes.push_back(intern(chrom));
+        return chromosomes.size() - 1;
+    }
+
+    //parent_idx must be the index of an already added node, or NO_IDX for the root
+    uint32_t add_node(uint32_t parent_idx, float branch_len, uint32_t name_idx) {
+        uint32_t idx = parent.size();
+        parent.push_back(parent_idx);
+        dfs_end.push_back(idx + 1);
+        branch_length.push_back(branch_len);
+        name.push_back(name_idx);
+        mut_offset.push_back(mutations.size());
+        annotations.resize(annotations.size() + num_annotations, NO_IDX);
+        //propagate subtree end to ancestors, nodes arrive in pre-order so only the open path is affected
+        while (parent_idx != NO_IDX && dfs_end[parent_idx] <= idx) {
+            dfs_end[parent_idx] = idx + 1;
+            parent_idx = parent[parent_idx];
+        }
+        return idx;
+    }
+
+    //mutations are appended to the last added node
+    void add_mutation(const Packed_Mutation& mut) {
+        mutations.push_back(mut);
+        mut_offset.back() = mutations.size();
+    }
+
+    void set_annotation(uint32_t node_idx, uint32_t annotation_idx, const std::string& annotation) {
+        if (annotation != "" && annotation_idx < num_annotations) {
+            annotations[(size_t)node_idx * num_annotations + annotation_idx] = intern(annotation);
+        }
+    }
+
+    void add_condensed(const std::string& node_name, const std::vector<std::string>& leaves) {
+        condensed_node.push_back(intern(node_name));
+        for (const auto& leaf : leaves) {
+            condensed_leaves.push_back(intern(leaf));
+        }
+        condensed_offset.push_back(condensed_leaves.size());
+    }
+
+    bool write(const std::string& filename) const {
+        if (too_many_chromosomes) {
+            fprintf(stderr, "ERROR: Snapshots support at most %d chromosomes, not writing %s\n", UINT8_MAX + 1, filename.c_str());
+            return false;
+        }
+        FILE* fh = fopen(filename.c_str(), "wb");
+        if (!fh) {
+            fprintf(stderr, "ERROR: Could not open %s for writing snapshot\n", filename.c_str());
+            return false;
+        }
+        Header header;
+        memset(&header, 0, sizeof(Header));
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.num_annotations = num_annotations;
+        header.num_nodes = parent.size();
+        header.num_mutations = mutations.size();
+        header.num_strings = string_offset.size() - 1;
+        header.num_chromosomes = chromosomes.size();
+        header.num_condensed = condensed_node.size();
+        header.num_condensed_leaves = condensed_leaves.size();
+        header.internal_node_counter = internal_node_counter;
+        //header is rewritten once all offsets are known
+        bool ok = fwrite(&header, sizeof(Header), 1, fh) == 1;
+        uint64_t offset = sizeof(Header);
+        auto& offs = header.offsets;
+        ok = ok && write_section(fh, parent, offs[PARENT], offset);
+        ok = ok && write_section(fh, dfs_end, offs[DFS_END], offset);
+        ok = ok && write_section(fh, branch_length, offs[BRANCH_LENGTH], offset);
+        ok = ok && write_section(fh, name, offs[NAME], offset);
+        ok = ok && write_section(fh, mut_offset, offs[MUT_OFFSET], offset);
+        ok = ok && write_section(fh, mutations, offs[MUTATIONS], offset);
+        ok = ok && write_section(fh, annotations, offs[ANNOTATIONS], offset);
+        ok = ok && write_section(fh, chromosomes, offs[CHROMOSOMES], offset);
+        ok = ok && write_section(fh, condensed_node, offs[CONDENSED_NODE], offset);
+        ok = ok && write_section(fh, condensed_offset, offs[CONDENSED_OFFSET], offset);
+        ok = ok && write_section(fh, condensed_leaves, offs[CONDENSED_LEAVES], offset);
+        ok = ok && write_section(fh, string_offset, offs[STRING_OFFSET], offset);
+        ok = ok && write_section(fh, string_data, offs[STRING_DATA], offset);
+        header.file_size = offset;
+        ok = ok && fseek(fh, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(Header), 1, fh) == 1;
+        ok = (fclose(fh) == 0) && ok;
+        if (!ok) {
+            fprintf(stderr, "ERROR: Failed writing snapshot %s\n", filename.c_str());
+        }
+        return ok;
+    }
+};
+
+// Read-only view of a snapshot mapped into memory, nothing is decoded up front
+class View {
+    void* map_base;
+    size_t map_size;
+    const Header* header;
+    template<typename T>
+    const T* section(Section sec) const {
+        return reinterpret_cast<const T*>(static_cast<const char*>(map_base) + header->offsets[sec]);
+    }
+
+  public:
+    View() : map_base(nullptr), map_size(0), header(nullptr) {}
+    View(const View&) = delete;
+    View& operator=(const View&) = delete;
+    ~View() {
+        close();
+    }
+
+    bool open(const std::string& filename) {
+        close();
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd == -1) {
+            fprintf(stderr, "ERROR: Could not open snapshot %s\n", filename.c_str());
+            return false;
+        }
+        struct stat stat_buf;
+        if (fstat(fd, &stat_buf) != 0) {
+            ::close(fd);
+            perror("stat snapshot");
+            return false;
+        }
+        map_size = stat_buf.st_size;
+        if (map_size < sizeof(Header)) {
+            ::close(fd);
+            fprintf(stderr, "ERROR: %s is too small to be a snapshot\n", filename.c_str());
+            return false;
+        }
+        map_base = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map_base == MAP_FAILED) {
+            map_base = nullptr;
+            perror("mmap snapshot");
+            return false;
+        }
+        header = static_cast<const Header*>(map_base);
+        if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION || header->file_size != map_size) {
+            fprintf(stderr, "ERROR: %s is not a compatible snapshot (version %u)\n", filename.c_str(), header->version);
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (map_base) {
+            munmap(map_base, map_size);
+        }
+        map_base = nullptr;
+        header = nullptr;
+        map_size = 0;
+    }
+
+    //hint the kernel to read ahead the whole file, as it is going to be scanned sequentially
+    void prefetch() const {
+        madvise(map_base, map_size, MADV_WILLNEED);
+    }
+
+    size_t num_nodes() const {
+        return header->num_nodes;
+    }
+    size_t num_mutations() const {
+        return header->num_mutations;
+    }
+    uint32_t num_annotations() const {
+        return header->num_annotations;
+    }
+    size_t num_condensed() const {
+        return header->num_condensed;
+    }
+    size_t num_chromosomes() const {
+        return header->num_chromosomes;
+    }
+    uint64_t internal_node_counter() const {
+        return header->internal_node_counter;
+    }
+    uint32_t parent(size_t idx) const {
+        return section<uint32_t>(PARENT)[idx];
+    }
+    uint32_t dfs_end(size_t idx) const {
+        return section<uint32_t>(DFS_END)[idx];
+    }
+    bool is_leaf(size_t idx) const {
+        return dfs_end(idx) == idx + 1;
+    }
+    float branch_length(size_t idx) const {
+        return section<float>(BRANCH_LENGTH)[idx];
+    }
+    uint32_t name_idx(size_t idx) const {
+        return section<uint32_t>(NAME)[idx];
+    }
+    std::string_view string(uint32_t str_idx) const {
+        auto offsets = section<uint64_t>(STRING_OFFSET);
+        return std::string_view(section<char>(STRING_DATA) + offsets[str_idx], offsets[str_idx + 1] - offsets[str_idx]);
+    }
+    std::string_view name(size_t idx) const {
+        auto str_idx = name_idx(idx);
+        return str_idx == NO_IDX ? std::string_view() : string(str_idx);
+    }
+    const Packed_Mutation* mutations_begin(size_t idx) const {
+        return section<Packed_Mutation>(MUTATIONS) + section<uint64_t>(MUT_OFFSET)[idx];
+    }
+    const Packed_Mutation* mutations_end(size_t idx) const {
+        return section<Packed_Mutation>(MUTATIONS) + section<uint64_t>(MUT_OFFSET)[idx + 1];
+    }
+    std::string_view annotation(size_t idx, uint32_t annotation_idx) const {
+        auto str_idx = section<uint32_t>(ANNOTATIONS)[idx * header->num_annotations + annotation_idx];
+        return str_idx == NO_IDX ? std::string_view() : string(str_idx);
+    }
+    std::string_view chromosome(uint8_t chrom_idx) const {
+        return string(section<uint32_t>(CHROMOSOMES)[chrom_idx]);
+    }
+    std::string_view condensed_node_name(size_t cond_idx) const {
+        return string(section<uint32_t>(CONDENSED_NODE)[cond_idx]);
+    }
+    template<typename F>
+    void for_each_condensed_leaf(size_t cond_idx, F f) const {
+        auto offsets = section<uint64_t>(CONDENSED_OFFSET);
+        auto leaves = section<uint32_t>(CONDENSED_LEAVES);
+        for (auto i = offsets[cond_idx]; i < offsets[cond_idx + 1]; i++) {
+            f(string(leaves[i]));
+        }
+    }
+    size_t num_condensed_leaves(size_t cond_idx) const {
+        auto offsets = section<uint64_t>(CONDENSED_OFFSET);
+        return offsets[cond_idx + 1] - offsets[cond_idx];
+    }
+};
+}
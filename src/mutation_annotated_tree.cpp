@@ -2,6 +2,7 @@
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <fcntl.h>
+#include "isa-l/igzip_lib.h"
 #include <google/protobuf/io/coded_stream.h>
 #include <iomanip>
 #include <iostream>
@@ -13,7 +14,11 @@
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include "usher_graph.hpp"
+#include "mat_snapshot.hpp"
+#include "parsimony_stream.hpp"
+#include "block_gzip.hpp"
 #include <signal.h>
+#include <mutex>
 // Uses one-hot encoding if base is unambiguous
 // A:1,C:2,G:4,T:8
 int8_t Mutation_Annotated_Tree::get_nuc_id (char nuc) {
@@ -521,92 +526,99 @@ Mutation_Annotated_Tree::Tree Mutation_Annotated_Tree::create_tree_from_newick (
 
 Mutation_Annotated_Tree::Tree Mutation_Annotated_Tree::load_mutation_annotated_tree (std::string filename) {
     TIMEIT();
+    if (MAT_Snapshot::is_snapshot(filename)) {
+        return load_mutation_annotated_tree_snapshot(filename);
+    }
     Tree tree;
 
-    Parsimony::data data;
-#define BIG_SIZE 2000000000l
     boost::iostreams::filtering_istream instream;
+    std::unique_ptr<Block_Gzip::Reader> block_reader;
     std::ifstream inpfile(filename, std::ios::in | std::ios::binary);
     if (filename.find(".gz\0") != std::string::npos) {
         if (!inpfile) {
             fprintf(stderr, "ERROR: Could not load the mutation-annotated tree object from file: %s!\n", filename.c_str());
             exit(1);
         }
-        try {
-            instream.push(boost::iostreams::gzip_decompressor());
-            instream.push(inpfile);
-        } catch(const boost::iostreams::gzip_error& e) {
-            std::cout << e.what() << '\n';
+        if (Block_Gzip::is_block_gzip(filename)) {
+            block_reader.reset(new Block_Gzip::Reader(filename));
+        } else {
+            // Single member gzip written before block gzip was used
+            try {
+                instream.push(boost::iostreams::gzip_decompressor());
+                instream.push(inpfile);
+            } catch(const boost::iostreams::gzip_error& e) {
+                std::cout << e.what() << '\n';
+            }
         }
     } else {
         instream.push(inpfile);
     }
-    google::protobuf::io::IstreamInputStream stream(&instream);
-    google::protobuf::io::CodedInputStream input(&stream);
-    //input.SetTotalBytesLimit(BIG_SIZE, BIG_SIZE);
-    data.ParseFromCodedStream(&input);
-    //check if the pb has a metadata field
-    bool hasmeta = (data.metadata_size()>0);
-    if (!hasmeta) {
-        fprintf(stderr, "WARNING: This pb does not include any metadata. Filling in default values\n");
-    }
-    tree = create_tree_from_newick_string(data.newick());
-    auto dfs = tree.depth_first_expansion();
-    static tbb::affinity_partitioner ap;
-    tbb::parallel_for( tbb::blocked_range<size_t>(0, dfs.size()),
-    [&](tbb::blocked_range<size_t> r) {
-        for (size_t idx = r.begin(); idx < r.end(); idx++) {
-            auto node = dfs[idx];
-            auto mutation_list = data.node_mutations(idx);
-            if (hasmeta) {
-                for (int k = 0; k < data.metadata(idx).clade_annotations_size(); k++) {
-                    node->clade_annotations.emplace_back(data.metadata(idx).clade_annotations(k));
+    google::protobuf::io::IstreamInputStream istream_input(&instream);
+    google::protobuf::io::ZeroCopyInputStream* stream = &istream_input;
+    if (block_reader) {
+        stream = block_reader.get();
+    }
+    std::vector<Node*> dfs;
+    bool hasmeta = false;
+    bool parsed = Parsimony_Stream::read_data(stream, hasmeta,
+    [&](const std::string& newick) {
+        tree = create_tree_from_newick_string(newick);
+        dfs = tree.depth_first_expansion();
+        return dfs.size();
+    },
+    [&](size_t idx, const Parsimony::mutation_list& mutation_list) {
+        auto node = dfs[idx];
+        for (int k = 0; k < mutation_list.mutation_size(); k++) {
+            const auto& mut = mutation_list.mutation(k);
+            Mutation m;
+            m.chrom = mut.chromosome();
+            m.position = mut.position();
+            if (!m.is_masked()) {
+                m.ref_nuc = (1 << mut.ref_nuc());
+                m.par_nuc = (1 << mut.par_nuc());
+                m.is_missing = false;
+                std::vector<int8_t> nuc_vec(mut.mut_nuc_size());
+                for (int n = 0; n < mut.mut_nuc_size(); n++) {
+                    nuc_vec[n] = mut.mut_nuc(n);
                 }
-            }
-            for (int k = 0; k < mutation_list.mutation_size(); k++) {
-                auto mut = mutation_list.mutation(k);
-                Mutation m;
-                m.chrom = mut.chromosome();
-                m.position = mut.position();
-                if (!m.is_masked()) {
-                    m.ref_nuc = (1 << mut.ref_nuc());
-                    m.par_nuc = (1 << mut.par_nuc());
-                    m.is_missing = false;
-                    std::vector<int8_t> nuc_vec(mut.mut_nuc_size());
-                    for (int n = 0; n < mut.mut_nuc_size(); n++) {
-                        nuc_vec[n] = mut.mut_nuc(n);
-                    }
-                    m.mut_nuc = get_nuc_id(nuc_vec);
-                    if (m.mut_nuc != m.par_nuc) {
-                        node->add_mutation(m);
-                    }
-                } else {
-                    // Mutation masked
-                    m.ref_nuc = 0;
-                    m.par_nuc = 0;
-                    m.mut_nuc = 0;
+                m.mut_nuc = get_nuc_id(nuc_vec);
+                if (m.mut_nuc != m.par_nuc) {
                     node->add_mutation(m);
                 }
-            }
-            if (!std::is_sorted(node->mutations.begin(), node->mutations.end())) {
-                fprintf(stderr, "WARNING: Mutations not sorted!\n");
-                std::sort(node->mutations.begin(), node->mutations.end());
-            }
-        }
-    }, ap);
-
-    size_t num_condensed_nodes = static_cast<size_t>(data.condensed_nodes_size());
-    tbb::parallel_for( tbb::blocked_range<size_t>(0, num_condensed_nodes),
-    [&](tbb::blocked_range<size_t> r) {
-        for (size_t idx = r.begin(); idx < r.end(); idx++) {
-            auto cn = data.condensed_nodes(idx);
-            tree.condensed_nodes.emplace(std::pair<std::string, std::vector<std::string>>(cn.node_name(), std::vector<std::string>(cn.condensed_leaves_size())));
-            for (int k = 0; k < cn.condensed_leaves_size(); k++) {
-                tree.condensed_nodes[cn.node_name()][k] = cn.condensed_leaves(k);
-                tree.condensed_leaves.emplace(cn.condensed_leaves(k));
+            } else {
+                // Mutation masked
+                m.ref_nuc = 0;
+                m.par_nuc = 0;
+                m.mut_nuc = 0;
+                node->add_mutation(m);
             }
         }
-    }, ap);
+        if (!std::is_sorted(node->mutations.begin(), node->mutations.end())) {
+            fprintf(stderr, "WARNING: Mutations not sorted!\n");
+            std::sort(node->mutations.begin(), node->mutations.end());
+        }
+    },
+    [&](size_t idx, const Parsimony::node_metadata& metadata) {
+        for (int k = 0; k < metadata.clade_annotations_size(); k++) {
+            dfs[idx]->clade_annotations.emplace_back(metadata.clade_annotations(k));
+        }
+    },
+    [&](const Parsimony::condensed_node& cn) {
+        auto& condensed_leaves = tree.condensed_nodes[cn.node_name()];
+        condensed_leaves.assign(cn.condensed_leaves().begin(), cn.condensed_leaves().end());
+        tree.condensed_leaves.insert(cn.condensed_leaves().begin(), cn.condensed_leaves().end());
+    });
+    if (block_reader && block_reader->error()) {
+        parsed = false;
+    }
+    if (!parsed) {
+        fprintf(stderr, "ERROR: Failed to parse the mutation-annotated tree object from file: %s!\n", filename.c_str());
+        exit(1);
+    }
+    //check if the pb has a metadata field
+    if (!hasmeta) {
+        fprintf(stderr, "WARNING: This pb does not include any metadata. Filling in default values\n");
+    }
 
     return tree;
 }
@@ -658,28 +670,130 @@ void Mutation_Annotated_Tree::save_mutation_annotated_tree (Mutation_Annotated_T
         }
     }
 
-    // Boost library used to stream the contents to the output protobuf file in
-    // uncompressed or compressed .gz format
-    std::ofstream outfile(filename, std::ios::out | std::ios::binary);
-    boost::iostreams::filtering_streambuf< boost::iostreams::output> outbuf;
-
+    // .gz output is block gzip (BGZF), compressed in parallel and still readable
+    // by gzip -d
     if (filename.find(".gz\0") != std::string::npos) {
-        try {
-            outbuf.push(boost::iostreams::gzip_compressor());
-            outbuf.push(outfile);
-            std::ostream outstream(&outbuf);
-            data.SerializeToOstream(&outstream);
-            boost::iostreams::close(outbuf);
-            outfile.close();
-        } catch(const boost::iostreams::gzip_error& e) {
-            std::cout << e.what() << '\n';
+        Block_Gzip::Writer writer(filename);
+        std::ostream outstream(&writer);
+        data.SerializeToOstream(&outstream);
+        if (!writer.close()) {
+            fprintf(stderr, "ERROR: Could not write the mutation-annotated tree object to file: %s!\n", filename.c_str());
         }
     } else {
+        std::ofstream outfile(filename, std::ios::out | std::ios::binary);
         data.SerializeToOstream(&outfile);
         outfile.close();
     }
 }
 
+// Load a tree saved by save_mutation_annotated_tree_snapshot. Topology and names
+// come straight from the mapped arrays, so there is no gunzip, protobuf or newick
+// parsing involved. The MAT::Tree consumers still edit nodes in place, so the tree
+// is materialized from the view rather than served by it: nodes are created serially,
+// as create_node registers them in the node name map, and mutations in parallel.
+Mutation_Annotated_Tree::Tree Mutation_Annotated_Tree::load_mutation_annotated_tree_snapshot (std::string filename) {
+    TIMEIT();
+    Tree tree;
+    MAT_Snapshot::View view;
+    if (!view.open(filename)) {
+        fprintf(stderr, "ERROR: Could not load the mutation-annotated tree snapshot from file: %s!\n", filename.c_str());
+        exit(1);
+    }
+    view.prefetch();
+
+    size_t num_nodes = view.num_nodes();
+    if (num_nodes == 0) {
+        fprintf(stderr, "WARNING: Tree found empty!\n");
+        return tree;
+    }
+    std::vector<Node*> nodes(num_nodes);
+    tree.curr_internal_node = view.internal_node_counter();
+    for (size_t idx = 0; idx < num_nodes; idx++) {
+        auto name = view.name(idx);
+        std::string nid = (view.name_idx(idx) == MAT_Snapshot::NO_IDX) ? tree.new_internal_node_id() : std::string(name);
+        auto par_idx = view.parent(idx);
+        if (par_idx == MAT_Snapshot::NO_IDX) {
+            nodes[idx] = tree.create_node(nid, view.branch_length(idx), view.num_annotations());
+        } else {
+            nodes[idx] = tree.create_node(nid, nodes[par_idx], view.branch_length(idx));
+        }
+    }
+
+    std::vector<std::string> chromosomes;
+    for (size_t k = 0; k < view.num_chromosomes(); k++) {
+        chromosomes.emplace_back(view.chromosome(k));
+    }
+    static tbb::affinity_partitioner ap;
+    tbb::parallel_for( tbb::blocked_range<size_t>(0, num_nodes),
+    [&](tbb::blocked_range<size_t> r) {
+        for (size_t idx = r.begin(); idx < r.end(); idx++) {
+            auto node = nodes[idx];
+            for (uint32_t k = 0; k < view.num_annotations(); k++) {
+                node->clade_annotations[k] = std::string(view.annotation(idx, k));
+            }
+            auto end = view.mutations_end(idx);
+            node->mutations.reserve(end - view.mutations_begin(idx));
+            // Mutations were written from a tree, so they are already sorted and
+            // free of reversals; no need to go through add_mutation
+            for (auto mut = view.mutations_begin(idx); mut < end; mut++) {
+                Mutation m;
+                m.chrom = chromosomes[mut->chrom_idx];
+                m.position = mut->position;
+                m.ref_nuc = mut->ref_nuc;
+                m.par_nuc = mut->par_nuc;
+                m.mut_nuc = mut->mut_nuc;
+                m.is_missing = false;
+                node->mutations.emplace_back(m);
+            }
+        }
+    }, ap);
+
+    for (size_t idx = 0; idx < view.num_condensed(); idx++) {
+        std::vector<std::string> leaves;
+        leaves.reserve(view.num_condensed_leaves(idx));
+        view.for_each_condensed_leaf(idx, [&](std::string_view leaf) {
+            leaves.emplace_back(leaf);
+            tree.condensed_leaves.emplace(leaf);
+        });
+        tree.condensed_nodes.emplace(std::string(view.condensed_node_name(idx)), std::move(leaves));
+    }
+
+    return tree;
+}
+
+void Mutation_Annotated_Tree::save_mutation_annotated_tree_snapshot (const Mutation_Annotated_Tree::Tree& tree, std::string filename) {
+    TIMEIT();
+    auto dfs = tree.depth_first_expansion();
+    MAT_Snapshot::Builder builder(dfs.size(), tree.get_num_annotations());
+    builder.internal_node_counter = tree.curr_internal_node;
+
+    for (size_t idx = 0; idx < dfs.size(); idx++) {
+        auto node = dfs[idx];
+        uint32_t par_idx = (node == dfs[0]) ? MAT_Snapshot::NO_IDX : node->parent->dfs_idx;
+        builder.add_node(par_idx, node->branch_length, builder.intern(node->identifier));
+        for (size_t k = 0; k < node->clade_annotations.size(); k++) {
+            builder.set_annotation(idx, k, node->clade_annotations[k]);
+        }
+        for (const auto& m: node->mutations) {
+            MAT_Snapshot::Packed_Mutation mut;
+            mut.position = m.position;
+            mut.chrom_idx = builder.chromosome(m.chrom);
+            mut.ref_nuc = m.ref_nuc;
+            mut.par_nuc = m.par_nuc;
+            mut.mut_nuc = m.mut_nuc;
+            builder.add_mutation(mut);
+        }
+    }
+
+    for (auto cn: tree.condensed_nodes) {
+        builder.add_condensed(cn.first, cn.second);
+    }
+
+    if (!builder.write(filename)) {
+        exit(1);
+    }
+}
+
 /* === Node === */
 bool Mutation_Annotated_Tree::Node::is_leaf () {
     return (children.size() == 0);
@@ -879,6 +993,7 @@ size_t Mutation_Annotated_Tree::Tree::get_num_leaves(Node* node) {
 }
 
 Mutation_Annotated_Tree::Node* Mutation_Annotated_Tree::Tree::create_node (std::string const& identifier, float branch_len, size_t num_annotations) {
+    invalidate_index();
     all_nodes.clear();
     Node* n = new Node(identifier, branch_len);
     for (size_t k=0; k < num_annotations; k++) {
@@ -894,6 +1009,7 @@ Mutation_Annotated_Tree::Node* Mutation_Annotated_Tree::Tree::create_node (std::
         fprintf(stderr, "Error: %s already in the tree!\n", identifier.c_str());
         exit(1);
     }
+    invalidate_index();
     Node* n = new Node(identifier, par, branch_len);
     size_t num_annotations = get_num_annotations();
     for (size_t k=0; k < num_annotations; k++) {
@@ -918,14 +1034,108 @@ Mutation_Annotated_Tree::Node* Mutation_Annotated_Tree::Tree::get_node (std::str
 }
 
 bool Mutation_Annotated_Tree::Tree::is_ancestor (std::string anc_id, std::string nid) const {
+    Node* anc = get_node(anc_id);
     Node* node = get_node(nid);
-    while (node->parent != NULL) {
-        node = node->parent;
-        if (node->identifier == anc_id) {
-            return true;
+    if ((anc == NULL) || (node == NULL)) {
+        return false;
+    }
+    return is_ancestor(anc, node);
+}
+
+Mutation_Annotated_Tree::Tree_Index::Tree_Index (Mutation_Annotated_Tree::Node* root) {
+    // Iterative pre-order, so deep trees don't overflow the stack
+    std::vector<Node*> remaining_nodes;
+    if (root != NULL) {
+        remaining_nodes.push_back(root);
+    }
+    while (remaining_nodes.size() > 0) {
+        Node* node = remaining_nodes.back();
+        remaining_nodes.pop_back();
+        node->index_dfs_idx = dfs.size();
+        depth.push_back((dfs.size() == 0) ? 0 : depth[node->parent->index_dfs_idx] + 1);
+        dfs.push_back(node);
+        for (auto it = node->children.rbegin(); it != node->children.rend(); it++) {
+            remaining_nodes.push_back(*it);
         }
     }
-    return false;
+    std::vector<uint32_t> subtree_size(dfs.size(), 1);
+    for (size_t idx = dfs.size(); idx-- > 1;) {
+        subtree_size[dfs[idx]->parent->index_dfs_idx] += subtree_size[idx];
+    }
+    dfs_end.resize(dfs.size());
+    for (size_t idx = 0; idx < dfs.size(); idx++) {
+        dfs_end[idx] = idx + subtree_size[idx];
+    }
+
+    size_t num_blocks = dfs.size() / block_size;
+    block_min.emplace_back(num_blocks);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_blocks), [&](tbb::blocked_range<size_t> r) {
+        for (size_t b = r.begin(); b < r.end(); b++) {
+            block_min[0][b] = scan_min(b * block_size, (b + 1) * block_size);
+        }
+    });
+    for (size_t level = 1; ((size_t)1 << level) <= num_blocks; level++) {
+        const auto& prev = block_min[level - 1];
+        std::vector<uint32_t> curr(num_blocks - ((size_t)1 << level) + 1);
+        for (size_t b = 0; b < curr.size(); b++) {
+            curr[b] = shallower(prev[b], prev[b + ((size_t)1 << (level - 1))]);
+        }
+        block_min.emplace_back(std::move(curr));
+    }
+}
+
+uint32_t Mutation_Annotated_Tree::Tree_Index::scan_min (size_t start, size_t end) const {
+    uint32_t ret = start;
+    for (size_t idx = start + 1; idx < end; idx++) {
+        ret = shallower(ret, idx);
+    }
+    return ret;
+}
+
+// Index of the shallowest node in [start, end)
+uint32_t Mutation_Annotated_Tree::Tree_Index::range_min (size_t start, size_t end) const {
+    size_t first_block = (start + block_size - 1) / block_size;
+    size_t last_block = end / block_size;
+    if (first_block >= last_block) {
+        return scan_min(start, end);
+    }
+    size_t level = 0;
+    while (((size_t)2 << level) <= last_block - first_block) {
+        level++;
+    }
+    auto ret = shallower(block_min[level][first_block], block_min[level][last_block - ((size_t)1 << level)]);
+    if (start < first_block * block_size) {
+        ret = shallower(scan_min(start, first_block * block_size), ret);
+    }
+    if (last_block * block_size < end) {
+        ret = shallower(ret, scan_min(last_block * block_size, end));
+    }
+    return ret;
+}
+
+// For nodes u, v numbered u < v, the LCA is the parent of the shallowest node in (u, v]
+Mutation_Annotated_Tree::Node* Mutation_Annotated_Tree::Tree_Index::LCA (const Mutation_Annotated_Tree::Node* n1, const Mutation_Annotated_Tree::Node* n2) const {
+    if (n1 == n2) {
+        return dfs[n1->index_dfs_idx];
+    }
+    auto start = std::min(n1->index_dfs_idx, n2->index_dfs_idx);
+    auto end = std::max(n1->index_dfs_idx, n2->index_dfs_idx);
+    return dfs[range_min(start + 1, end + 1)]->parent;
+}
+
+const Mutation_Annotated_Tree::Tree_Index& Mutation_Annotated_Tree::Tree_Index_Holder::get(Mutation_Annotated_Tree::Node* root) const {
+    auto curr_index = index.load(std::memory_order_acquire);
+    if (curr_index == NULL) {
+        std::lock_guard<std::mutex> lock(build_mutex);
+        curr_index = index.load(std::memory_order_relaxed);
+        if (curr_index == NULL) {
+            // Node::index_dfs_idx is written by the constructor, before the
+            // index is published
+            curr_index = new Tree_Index(root);
+            index.store(curr_index, std::memory_order_release);
+        }
+    }
+    return *curr_index;
 }
 
 std::vector<Mutation_Annotated_Tree::Node*> Mutation_Annotated_Tree::Tree::rsearch (const std::string& nid, bool include_self) const {
@@ -1050,10 +1260,12 @@ void Mutation_Annotated_Tree::Tree::remove_node_helper (std::string nid, bool mo
 
 void Mutation_Annotated_Tree::Tree::remove_node (std::string nid, bool move_level) {
     TIMEIT();
+    invalidate_index();
     remove_node_helper (nid, move_level);
 }
 
 void Mutation_Annotated_Tree::Tree::remove_single_child_nodes() {
+    invalidate_index();
     auto bfs = breadth_first_expansion();
     for (auto n: bfs) {
         if ((n == root) || (n->children.size() != 1)) {
@@ -1135,6 +1347,7 @@ static void remove_child(Mutation_Annotated_Tree::Tree *T, Mutation_Annotated_Tr
 void Mutation_Annotated_Tree::Tree::move_node (std::string source_id, std::string dest_id, bool move_level) {
     // Move source to become a child of destination, update all affected nodes' parent pointers and
     // child lists, and recalculate levels if necessary.
+    invalidate_index();
     Node* source = all_nodes[source_id];
     Node* destination = all_nodes[dest_id];
     Node* curr_parent = source->parent;
@@ -1332,6 +1545,7 @@ void Mutation_Annotated_Tree::Tree::condense_leaves(std::vector<std::string> mis
 }
 
 void Mutation_Annotated_Tree::Tree::uncondense_leaves() {
+    invalidate_index();
     for (auto cn = condensed_nodes.begin(); cn!=condensed_nodes.end(); cn++) {
 
         auto n = get_node(cn->first);
@@ -1420,6 +1634,7 @@ static void collapse_tree_r(Mutation_Annotated_Tree::Tree *T, Mutation_Annotated
 }
 
 void Mutation_Annotated_Tree::Tree::collapse_tree() {
+    invalidate_index();
     collapse_tree_r(this, this->root);
 }
 
@@ -1548,26 +1763,69 @@ Mutation_Annotated_Tree::Tree Mutation_Annotated_Tree::get_tree_copy(const Mutat
     return copy;
 }
 
+// Exact copy of the tree, including node identifiers, child order, mutation
+// order and the internal node counter. Unlike get_tree_copy, nodes are copied
+// directly instead of going through a newick string
+Mutation_Annotated_Tree::Tree Mutation_Annotated_Tree::clone_tree(const Mutation_Annotated_Tree::Tree& tree) {
+    TIMEIT();
+    Tree copy;
+    copy.curr_internal_node = tree.curr_internal_node;
+    if (tree.root == NULL) {
+        return copy;
+    }
+
+    auto dfs1 = tree.depth_first_expansion();
+    std::vector<Node*> dfs2(dfs1.size());
+
+    // Node creation updates the node map of the copy, so it is done serially
+    std::unordered_map<const Node*, Node*> copied;
+    copied.reserve(dfs1.size());
+    for (size_t k = 0; k < dfs1.size(); k++) {
+        auto n1 = dfs1[k];
+        if (n1->parent == NULL) {
+            dfs2[k] = copy.create_node(n1->identifier, n1->branch_length);
+        } else {
+            dfs2[k] = copy.create_node(n1->identifier, copied[n1->parent], n1->branch_length);
+        }
+        copied[n1] = dfs2[k];
+    }
+
+    static tbb::affinity_partitioner ap;
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, dfs1.size()),
+    [&](tbb::blocked_range<size_t> r) {
+        for (size_t k=r.begin(); k<r.end(); ++k) {
+            auto n1 = dfs1[k];
+            auto n2 = dfs2[k];
+            n2->level = n1->level;
+            n2->dfs_idx = n1->dfs_idx;
+            n2->dfs_end_idx = n1->dfs_end_idx;
+            n2->clade_annotations = n1->clade_annotations;
+            n2->mutations = n1->mutations;
+        }
+    }, ap);
+
+    for (auto cn: tree.condensed_nodes) {
+        copy.condensed_nodes.insert(cn);
+    }
+    for (auto l: tree.condensed_leaves) {
+        copy.condensed_leaves.insert(l);
+    }
+
+    return copy;
+}
+
 // Get the last common ancestor of two node identifiers. Return NULL if does not
 // exist
 Mutation_Annotated_Tree::Node* Mutation_Annotated_Tree::LCA (const Mutation_Annotated_Tree::Tree& tree, const std::string& nid1, const std::string& nid2) {
     TIMEIT();
 
-    if ((tree.get_node(nid1) == NULL) || (tree.get_node(nid2) == NULL)) {
+    auto n1 = tree.get_node(nid1);
+    auto n2 = tree.get_node(nid2);
+    if ((n1 == NULL) || (n2 == NULL)) {
         return NULL;
     }
 
-    auto n2_ancestors = tree.rsearch(nid2, true);
-
-    for (auto anc1: tree.rsearch(nid1, true)) {
-        for (auto anc2: n2_ancestors) {
-            if (anc1 == anc2) {
-                return anc1;
-            }
-        }
-    }
-
-    return NULL;
+    return tree.LCA(n1, n2);
 }
 
 // Extract the subtree consisting of the specified set of samples. This routine
@@ -1620,7 +1878,7 @@ Mutation_Annotated_Tree::Tree Mutation_Annotated_Tree::get_subtree (const Mutati
         if (subtree_nodes.find(n) != subtree_nodes.end()) {
             Node* subtree_parent = NULL;
             if (last_subtree_node.size() > 0) {
-                while (!tree.is_ancestor(last_subtree_node.top()->identifier, n->identifier)) {
+                while (!tree.is_ancestor(last_subtree_node.top(), n)) {
                     last_subtree_node.pop();
                 }
                 subtree_parent = last_subtree_node.top();
@@ -1685,6 +1943,7 @@ Mutation_Annotated_Tree::Tree Mutation_Annotated_Tree::get_subtree (const Mutati
 }
 
 void Mutation_Annotated_Tree::clear_tree(Mutation_Annotated_Tree::Tree& T) {
+    T.invalidate_index();
     for (auto n: T.depth_first_expansion()) {
         delete(n);
     }
@@ -1866,7 +2125,7 @@ void Mutation_Annotated_Tree::get_random_sample_subtrees (Mutation_Annotated_Tre
 
                 std::vector<NodeDist> node_distances;
                 for (auto l: T->get_leaves(anc->identifier)) {
-                    if (T->is_ancestor(last_anc->identifier, l->identifier)) {
+                    if (T->is_ancestor(last_anc, l)) {
                         continue;
                     }
 
@@ -2049,6 +2308,313 @@ void Mutation_Annotated_Tree::get_sample_mutation_paths (Mutation_Annotated_Tree
     fclose(mutation_paths_file);
 }
 
+// Size of the decompressed chunks handed to the VCF line parsers
+static const size_t VCF_BLOCK_SIZE = 1 << 23;
+
+// Reads an uncompressed or .gz VCF file in blocks of whole lines. Compressed
+// files are memory mapped and inflated with isa-l, which is several times
+// faster than zlib and keeps the decompression ahead of the parallel parsers
+class VCF_Reader {
+    FILE* fh;
+    unsigned char* map_start;
+    size_t mapped_size;
+    struct inflate_state* state;
+    // Decompressed text not yet returned, starting at pending_start
+    std::string pending;
+    size_t pending_start;
+
+    // Fills buffer with up to size bytes of the decompressed file and returns
+    // the number of bytes read, 0 at the end of the file
+    size_t read_raw(char* buffer, size_t size) {
+        if (state == NULL) {
+            return fread(buffer, 1, size, fh);
+        }
+        state->next_out = (uint8_t*) buffer;
+        state->avail_out = size;
+        while ((state->avail_out > 0) && (state->avail_in > 0)) {
+            if (state->block_state == ISAL_BLOCK_FINISH) {
+                // bgzip output is a series of concatenated gzip members,
+                // anything else after the end of a member is ignored
+                if ((state->next_in[0] != 31) || ((state->avail_in > 1) && (state->next_in[1] != 139))) {
+                    state->avail_in = 0;
+                    break;
+                }
+                isal_inflate_reset(state);
+            }
+            auto ret = isal_inflate(state);
+            if (ret != ISAL_DECOMP_OK) {
+                fprintf(stderr, "ERROR: Could not decompress the VCF file (isa-l error %d)!\n", ret);
+                exit(1);
+            }
+        }
+        return size - state->avail_out;
+    }
+
+    // Appends up to VCF_BLOCK_SIZE bytes to buffer, returns false at the end
+    // of the file
+    bool append_raw(std::string& buffer) {
+        auto old_size = buffer.size();
+        buffer.resize(old_size + VCF_BLOCK_SIZE);
+        auto bytes_read = read_raw(&buffer[old_size], VCF_BLOCK_SIZE);
+        buffer.resize(old_size + bytes_read);
+        return (bytes_read > 0);
+    }
+
+  public:
+    VCF_Reader(const std::string& vcf_filename): fh(NULL), map_start(NULL), mapped_size(0), state(NULL), pending_start(0) {
+        if (vcf_filename.find(".gz\0") == std::string::npos) {
+            fh = fopen(vcf_filename.c_str(), "rb");
+            if (fh == NULL) {
+                fprintf(stderr, "ERROR: Could not open the VCF file: %s!\n", vcf_filename.c_str());
+                exit(1);
+            }
+            return;
+        }
+        int fd = open(vcf_filename.c_str(), O_RDONLY);
+        struct stat stat_buf;
+        if ((fd < 0) || (fstat(fd, &stat_buf) != 0)) {
+            fprintf(stderr, "ERROR: Could not open the VCF file: %s!\n", vcf_filename.c_str());
+            exit(1);
+        }
+        mapped_size = stat_buf.st_size;
+        state = new struct inflate_state;
+        isal_inflate_init(state);
+        state->crc_flag = IGZIP_GZIP;
+        state->avail_in = 0;
+        if (mapped_size > 0) {
+            map_start = (unsigned char*) mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map_start == MAP_FAILED) {
+                fprintf(stderr, "ERROR: Could not map the VCF file: %s!\n", vcf_filename.c_str());
+                exit(1);
+            }
+            madvise(map_start, mapped_size, MADV_SEQUENTIAL);
+            state->next_in = map_start;
+            state->avail_in = mapped_size;
+        }
+        close(fd);
+    }
+
+    ~VCF_Reader() {
+        if (fh != NULL) {
+            fclose(fh);
+        }
+        if (map_start != NULL) {
+            munmap(map_start, mapped_size);
+        }
+        delete state;
+    }
+
+    // Reads the next line without the trailing newline, returns false at the
+    // end of the file
+    bool getline(std::string& line) {
+        size_t line_end;
+        while ((line_end = pending.find('\n', pending_start)) == std::string::npos) {
+            pending.erase(0, pending_start);
+            pending_start = 0;
+            if (!append_raw(pending)) {
+                if (pending.empty()) {
+                    return false;
+                }
+                line_end = pending.size();
+                break;
+            }
+        }
+        line.assign(pending, pending_start, line_end-pending_start);
+        pending_start = std::min(line_end+1, pending.size());
+        return true;
+    }
+
+    // Reads the next block of whole lines (at least VCF_BLOCK_SIZE bytes unless
+    // it is the last one), returns false at the end of the file
+    bool read_block(std::string& block) {
+        block.assign(pending, pending_start, std::string::npos);
+        pending.clear();
+        pending_start = 0;
+        while (append_raw(block)) {
+            auto last_newline = block.rfind('\n');
+            if (last_newline != std::string::npos) {
+                pending.assign(block, last_newline+1, std::string::npos);
+                block.resize(last_newline+1);
+                return true;
+            }
+        }
+        return !block.empty();
+    }
+};
+
+// Reads lines up to the header (where "POS" is the second word) and returns
+// the sample names, which start from the 10th word of the header
+static void read_vcf_header(VCF_Reader& reader, std::vector<std::string>& variant_ids) {
+    std::string s;
+    while (reader.getline(s)) {
+        std::vector<std::string> words;
+        Mutation_Annotated_Tree::string_split(s, words);
+        if ((words.size() > 1) && (words[1] == "POS")) {
+            variant_ids.assign(words.begin()+9, words.end());
+            return;
+        }
+    }
+}
+
+// Reads the header and adds the samples not already in T to missing_samples.
+// Returns the index (among the samples of the VCF) of each added sample
+static std::vector<size_t> add_missing_samples(const Mutation_Annotated_Tree::Tree* T, VCF_Reader& reader,
+        std::vector<Missing_Sample>& missing_samples) {
+    std::vector<std::string> variant_ids;
+    std::vector<size_t> missing_idx;
+    read_vcf_header(reader, variant_ids);
+    for (size_t j=0; j < variant_ids.size(); j++) {
+        if ((T->get_node(variant_ids[j]) == NULL) && (T->condensed_leaves.find(variant_ids[j]) == T->condensed_leaves.end())) {
+            missing_samples.emplace_back(Missing_Sample(variant_ids[j]));
+            missing_idx.emplace_back(j);
+        } else {
+            fprintf(stderr, "WARNING: Ignoring sample %s as it is already in the tree.\n", variant_ids[j].c_str());
+        }
+    }
+    missing_idx.emplace_back(variant_ids.size());
+    return missing_idx;
+}
+
+// Non-reference alleles found in a block of VCF lines. Only the genotypes
+// present in the block are stored, so the size of a block does not depend on
+// the number of samples in the VCF.
+struct VCF_Block_Mutations {
+    // (k, mutation) for the sample missing_idx[k], grouped by sample and in the
+    // order of the VCF lines within a group
+    std::vector<std::pair<size_t, Mutation_Annotated_Tree::Mutation>> mutations;
+    // Start of each group in mutations, followed by mutations.size()
+    std::vector<size_t> group_starts;
+};
+
+// Parses the variant lines in block and collects the non-reference alleles of
+// sample missing_idx[k] in block_mutations. The last element of missing_idx
+// is the number of samples in the VCF. Only the words of the requested
+// samples are copied out of each line.
+static void parse_vcf_block(const std::string& block, const std::vector<size_t>& missing_idx,
+                            VCF_Block_Mutations& block_mutations) {
+    auto& mutations = block_mutations.mutations;
+    size_t num_variant_ids = missing_idx.back();
+    size_t num_samples = missing_idx.size()-1;
+    // Offsets of the first character and one past the last one of each word
+    std::vector<std::pair<size_t, size_t>> words;
+    std::vector<std::string> alleles;
+    for (size_t line_start = 0; line_start < block.size();) {
+        size_t line_end = block.find('\n', line_start);
+        if (line_end == std::string::npos) {
+            line_end = block.size();
+        }
+        words.clear();
+        for (size_t pos = line_start; pos < line_end;) {
+            while ((pos < line_end) && std::isspace((unsigned char) block[pos])) {
+                pos++;
+            }
+            size_t start = pos;
+            while ((pos < line_end) && !std::isspace((unsigned char) block[pos])) {
+                pos++;
+            }
+            if (pos > start) {
+                words.emplace_back(start, pos);
+            }
+        }
+        line_start = line_end+1;
+        if (words.size() != 9+num_variant_ids) {
+            fprintf(stderr, "ERROR! Incorrect VCF format. Expected %zu columns but got %zu.\n", 9+num_variant_ids, words.size());
+            exit(1);
+        }
+        alleles.clear();
+        Mutation_Annotated_Tree::string_split(block.substr(words[4].first, words[4].second-words[4].first), ',', alleles);
+
+        Mutation_Annotated_Tree::Mutation m;
+        m.chrom = block.substr(words[0].first, words[0].second-words[0].first);
+        m.position = std::stoi(block.substr(words[1].first, words[1].second-words[1].first));
+        m.ref_nuc = Mutation_Annotated_Tree::get_nuc_id(block[words[3].first]);
+        assert((m.ref_nuc & (m.ref_nuc-1)) == 0); //check if it is power of 2
+        m.par_nuc = m.ref_nuc;
+        for (size_t k = 0; k < num_samples; k++) {
+            const char* genotype = block.c_str() + words[9+missing_idx[k]].first;
+            // Alleles such as '.' should be treated as missing
+            // data. if the word is numeric, it is an index to one
+            // of the alleles
+            if (isdigit(genotype[0])) {
+                int allele_id = std::strtol(genotype, NULL, 10);
+                if (allele_id == 0) {
+                    continue;
+                }
+                const std::string& allele = alleles[allele_id-1];
+                if (allele[0] == 'N') {
+                    m.is_missing = true;
+                    m.mut_nuc = Mutation_Annotated_Tree::get_nuc_id('N');
+                } else {
+                    auto nuc = Mutation_Annotated_Tree::get_nuc_id(allele[0]);
+                    m.is_missing = (nuc == Mutation_Annotated_Tree::get_nuc_id('N'));
+                    m.mut_nuc = nuc;
+                }
+            } else {
+                m.is_missing = true;
+                m.mut_nuc = Mutation_Annotated_Tree::get_nuc_id('N');
+            }
+            mutations.emplace_back(k, m);
+        }
+    }
+    // Mutations were collected line by line, a stable sort keeps the line
+    // order within each sample
+    std::stable_sort(mutations.begin(), mutations.end(), [](const std::pair<size_t, Mutation_Annotated_Tree::Mutation>& a,
+    const std::pair<size_t, Mutation_Annotated_Tree::Mutation>& b) {
+        return (a.first < b.first);
+    });
+    for (size_t idx = 0; idx < mutations.size(); idx++) {
+        if ((idx == 0) || (mutations[idx].first != mutations[idx-1].first)) {
+            block_mutations.group_starts.emplace_back(idx);
+        }
+    }
+    block_mutations.group_starts.emplace_back(mutations.size());
+}
+
+// Reads the variant lines following the header and adds the non-reference
+// alleles of sample missing_idx[k] to samples[k]. Blocks of lines are parsed
+// in parallel and appended in file order, so each sample gets its mutations
+// in the order of the VCF lines.
+static void read_vcf_genotypes(VCF_Reader& reader, const std::vector<size_t>& missing_idx, Missing_Sample* samples) {
+    size_t max_blocks = 2*tbb::this_task_arena::max_concurrency();
+    tbb::parallel_pipeline(max_blocks,
+                           tbb::make_filter<void, std::string*>(tbb::filter_mode::serial_in_order,
+    [&](tbb::flow_control& fc) -> std::string* {
+        auto block = new std::string;
+        if (!reader.read_block(*block)) {
+            delete block;
+            fc.stop();
+            return NULL;
+        }
+        return block;
+    }) &
+    tbb::make_filter<std::string*, VCF_Block_Mutations*>(tbb::filter_mode::parallel,
+    [&](std::string* block) {
+        auto block_mutations = new VCF_Block_Mutations;
+        parse_vcf_block(*block, missing_idx, *block_mutations);
+        delete block;
+        return block_mutations;
+    }) &
+    tbb::make_filter<VCF_Block_Mutations*, void>(tbb::filter_mode::serial_in_order,
+    [&](VCF_Block_Mutations* block_mutations) {
+        auto& mutations = block_mutations->mutations;
+        const auto& group_starts = block_mutations->group_starts;
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, group_starts.size()-1),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t g = r.begin(); g < r.end(); g++) {
+                auto& sample = samples[mutations[group_starts[g]].first];
+                for (size_t idx = group_starts[g]; idx < group_starts[g+1]; idx++) {
+                    auto& m = mutations[idx].second;
+                    if ((m.mut_nuc & (m.mut_nuc-1)) !=0) {
+                        sample.num_ambiguous++;
+                    }
+                    sample.mutations.emplace_back(std::move(m));
+                }
+            }
+        });
+        delete block_mutations;
+    }));
+}
+
 void Mutation_Annotated_Tree::read_vcf(Mutation_Annotated_Tree::Tree* T, std::string &vcf_filename, std::vector<Missing_Sample>& missing_samples, bool create_new_mat) {
     if (create_new_mat) {
         // If called with a tree file that needs to create a MAT
@@ -2074,22 +2640,7 @@ void Mutation_Annotated_Tree::read_vcf(Mutation_Annotated_Tree::Tree* T, std::st
         fprintf(stderr, "Loading VCF file.\n");
         timer.Start();
 
-        // Boost library used to stream the contents of the input VCF file in
-        // uncompressed or compressed .gz format
-        std::ifstream infile(vcf_filename, std::ios_base::in | std::ios_base::binary);
-        if (!infile) {
-            fprintf(stderr, "ERROR: Could not open the VCF file: %s!\n", vcf_filename.c_str());
-            exit(1);
-        }
-        boost::iostreams::filtering_istream instream;
-        try {
-            if (vcf_filename.find(".gz\0") != std::string::npos) {
-                instream.push(boost::iostreams::gzip_decompressor());
-            }
-            instream.push(infile);
-        } catch(const boost::iostreams::gzip_error& e) {
-            std::cout << e.what() << '\n';
-        }
+        VCF_Reader vcf_reader(vcf_filename);
 
         fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
 
@@ -2113,14 +2664,12 @@ void Mutation_Annotated_Tree::read_vcf(Mutation_Annotated_Tree::Tree* T, std::st
             mapper_input inp;
 
             //check if reached end-of-file
-            int curr_char = instream.peek();
-            if(curr_char == EOF) {
+            std::string s;
+            if (!vcf_reader.getline(s)) {
                 fc.stop();
                 return inp;
             }
 
-            std::string s;
-            std::getline(instream, s);
             std::vector<std::string> words;
             string_split(s, words);
             inp.variant_pos = -1;
@@ -2179,101 +2728,25 @@ void Mutation_Annotated_Tree::read_vcf(Mutation_Annotated_Tree::Tree* T, std::st
         mapper_graph.wait_for_all();
     } else {
         // Read vcf with existing mat
-
         fprintf(stderr, "Loading VCF file\n");
-        // Boost library used to stream the contents of the input VCF file in
-        // uncompressed or compressed .gz format
-        std::ifstream infile(vcf_filename, std::ios_base::in | std::ios_base::binary);
-        if (!infile) {
-            fprintf(stderr, "ERROR: Could not open the VCF file: %s!\n", vcf_filename.c_str());
-            exit(1);
-        }
-        boost::iostreams::filtering_istream instream;
-        try {
-            if (vcf_filename.find(".gz\0") != std::string::npos) {
-                instream.push(boost::iostreams::gzip_decompressor());
-            }
-            instream.push(infile);
-        } catch(const boost::iostreams::gzip_error& e) {
-            std::cout << e.what() << '\n';
-        }
+        VCF_Reader reader(vcf_filename);
 
-        bool header_found = false;
-        std::vector<std::string> variant_ids;
-        std::vector<size_t> missing_idx;
-        std::string s;
-        // This while loop reads the VCF file line by line and populates
-        // missing_samples and missing_sample_mutations based on the names and
-        // variants of missing samples. If a sample name in the VCF is already
-        // found in the tree, it gets ignored with a warning message
-        while (instream.peek() != EOF) {
-            std::getline(instream, s);
-            std::vector<std::string> words;
-            string_split(s, words);
-            if ((not header_found) && (words.size() > 1)) {
-                if (words[1] == "POS") {
-                    for (size_t j=9; j < words.size(); j++) {
-                        variant_ids.emplace_back(words[j]);
-                        if ((T->get_node(words[j]) == NULL) && (T->condensed_leaves.find(words[j]) == T->condensed_leaves.end())) {
-                            missing_samples.emplace_back(Missing_Sample(words[j]));
-                            missing_idx.emplace_back(j);
-                        } else {
-                            fprintf(stderr, "WARNING: Ignoring sample %s as it is already in the tree.\n", words[j].c_str());
-                        }
-                    }
-                    header_found = true;
-                }
-            } else if (header_found) {
-                if (words.size() != 9+variant_ids.size()) {
-                    fprintf(stderr, "ERROR! Incorrect VCF format. Expected %zu columns but got %zu.\n", 9+variant_ids.size(), words.size());
-                    exit(1);
-                }
-                std::vector<std::string> alleles;
-                alleles.clear();
-                string_split(words[4], ',', alleles);
-                for (size_t k = 0; k < missing_idx.size(); k++) {
-                    size_t j = missing_idx[k];
-                    auto iter = missing_samples.begin();
-                    std::advance(iter, k);
-                    if (iter != missing_samples.end()) {
-                        Mutation m;
-                        m.chrom = words[0];
-                        m.position = std::stoi(words[1]);
-                        m.ref_nuc = get_nuc_id(words[3][0]);
-                        assert((m.ref_nuc & (m.ref_nuc-1)) == 0); //check if it is power of 2
-                        m.par_nuc = m.ref_nuc;
-                        // Alleles such as '.' should be treated as missing
-                        // data. if the word is numeric, it is an index to one
-                        // of the alleles
-                        if (isdigit(words[j][0])) {
-                            int allele_id = std::stoi(words[j]);
-                            if (allele_id > 0) {
-                                std::string allele = alleles[allele_id-1];
-                                if (allele[0] == 'N') {
-                                    m.is_missing = true;
-                                    m.mut_nuc = get_nuc_id('N');
-                                } else {
-                                    auto nuc = get_nuc_id(allele[0]);
-                                    if (nuc == get_nuc_id('N')) {
-                                        m.is_missing = true;
-                                    } else {
-                                        m.is_missing = false;
-                                    }
-                                    m.mut_nuc = nuc;
-                                }
-                                (*iter).mutations.emplace_back(m);
-                            }
-                        } else {
-                            m.is_missing = true;
-                            m.mut_nuc = get_nuc_id('N');
-                            (*iter).mutations.emplace_back(m);
-                        }
-                        if ((m.mut_nuc & (m.mut_nuc-1)) !=0) {
-                            (*iter).num_ambiguous++;
-                        }
-                    }
-                }
-            }
-        }
+        size_t first_missing = missing_samples.size();
+        auto missing_idx = add_missing_samples(T, reader, missing_samples);
+        read_vcf_genotypes(reader, missing_idx, missing_samples.data()+first_missing);
     }
 }
+
+std::vector<size_t> Mutation_Annotated_Tree::read_vcf_missing_samples(const Mutation_Annotated_Tree::Tree* T, const std::string& vcf_filename, std::vector<Missing_Sample>& missing_samples) {
+    VCF_Reader reader(vcf_filename);
+    return add_missing_samples(T, reader, missing_samples);
+}
+
+void Mutation_Annotated_Tree::read_vcf_samples(const std::string& vcf_filename, const std::vector<size_t>& missing_idx, std::vector<Missing_Sample>& missing_samples, size_t start, size_t end) {
+    VCF_Reader reader(vcf_filename);
+    std::vector<std::string> variant_ids;
+    read_vcf_header(reader, variant_ids);
+    std::vector<size_t> batch_idx(missing_idx.begin()+start, missing_idx.begin()+end);
+    batch_idx.emplace_back(missing_idx.back());
+    read_vcf_genotypes(reader, batch_idx, missing_samples.data()+start);
+}
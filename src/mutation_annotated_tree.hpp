@@ -10,6 +10,9 @@
 #include <unordered_set>
 #include <algorithm>
 #include <cassert>
+#include <memory>
+#include <atomic>
+#include <mutex>
 #include <tbb/flow_graph.h>
 #include <tbb/rw_mutex.h>
 #include <tbb/scalable_allocator.h>
@@ -96,6 +99,9 @@ class Node {
     std::vector<Mutation> mutations;
     size_t dfs_idx;
     size_t dfs_end_idx;
+    // Position in the depth-first order of the Tree_Index, valid while the index is
+    // not invalidated
+    size_t index_dfs_idx;
 
     bool is_leaf();
     bool is_root();
@@ -110,11 +116,73 @@ class Node {
     Mutation_Annotated_Tree::Node* find_child_with_muts(std::vector<Mutation> &muts);
 };
 
+// Constant time ancestry and LCA queries. Nodes are numbered in depth-first order
+// (Node::index_dfs_idx), so the descendants of a node are an interval of that order.
+// LCAs are range minimums over node depths in that order (the Euler tour restricted
+// to first visits), indexed per block of nodes by a sparse table.
+class Tree_Index {
+    static const size_t block_size = 64;
+    std::vector<Node*> dfs;
+    std::vector<uint32_t> dfs_end;
+    std::vector<uint32_t> depth;
+    //block_min[level][b] is the index of the shallowest node in blocks [b, b+2^level)
+    std::vector<std::vector<uint32_t>> block_min;
+
+    uint32_t shallower(uint32_t a, uint32_t b) const {
+        return (depth[b] < depth[a]) ? b : a;
+    }
+    uint32_t scan_min(size_t start, size_t end) const;
+    uint32_t range_min(size_t start, size_t end) const;
+  public:
+    Tree_Index(Node* root);
+    size_t size() const {
+        return dfs.size();
+    }
+    Node* get_dfs_node(size_t idx) const {
+        return dfs[idx];
+    }
+    size_t get_depth(const Node* n) const {
+        return depth[n->index_dfs_idx];
+    }
+    size_t get_num_descendants(const Node* n) const {
+        return dfs_end[n->index_dfs_idx] - n->index_dfs_idx - 1;
+    }
+    // True if anc is a proper ancestor of n
+    bool is_ancestor(const Node* anc, const Node* n) const {
+        return (anc->index_dfs_idx < n->index_dfs_idx) && (n->index_dfs_idx < dfs_end[anc->index_dfs_idx]);
+    }
+    Node* LCA(const Node* n1, const Node* n2) const;
+};
+
+// Lazily built Tree_Index of a Tree. The first query builds the index under a
+// lock and later ones only load an atomic pointer, so queries can run in
+// parallel. reset() must not run concurrently with queries; references to the
+// index are valid until then. Copies start without an index.
+class Tree_Index_Holder {
+    mutable std::mutex build_mutex;
+    mutable std::atomic<const Tree_Index*> index;
+  public:
+    Tree_Index_Holder(): index(NULL) {}
+    Tree_Index_Holder(const Tree_Index_Holder&): index(NULL) {}
+    Tree_Index_Holder& operator=(const Tree_Index_Holder&) {
+        reset();
+        return *this;
+    }
+    ~Tree_Index_Holder() {
+        reset();
+    }
+    const Tree_Index& get(Node* root) const;
+    void reset() {
+        delete index.exchange(NULL);
+    }
+};
+
 class Tree {
   private:
     void remove_node_helper (std::string nid, bool move_level);
     void depth_first_expansion_helper(Node* node, std::vector<Node*>& vec) const;
     std::unordered_map <std::string, Node*> all_nodes;
+    Tree_Index_Holder index;
   public:
     Tree() {
         root = NULL;
@@ -143,6 +211,22 @@ class Tree {
     Node* create_node (std::string const& identifier, std::string const& parent_id, float branch_length = -1.0);
     Node* get_node (std::string identifier) const;
     bool is_ancestor (std::string anc_id, std::string nid) const;
+    // Ancestry and LCA index, built on first use and dropped by topology edits
+    // through Tree methods. Code editing parent/children links directly must
+    // call invalidate_index(), which must not run concurrently with queries.
+    // The returned reference is valid until the next invalidation.
+    const Tree_Index& get_index() const {
+        return index.get(root);
+    }
+    void invalidate_index() {
+        index.reset();
+    }
+    bool is_ancestor (const Node* anc, const Node* node) const {
+        return get_index().is_ancestor(anc, node);
+    }
+    Node* LCA (const Node* n1, const Node* n2) const {
+        return get_index().LCA(n1, n2);
+    }
     std::vector<Node*> rsearch (const std::string& nid, bool include_self = false) const;
     std::string get_clade_assignment (const Node* n, int clade_id, bool include_self = true) const;
     void remove_node (std::string nid, bool move_level);
@@ -171,8 +255,13 @@ Mutation* mutation_from_string(const std::string& mut_string);
 
 Tree load_mutation_annotated_tree (std::string filename);
 void save_mutation_annotated_tree (Tree tree, std::string filename);
+// Flat mmap-able snapshot format (see mat_snapshot.hpp), load_mutation_annotated_tree
+// also recognizes snapshots by their magic number
+Tree load_mutation_annotated_tree_snapshot (std::string filename);
+void save_mutation_annotated_tree_snapshot (const Tree& tree, std::string filename);
 
 Tree get_tree_copy(const Tree& tree, const std::string& identifier="");
+Tree clone_tree(const Tree& tree);
 
 Node* LCA (const Tree& tree, const std::string& node_id1, const std::string& node_id2);
 Tree get_subtree (const Tree& tree, const std::vector<std::string>& samples, bool keep_clade_annotations=false);
@@ -182,5 +271,11 @@ void get_sample_mutation_paths (Mutation_Annotated_Tree::Tree* T, std::vector<st
 void clear_tree(Tree& tree);
 
 void read_vcf (Mutation_Annotated_Tree::Tree* T, std::string &vcf_filename, std::vector<Missing_Sample>& missing_samples, bool create_new_mat);
+// For reading the samples of a VCF in batches with an existing tree: reads the
+// header only, adding the samples not in T to missing_samples without their
+// genotypes, and returns what read_vcf_samples needs to load them
+std::vector<size_t> read_vcf_missing_samples (const Tree* T, const std::string& vcf_filename, std::vector<Missing_Sample>& missing_samples);
+// Loads the genotypes of missing_samples[start, end) in one pass over the VCF
+void read_vcf_samples (const std::string& vcf_filename, const std::vector<size_t>& missing_idx, std::vector<Missing_Sample>& missing_samples, size_t start, size_t end);
 }
 
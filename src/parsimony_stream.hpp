@@ -0,0 +1,159 @@
+#pragma once
+// Incremental decoder for Parsimony::data, shared by the classic and matOptimize
+// MAT loaders.
+//
+// Parsing the whole Parsimony::data message first keeps the full protobuf object
+// graph (every mut with its own chromosome string) in memory next to the tree being
+// built from it. Instead, the top level fields are read one at a time: the newick
+// string builds the tree, and every node_mutations / metadata record is kept as its
+// raw bytes only until a worker converts it into the mutations of its node. Reading
+// (and gunzip) runs in the serial input stage of a pipeline, so it overlaps with the
+// conversion of earlier records.
+//
+// The serializer writes the newick string (field 1) before node_mutations (field 2)
+// and metadata (field 4); records that arrive before the newick string are held back
+// until it is read.
+#include "parsimony.pb.h"
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <tbb/parallel_pipeline.h>
+#include <tbb/task_arena.h>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Parsimony_Stream {
+static const uint32_t NEWICK_FIELD = 1;
+static const uint32_t NODE_MUTATIONS_FIELD = 2;
+static const uint32_t CONDENSED_NODES_FIELD = 3;
+static const uint32_t METADATA_FIELD = 4;
+//raw bytes of node records handed to a conversion task at once
+static const size_t BATCH_BYTES = 1 << 20;
+
+struct Record {
+    uint32_t field;
+    //index of the node in DFS pre-order
+    size_t idx;
+    std::string bytes;
+};
+
+// Decodes a Parsimony::data message from stream.
+// on_newick(const std::string& newick) builds the tree and returns its number of nodes.
+// on_mutations(size_t idx, const Parsimony::mutation_list&) and
+// on_metadata(size_t idx, const Parsimony::node_metadata&) are called concurrently,
+// at most once per node and record type.
+// on_condensed(const Parsimony::condensed_node&) is called serially after all nodes.
+// Returns false if the message is malformed; has_metadata is set if any metadata record was read.
+template<typename Newick_Fn, typename Mutations_Fn, typename Metadata_Fn, typename Condensed_Fn>
+bool read_data(google::protobuf::io::ZeroCopyInputStream* stream, bool& has_metadata, Newick_Fn on_newick,
+               Mutations_Fn on_mutations, Metadata_Fn on_metadata, Condensed_Fn on_condensed) {
+    typedef google::protobuf::internal::WireFormatLite WireFormatLite;
+    google::protobuf::io::CodedInputStream input(stream);
+    bool have_newick = false;
+    bool at_end = false;
+    std::atomic_bool failed(false);
+    size_t num_nodes = 0;
+    size_t num_mutation_lists = 0;
+    size_t num_metadata = 0;
+    std::vector<Record> deferred;
+    std::vector<std::string> condensed_nodes;
+    size_t max_batches = 2 * tbb::this_task_arena::max_concurrency();
+    tbb::parallel_pipeline(max_batches,
+                           tbb::make_filter<void, std::vector<Record>*>(tbb::filter_mode::serial_in_order,
+    [&](tbb::flow_control& fc) -> std::vector<Record>* {
+        auto batch = new std::vector<Record>;
+        size_t batch_bytes = 0;
+        while (!at_end && !failed && batch_bytes < BATCH_BYTES) {
+            auto tag = input.ReadTag();
+            if (tag == 0) {
+                at_end = true;
+                if (!input.ConsumedEntireMessage()) {
+                    failed = true;
+                }
+                break;
+            }
+            uint32_t field = WireFormatLite::GetTagFieldNumber(tag);
+            if ((field < NEWICK_FIELD) || (field > METADATA_FIELD) ||
+                    (WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_LENGTH_DELIMITED)) {
+                if (!WireFormatLite::SkipField(&input, tag)) {
+                    failed = true;
+                }
+                continue;
+            }
+            std::string bytes;
+            uint32_t length;
+            if (!input.ReadVarint32(&length) || !input.ReadString(&bytes, length)) {
+                failed = true;
+                break;
+            }
+            batch_bytes += length;
+            if (field == NEWICK_FIELD) {
+                num_nodes = on_newick(bytes);
+                have_newick = true;
+                for (auto& record : deferred) {
+                    batch->emplace_back(std::move(record));
+                }
+                deferred.clear();
+            } else if (field == CONDENSED_NODES_FIELD) {
+                condensed_nodes.emplace_back(std::move(bytes));
+            } else {
+                size_t idx = (field == NODE_MUTATIONS_FIELD) ? num_mutation_lists++ : num_metadata++;
+                (have_newick ? *batch : deferred).emplace_back(Record{field, idx, std::move(bytes)});
+            }
+        }
+        if (batch->empty() && (at_end || failed)) {
+            delete batch;
+            fc.stop();
+            return NULL;
+        }
+        return batch;
+    }) &
+    tbb::make_filter<std::vector<Record>*, void>(tbb::filter_mode::parallel,
+    [&](std::vector<Record>* batch) {
+        Parsimony::mutation_list mutation_list;
+        Parsimony::node_metadata metadata;
+        for (const auto& record : *batch) {
+            if (record.idx >= num_nodes) {
+                failed = true;
+                break;
+            }
+            if (record.field == NODE_MUTATIONS_FIELD) {
+                if (!mutation_list.ParseFromString(record.bytes)) {
+                    failed = true;
+                    break;
+                }
+                on_mutations(record.idx, mutation_list);
+            } else {
+                if (!metadata.ParseFromString(record.bytes)) {
+                    failed = true;
+                    break;
+                }
+                on_metadata(record.idx, metadata);
+            }
+        }
+        delete batch;
+    }));
+    if (!have_newick && !failed) {
+        //an empty newick string is not serialized at all
+        if (!deferred.empty()) {
+            return false;
+        }
+        num_nodes = on_newick(std::string());
+    }
+    if (failed || (num_mutation_lists < num_nodes)) {
+        return false;
+    }
+    Parsimony::condensed_node condensed_node;
+    for (const auto& bytes : condensed_nodes) {
+        if (!condensed_node.ParseFromString(bytes)) {
+            return false;
+        }
+        on_condensed(condensed_node);
+    }
+    has_metadata = (num_metadata > 0);
+    return true;
+}
+}
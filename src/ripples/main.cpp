@@ -8,6 +8,7 @@
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 #include "tbb/concurrent_unordered_set.h"
+#include "tbb/parallel_pipeline.h"
 #include "../usher_graph.hpp"
 
 
@@ -164,6 +165,46 @@ std::vector<Recomb_Interval> combine_intervals(std::vector<Recomb_Interval> pair
 }
 
 
+// Placement of the pruned recombinant branch at a candidate donor or acceptor
+struct Placement_Positions {
+    MAT::Node* node;
+    int set_difference;
+    bool has_unique;
+    // Sorted positions of the excess mutations of the placement not carried by node itself
+    std::vector<int> positions;
+    Placement_Positions() {
+        node = NULL;
+        set_difference = 0;
+        has_unique = false;
+    }
+};
+
+struct Recomb_Search_Result {
+    int orig_parsimony;
+    bool has_recomb;
+    std::vector<Recomb_Interval> valid_pairs;
+};
+
+std::vector<int> unmatched_positions(const std::vector<MAT::Mutation>& excess_mutations, const MAT::Node* node) {
+    std::vector<int> positions;
+    for (const auto& m1: excess_mutations) {
+        bool found = false;
+        if (!m1.is_masked()) {
+            for (const auto& m2: node->mutations) {
+                if ((m1.position == m2.position) && (m1.mut_nuc == m2.mut_nuc)) {
+                    found = true;
+                    break;
+                }
+            }
+        }
+        if (!found) {
+            positions.emplace_back(m1.position);
+        }
+    }
+    std::sort(positions.begin(), positions.end());
+    return positions;
+}
+
 int main(int argc, char** argv) {
     po::variables_map vm = check_options(argc, argv);
     std::string input_mat_filename = vm["input-mat"].as<std::string>();
@@ -288,6 +329,19 @@ int main(int argc, char** argv) {
         tree_num_leaves[n] = desc;
     }
 
+    // Nodes large enough to be donors or acceptors
+    std::vector<size_t> eligible_nodes;
+    for (size_t k = 0; k < bfs.size(); k++) {
+        if (tree_num_leaves[bfs[k]] >= num_descendants) {
+            eligible_nodes.emplace_back(k);
+        }
+    }
+
+    // The tree is not modified from here on, so the ancestral mutations of
+    // every node are computed once and shared by all branches
+    Ancestral_Mutations_Cache ancestral_mutations_cache;
+    ancestral_mutations_cache.build(&T);
+
     size_t s = 0, e = nodes_to_consider.size();
 
     if ((start_idx >= 0) && (end_idx >= 0)) {
@@ -299,12 +353,16 @@ int main(int argc, char** argv) {
 
     fprintf(stderr, "Running placement individually for %zu branches to identify potential recombination events.\n", e-s);
 
-    size_t num_done = 0;
-    for (size_t idx = s; idx < e; idx++) {
-        auto nid_to_consider = nodes_to_consider_vec[idx];
-        fprintf(stderr, "At node id: %s\n", nid_to_consider.c_str());
+    // Search for recombination on one branch. Placing the pruned branch at
+    // each node is scored once, keeping the sorted positions of the mutations
+    // it adds, so that each breakpoint pair only has to count the positions
+    // falling inside or outside the donor interval.
+    auto find_recombination = [&](const std::string& nid_to_consider) {
+        Recomb_Search_Result result;
 
-        int orig_parsimony = (int) T.get_node(nid_to_consider)->mutations.size();
+        auto node_to_consider = T.get_node(nid_to_consider);
+        int orig_parsimony = (int) node_to_consider->mutations.size();
+        result.orig_parsimony = orig_parsimony;
 
         Pruned_Sample pruned_sample(nid_to_consider);
         // Find mutations on the node to prune
@@ -316,395 +374,246 @@ int main(int argc, char** argv) {
         }
         size_t num_mutations = pruned_sample.sample_mutations.size();
 
-        size_t total_nodes = bfs.size();
-
-        std::vector<std::vector<MAT::Mutation>> node_excess_mutations(total_nodes);
-        std::vector<std::vector<MAT::Mutation>> imputed_mutations(total_nodes);
-
-        std::vector<int> node_set_difference(total_nodes);
-
-        size_t best_node_num_leaves = 0;
-        int best_set_difference = 1e9;
-
-        std::vector<bool> node_has_unique(total_nodes);
-        size_t best_j = 0;
-        bool best_node_has_unique = false;
-
-        size_t best_distance = 1e9;
-
-        std::vector<size_t> best_j_vec;
-
-        size_t num_best = 1;
-        MAT::Node* best_node = T.root;
-        best_j_vec.emplace_back(0);
-
-        std::vector<size_t> node_distance(total_nodes, 0);
+        // Descendants of the recombinant node cannot be donors or acceptors
+        std::vector<Placement_Positions> placements;
+        for (auto k: eligible_nodes) {
+            if (!T.is_ancestor(node_to_consider, bfs[k])) {
+                placements.emplace_back();
+                placements.back().node = bfs[k];
+            }
+        }
 
-        tbb::parallel_for( tbb::blocked_range<size_t>(0, total_nodes),
+        tbb::parallel_for( tbb::blocked_range<size_t>(0, placements.size()),
         [&](tbb::blocked_range<size_t> r) {
             for (size_t k=r.begin(); k<r.end(); ++k) {
-                if (tree_num_leaves[bfs[k]] < num_descendants) {
-                    continue;
-                }
-
-                node_has_unique[k] = false;
+                auto& placement = placements[k];
+                std::vector<MAT::Mutation> excess_mutations;
+                std::vector<MAT::Mutation> imputed_mutations;
+                int best_set_difference = 1e9;
 
                 mapper2_input inp;
                 inp.T = &T;
-                inp.node = bfs[k];
+                inp.node = placement.node;
                 inp.missing_sample_mutations = &pruned_sample.sample_mutations;
-                inp.excess_mutations = &node_excess_mutations[k];
-                inp.imputed_mutations = &imputed_mutations[k];
-                inp.best_node_num_leaves = &best_node_num_leaves;
+                inp.excess_mutations = &excess_mutations;
+                inp.imputed_mutations = &imputed_mutations;
                 inp.best_set_difference = &best_set_difference;
-                inp.best_node = &best_node;
-                inp.best_j =  &best_j;
-                inp.num_best = &num_best;
-                inp.j = k;
-                inp.has_unique = &best_node_has_unique;
+                inp.set_difference = &placement.set_difference;
+                inp.ancestral_mutations_cache = &ancestral_mutations_cache;
+                inp.node_has_unique_out = &placement.has_unique;
+
+                mapper2_body(inp, true);
 
-                inp.set_difference = &node_set_difference[k];
+                placement.positions = unmatched_positions(excess_mutations, placement.node);
+            }
+        });
 
-                inp.distance = node_distance[k];
-                inp.best_distance = &best_distance;
+        // Pairs found for each first breakpoint, concatenated in order so
+        // the output does not depend on scheduling
+        std::vector<std::vector<Recomb_Interval>> valid_pairs_at(num_mutations);
 
-                inp.best_j_vec = &best_j_vec;
-                inp.node_has_unique = &(node_has_unique);
+        tbb::parallel_for( tbb::blocked_range<size_t>(0, num_mutations),
+        [&](tbb::blocked_range<size_t> r) {
+            for (size_t i=r.begin(); i<r.end(); ++i) {
+                for (size_t j=i; j<num_mutations; j++) {
+                    // Mutations of the pruned sample are at distinct positions,
+                    // so the donor gets j-i of them and the acceptor the rest
+                    size_t num_donor_mutations = j-i;
+                    size_t num_acceptor_mutations = num_mutations-num_donor_mutations;
 
-                mapper2_body(inp, true);
+                    int start_range_high = pruned_sample.sample_mutations[i].position;
+                    int start_range_low = (i>=1) ? pruned_sample.sample_mutations[i-1].position : 0;
 
-            }
-        }, ap);
+                    //int end_range_high = pruned_sample.sample_mutations[j].position;
+                    int end_range_high = 1e9;
+                    int end_range_low = (j>=1) ? pruned_sample.sample_mutations[j-1].position : 0;
 
-        std::vector<Recomb_Interval> valid_pairs;
-        bool has_recomb = false;
+                    //int end_range_low = pruned_sample.sample_mutations[j].position;
+                    //int end_range_high = (j+1<num_mutations) ? pruned_sample.sample_mutations[j+1].position : 1e9;
 
-        size_t at = 0;
-        for (size_t i = 0; i<num_mutations; i++) {
-            for (size_t j=i; j<num_mutations; j++) {
-                fprintf(stderr, "\rTrying %zu of %zu breakpoint pairs.", ++at, num_mutations*(1+num_mutations)/2);
-                Pruned_Sample donor("donor");
-                Pruned_Sample acceptor("acceptor");
+                    if ((num_donor_mutations < branch_len) || (num_acceptor_mutations < branch_len) ||
+                            (end_range_low-start_range_high < min_range) || (end_range_low-start_range_high > max_range)) {
+                        continue;
+                    }
 
-                donor.sample_mutations.clear();
-                acceptor.sample_mutations.clear();
+                    tbb::concurrent_vector<Recomb_Node> donor_nodes;
+                    tbb::concurrent_vector<Recomb_Node> acceptor_nodes;
+
+                    // The donor is charged the mutations within
+                    // [start_range_high, end_range_low], the acceptor the rest
+                    tbb::parallel_for( tbb::blocked_range<size_t>(0, placements.size()),
+                    [&](tbb::blocked_range<size_t> r2) {
+                        for (size_t k=r2.begin(); k<r2.end(); ++k) {
+                            const auto& placement = placements[k];
+                            const auto& positions = placement.positions;
+                            auto first = std::lower_bound(positions.begin(), positions.end(), start_range_high);
+                            auto last = std::upper_bound(positions.begin(), positions.end(), end_range_low);
+                            size_t num_inside = (first < last) ? (last - first) : 0;
+                            size_t num_outside = positions.size() - num_inside;
+                            char is_sibling = (placement.node->is_leaf() || placement.has_unique) ? 'y' : 'n';
+
+                            if (num_outside + parsimony_improvement <= (size_t) orig_parsimony) {
+                                acceptor_nodes.emplace_back(Recomb_Node(placement.node->identifier, placement.set_difference, num_outside, is_sibling));
+                            }
+                            if (num_inside + parsimony_improvement <= (size_t) orig_parsimony) {
+                                donor_nodes.emplace_back(Recomb_Node(placement.node->identifier, placement.set_difference, num_inside, is_sibling));
+                            }
+                        }
+                    });
 
-                for (size_t k=0; k<num_mutations; k++) {
-                    if ((k>=i) && (k<j)) {
-                        donor.add_mutation(pruned_sample.sample_mutations[k]);
-                    } else {
-                        acceptor.add_mutation(pruned_sample.sample_mutations[k]);
+                    if (acceptor_nodes.size() == 0) {
+                        continue;
                     }
-                }
 
-                int start_range_high = pruned_sample.sample_mutations[i].position;
-                int start_range_low = (i>=1) ? pruned_sample.sample_mutations[i-1].position : 0;
+                    tbb::parallel_sort (donor_nodes.begin(), donor_nodes.end());
+                    tbb::parallel_sort (acceptor_nodes.begin(), acceptor_nodes.end());
 
-                //int end_range_high = pruned_sample.sample_mutations[j].position;
-                int end_range_high = 1e9;
-                int end_range_low = (j>=1) ? pruned_sample.sample_mutations[j-1].position : 0;
 
-                //int end_range_low = pruned_sample.sample_mutations[j].position;
-                //int end_range_high = (j+1<num_mutations) ? pruned_sample.sample_mutations[j+1].position : 1e9;
+                    if (donor_nodes.size() > 1000) {
+                        donor_nodes.resize(1000);
+                    }
 
-                if ((donor.sample_mutations.size() < branch_len) || (acceptor.sample_mutations.size() < branch_len) ||
-                        (end_range_low-start_range_high < min_range) || (end_range_low-start_range_high > max_range)) {
-                    continue;
-                }
+                    if (acceptor_nodes.size() > 1000) {
+                        acceptor_nodes.resize(1000);
+                    }
 
-                tbb::concurrent_vector<Recomb_Node> donor_nodes;
-                tbb::concurrent_vector<Recomb_Node> acceptor_nodes;
 
-                donor_nodes.clear();
-                acceptor_nodes.clear();
-                // find acceptor(s)
-                {
-                    tbb::parallel_for( tbb::blocked_range<size_t>(0, total_nodes),
-                    [&](tbb::blocked_range<size_t> r) {
+                    // to print any pair of breakpoint interval exactly once for
+                    // multiple donor-acceptor pairs
+                    bool has_printed = false;
 
+                    for (auto d: donor_nodes) {
+                        for (auto a:acceptor_nodes) {
+                            // Ensure donor and acceptor are not the same and
+                            // not the recombinant node and total parsimony is
+                            // less than the maximum allowed
+                            if ((d.name!=a.name) && (d.name!=nid_to_consider) && (a.name!=nid_to_consider) &&
+                                    (orig_parsimony >= d.parsimony + a.parsimony + parsimony_improvement)) {
+                                Pruned_Sample donor("curr-donor");
+                                donor.sample_mutations.clear();
 
-                        for (size_t k=r.begin(); k<r.end(); ++k) {
-                            size_t num_mut = 0;
-                            if ((tree_num_leaves[bfs[k]] < num_descendants) || (T.is_ancestor(nid_to_consider,bfs[k]->identifier))) {
-                                continue;
-                            }
-                            // Is placement as sibling
-                            if (bfs[k]->is_leaf() || node_has_unique[k]) {
-                                std::vector<MAT::Mutation> l2_mut;
-
-                                // Compute l2_mut
-                                for (auto m1: node_excess_mutations[k]) {
-                                    bool found = false;
-                                    for (auto m2: bfs[k]->mutations) {
-                                        if (m1.is_masked()) {
-                                            break;
-                                        }
-                                        if (m1.position == m2.position) {
-                                            if (m1.mut_nuc == m2.mut_nuc) {
-                                                found = true;
-                                                break;
-                                            }
-                                        }
-                                    }
-                                    if (!found) {
-                                        if ((m1.position < start_range_high) || (m1.position > end_range_low)) {
-                                            num_mut++;
-                                        }
-                                    }
-                                    if (num_mut + parsimony_improvement > (size_t) orig_parsimony) {
-                                        break;
+                                for (auto anc: T.rsearch(d.name, true)) {
+                                    for (auto mut: anc->mutations) {
+                                        donor.add_mutation(mut);
                                     }
                                 }
 
-                                if (num_mut + parsimony_improvement <= (size_t) orig_parsimony) {
-                                    acceptor_nodes.emplace_back(Recomb_Node(bfs[k]->identifier, node_set_difference[k], num_mut, 'y'));
-                                }
-                            }
-                            // Else placement as child
-                            else {
-                                for (auto m1: node_excess_mutations[k]) {
-                                    bool found = false;
-                                    for (auto m2: bfs[k]->mutations) {
-                                        if (m1.is_masked()) {
-                                            break;
-                                        }
-                                        if (m1.position == m2.position) {
-                                            if (m1.mut_nuc == m2.mut_nuc) {
-                                                found = true;
-                                                break;
+                                for (auto mut: donor.sample_mutations) {
+                                    if ((mut.position > start_range_low) && (mut.position <= start_range_high)) {
+                                        bool in_pruned_sample = false;
+                                        for (auto mut2: pruned_sample.sample_mutations) {
+                                            if (mut.position == mut2.position) {
+                                                in_pruned_sample = true;
                                             }
                                         }
-                                    }
-                                    if (!found) {
-                                        if ((m1.position < start_range_high) || (m1.position > end_range_low)) {
-                                            num_mut++;
+                                        if (!in_pruned_sample) {
+                                            start_range_low = mut.position;
                                         }
                                     }
-                                    if (num_mut + parsimony_improvement > (size_t) orig_parsimony) {
-                                        break;
-                                    }
-                                }
-
-                                if (num_mut + parsimony_improvement <= (size_t) orig_parsimony) {
-                                    acceptor_nodes.emplace_back(Recomb_Node(bfs[k]->identifier, node_set_difference[k], num_mut, 'n'));
-                                }
-                            }
-                        }
-                    }, ap);
-                }
-
-                if (acceptor_nodes.size() == 0) {
-                    continue;
-                }
-
-                // find donor(s)
-                {
-                    tbb::parallel_for( tbb::blocked_range<size_t>(0, total_nodes),
-                    [&](tbb::blocked_range<size_t> r) {
-                        for (size_t k=r.begin(); k<r.end(); ++k) {
-                            if ((tree_num_leaves[bfs[k]] < num_descendants) || (T.is_ancestor(nid_to_consider,bfs[k]->identifier))) {
-                                continue;
-                            }
-
-                            size_t num_mut = 0;
-
-                            // Is placement as sibling
-                            if (bfs[k]->is_leaf() || node_has_unique[k]) {
-                                std::vector<MAT::Mutation> l2_mut;
-
-                                // Compute l2_mut
-                                for (auto m1: node_excess_mutations[k]) {
-                                    bool found = false;
-                                    for (auto m2: bfs[k]->mutations) {
-                                        if (m1.is_masked()) {
-                                            break;
-                                        }
-                                        if (m1.position == m2.position) {
-                                            if (m1.mut_nuc == m2.mut_nuc) {
-                                                found = true;
-                                                break;
+                                    if ((mut.position > end_range_low) && (mut.position <= end_range_high)) {
+                                        bool in_pruned_sample = false;
+                                        for (auto mut2: pruned_sample.sample_mutations) {
+                                            if (mut.position == mut2.position) {
+                                                in_pruned_sample = true;
                                             }
                                         }
-                                    }
-                                    if (!found) {
-                                        if ((m1.position >= start_range_high) && (m1.position <= end_range_low)) {
-                                            num_mut++;
+                                        if (!in_pruned_sample) {
+                                            end_range_high = mut.position;
                                         }
                                     }
-
-                                    if (num_mut + parsimony_improvement > (size_t) orig_parsimony) {
-                                        break;
-                                    }
                                 }
 
-                                if (num_mut + parsimony_improvement <= (size_t) orig_parsimony) {
-                                    donor_nodes.emplace_back(Recomb_Node(bfs[k]->identifier, node_set_difference[k], num_mut, 'y'));
-                                }
-                            }
-                            // Else placement as child
-                            else {
-                                for (auto m1: node_excess_mutations[k]) {
-                                    bool found = false;
-                                    for (auto m2: bfs[k]->mutations) {
-                                        if (m1.is_masked()) {
-                                            break;
-                                        }
-                                        if (m1.position == m2.position) {
-                                            if (m1.mut_nuc == m2.mut_nuc) {
-                                                found = true;
-                                                break;
+                                for (auto mut: pruned_sample.sample_mutations) {
+                                    if ((mut.position > start_range_low) && (mut.position <= start_range_high)) {
+                                        bool in_pruned_sample = false;
+                                        for (auto mut2: donor.sample_mutations) {
+                                            if (mut.position == mut2.position) {
+                                                in_pruned_sample = true;
                                             }
                                         }
-                                    }
-                                    if (!found) {
-                                        if ((m1.position >= start_range_high) && (m1.position <= end_range_low)) {
-                                            num_mut++;
-                                        }
-                                    }
-                                    if (num_mut + parsimony_improvement > (size_t) orig_parsimony) {
-                                        break;
-                                    }
-                                }
-
-                                if (num_mut + parsimony_improvement <= (size_t) orig_parsimony) {
-                                    donor_nodes.emplace_back(Recomb_Node(bfs[k]->identifier, node_set_difference[k], num_mut, 'n'));
-                                }
-                            }
-                        }
-                    }, ap);
-                }
-
-                tbb::parallel_sort (donor_nodes.begin(), donor_nodes.end());
-                tbb::parallel_sort (acceptor_nodes.begin(), acceptor_nodes.end());
-
-
-                if (donor_nodes.size() > 1000) {
-                    donor_nodes.resize(1000);
-                }
-
-                if (acceptor_nodes.size() > 1000) {
-                    acceptor_nodes.resize(1000);
-                }
-
-
-                // to print any pair of breakpoint interval exactly once for
-                // multiple donor-acceptor pairs
-                bool has_printed = false;
-
-                for (auto d: donor_nodes) {
-                    if (T.is_ancestor(nid_to_consider,d.name)) {
-                        continue;
-                    }
-                    for (auto a:acceptor_nodes) {
-                        if (T.is_ancestor(nid_to_consider,a.name)) {
-                            continue;
-                        }
-                        // Ensure donor and acceptor are not the same and
-                        // neither of them is a descendant of the recombinant
-                        // node total parsimony is less than the maximum allowed
-                        if ((d.name!=a.name) && (d.name!=nid_to_consider) && (a.name!=nid_to_consider) &&
-                                //(!T.is_ancestor(nid_to_consider,d.name)) && (!T.is_ancestor(nid_to_consider,a.name)) &&
-                                (orig_parsimony >= d.parsimony + a.parsimony + parsimony_improvement)) {
-                            Pruned_Sample donor("curr-donor");
-                            donor.sample_mutations.clear();
-                            acceptor.sample_mutations.clear();
-
-                            for (auto anc: T.rsearch(d.name, true)) {
-                                for (auto mut: anc->mutations) {
-                                    donor.add_mutation(mut);
-                                }
-                            }
-
-                            for (auto mut: donor.sample_mutations) {
-                                if ((mut.position > start_range_low) && (mut.position <= start_range_high)) {
-                                    bool in_pruned_sample = false;
-                                    for (auto mut2: pruned_sample.sample_mutations) {
-                                        if (mut.position == mut2.position) {
-                                            in_pruned_sample = true;
-                                        }
-                                    }
-                                    if (!in_pruned_sample) {
-                                        start_range_low = mut.position;
-                                    }
-                                }
-                                if ((mut.position > end_range_low) && (mut.position <= end_range_high)) {
-                                    bool in_pruned_sample = false;
-                                    for (auto mut2: pruned_sample.sample_mutations) {
-                                        if (mut.position == mut2.position) {
-                                            in_pruned_sample = true;
+                                        if (!in_pruned_sample) {
+                                            start_range_low = mut.position;
                                         }
                                     }
-                                    if (!in_pruned_sample) {
-                                        end_range_high = mut.position;
-                                    }
-                                }
-                            }
-
-                            for (auto mut: pruned_sample.sample_mutations) {
-                                if ((mut.position > start_range_low) && (mut.position <= start_range_high)) {
-                                    bool in_pruned_sample = false;
-                                    for (auto mut2: donor.sample_mutations) {
-                                        if (mut.position == mut2.position) {
-                                            in_pruned_sample = true;
+                                    if ((mut.position > end_range_low) && (mut.position <= end_range_high)) {
+                                        bool in_pruned_sample = false;
+                                        for (auto mut2: donor.sample_mutations) {
+                                            if (mut.position == mut2.position) {
+                                                in_pruned_sample = true;
+                                            }
                                         }
-                                    }
-                                    if (!in_pruned_sample) {
-                                        start_range_low = mut.position;
-                                    }
-                                }
-                                if ((mut.position > end_range_low) && (mut.position <= end_range_high)) {
-                                    bool in_pruned_sample = false;
-                                    for (auto mut2: donor.sample_mutations) {
-                                        if (mut.position == mut2.position) {
-                                            in_pruned_sample = true;
+                                        if (!in_pruned_sample) {
+                                            end_range_high = mut.position;
                                         }
                                     }
-                                    if (!in_pruned_sample) {
-                                        end_range_high = mut.position;
-                                    }
                                 }
-                            }
 
-                            //tbb_lock.lock();
-                            valid_pairs.push_back(Recomb_Interval(d, a, start_range_low, start_range_high, end_range_low, end_range_high));
-                            //tbb_lock.unlock();
+                                valid_pairs_at[i].push_back(Recomb_Interval(d, a, start_range_low, start_range_high, end_range_low, end_range_high));
 
-                            has_recomb = true;
-                            has_printed = true;
+                                has_printed = true;
+                                break;
+                            }
+                        }
+                        if (has_printed) {
                             break;
                         }
                     }
-                    if (has_printed) {
-                        break;
-                    }
                 }
             }
+        });
+
+        for (const auto& pairs: valid_pairs_at) {
+            result.valid_pairs.insert(result.valid_pairs.end(), pairs.begin(), pairs.end());
         }
-        fprintf(stderr, "\n");
+        result.has_recomb = (result.valid_pairs.size() > 0);
+        result.valid_pairs = combine_intervals(result.valid_pairs);
+        return result;
+    };
 
-        valid_pairs = combine_intervals(valid_pairs);
+    // Branches are searched concurrently, with at most num_threads of them in
+    // flight to bound memory, and written out in their original order
+    size_t num_done = 0;
+    size_t next_idx = s;
+    tbb::parallel_pipeline(num_threads,
+                           tbb::make_filter<void, size_t>(tbb::filter_mode::serial_in_order,
+    [&](tbb::flow_control& fc) {
+        if (next_idx >= e) {
+            fc.stop();
+            return e;
+        }
+        return next_idx++;
+    }) &
+    tbb::make_filter<size_t, Recomb_Search_Result*>(tbb::filter_mode::parallel,
+    [&](size_t idx) {
+        return new Recomb_Search_Result(find_recombination(nodes_to_consider_vec[idx]));
+    }) &
+    tbb::make_filter<Recomb_Search_Result*, void>(tbb::filter_mode::serial_in_order,
+    [&](Recomb_Search_Result* result) {
+        auto nid_to_consider = nodes_to_consider_vec[s + num_done];
+        int orig_parsimony = result->orig_parsimony;
         //print combined pairs
-        for(auto p: valid_pairs) {
+        for(auto p: result->valid_pairs) {
             std::string end_range_high_str = (p.end_range_high == 1e9) ? "GENOME_SIZE" : std::to_string(p.end_range_high);
             fprintf(recomb_file, "%s\t(%i,%i)\t(%i,%s)\t%s\t%c\t%i\t%s\t%c\t%i\t%i\t%i\t%i\n", nid_to_consider.c_str(), p.start_range_low,
                     p.start_range_high, p.end_range_low, end_range_high_str.c_str(), p.d.name.c_str(), p.d.is_sibling, p.d.node_parsimony,
                     p.a.name.c_str(), p.a.is_sibling, p.a.node_parsimony, orig_parsimony,
                     std::min({orig_parsimony, p.d.node_parsimony, p.a.node_parsimony}), p.d.parsimony+p.a.parsimony);
-            fflush(recomb_file);
         }
+        fflush(recomb_file);
 
-        if (has_recomb) {
+        if (result->has_recomb) {
             fprintf(desc_file, "%s\t", nid_to_consider.c_str());
             for (auto l: T.get_leaves(nid_to_consider)) {
                 fprintf(desc_file, "%s,", l->identifier.c_str());
             }
             fprintf(desc_file, "\n");
             fflush(desc_file);
-            fprintf(stderr, "Done %zu/%zu branches [RECOMBINATION FOUND!]\n\n", ++num_done, nodes_to_consider.size());
+            fprintf(stderr, "Done %zu/%zu branches (%s) [RECOMBINATION FOUND!]\n", ++num_done, e-s, nid_to_consider.c_str());
         } else {
-            fprintf(stderr, "Done %zu/%zu branches\n\n", ++num_done, nodes_to_consider.size());
+            fprintf(stderr, "Done %zu/%zu branches (%s)\n", ++num_done, e-s, nid_to_consider.c_str());
         }
-    }
+        delete result;
+    }));
 
     fclose(desc_file);
     fclose(recomb_file);
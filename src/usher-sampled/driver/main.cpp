@@ -3,6 +3,7 @@
 #include "src/matOptimize/tree_rearrangement_internal.hpp"
 #include "src/matOptimize/Profitable_Moves_Enumerators/Profitable_Moves_Enumerators.hpp"
 #include "src/usher-sampled/usher.hpp"
+#include "src/usher-sampled/static_tree_mapper/index.hpp"
 #include <algorithm>
 #include <atomic>
 #include <cstdio>
@@ -302,10 +303,11 @@ static int leader_thread(
             tree.MPI_send_tree();
         }
         tree.breadth_first_expansion();
+        auto traversal_info=load_or_build_idx(tree, options.placement_index);
         place_sample_leader(samples_to_place, tree, 100, curr_idx, INT_MAX,
                             true, placement_stats_file, INT_MAX, INT_MAX,
                             low_confidence_samples, samples_clade,
-                            sample_start_idx, nullptr, true);
+                            sample_start_idx, nullptr, true, &traversal_info);
         print_annotation(tree, options.out_options, samples_clade,
                          sample_start_idx, sample_end_idx,
                          tree.get_num_annotations());
@@ -440,6 +442,8 @@ int main(int argc, char **argv) {
      "Retain the branch lengths from the input tree in out newick files instead of using number of mutations for the branch lengths.")
     ("no-add,n", po::bool_switch(&options.no_add), \
      "Do not add new samples to the tree")
+    ("placement-index", po::value<std::string>(&options.placement_index)->default_value(""), \
+     "Index file for the placement done by --no-add and --sort-before-placement-1/2. Loaded if it matches the input tree, otherwise built and saved there")
     ("detailed-clades,D", po::bool_switch(&options.out_options.detailed_clades), \
      "In clades.txt, write a histogram of annotated clades and counts across all equally parsimonious placements")
     ("diff",po::value<std::string>(&options.diff_file_name),"diff file from MAPLE, to be used with reference sequence")
@@ -530,7 +534,9 @@ int main(int argc, char **argv) {
                 assign_levels(tree.root);
                 set_descendant_count(tree.root);
             }
-            follower_place_sample(tree,100,true);
+            //only the leader writes the index file
+            auto traversal_info=load_or_build_idx(tree, options.placement_index, false);
+            follower_place_sample(tree,100,true,&traversal_info);
         }
         if (options.no_add) {
             MPI_Finalize();
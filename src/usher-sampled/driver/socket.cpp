@@ -15,6 +15,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <fcntl.h>
 #include <fstream>
 #include <functional>
@@ -63,12 +64,23 @@ struct tree_info {
         expanded_tree.delete_nodes();
     }
 };
+//A pre-forked worker, waiting on control_fd for a connection to serve, then exits after serving it
 struct child_proc_info {
     std::chrono::steady_clock::time_point start_time;
-    //int fd;
+    int control_fd;
+    bool busy;
+    //value of worker_generation when forked, idle workers from older generations have stale trees
+    size_t generation;
     child_proc_info()=default;
-    child_proc_info(int fd):start_time(std::chrono::steady_clock::now()) {}
+    child_proc_info(int control_fd,size_t generation):control_fd(control_fd),busy(false),generation(generation) {}
+    void start() {
+        busy=true;
+        start_time=std::chrono::steady_clock::now();
+    }
     bool is_time_out(long limit) {
+        if (!busy) {
+            return false;
+        }
         auto duration=std::chrono::steady_clock::now()-start_time;
         return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count()>limit;
     }
@@ -78,6 +90,9 @@ int process_count = 1;
 int this_rank = 0;
 unsigned int num_threads;
 std::atomic_bool interrupted(false);
+//bumped under tree_loading_mutex whenever state copied into pre-forked workers changes (loaded trees, thread count),
+//fork_worker reads it under the same lock, atomic so that accept_fork_loop can check idle workers without it
+std::atomic_size_t worker_generation(0);
 bool prep_single_tree(std::string path, std::shared_ptr<tree_info> &out) {
     if (!MAT::load_mutation_annotated_tree(path, out->tree)) {
         return false;
@@ -98,6 +113,7 @@ bool prep_single_tree(std::string path, std::shared_ptr<tree_info> &out) {
 }
 
 typedef std::shared_ptr<std::unordered_map<std::string, std::shared_ptr<tree_info> > > TreeCollectionPtr;
+//Caller holds tree_loading_mutex
 void reload_trees(TreeCollectionPtr &to_replace, const std::vector<std::string>& paths) {
     fprintf(stderr, "loading the tree\n");
     tbb::global_control global_limit(tbb::global_control::max_allowed_parallelism, num_threads);
@@ -115,6 +131,7 @@ void reload_trees(TreeCollectionPtr &to_replace, const std::vector<std::string>&
         }
     }
     to_replace.reset(next);
+    worker_generation++;
     fprintf(stderr, "finish loading the tree\n");
 }
 void refresh_tree(TreeCollectionPtr &to_replace, std::fstream &tree_paths) {
@@ -167,7 +184,9 @@ static void mgr_thread(TreeCollectionPtr &to_replace, std::string cmd_fifo_name,
             if (scaned) {
                 fprintf(stderr, "setting thread count to %d\n",
                         new_thread_count);
+                std::lock_guard<std::mutex> lk (tree_loading_mutex);
                 num_threads = new_thread_count;
+                worker_generation++;
             } else {
                 int new_time_out_second;
                 auto scaned = sscanf(buf.c_str(), "timeout %d", &new_time_out_second);
@@ -214,6 +233,7 @@ static void collect_done(std::unordered_map<int, child_proc_info> &pid_to_fd_map
             auto done_pid = waitpid(proc.first, &ignored, WNOHANG);
             if(done_pid==proc.first){
                 std::cerr<<"pid "<< done_pid<<" exited with "<<ignored<<"\n";
+                close(proc.second.control_fd);
                 to_remove.push_back(done_pid);
                 continue;
             }
@@ -247,6 +267,7 @@ static void collect_done(std::unordered_map<int, child_proc_info> &pid_to_fd_map
                 perror("failed to close");
             }*/
             std::cerr<<"pid "<< done_pid<<" exited with "<<ignored<<"\n";
+            close(iter->second.control_fd);
             pid_to_fd_map.erase(iter);
         }
     }
@@ -483,6 +504,11 @@ static void child_proc(int fd, TreeCollectionPtr &trees_ptr) {
             fopen(placement_stats_filename.c_str(), "w");
         // auto reordered =
         fputs("sorting sample\n", stderr);
+        //the index for the dry run placement is only needed when sorting, so it is loaded or built
+        //then, and saved next to the protobuf for later requests if the directory is writable
+        if (options.placement_index == "") {
+            options.placement_index = iter->first + ".placement_idx";
+        }
         sort_samples(options, samples_to_place, tree, sample_start_idx);
         fputs("placing sample\n", stderr);
         place_sample_sequential(samples_to_place, tree, false,
@@ -504,43 +530,222 @@ static void child_proc(int fd, TreeCollectionPtr &trees_ptr) {
     fclose(f);
     exit(EXIT_SUCCESS);
 }
-static void accept_fork_loop(int socket_fd, TreeCollectionPtr &trees_ptr,std::atomic_size_t& wait_miliseconds) {
-    std::unordered_map<int, child_proc_info> pid_to_fd_map;
-    struct pollfd fd_to_watch;
-    fd_to_watch.fd=socket_fd;
-    fd_to_watch.events=POLLIN;
+//Pass fd_to_send to the process at the other end of the unix socket control_fd
+static bool send_fd(int control_fd,int fd_to_send) {
+    char dummy='c';
+    struct iovec iov;
+    iov.iov_base=&dummy;
+    iov.iov_len=1;
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control_buf;
+    memset(&control_buf, 0, sizeof(control_buf));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov=&iov;
+    msg.msg_iovlen=1;
+    msg.msg_control=control_buf.buf;
+    msg.msg_controllen=sizeof(control_buf.buf);
+    auto cmsg=CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level=SOL_SOCKET;
+    cmsg->cmsg_type=SCM_RIGHTS;
+    cmsg->cmsg_len=CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd_to_send, sizeof(int));
+    return sendmsg(control_fd, &msg, MSG_NOSIGNAL)==1;
+}
+//Block until a fd is sent over control_fd, -1 if the other end is closed
+static int receive_fd(int control_fd) {
+    char dummy;
+    struct iovec iov;
+    iov.iov_base=&dummy;
+    iov.iov_len=1;
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control_buf;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov=&iov;
+    msg.msg_iovlen=1;
+    msg.msg_control=control_buf.buf;
+    msg.msg_controllen=sizeof(control_buf.buf);
+    ssize_t ret;
+    do {
+        ret=recvmsg(control_fd, &msg, 0);
+    } while (ret==-1&&errno==EINTR);
+    if (ret<=0) {
+        return -1;
+    }
+    auto cmsg=CMSG_FIRSTHDR(&msg);
+    if (cmsg==NULL||cmsg->cmsg_type!=SCM_RIGHTS) {
+        return -1;
+    }
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+//Fork a worker that waits for a connection with the trees currently loaded. The trees are only read
+//until a request arrives, so the worker shares all their pages with the server until then. The child closes
+//every fd of the server it does not need, including queued connections, whose clients would not see EOF otherwise
+static void fork_worker(int socket_fd, TreeCollectionPtr &trees_ptr,std::unordered_map<int, child_proc_info> &workers,
+                        const std::deque<int>& queued_conns) {
+    int control_fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, control_fds)!=0) {
+        perror("cannot create worker control socket");
+        return;
+    }
+    std::lock_guard<std::mutex> lk(tree_loading_mutex);
+    auto generation=worker_generation.load();
+    auto pid = fork();
+    if (pid == 0) {
+        close(socket_fd);
+        close(control_fds[0]);
+        for (const auto& worker : workers) {
+            close(worker.second.control_fd);
+        }
+        for (auto queued_fd : queued_conns) {
+            close(queued_fd);
+        }
+        auto conn_fd=receive_fd(control_fds[1]);
+        if (conn_fd==-1) {
+            exit(EXIT_SUCCESS);
+        }
+        //control_fds[1] stays open until the worker exits, closing it is what wakes the server up to reap it
+        child_proc(conn_fd, trees_ptr);
+    }
+    close(control_fds[1]);
+    if (pid==-1) {
+        perror("cannot fork worker");
+        close(control_fds[0]);
+        return;
+    }
+    workers.emplace(pid, child_proc_info(control_fds[0],generation));
+}
+//Idle workers exit once their control socket is closed
+static void retire_workers(std::unordered_map<int, child_proc_info> &workers,const std::vector<int>& to_retire) {
+    for (auto pid : to_retire) {
+        close(workers[pid].control_fd);
+    }
+    for (auto pid : to_retire) {
+        waitpid(pid, NULL, 0);
+        workers.erase(pid);
+    }
+}
+//Wait for busy workers to finish serving their requests, only killing those running past the time out
+static void wait_busy_workers(std::unordered_map<int, child_proc_info> &workers,long milisecond_time_out) {
+    std::vector<struct pollfd> fds_to_watch;
     while (true) {
-        if (interrupted) {
-            break;
+        collect_done(workers, false,milisecond_time_out);
+        if (workers.empty()) {
+            return;
         }
-        collect_done(pid_to_fd_map, false,wait_miliseconds);
-        poll(&fd_to_watch, 1, wait_miliseconds);
-        auto conn_fd = accept(socket_fd, NULL, 0);
-        if (interrupted) {
+        fds_to_watch.clear();
+        for (const auto& worker : workers) {
+            fds_to_watch.push_back(pollfd{worker.second.control_fd,POLLIN,0});
+        }
+        poll(fds_to_watch.data(), fds_to_watch.size(), milisecond_time_out);
+    }
+}
+static void reject_connection(int conn_fd) {
+    const char msg[]="Server busy, too many requests queued\n\004\n";
+    if (write(conn_fd, msg, sizeof(msg)-1)==-1) {
+        perror("cannot reply to rejected connection");
+    }
+    close(conn_fd);
+}
+//Keep pool_size workers forked ahead of connections. Accepted connections wait in a queue of at most
+//max_queued until a worker is idle, further connections are rejected.
+static void accept_fork_loop(int socket_fd, TreeCollectionPtr &trees_ptr,std::atomic_size_t& wait_miliseconds,
+                             size_t pool_size,size_t max_queued) {
+    std::unordered_map<int, child_proc_info> workers;
+    std::deque<int> queued_conns;
+    std::vector<struct pollfd> fds_to_watch;
+    std::vector<int> to_retire;
+    while (true) {
+        if (interrupted&&queued_conns.empty()) {
             break;
         }
-        if (conn_fd == -1) {
-            if (errno!=EAGAIN&&errno!=EWOULDBLOCK) {
-                perror("cannot accept connection");
+        collect_done(workers, false,wait_miliseconds);
+        //idle workers holding outdated trees are told to exit by closing their control socket
+        auto generation=worker_generation.load();
+        to_retire.clear();
+        for (const auto& worker : workers) {
+            if (!worker.second.busy&&worker.second.generation!=generation) {
+                to_retire.push_back(worker.first);
+            }
+        }
+        retire_workers(workers, to_retire);
+        while (workers.size()<pool_size) {
+            auto old_size=workers.size();
+            fork_worker(socket_fd, trees_ptr, workers, queued_conns);
+            if (workers.size()==old_size) {
+                break;
+            }
+        }
+        for (auto& worker : workers) {
+            if (queued_conns.empty()) {
+                break;
+            }
+            if (worker.second.busy) {
+                continue;
+            }
+            auto conn_fd=queued_conns.front();
+            queued_conns.pop_front();
+            if (!send_fd(worker.second.control_fd, conn_fd)) {
+                perror("cannot pass connection to worker");
+            }
+            close(conn_fd);
+            worker.second.start();
+        }
+        //a busy worker closes its control socket on exit, which wakes the poll up to reap it
+        fds_to_watch.clear();
+        if (!interrupted) {
+            fds_to_watch.push_back(pollfd{socket_fd,POLLIN,0});
+        }
+        for (const auto& worker : workers) {
+            if (worker.second.busy) {
+                fds_to_watch.push_back(pollfd{worker.second.control_fd,POLLIN,0});
             }
+        }
+        poll(fds_to_watch.data(), fds_to_watch.size(), wait_miliseconds);
+        if (interrupted) {
             continue;
         }
-        {
-            std::unique_lock<std::mutex> lk(tree_loading_mutex);
-            TreeCollectionPtr local_copy = trees_ptr;
-            auto pid = fork();
-            if (pid == 0) {
-                child_proc(conn_fd, trees_ptr);
-            } else {
-                local_copy.reset();
-                lk.unlock();
+        //connections that idle workers will take right away do not count toward the queue limit
+        size_t idle_workers=0;
+        for (const auto& worker : workers) {
+            idle_workers+=!worker.second.busy;
+        }
+        while (true) {
+            auto conn_fd = accept(socket_fd, NULL, 0);
+            if (conn_fd == -1) {
+                if (errno!=EAGAIN&&errno!=EWOULDBLOCK) {
+                    perror("cannot accept connection");
+                }
+                break;
+            }
+            if (interrupted) {
                 close(conn_fd);
-                pid_to_fd_map.emplace(pid, child_proc_info(conn_fd));
+                break;
+            }
+            if (queued_conns.size()>=max_queued+idle_workers) {
+                fprintf(stderr, "%zu connections queued, rejecting new connection\n",queued_conns.size()-std::min(idle_workers,queued_conns.size()));
+                reject_connection(conn_fd);
+            } else {
+                queued_conns.push_back(conn_fd);
             }
         }
     }
-    //sleep(wait_miliseconds/1000);
-    collect_done(pid_to_fd_map, true,wait_miliseconds);
+    to_retire.clear();
+    for (const auto& worker : workers) {
+        if (!worker.second.busy) {
+            to_retire.push_back(worker.first);
+        }
+    }
+    retire_workers(workers, to_retire);
+    //requests dispatched from the queue during shutdown are still served
+    wait_busy_workers(workers, wait_miliseconds);
 }
 static void tree_update_watch(int refresh_period, std::mutex& done_mutex,std::condition_variable& done_cv, bool& done,TreeCollectionPtr &trees_ptr){
     while (true) {
@@ -582,6 +787,7 @@ static void tree_update_watch(int refresh_period, std::mutex& done_mutex,std::co
                         fprintf(stderr, "check %s for update got error %s\n", iter.first.c_str(),e.what());
                     }
                 }
+                worker_generation++;
             }
         }
     }
@@ -594,6 +800,8 @@ int main(int argc, char** argv) {
     std::vector<std::string> init_pb_to_load;
     int wait_second;
     int refresh_period;
+    size_t pool_size;
+    size_t max_queued;
     signal(SIGEV_SIGNAL, print_stack_trace);
     std::string num_threads_message = "Number of threads to use when possible "
                                       "[DEFAULT uses all available cores, " +
@@ -613,6 +821,8 @@ int main(int argc, char** argv) {
     ("threads-per-process,T",po::value<unsigned int>(&num_threads),num_threads_message.c_str())
     ("timeout,t",po::value<int>(&wait_second)->default_value(180),"Timeout in seconds for child process\n")
     ("reload_peroid,r",po::value<int>(&refresh_period)->default_value(1),"Timeout in minutes to check whether loaded protobuf is outdated\n")
+    ("workers,w",po::value<size_t>(&pool_size)->default_value(0),"Number of worker processes forked ahead of requests, each serving one request at a time [DEFAULT number of cores divided by threads-per-process]\n")
+    ("max-queued,q",po::value<size_t>(&max_queued)->default_value(128),"Maximum number of requests waiting for a worker, further requests are rejected\n")
     ("pb-to-load,l",po::value<std::vector<std::string>>(&init_pb_to_load)->multitoken()->composing(),"Initial list of protobufs to load (multiple file args can follow)")
     ;
     po::variables_map vm;
@@ -634,7 +844,10 @@ int main(int argc, char** argv) {
         fprintf(stderr, "socket path is empty\n");
         exit(EXIT_FAILURE);
     }
-    fprintf(stderr, "Server PID: %d\n",getpid());
+    if (pool_size==0) {
+        pool_size=std::max(std::thread::hardware_concurrency()/std::max(num_threads,1u),1u);
+    }
+    fprintf(stderr, "Server PID: %d, %zu workers\n",getpid(),pool_size);
     std::atomic_size_t wait_miliseconds(wait_second*1000);
     auto socket_fd=create_socket(socket_path);
     TreeCollectionPtr trees;
@@ -648,7 +861,7 @@ int main(int argc, char** argv) {
     }
     std::thread mgr(mgr_thread,std::ref(trees), mgr_fifo, socket_path,std::ref(wait_miliseconds));
     std::thread tree_age_checker(tree_update_watch,refresh_period, std::ref(done_mutex), std::ref(done_cv), std::ref(done), std::ref(trees));
-    accept_fork_loop(socket_fd, trees,wait_miliseconds);
+    accept_fork_loop(socket_fd, trees,wait_miliseconds,pool_size,max_queued);
     mgr.join();
     {
         std::lock_guard<std::mutex> lk(done_mutex);
@@ -316,15 +316,8 @@ void register_target(Main_Tree_Target &target, int this_score,Output<Main_Tree_T
     if ((!target.target_node->is_root())&&target.shared_mutations.empty()) {
         return;
     }
-    if (output.best_par_score >= this_score) {
-        std::lock_guard<std::mutex> lk(output.mutex);
-        if (output.best_par_score > this_score) {
-            output.best_par_score = this_score;
-            output.targets.clear();
-        }
-        if (output.best_par_score == this_score) {
-            output.targets.push_back(std::move(target));
-        }
+    if (output.best_par_score.load(std::memory_order_relaxed) >= this_score) {
+        output.add(std::move(target), this_score);
     }
 }
 static void search_serial(const MAT::Node* node,std::vector<To_Place_Sample_Mutation>& this_muts,Output<Main_Tree_Target> &output) {
@@ -471,8 +464,7 @@ place_main_tree(const std::vector<To_Place_Sample_Mutation> &mutations,
 #endif
                ) {
     Output<Main_Tree_Target> output;
-    output.targets.reserve(1000);
-    output.best_par_score = 0;
+    int initial_par_score = 0;
     To_Place_Sample_Mutation temp(INT_MAX,0,0xf);
     Main_Tree_Target target;
     target.target_node=main_tree.root;
@@ -484,10 +476,11 @@ place_main_tree(const std::vector<To_Place_Sample_Mutation> &mutations,
     target.sample_mutations.push_back(temp);
     for (const auto& mut : mutations) {
         if (!(mut.par_nuc&mut.mut_nuc)) {        
-            output.best_par_score++;
+            initial_par_score++;
         }
     }
-    output.targets.push_back(target);
+    output.best_par_score = initial_par_score;
+    output.add(std::move(target), initial_par_score);
 
     tf::Executor executor;
     tf::Taskflow taskflow;
@@ -507,6 +500,7 @@ place_main_tree(const std::vector<To_Place_Sample_Mutation> &mutations,
 
     executor.run(taskflow).wait();
         
-    assert(!output.targets.empty());
-    return std::make_tuple(std::move(output.targets), output.best_par_score);
+    auto targets = output.collect();
+    assert(!targets.empty());
+    return std::make_tuple(std::move(targets), output.best_par_score.load());
 }
@@ -1,10 +1,50 @@
 #include "usher.hpp"
+#include <atomic>
+#include <climits>
+#include <tbb/enumerable_thread_specific.h>
+#include <utility>
 #include <vector>
 #pragma once
+//Collects the most parsimonious targets found by concurrent search tasks without a shared lock:
+//best_par_score is lowered with a CAS, each thread keeps the targets tying with the best score it
+//has seen, and collect() merges the buffers holding the final best score
 template <typename Target_Type> struct Output {
-    std::mutex mutex;
-    int best_par_score;
-    std::vector<Target_Type> targets;
+    std::atomic_int best_par_score;
+    struct Local_Targets {
+        int best_par_score=INT_MAX;
+        std::vector<Target_Type> targets;
+    };
+    tbb::enumerable_thread_specific<Local_Targets> local_targets;
+    void add(Target_Type&& target,int this_score) {
+        int curr_best=best_par_score.load(std::memory_order_relaxed);
+        while (curr_best>this_score&&!best_par_score.compare_exchange_weak(curr_best, this_score,std::memory_order_relaxed)) {}
+        if (curr_best<this_score) {
+            return;
+        }
+        auto& local=local_targets.local();
+        if (local.best_par_score>this_score) {
+            local.best_par_score=this_score;
+            local.targets.clear();
+        }
+        if (local.best_par_score==this_score) {
+            local.targets.push_back(std::move(target));
+        }
+    }
+    //call after all search tasks finished
+    std::vector<Target_Type> collect() {
+        int final_best=best_par_score.load();
+        std::vector<Target_Type> out;
+        for (auto& local : local_targets) {
+            if (local.best_par_score==final_best) {
+                if (out.empty()) {
+                    out=std::move(local.targets);
+                } else {
+                    out.insert(out.end(),std::make_move_iterator(local.targets.begin()),std::make_move_iterator(local.targets.end()));
+                }
+            }
+        }
+        return out;
+    }
 };
 struct Main_Tree_Target {
     MAT::Node *target_node;
@@ -687,7 +687,8 @@ void place_sample_leader(std::vector<Sample_Muts> &sample_to_place,
                          std::vector<std::string>& low_confidence_samples,
                          std::vector<Clade_info>& samples_clade,
                          size_t sample_start_idx,std::vector<size_t>* idx_map,
-                         bool do_print
+                         bool do_print,
+                         const Traversal_Info* prebuilt_idx
                         ) {
     int start_idx=curr_idx;
     std::vector<MAT::Node *> deleted_nodes;
@@ -708,10 +709,13 @@ void place_sample_leader(std::vector<Sample_Muts> &sample_to_place,
         // Finder function based on dry_run mode
         std::function<void(Sample_Muts*)> search_func;
         if (dry_run) {
-            traversal_info = build_idx(main_tree);
+            if (!prebuilt_idx) {
+                traversal_info = build_idx(main_tree);
+                prebuilt_idx = &traversal_info;
+            }
             dfs_ordered_nodes = main_tree.depth_first_expansion();
             search_func = [&](Sample_Muts* to_search) {
-                auto res = place_sample_fixed_idx(traversal_info, to_search, dfs_ordered_nodes);
+                auto res = place_sample_fixed_idx(*prebuilt_idx, to_search, dfs_ordered_nodes);
                 std::get<2>(*res) = true;
                 found_queue.push(res);
             };
@@ -197,11 +197,14 @@ static Sample_Muts* fetch_sample_from_leader(bool& is_first) {
     delete[] buffer;
     return out;
 }
-void follower_place_sample(MAT::Tree &main_tree,int batch_size,bool dry_run) {
+void follower_place_sample(MAT::Tree &main_tree,int batch_size,bool dry_run,const Traversal_Info* prebuilt_idx) {
     Traversal_Info traversal_info;
     std::vector<MAT::Node *> dfs_ordered_nodes;
     if (dry_run) {
-        traversal_info = build_idx(main_tree);
+        if (!prebuilt_idx) {
+            traversal_info = build_idx(main_tree);
+            prebuilt_idx = &traversal_info;
+        }
         dfs_ordered_nodes = main_tree.depth_first_expansion();
     }
     check_parent(main_tree.root, main_tree);
@@ -215,7 +218,7 @@ void follower_place_sample(MAT::Tree &main_tree,int batch_size,bool dry_run) {
         auto finder_func = [&](Sample_Muts* to_search) {
             std::string buffer;
             if (dry_run) {
-                buffer = serialize_move(place_sample_fixed_idx(traversal_info, to_search, dfs_ordered_nodes), main_tree);
+                buffer = serialize_move(place_sample_fixed_idx(*prebuilt_idx, to_search, dfs_ordered_nodes), main_tree);
             } else {
                 buffer = serialize_move(find_place(main_tree, to_search), main_tree);
             }
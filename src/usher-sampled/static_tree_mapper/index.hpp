@@ -1,9 +1,11 @@
+#pragma once
 #include "src/matOptimize/mutation_annotated_tree.hpp"
 #include "src/usher-sampled/usher.hpp"
 #include "src/usher-sampled/mapper.hpp"
 #include "src/usher-sampled/place_sample.hpp"
 #include <vector>
 #include <array>
+#include <string>
 #define INDEX_END_POSITION INT_MAX
 struct index_ele {
     int dfs_idx;
@@ -22,6 +24,13 @@ struct Traversal_Info {
     int tree_height;
 };
 Traversal_Info build_idx(MAT::Tree& tree);
+//Persistent index, stored alongside the MAT and keyed by placement_index_hash of the tree
+uint64_t placement_index_hash(MAT::Tree& tree);
+bool save_idx(const Traversal_Info& in,uint64_t content_hash,const std::string& path);
+bool load_idx(Traversal_Info& out,MAT::Tree& tree,uint64_t content_hash,const std::string& path);
+//load the index at path if it matches the tree, otherwise build it (and save it there if save is set),
+//empty path always builds
+Traversal_Info load_or_build_idx(MAT::Tree& tree,const std::string& path,bool save=true);
 move_type* place_sample_fixed_idx(const Traversal_Info &in,
                                   Sample_Muts* to_search,
                                   const std::vector<MAT::Node*>& dfs_ordered_nodes);
\ No newline at end of file
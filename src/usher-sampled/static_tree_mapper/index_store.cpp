@@ -0,0 +1,155 @@
+#include "index.hpp"
+#include "src/matOptimize/mutation_annotated_tree.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <unistd.h>
+#include <vector>
+namespace MAT = Mutation_Annotated_Tree;
+//On disk layout: header, offsets[num_positions*4+1] into the element array
+//(list of position p, nucleotide n is elements[offsets[4p+n],offsets[4p+n+1])), elements
+static const char PLACEMENT_INDEX_MAGIC[8]= {'U','S','H','P','L','I','D','X'};
+static const uint32_t PLACEMENT_INDEX_VERSION=1;
+struct placement_index_header {
+    char magic[8];
+    uint32_t version;
+    int32_t tree_height;
+    uint64_t content_hash;
+    uint64_t num_positions;
+    uint64_t num_elements;
+};
+static_assert(sizeof(index_ele)==12,"index_ele is stored as is");
+static uint64_t hash_mix(uint64_t hash, uint64_t value) {
+    value*=0x9e3779b97f4a7c15ULL;
+    value^=value>>29;
+    return (hash^value)*0x100000001b3ULL;
+}
+//Covers everything build_idx reads: DFS topology, mutation positions and alleles, genome length
+uint64_t placement_index_hash(MAT::Tree& tree) {
+    auto dfs=tree.depth_first_expansion();
+    uint64_t hash=hash_mix(0xcbf29ce484222325ULL, MAT::Mutation::refs.size());
+    hash=hash_mix(hash, dfs.size());
+    for (const auto node : dfs) {
+        hash=hash_mix(hash, ((uint64_t)node->dfs_end_index<<32)|node->mutations.size());
+        for (const auto& mut : node->mutations) {
+            hash=hash_mix(hash, ((uint64_t)(uint32_t)mut.get_position()<<8)|mut.get_mut_one_hot());
+        }
+    }
+    return hash;
+}
+static void fill_traversal_track(MAT::Tree& tree,Traversal_Info& out) {
+    auto dfs=tree.depth_first_expansion();
+    out.traversal_track.clear();
+    out.traversal_track.reserve(dfs.size());
+    for (auto node : dfs) {
+        out.traversal_track.emplace_back(traversal_track_elem{(int)node->mutations.size(),(int)node->dfs_end_index,node->mutations.data()});
+    }
+}
+bool save_idx(const Traversal_Info& in,uint64_t content_hash,const std::string& path) {
+    //written to a temporary file then renamed, so concurrent readers never see a partial index
+    auto temp_path=path+".tmp"+std::to_string(getpid());
+    FILE* fh=fopen(temp_path.c_str(), "wb");
+    if (!fh) {
+        fprintf(stderr, "WARNING: Could not open %s for writing placement index\n",temp_path.c_str());
+        return false;
+    }
+    placement_index_header header;
+    memcpy(header.magic, PLACEMENT_INDEX_MAGIC, sizeof(PLACEMENT_INDEX_MAGIC));
+    header.version=PLACEMENT_INDEX_VERSION;
+    header.tree_height=in.tree_height;
+    header.content_hash=content_hash;
+    header.num_positions=in.indexes.size();
+    std::vector<uint64_t> offsets;
+    offsets.reserve(in.indexes.size()*4+1);
+    uint64_t num_elements=0;
+    for (const auto& pos : in.indexes) {
+        for (const auto& nuc : pos) {
+            offsets.push_back(num_elements);
+            num_elements+=nuc.size();
+        }
+    }
+    offsets.push_back(num_elements);
+    header.num_elements=num_elements;
+    bool ok=fwrite(&header, sizeof(header), 1, fh)==1;
+    ok=ok&&fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), fh)==offsets.size();
+    for (const auto& pos : in.indexes) {
+        for (const auto& nuc : pos) {
+            ok=ok&&(nuc.empty()||fwrite(nuc.data(), sizeof(index_ele), nuc.size(), fh)==nuc.size());
+        }
+    }
+    ok=(fclose(fh)==0)&&ok;
+    if (!ok||rename(temp_path.c_str(), path.c_str())!=0) {
+        fprintf(stderr, "WARNING: Failed writing placement index %s\n",path.c_str());
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+bool load_idx(Traversal_Info& out,MAT::Tree& tree,uint64_t content_hash,const std::string& path) {
+    int fd=open(path.c_str(), O_RDONLY);
+    if (fd<0) {
+        return false;
+    }
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf)!=0||(size_t)stat_buf.st_size<sizeof(placement_index_header)) {
+        close(fd);
+        return false;
+    }
+    size_t map_size=stat_buf.st_size;
+    auto map_base=mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map_base==MAP_FAILED) {
+        perror("mmap placement index");
+        return false;
+    }
+    const auto header=(const placement_index_header*)map_base;
+    bool valid=memcmp(header->magic, PLACEMENT_INDEX_MAGIC, sizeof(PLACEMENT_INDEX_MAGIC))==0&&
+               header->version==PLACEMENT_INDEX_VERSION&&
+               header->content_hash==content_hash&&
+               header->num_positions==MAT::Mutation::refs.size()&&
+               map_size==sizeof(placement_index_header)+(header->num_positions*4+1)*sizeof(uint64_t)+header->num_elements*sizeof(index_ele);
+    if (!valid) {
+        fprintf(stderr, "Placement index %s does not match the tree, rebuilding\n",path.c_str());
+        munmap(map_base, map_size);
+        return false;
+    }
+    const auto offsets=(const uint64_t*)(header+1);
+    const auto elements=(const index_ele*)(offsets+header->num_positions*4+1);
+    out.indexes.resize(header->num_positions);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0,header->num_positions),[&](tbb::blocked_range<size_t> r) {
+        for (size_t idx=r.begin(); idx<r.end(); idx++) {
+            for (int nuc_idx=0; nuc_idx<4; nuc_idx++) {
+                auto start=offsets[idx*4+nuc_idx];
+                auto end=offsets[idx*4+nuc_idx+1];
+                out.indexes[idx][nuc_idx].assign(elements+start,elements+end);
+            }
+        }
+    });
+    out.tree_height=header->tree_height;
+    munmap(map_base, map_size);
+    fill_traversal_track(tree, out);
+    return true;
+}
+Traversal_Info load_or_build_idx(MAT::Tree& tree,const std::string& path,bool save) {
+    if (path=="") {
+        return build_idx(tree);
+    }
+    auto content_hash=placement_index_hash(tree);
+    Traversal_Info out;
+    if (load_idx(out, tree, content_hash, path)) {
+        fprintf(stderr, "Loaded placement index %s\n",path.c_str());
+        return out;
+    }
+    out=build_idx(tree);
+    if (save&&save_idx(out, content_hash, path)) {
+        fprintf(stderr, "Saved placement index %s\n",path.c_str());
+    }
+    return out;
+}
@@ -24,6 +24,7 @@ namespace MAT = Mutation_Annotated_Tree;
 #define mpi_trace_print(...)
 #endif
 extern int switch_to_serial_threshold;
+struct Traversal_Info;
 void check_order(MAT::Mutations_Collection& in);
 struct To_Place_Sample_Mutation {
     int position;
@@ -109,14 +110,15 @@ void place_sample_leader(std::vector<Sample_Muts> &sample_to_place,
                          std::vector<std::string>& low_confidence_samples,
                          std::vector<Clade_info>& samples_clade,
                          size_t sample_start_idx,std::vector<size_t>* idx_map,
-                         bool do_print=false
+                         bool do_print=false,
+                         const Traversal_Info* prebuilt_idx=nullptr
                         ) ;
 void fix_parent(Mutation_Annotated_Tree::Tree &tree);
 void convert_mut_type(const std::vector<MAT::Mutation> &in,
                       std::vector<To_Place_Sample_Mutation> &out);
 void assign_descendant_muts(MAT::Tree &in);
 void assign_levels(MAT::Node* root);
-void follower_place_sample(MAT::Tree &main_tree,int batch_size,bool dry_run);
+void follower_place_sample(MAT::Tree &main_tree,int batch_size,bool dry_run,const Traversal_Info* prebuilt_idx=nullptr);
 void check_parent(MAT::Node* root,MAT::Tree& tree);
 void find_moved_node_neighbors(int radius,size_t start_idx, MAT::Tree& tree, size_t cur_idx,std::vector<size_t>& node_to_search_idx);
 int follower_recieve_positions( std::vector<mutated_t>& to_recieve);
@@ -146,13 +148,15 @@ struct Leader_Thread_Options {
     bool no_add;
     std::string diff_file_name;
     std::string reference_file_name;
+    //path of the persistent index used by dry run placement, empty to always rebuild it
+    std::string placement_index;
 };
 int set_descendant_count(MAT::Node* root);
 void discretize_mutations(const std::vector<To_Place_Sample_Mutation> &in,
                           const MAT::Mutations_Collection &shared_mutations,
                           MAT::Node *parent_node,
                           MAT::Mutations_Collection &out);
-bool sort_samples(const Leader_Thread_Options& options,std::vector<Sample_Muts>& samples_to_place, MAT::Tree& tree,size_t sample_start_idx);
+bool sort_samples(const Leader_Thread_Options& options,std::vector<Sample_Muts>& samples_to_place, MAT::Tree& tree,size_t sample_start_idx,const Traversal_Info* prebuilt_idx=nullptr);
 void place_sample_multiple_tree(
     std::vector<Sample_Muts> &sample_to_place,
     std::vector<MAT::Tree>& trees,
@@ -1,5 +1,6 @@
 #include "src/matOptimize/tree_rearrangement_internal.hpp"
 #include "src/usher-sampled/usher.hpp"
+#include "src/usher-sampled/static_tree_mapper/index.hpp"
 #include <tbb/parallel_for.h>
 extern int process_count;
 int prep_tree(MAT::Tree &tree) {
@@ -14,7 +15,7 @@ int prep_tree(MAT::Tree &tree) {
     assign_levels(tree.root);
     return set_descendant_count(tree.root);
 }
-bool sort_samples(const Leader_Thread_Options& options,std::vector<Sample_Muts>& samples_to_place, MAT::Tree& tree,size_t sample_start_idx) {
+bool sort_samples(const Leader_Thread_Options& options,std::vector<Sample_Muts>& samples_to_place, MAT::Tree& tree,size_t sample_start_idx,const Traversal_Info* prebuilt_idx) {
     bool reordered=false;
     if (options.sort_by_ambiguous_bases) {
         fprintf(stderr, "Sorting missing samples based on the number of ambiguous bases \n");
@@ -94,10 +95,15 @@ bool sort_samples(const Leader_Thread_Options& options,std::vector<Sample_Muts>&
                 tree.MPI_send_tree();
             }
             std::atomic_size_t curr_idx(0);
+            Traversal_Info traversal_info;
+            if (!prebuilt_idx&&options.placement_index!="") {
+                traversal_info=load_or_build_idx(tree, options.placement_index);
+                prebuilt_idx=&traversal_info;
+            }
             place_sample_leader(samples_to_place, tree, 100, curr_idx, INT_MAX,
                                 true, nullptr, options.max_parsimony,
                                 options.max_uncertainty, low_confidence_samples,
-                                samples_clade,sample_start_idx,nullptr);
+                                samples_clade,sample_start_idx,nullptr,false,prebuilt_idx);
             fputc('\n', stderr);
             //check_repeats(samples_to_place, sample_start_idx);
             // Sort samples order in indexes based on parsimony scores
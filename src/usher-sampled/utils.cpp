@@ -164,16 +164,18 @@ int follower_recieve_positions( std::vector<mutated_t>& to_recieve) {
 void get_pos_samples_old_tree(MAT::Tree& tree,std::vector<mutated_t>& output) {
     Original_State_t origin_states;
     check_samples(tree.root,origin_states,&tree);
-    std::vector<tbb::concurrent_vector<std::pair<size_t,char>>> pos_mutated(MAT::Mutation::refs.size());
-    tbb::parallel_for_each(origin_states.begin(),origin_states.end(),[&pos_mutated,&tree](const std::pair<size_t, Mutation_Set>& sample_mutations) {
-        for (const MAT::Mutation &m : sample_mutations.second) {
-            pos_mutated[m.get_position()].emplace_back(tree.get_node(sample_mutations.first)->node_id,m.get_all_major_allele());
+    Mutated_Positions pos_mutated;
+    pos_mutated.build(origin_states);
+    origin_states.clear();
+    fprintf(stderr, "output size %zu, nuc size %zu, pos_mutated size %zu\n",output.size(),MAT::Mutation::refs.size(),pos_mutated.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0,pos_mutated.size()),[&pos_mutated,&output](const tbb::blocked_range<size_t>& range) {
+        for (size_t idx=range.begin(); idx<range.end(); idx++) {
+            auto& this_pos=output[pos_mutated.mutations[idx].get_position()];
+            for (auto iter=pos_mutated.samples_begin(idx); iter!=pos_mutated.samples_end(idx); iter++) {
+                this_pos.emplace_back(iter->node_id,iter->allele);
+            }
         }
     });
-    fprintf(stderr, "output size %zu, nuc size %zu, pos_mutated size %zu\n",output.size(),MAT::Mutation::refs.size(),pos_mutated.size());
-    for (size_t idx=0; idx<MAT::Mutation::refs.size(); idx++) {
-        output[idx].insert(output[idx].end(),pos_mutated[idx].begin(),pos_mutated[idx].end());
-    }
     if (process_count>1) {
         distribute_positions(output);
     }
@@ -41,6 +41,7 @@ int main(int argc, char** argv) {
     bool detailed_clades = false;
     size_t print_subtrees_size=0;
     size_t print_subtrees_single=0;
+    size_t stream_batch_size=0;
     po::options_description desc{"Options"};
 
     std::string num_threads_message = "Number of threads to use when possible [DEFAULT uses all available cores, " + std::to_string(num_cores) + " detected on this machine]";
@@ -81,6 +82,8 @@ int main(int argc, char** argv) {
      "Do not add new samples to the tree")
     ("detailed-clades,D", po::bool_switch(&detailed_clades), \
      "In clades.txt, write a histogram of annotated clades and counts across all equally parsimonious placements")
+    ("stream-batch-size", po::value<size_t>(&stream_batch_size)->default_value(0), \
+     "Read the new samples from the VCF in batches of this many samples (one pass over the VCF per batch, overlapped with placing the previous batch), so that memory does not grow with the number of samples. Sorting options then apply within each batch. Requires --load-mutation-annotated-tree (-i) [DEFAULT reads the whole VCF before placement]")
     ("threads,T", po::value<uint32_t>(&num_threads)->default_value(num_cores), num_threads_message.c_str())
     ("version", "Print version number")
     ("help,h", "Print help messages");
@@ -125,11 +128,18 @@ int main(int argc, char** argv) {
     // parsimony-optimal placements
     std::vector<std::string> low_confidence_samples;
 
+    // Set only when the samples are read in batches during placement
+    std::unique_ptr<VCF_Sample_Batches> sample_batches;
+
     // If tree filename is specified, UShER needs to first load the tree and
     // a create a new mutation-annotated tree object (stored in optimal_trees)
     // using the sample variants in the input VCF file. If the VCF contains
     // samples missing in the input tree, they get added to missing_samples
     if (tree_filename != "") {
+        if (stream_batch_size > 0) {
+            fprintf(stderr, "ERROR: --stream-batch-size requires an input mutation-annotated tree (-i), since the whole VCF is needed to annotate the input tree.\n");
+            exit(1);
+        }
         fprintf(stderr, "Loading input tree.\n");
         timer.Start();
         // Create a new tree from the input newick file
@@ -164,7 +174,15 @@ int main(int argc, char** argv) {
 
         timer.Start();
 
-        MAT::read_vcf(T, vcf_filename, missing_samples, false);
+        if (stream_batch_size > 0) {
+            fprintf(stderr, "Reading the samples of the VCF file %s, to be loaded in batches of %zu samples\n", vcf_filename.c_str(), stream_batch_size);
+            sample_batches.reset(new VCF_Sample_Batches());
+            sample_batches->vcf_filename = vcf_filename;
+            sample_batches->batch_size = stream_batch_size;
+            sample_batches->missing_idx = MAT::read_vcf_missing_samples(T, vcf_filename, missing_samples);
+        } else {
+            MAT::read_vcf(T, vcf_filename, missing_samples, false);
+        }
 
         fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
     } else {
@@ -175,7 +193,7 @@ int main(int argc, char** argv) {
     int return_val = usher_common(dout_filename, outdir, max_trees, max_uncertainty, max_parsimony,
                                   sort_before_placement_1, sort_before_placement_2, sort_before_placement_3, reverse_sort, collapse_tree,
                                   collapse_output_tree, print_uncondensed_tree, print_parsimony_scores, retain_original_branch_len, no_add,
-                                  detailed_clades, print_subtrees_size, print_subtrees_single, missing_samples, low_confidence_samples, T);
+                                  detailed_clades, print_subtrees_size, print_subtrees_single, missing_samples, low_confidence_samples, T, sample_batches.get());
 
     return return_val;
 }
@@ -8,7 +8,8 @@ int usher_common(std::string dout_filename, std::string outdir, uint32_t max_tre
                  uint32_t max_uncertainty, uint32_t max_parsimony, bool sort_before_placement_1, bool sort_before_placement_2, bool sort_before_placement_3,
                  bool reverse_sort, bool collapse_tree, bool collapse_output_tree, bool print_uncondensed_tree, bool print_parsimony_scores,
                  bool retain_original_branch_len, bool no_add, bool detailed_clades, size_t print_subtrees_size, size_t print_subtrees_single,
-                 std::vector<Missing_Sample>& missing_samples, std::vector<std::string>& low_confidence_samples, MAT::Tree* loaded_MAT) {
+                 std::vector<Missing_Sample>& missing_samples, std::vector<std::string>& low_confidence_samples, MAT::Tree* loaded_MAT,
+                 const VCF_Sample_Batches* sample_batches) {
 
 
     if (print_subtrees_size == 1) {
@@ -113,6 +114,10 @@ int usher_common(std::string dout_filename, std::string outdir, uint32_t max_tre
     // score of each tree
     std::vector<size_t> tree_parsimony_scores;
 
+    // Ancestral mutations of the nodes of each tree in optimal_trees, computed
+    // lazily and shared by all samples placed on the same tree
+    std::vector<Ancestral_Mutations_Cache> ancestral_mutations_caches;
+
     auto num_trees = optimal_trees.size();
 
     // Collapses the tree nodes not carrying a mutation and also condenses
@@ -146,8 +151,9 @@ int usher_common(std::string dout_filename, std::string outdir, uint32_t max_tre
 
     FILE* parsimony_scores_file = NULL;
 
-    //Sort samples based on number of ambiguous bases if specified
-    if (sort_before_placement_3) {
+    //Sort samples based on number of ambiguous bases if specified. Samples
+    //read in batches are sorted within their batch instead, once loaded
+    if (sort_before_placement_3 && (sample_batches == NULL)) {
         timer.Start();
         fprintf(stderr, "Sorting missing samples based on the number of ambiguous bases \n");
         std::stable_sort(missing_samples.begin(), missing_samples.end());
@@ -183,8 +189,49 @@ int usher_common(std::string dout_filename, std::string outdir, uint32_t max_tre
             fclose(current_tree_file);
 
             fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
-        } else {
-            if ((sort_before_placement_1 || sort_before_placement_2) && (missing_samples.size() > 1)) {
+        }
+
+        std::string placement_stats_filename = outdir + "/placement_stats.tsv";
+        FILE *placement_stats_file = fopen(placement_stats_filename.c_str(), "w");
+
+        // Samples are sorted and placed one batch at a time. Without
+        // sample_batches, there is a single batch with all samples, already
+        // loaded. Otherwise the genotypes of the next batch are read from the
+        // VCF while the current one is placed, and freed once it is placed, so
+        // that at most two batches of genotypes are in memory.
+        size_t vcf_batch_size = (sample_batches != NULL) ? sample_batches->batch_size : missing_samples.size();
+        std::thread batch_reader;
+        auto read_batch = [&](size_t start) {
+            MAT::read_vcf_samples(sample_batches->vcf_filename, sample_batches->missing_idx, missing_samples,
+                                  start, std::min(start+vcf_batch_size, missing_samples.size()));
+        };
+        if (sample_batches != NULL) {
+            batch_reader = std::thread(read_batch, 0);
+        }
+
+        for (size_t samples_start=0; samples_start<missing_samples.size(); samples_start+=vcf_batch_size) {
+            size_t samples_end = std::min(samples_start+vcf_batch_size, missing_samples.size());
+
+            if (sample_batches != NULL) {
+                timer.Start();
+                batch_reader.join();
+                fprintf(stderr, "Loaded samples %zu to %zu of %zu from the VCF (waited %ld msec).\n\n", samples_start+1, samples_end,
+                        missing_samples.size(), timer.Stop());
+                if (samples_end < missing_samples.size()) {
+                    batch_reader = std::thread(read_batch, samples_end);
+                }
+
+                if (sort_before_placement_3) {
+                    std::stable_sort(indexes.begin()+samples_start, indexes.begin()+samples_end, [&missing_samples](size_t i1, size_t i2) {
+                        return missing_samples[i1] < missing_samples[i2];
+                    });
+                    if (reverse_sort) {
+                        std::reverse(indexes.begin()+samples_start, indexes.begin()+samples_end);
+                    }
+                }
+            }
+
+            if (!print_parsimony_scores && (sort_before_placement_1 || sort_before_placement_2) && (samples_end-samples_start > 1)) {
                 timer.Start();
                 fprintf(stderr, "Computing parsimony scores and number of parsimony-optimal placements for new samples and using them to sort the samples.\n");
                 if (max_trees > 1) {
@@ -197,54 +244,58 @@ int usher_common(std::string dout_filename, std::string outdir, uint32_t max_tre
                 std::vector<int> best_parsimony_scores;
                 std::vector<size_t> num_best_placements;
 
-                for (size_t s=0; s<missing_samples.size(); s++) {
-
-                    //Sort the missing sample mutations by position
-                    std::sort(missing_samples[s].mutations.begin(), missing_samples[s].mutations.end());
-
-                    auto bfs = T->breadth_first_expansion();
-                    size_t total_nodes = bfs.size();
+                // The tree is not modified while sorting, so the node order
+                // and ancestral mutations can be shared by all samples
+                T = &optimal_trees[0];
+                auto bfs = T->breadth_first_expansion();
+                size_t total_nodes = bfs.size();
 
-                    // Stores the excess mutations to place the sample at each
-                    // node of the tree in DFS order. When placement is as a
-                    // child, it only contains parsimony-increasing mutations in
-                    // the sample. When placement is as a sibling, it contains
-                    // parsimony-increasing mutations as well as the mutations
-                    // on the placed node in common with the new sample. Note
-                    // guaranteed to be corrrect only for optimal nodes since
-                    // the mapper can terminate the search early for non-optimal
-                    // nodes
-                    std::vector<std::vector<MAT::Mutation>> node_excess_mutations(total_nodes);
-                    // Stores the imputed mutations for ambiguous bases in the
-                    // sampled in order to place the sample at each node of the
-                    // tree in DFS order. Again, guaranteed to be corrrect only
-                    // for pasrimony-optimal nodes
-                    std::vector<std::vector<MAT::Mutation>> node_imputed_mutations(total_nodes);
+                ancestral_mutations_caches.resize(optimal_trees.size());
+                if (!ancestral_mutations_caches[0].is_built()) {
+                    ancestral_mutations_caches[0].build(T);
+                }
 
-                    // Stores the parsimony score to place the sample at each
-                    // node of the tree in DFS order.
-                    std::vector<int> node_set_difference;
-                    if (print_parsimony_scores) {
-                        node_set_difference.resize(total_nodes);
-                    }
+                // Samples are scored in batches: each node is visited once per
+                // batch and all samples of the batch are compared against its
+                // (cached) ancestral mutations while they are hot in cache.
+                // Only parsimony scores and the number of optimal placements
+                // are needed here, so per-node mutation vectors are not kept
+                const size_t batch_size = 64;
 
+                // Search state for one sample of a batch, see mapper2_input
+                struct Sample_Search {
                     size_t best_node_num_leaves = 0;
-                    // The maximum number of mutations is bound by the number
-                    // of mutations in the missing sample (place at root)
-                    //int best_set_difference = 1e9;
-                    // TODO: currently number of root mutations is also added to
-                    // this value since it forces placement as child but this
-                    // could be changed later
-                    int best_set_difference = missing_samples[s].mutations.size() + T->root->mutations.size() + 1;
-
+                    int best_set_difference;
                     size_t best_j = 0;
                     size_t num_best = 1;
                     bool best_node_has_unique = false;
-                    MAT::Node* best_node = T->root;
-
-                    std::vector<bool> node_has_unique(total_nodes, false);
+                    MAT::Node* best_node;
+                    std::vector<bool> node_has_unique;
                     std::vector<size_t> best_j_vec;
-                    best_j_vec.emplace_back(0);
+                };
+
+                best_parsimony_scores.resize(samples_end-samples_start);
+                num_best_placements.resize(samples_end-samples_start);
+
+                for (size_t batch_start=samples_start; batch_start<samples_end; batch_start+=batch_size) {
+                    size_t batch_end = std::min(batch_start+batch_size, samples_end);
+
+                    std::vector<Sample_Search> searches(batch_end-batch_start);
+                    for (size_t s=batch_start; s<batch_end; s++) {
+                        //Sort the missing sample mutations by position
+                        std::sort(missing_samples[s].mutations.begin(), missing_samples[s].mutations.end());
+
+                        auto& search = searches[s-batch_start];
+                        // The maximum number of mutations is bound by the number
+                        // of mutations in the missing sample (place at root)
+                        // TODO: currently number of root mutations is also added to
+                        // this value since it forces placement as child but this
+                        // could be changed later
+                        search.best_set_difference = missing_samples[s].mutations.size() + T->root->mutations.size() + 1;
+                        search.best_node = T->root;
+                        search.node_has_unique.resize(total_nodes, false);
+                        search.best_j_vec.emplace_back(0);
+                    }
 
                     // Parallel for loop to search for most parsimonious
                     // placements. Real action happens within mapper2_body
@@ -252,41 +303,49 @@ int usher_common(std::string dout_filename, std::string outdir, uint32_t max_tre
                     tbb::parallel_for( tbb::blocked_range<size_t>(0, total_nodes),
                     [&](tbb::blocked_range<size_t> r) {
                         for (size_t k=r.begin(); k<r.end(); ++k) {
-                            mapper2_input inp;
-                            inp.T = T;
-                            inp.node = bfs[k];
-                            inp.missing_sample_mutations = &missing_samples[s].mutations;
-                            inp.excess_mutations = &node_excess_mutations[k];
-                            inp.imputed_mutations = &node_imputed_mutations[k];
-                            inp.best_node_num_leaves = &best_node_num_leaves;
-                            inp.best_set_difference = &best_set_difference;
-                            inp.best_node = &best_node;
-                            inp.best_j =  &best_j;
-                            inp.num_best = &num_best;
-                            inp.j = k;
-                            inp.has_unique = &best_node_has_unique;
-                            inp.best_j_vec = &best_j_vec;
-                            inp.node_has_unique = &(node_has_unique);
-
-                            mapper2_body(inp, false);
+                            for (size_t s=batch_start; s<batch_end; s++) {
+                                auto& search = searches[s-batch_start];
+                                mapper2_input inp;
+                                inp.T = T;
+                                inp.node = bfs[k];
+                                inp.missing_sample_mutations = &missing_samples[s].mutations;
+                                inp.best_node_num_leaves = &search.best_node_num_leaves;
+                                inp.best_set_difference = &search.best_set_difference;
+                                inp.best_node = &search.best_node;
+                                inp.best_j =  &search.best_j;
+                                inp.num_best = &search.num_best;
+                                inp.j = k;
+                                inp.has_unique = &search.best_node_has_unique;
+                                inp.best_j_vec = &search.best_j_vec;
+                                inp.node_has_unique = &(search.node_has_unique);
+                                inp.ancestral_mutations_cache = &ancestral_mutations_caches[0];
+
+                                mapper2_body(inp, false, false);
+                            }
                         }
                     }, ap);
 
-                    best_parsimony_scores.emplace_back(best_set_difference);
-                    num_best_placements.emplace_back(num_best);
+                    for (size_t s=batch_start; s<batch_end; s++) {
+                        best_parsimony_scores[s-samples_start] = searches[s-batch_start].best_set_difference;
+                        num_best_placements[s-samples_start] = searches[s-batch_start].num_best;
+                    }
                 }
 
                 // Sort samples order in indexes based on parsimony scores
                 // and number of parsimony-optimal placements
                 if (sort_before_placement_1) {
-                    std::stable_sort(indexes.begin(), indexes.end(),
-                    [&num_best_placements, &best_parsimony_scores](size_t i1, size_t i2) {
+                    std::stable_sort(indexes.begin()+samples_start, indexes.begin()+samples_end,
+                    [&num_best_placements, &best_parsimony_scores, samples_start](size_t i1, size_t i2) {
+                        i1 -= samples_start;
+                        i2 -= samples_start;
                         return ((best_parsimony_scores[i1] < best_parsimony_scores[i2]) || \
                                 ((best_parsimony_scores[i1] == best_parsimony_scores[i2]) && (num_best_placements[i1] < num_best_placements[i2])));
                     });
                 } else if (sort_before_placement_2) {
-                    std::stable_sort(indexes.begin(), indexes.end(),
-                    [&num_best_placements, &best_parsimony_scores](size_t i1, size_t i2) {
+                    std::stable_sort(indexes.begin()+samples_start, indexes.begin()+samples_end,
+                    [&num_best_placements, &best_parsimony_scores, samples_start](size_t i1, size_t i2) {
+                        i1 -= samples_start;
+                        i2 -= samples_start;
                         return ((num_best_placements[i1] < num_best_placements[i2]) || \
                                 ((num_best_placements[i1] == num_best_placements[i2]) && (best_parsimony_scores[i1] < best_parsimony_scores[i2])));
                     });
@@ -294,139 +353,105 @@ int usher_common(std::string dout_filename, std::string outdir, uint32_t max_tre
 
                 // Reverse sorted order if specified
                 if (reverse_sort) {
-                    std::reverse(indexes.begin(), indexes.end());
+                    std::reverse(indexes.begin()+samples_start, indexes.begin()+samples_end);
                 }
 
                 fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
             }
 
-            fprintf(stderr, "Adding missing samples to the tree.\n");
-        }
+            if (!print_parsimony_scores && (samples_start == 0)) {
+                fprintf(stderr, "Adding missing samples to the tree.\n");
+            }
 
-        std::string placement_stats_filename = outdir + "/placement_stats.tsv";
-        FILE *placement_stats_file = fopen(placement_stats_filename.c_str(), "w");
+            // Traverse in sorted sample order
+            for (size_t idx=samples_start; idx<samples_end; idx++) {
 
-        // Traverse in sorted sample order
-        for (size_t idx=0; idx<indexes.size(); idx++) {
+                num_trees = optimal_trees.size();
 
-            num_trees = optimal_trees.size();
+                for (size_t t_idx=0; t_idx < num_trees; t_idx++) {
+                    timer.Start();
 
-            for (size_t t_idx=0; t_idx < num_trees; t_idx++) {
-                timer.Start();
+                    T = &optimal_trees[t_idx];
 
-                T = &optimal_trees[t_idx];
+                    ancestral_mutations_caches.resize(optimal_trees.size());
+                    auto ancestral_mutations_cache = &ancestral_mutations_caches[t_idx];
+                    if (!ancestral_mutations_cache->is_built()) {
+                        ancestral_mutations_cache->build(T);
+                    }
 
-                if (num_trees > 1) {
-                    fprintf(stderr, "==Tree %zu=== \n", t_idx+1);
-                }
+                    if (num_trees > 1) {
+                        fprintf(stderr, "==Tree %zu=== \n", t_idx+1);
+                    }
 
-                size_t s = indexes[idx];
-                auto sample = missing_samples[s].name;
+                    size_t s = indexes[idx];
+                    auto sample = missing_samples[s].name;
 
-                if (T->get_node(sample) != NULL) {
-                    fprintf(stderr, "WARNING: Sample %s already in the tree! Ignoring.\n\n", sample.c_str());
-                    continue;
-                }
+                    if (T->get_node(sample) != NULL) {
+                        fprintf(stderr, "WARNING: Sample %s already in the tree! Ignoring.\n\n", sample.c_str());
+                        continue;
+                    }
 
-                if (print_parsimony_scores) {
-                    auto parsimony_scores_filename = outdir + "/parsimony-scores.tsv";
-                    if (s==0) {
-                        fprintf(stderr, "\nNow computing branch parsimony scores for adding the missing samples at each of the %zu nodes in the existing tree without modifying the tree.\n", T->breadth_first_expansion().size());
-                        fprintf(stderr, "The branch parsimony scores will be written to file %s\n\n", parsimony_scores_filename.c_str());
+                    if (print_parsimony_scores) {
+                        auto parsimony_scores_filename = outdir + "/parsimony-scores.tsv";
+                        if (s==0) {
+                            fprintf(stderr, "\nNow computing branch parsimony scores for adding the missing samples at each of the %zu nodes in the existing tree without modifying the tree.\n", T->breadth_first_expansion().size());
+                            fprintf(stderr, "The branch parsimony scores will be written to file %s\n\n", parsimony_scores_filename.c_str());
 
-                        parsimony_scores_file = fopen(parsimony_scores_filename.c_str(), "w");
-                        fprintf (parsimony_scores_file, "#Sample\tTree node\tParsimony score\tOptimal (y/n)\tParsimony-increasing mutations (for optimal nodes)\n");
+                            parsimony_scores_file = fopen(parsimony_scores_filename.c_str(), "w");
+                            fprintf (parsimony_scores_file, "#Sample\tTree node\tParsimony score\tOptimal (y/n)\tParsimony-increasing mutations (for optimal nodes)\n");
+                        }
                     }
-                }
 
-                auto bfs = T->breadth_first_expansion();
-                size_t total_nodes = bfs.size();
+                    auto bfs = T->breadth_first_expansion();
+                    size_t total_nodes = bfs.size();
 
-                // Stores the excess mutations to place the sample at each
-                // node of the tree in DFS order. When placement is as a
-                // child, it only contains parsimony-increasing mutations in
-                // the sample. When placement is as a sibling, it contains
-                // parsimony-increasing mutations as well as the mutations
-                // on the placed node in common with the new sample. Note
-                // guaranteed to be corrrect only for optimal nodes since
-                // the mapper can terminate the search early for non-optimal
-                // nodes
-                std::vector<std::vector<MAT::Mutation>> node_excess_mutations(total_nodes);
-                // Stores the imputed mutations for ambiguous bases in the
-                // sampled in order to place the sample at each node of the
-                // tree in DFS order. Again, guaranteed to be corrrect only
-                // for pasrimony-optimal nodes
-                std::vector<std::vector<MAT::Mutation>> node_imputed_mutations(total_nodes);
-
-                std::vector<int> node_set_difference;
-
-                if (print_parsimony_scores) {
-                    node_set_difference.resize(total_nodes);
-                }
+                    // Stores the excess mutations to place the sample at each
+                    // node of the tree in DFS order. When placement is as a
+                    // child, it only contains parsimony-increasing mutations in
+                    // the sample. When placement is as a sibling, it contains
+                    // parsimony-increasing mutations as well as the mutations
+                    // on the placed node in common with the new sample. Note
+                    // guaranteed to be corrrect only for optimal nodes since
+                    // the mapper can terminate the search early for non-optimal
+                    // nodes
+                    std::vector<std::vector<MAT::Mutation>> node_excess_mutations(total_nodes);
+                    // Stores the imputed mutations for ambiguous bases in the
+                    // sampled in order to place the sample at each node of the
+                    // tree in DFS order. Again, guaranteed to be corrrect only
+                    // for pasrimony-optimal nodes
+                    std::vector<std::vector<MAT::Mutation>> node_imputed_mutations(total_nodes);
 
-                size_t best_node_num_leaves = 0;
-                // The maximum number of mutations is bound by the number
-                // of mutations in the missing sample (place at root)
-                //int best_set_difference = 1e9;
-                // TODO: currently number of root mutations is also added to
-                // this value since it forces placement as child but this
-                // could be changed later
-                int best_set_difference = missing_samples[s].mutations.size() + T->root->mutations.size() + 1;
-
-                size_t best_j = 0;
-                bool best_node_has_unique = false;
-
-                std::vector<bool> node_has_unique(total_nodes, false);
-                std::vector<size_t> best_j_vec;
-                best_j_vec.emplace_back(0);
-
-                size_t num_best = 1;
-                MAT::Node* best_node = T->root;
-
-                // Parallel for loop to search for most parsimonious
-                // placements. Real action happens within mapper2_body
-                static tbb::affinity_partitioner ap;
-                tbb::parallel_for( tbb::blocked_range<size_t>(0, total_nodes),
-                [&](tbb::blocked_range<size_t> r) {
-                    for (size_t k=r.begin(); k<r.end(); ++k) {
-                        mapper2_input inp;
-                        inp.T = T;
-                        inp.node = bfs[k];
-                        inp.missing_sample_mutations = &missing_samples[s].mutations;
-                        inp.excess_mutations = &node_excess_mutations[k];
-                        inp.imputed_mutations = &node_imputed_mutations[k];
-                        inp.best_node_num_leaves = &best_node_num_leaves;
-                        inp.best_set_difference = &best_set_difference;
-                        inp.best_node = &best_node;
-                        inp.best_j =  &best_j;
-                        inp.num_best = &num_best;
-                        inp.j = k;
-                        inp.has_unique = &best_node_has_unique;
-
-                        if (print_parsimony_scores) {
-                            inp.set_difference = &node_set_difference[k];
-                        }
-                        inp.best_j_vec = &best_j_vec;
-                        inp.node_has_unique = &(node_has_unique);
+                    std::vector<int> node_set_difference;
 
-                        mapper2_body(inp, print_parsimony_scores, print_parsimony_scores);
+                    if (print_parsimony_scores) {
+                        node_set_difference.resize(total_nodes);
                     }
-                }, ap);
 
-                if (!print_parsimony_scores) {
-                    best_set_difference += 1;
+                    size_t best_node_num_leaves = 0;
+                    // The maximum number of mutations is bound by the number
+                    // of mutations in the missing sample (place at root)
+                    //int best_set_difference = 1e9;
+                    // TODO: currently number of root mutations is also added to
+                    // this value since it forces placement as child but this
+                    // could be changed later
+                    int best_set_difference = missing_samples[s].mutations.size() + T->root->mutations.size() + 1;
+
+                    size_t best_j = 0;
+                    bool best_node_has_unique = false;
 
-                    auto tmp_vec = std::vector<size_t>(best_j_vec.begin(), best_j_vec.end());
+                    std::vector<bool> node_has_unique(total_nodes, false);
+                    std::vector<size_t> best_j_vec;
+                    best_j_vec.emplace_back(0);
 
-                    num_best = 0;
-                    best_j_vec.clear();
+                    size_t num_best = 1;
+                    MAT::Node* best_node = T->root;
 
                     // Parallel for loop to search for most parsimonious
                     // placements. Real action happens within mapper2_body
-                    tbb::parallel_for( tbb::blocked_range<size_t>(0, tmp_vec.size()),
+                    static tbb::affinity_partitioner ap;
+                    tbb::parallel_for( tbb::blocked_range<size_t>(0, total_nodes),
                     [&](tbb::blocked_range<size_t> r) {
-                        for (size_t l=r.begin(); l<r.end(); ++l) {
-                            auto k = tmp_vec[l];
+                        for (size_t k=r.begin(); k<r.end(); ++k) {
                             mapper2_input inp;
                             inp.T = T;
                             inp.node = bfs[k];
@@ -441,353 +466,410 @@ int usher_common(std::string dout_filename, std::string outdir, uint32_t max_tre
                             inp.j = k;
                             inp.has_unique = &best_node_has_unique;
 
+                            if (print_parsimony_scores) {
+                                inp.set_difference = &node_set_difference[k];
+                            }
                             inp.best_j_vec = &best_j_vec;
                             inp.node_has_unique = &(node_has_unique);
+                            inp.ancestral_mutations_cache = ancestral_mutations_cache;
 
-                            mapper2_body(inp, false);
+                            mapper2_body(inp, print_parsimony_scores, print_parsimony_scores);
                         }
                     }, ap);
 
-                    fprintf(stderr, "Current tree size (#nodes): %zu\tSample name: %s\tParsimony score: %d\tNumber of parsimony-optimal placements: %zu\n", total_nodes, sample.c_str(), \
-                            best_set_difference, num_best);
-                    fprintf(placement_stats_file, "%s\t%d\t%zu\t", sample.c_str(), best_set_difference, num_best);
-                    // Prints a warning message if 2 or more
-                    // parsimony-optimal placements found
-                    if (num_best > 1) {
-                        if (max_trees == 1) {
-                            low_confidence_samples.emplace_back(sample);
+                    if (!print_parsimony_scores) {
+                        best_set_difference += 1;
+
+                        auto tmp_vec = std::vector<size_t>(best_j_vec.begin(), best_j_vec.end());
+
+                        num_best = 0;
+                        best_j_vec.clear();
+
+                        // Parallel for loop to search for most parsimonious
+                        // placements. Real action happens within mapper2_body
+                        tbb::parallel_for( tbb::blocked_range<size_t>(0, tmp_vec.size()),
+                        [&](tbb::blocked_range<size_t> r) {
+                            for (size_t l=r.begin(); l<r.end(); ++l) {
+                                auto k = tmp_vec[l];
+                                mapper2_input inp;
+                                inp.T = T;
+                                inp.node = bfs[k];
+                                inp.missing_sample_mutations = &missing_samples[s].mutations;
+                                inp.excess_mutations = &node_excess_mutations[k];
+                                inp.imputed_mutations = &node_imputed_mutations[k];
+                                inp.best_node_num_leaves = &best_node_num_leaves;
+                                inp.best_set_difference = &best_set_difference;
+                                inp.best_node = &best_node;
+                                inp.best_j =  &best_j;
+                                inp.num_best = &num_best;
+                                inp.j = k;
+                                inp.has_unique = &best_node_has_unique;
+
+                                inp.best_j_vec = &best_j_vec;
+                                inp.node_has_unique = &(node_has_unique);
+                                inp.ancestral_mutations_cache = ancestral_mutations_cache;
+
+                                mapper2_body(inp, false);
+                            }
+                        }, ap);
+
+                        fprintf(stderr, "Current tree size (#nodes): %zu\tSample name: %s\tParsimony score: %d\tNumber of parsimony-optimal placements: %zu\n", total_nodes, sample.c_str(), \
+                                best_set_difference, num_best);
+                        fprintf(placement_stats_file, "%s\t%d\t%zu\t", sample.c_str(), best_set_difference, num_best);
+                        // Prints a warning message if 2 or more
+                        // parsimony-optimal placements found
+                        if (num_best > 1) {
+                            if (max_trees == 1) {
+                                low_confidence_samples.emplace_back(sample);
+                            }
+                            if (num_best > max_uncertainty) {
+                                fprintf(stderr, "WARNING: Number of parsimony-optimal placements exceeds maximum allowed value (%u). Ignoring sample %s.\n", max_uncertainty, sample.c_str());
+                            }  else if (best_set_difference <= max_parsimony) {
+                                fprintf(stderr, "WARNING: Multiple parsimony-optimal placements found. Placement done without high confidence.\n");
+                            }
                         }
-                        if (num_best > max_uncertainty) {
-                            fprintf(stderr, "WARNING: Number of parsimony-optimal placements exceeds maximum allowed value (%u). Ignoring sample %s.\n", max_uncertainty, sample.c_str());
-                        }  else if (best_set_difference <= max_parsimony) {
-                            fprintf(stderr, "WARNING: Multiple parsimony-optimal placements found. Placement done without high confidence.\n");
+
+                        if (best_set_difference > max_parsimony) {
+                            fprintf(stderr, "WARNING: Parsimony score of the most parsimonious placement exceeds the maximum allowed value (%u). Ignoring sample %s.\n", max_parsimony, sample.c_str());
                         }
-                    }
+                    }  else {
+                        fprintf(stderr, "Missing sample: %s\t Best parsimony score: %d\tNumber of parsimony-optimal placements: %zu\n", sample.c_str(), \
+                                best_set_difference, num_best);
 
-                    if (best_set_difference > max_parsimony) {
-                        fprintf(stderr, "WARNING: Parsimony score of the most parsimonious placement exceeds the maximum allowed value (%u). Ignoring sample %s.\n", max_parsimony, sample.c_str());
                     }
-                }  else {
-                    fprintf(stderr, "Missing sample: %s\t Best parsimony score: %d\tNumber of parsimony-optimal placements: %zu\n", sample.c_str(), \
-                            best_set_difference, num_best);
 
-                }
-
-                // Debugging information to be printed if -DDEBUG compile-time
-                // flag is set. This includes sample mutations, details of the
-                // best node and the list of mutations at the best node
+                    // Debugging information to be printed if -DDEBUG compile-time
+                    // flag is set. This includes sample mutations, details of the
+                    // best node and the list of mutations at the best node
 #if DEBUG == 1
-                fprintf (stderr, "Sample mutations:\t");
-                if (missing_samples[s].mutations.size() > 0) {
-                    for (auto m: missing_samples[s].mutations) {
-                        if (m.is_missing) {
-                            continue;
+                    fprintf (stderr, "Sample mutations:\t");
+                    if (missing_samples[s].mutations.size() > 0) {
+                        for (auto m: missing_samples[s].mutations) {
+                            if (m.is_missing) {
+                                continue;
+                            }
+                            fprintf(stderr, "|%s", (MAT::get_nuc(m.par_nuc) + std::to_string(m.position) + MAT::get_nuc(m.mut_nuc)).c_str());
+                            fprintf(stderr, "| ");
                         }
-                        fprintf(stderr, "|%s", (MAT::get_nuc(m.par_nuc) + std::to_string(m.position) + MAT::get_nuc(m.mut_nuc)).c_str());
-                        fprintf(stderr, "| ");
                     }
-                }
-                fprintf (stderr, "\n");
+                    fprintf (stderr, "\n");
 
-                assert(num_best > 0);
+                    assert(num_best > 0);
 
-                //best_node_vec.emplace_back(best_node);
-                if ((num_best > 0) && (num_best <= max_uncertainty) && (best_set_difference <= max_parsimony)) {
-                    for (auto j: best_j_vec) {
-                        auto node = bfs[j];
+                    //best_node_vec.emplace_back(best_node);
+                    if ((num_best > 0) && (num_best <= max_uncertainty) && (best_set_difference <= max_parsimony)) {
+                        for (auto j: best_j_vec) {
+                            auto node = bfs[j];
 
-                        std::vector<std::string> muts;
+                            std::vector<std::string> muts;
 
-                        fprintf(stderr, "Best node ");
-                        if (node->is_leaf() || node_has_unique[j]) {
-                            fprintf(stderr, "(sibling)");
-                        } else {
-                            fprintf(stderr, "(child)");
-                        }
-
-                        if (node == best_node) {
-                            fprintf(stderr, "*: %s\t", node->identifier.c_str());
-                        } else {
-                            fprintf(stderr, ": %s\t", node->identifier.c_str());
-                        }
+                            fprintf(stderr, "Best node ");
+                            if (node->is_leaf() || node_has_unique[j]) {
+                                fprintf(stderr, "(sibling)");
+                            } else {
+                                fprintf(stderr, "(child)");
+                            }
 
-                        std::string s = "|";
-                        for (auto m: node->mutations) {
-                            s += MAT::get_nuc(m.par_nuc) + std::to_string(m.position) + MAT::get_nuc(m.mut_nuc) + '|';
-                        }
-                        if (node->mutations.size() > 0) {
-                            muts.emplace_back(std::move(s));
-                        }
+                            if (node == best_node) {
+                                fprintf(stderr, "*: %s\t", node->identifier.c_str());
+                            } else {
+                                fprintf(stderr, ": %s\t", node->identifier.c_str());
+                            }
 
-                        for (auto anc: T->rsearch(node->identifier)) {
-                            s = "|";
-                            for (auto m: anc->mutations) {
+                            std::string s = "|";
+                            for (auto m: node->mutations) {
                                 s += MAT::get_nuc(m.par_nuc) + std::to_string(m.position) + MAT::get_nuc(m.mut_nuc) + '|';
                             }
-                            if (anc->mutations.size() > 0) {
+                            if (node->mutations.size() > 0) {
                                 muts.emplace_back(std::move(s));
                             }
-                        }
 
+                            for (auto anc: T->rsearch(node->identifier)) {
+                                s = "|";
+                                for (auto m: anc->mutations) {
+                                    s += MAT::get_nuc(m.par_nuc) + std::to_string(m.position) + MAT::get_nuc(m.mut_nuc) + '|';
+                                }
+                                if (anc->mutations.size() > 0) {
+                                    muts.emplace_back(std::move(s));
+                                }
+                            }
 
-                        std::reverse(muts.begin(), muts.end());
 
-                        fprintf(stderr, "Mutations: ");
-                        for (size_t m = 0; m < muts.size(); m++) {
-                            fprintf(stderr, "%s", muts[m].c_str());
-                            if (m+1 < muts.size()) {
-                                fprintf(stderr, " > ");
+                            std::reverse(muts.begin(), muts.end());
+
+                            fprintf(stderr, "Mutations: ");
+                            for (size_t m = 0; m < muts.size(); m++) {
+                                fprintf(stderr, "%s", muts[m].c_str());
+                                if (m+1 < muts.size()) {
+                                    fprintf(stderr, " > ");
+                                }
                             }
+                            fprintf(stderr, "\n");
                         }
                         fprintf(stderr, "\n");
                     }
-                    fprintf(stderr, "\n");
-                }
 
 #endif
 
-                // If number of parsimony-optimal trees is more than 1 and if
-                // the number of trees has not already exceeded the maximum
-                // limit, create a copy of the current tree in curr_tree
-                MAT::Tree curr_tree;
-                if ((max_trees > 1) && (num_best > 1) && (num_trees < max_trees)) {
-                    curr_tree = MAT::get_tree_copy(*T);
-                }
+                    // If number of parsimony-optimal trees is more than 1 and if
+                    // the number of trees has not already exceeded the maximum
+                    // limit, create a copy of the current tree in curr_tree
+                    MAT::Tree curr_tree;
+                    if ((max_trees > 1) && (num_best > 1) && (num_trees < max_trees)) {
+                        curr_tree = MAT::get_tree_copy(*T);
+                    }
 
-                if (print_parsimony_scores) {
-                    for (size_t k = 0; k < total_nodes; k++) {
-                        char is_optimal = (node_set_difference[k] == best_set_difference) ? 'y' : 'n';
-                        fprintf (parsimony_scores_file, "%s\t%s\t%d\t\t%c\t", sample.c_str(), bfs[k]->identifier.c_str(), node_set_difference[k], is_optimal);
-                        if (node_set_difference[k] == best_set_difference) {
-                            if (node_set_difference[k] == 0) {
-                                fprintf(parsimony_scores_file, "*");
-                            }
-                            for (size_t idx = 0; idx < static_cast<size_t>(node_set_difference[k]); idx++) {
-                                auto m = node_excess_mutations[k][idx];
-                                assert (m.is_masked() || ((m.mut_nuc & (m.mut_nuc-1)) == 0));
-                                fprintf(parsimony_scores_file, "%s", m.get_string().c_str());
-                                if (idx+1 < static_cast<size_t>(node_set_difference[k])) {
-                                    fprintf(parsimony_scores_file, ",");
+                    if (print_parsimony_scores) {
+                        for (size_t k = 0; k < total_nodes; k++) {
+                            char is_optimal = (node_set_difference[k] == best_set_difference) ? 'y' : 'n';
+                            fprintf (parsimony_scores_file, "%s\t%s\t%d\t\t%c\t", sample.c_str(), bfs[k]->identifier.c_str(), node_set_difference[k], is_optimal);
+                            if (node_set_difference[k] == best_set_difference) {
+                                if (node_set_difference[k] == 0) {
+                                    fprintf(parsimony_scores_file, "*");
                                 }
+                                for (size_t idx = 0; idx < static_cast<size_t>(node_set_difference[k]); idx++) {
+                                    auto m = node_excess_mutations[k][idx];
+                                    assert (m.is_masked() || ((m.mut_nuc & (m.mut_nuc-1)) == 0));
+                                    fprintf(parsimony_scores_file, "%s", m.get_string().c_str());
+                                    if (idx+1 < static_cast<size_t>(node_set_difference[k])) {
+                                        fprintf(parsimony_scores_file, ",");
+                                    }
+                                }
+                            } else {
+                                fprintf(parsimony_scores_file, "N/A");
                             }
-                        } else {
-                            fprintf(parsimony_scores_file, "N/A");
+                            fprintf(parsimony_scores_file, "\n");
                         }
-                        fprintf(parsimony_scores_file, "\n");
                     }
-                }
-                // Do placement only if number of parsimony-optimal placements
-                // does not exceed the maximum allowed value and the parsimony
-                // score for the most parsimonious placement does not exceed
-                // the maximum allowed value
-                else if ((num_best <= max_uncertainty) && (best_set_difference <= max_parsimony)) {
-                    if (num_best > 1) {
-                        if (max_trees > 1) {
-                            // Sorting by bfs order ensures reproducible results
-                            // during multiple placements
-                            std::sort(best_j_vec.begin(), best_j_vec.end());
-                        }
+                    // Do placement only if number of parsimony-optimal placements
+                    // does not exceed the maximum allowed value and the parsimony
+                    // score for the most parsimonious placement does not exceed
+                    // the maximum allowed value
+                    else if ((num_best <= max_uncertainty) && (best_set_difference <= max_parsimony)) {
+                        if (num_best > 1) {
+                            if (max_trees > 1) {
+                                // Sorting by bfs order ensures reproducible results
+                                // during multiple placements
+                                std::sort(best_j_vec.begin(), best_j_vec.end());
+                            }
 
-                        // Update num_best so that the number of trees does
-                        // not exceed maximum limit
-                        if ((optimal_trees.size() <= max_trees) && (num_best + optimal_trees.size() > max_trees)) {
-                            if ((num_best + optimal_trees.size() > max_trees+1) && (max_trees > 1))
-                                fprintf (stderr, "%zu parsimony-optimal placements found but total trees has already exceed the max possible value (%i)!\n", num_best, max_trees);
-                            num_best = 1 + max_trees - optimal_trees.size();
+                            // Update num_best so that the number of trees does
+                            // not exceed maximum limit
+                            if ((optimal_trees.size() <= max_trees) && (num_best + optimal_trees.size() > max_trees)) {
+                                if ((num_best + optimal_trees.size() > max_trees+1) && (max_trees > 1))
+                                    fprintf (stderr, "%zu parsimony-optimal placements found but total trees has already exceed the max possible value (%i)!\n", num_best, max_trees);
+                                num_best = 1 + max_trees - optimal_trees.size();
+                            }
                         }
-                    }
 
-                    // Assign clades if maximum number of trees is 1
-                    if (max_trees == 1) {
-                        missing_samples[s].clade_assignments.clear();
-                        missing_samples[s].clade_assignments.resize(T->get_num_annotations());
-                        missing_samples[s].best_clade_assignment.clear();
-                        missing_samples[s].best_clade_assignment.resize(T->get_num_annotations());
-                        for (size_t c=0; c < T->get_num_annotations(); c++) {
-                            missing_samples[s].clade_assignments[c].resize(best_j_vec.size());
-                            //TODO: can be parallelized
-                            for (size_t k=0; k < best_j_vec.size(); k++) {
-                                bool include_self = !bfs[best_j_vec[k]]->is_leaf() && !node_has_unique[best_j_vec[k]];
-                                auto clade_assignment = T->get_clade_assignment(bfs[best_j_vec[k]], c, include_self);
-                                missing_samples[s].clade_assignments[c][k] = clade_assignment;
-                                if (bfs[best_j_vec[k]]==best_node) {
-                                    missing_samples[s].best_clade_assignment[c] = clade_assignment;
+                        // Assign clades if maximum number of trees is 1
+                        if (max_trees == 1) {
+                            missing_samples[s].clade_assignments.clear();
+                            missing_samples[s].clade_assignments.resize(T->get_num_annotations());
+                            missing_samples[s].best_clade_assignment.clear();
+                            missing_samples[s].best_clade_assignment.resize(T->get_num_annotations());
+                            for (size_t c=0; c < T->get_num_annotations(); c++) {
+                                missing_samples[s].clade_assignments[c].resize(best_j_vec.size());
+                                //TODO: can be parallelized
+                                for (size_t k=0; k < best_j_vec.size(); k++) {
+                                    bool include_self = !bfs[best_j_vec[k]]->is_leaf() && !node_has_unique[best_j_vec[k]];
+                                    auto clade_assignment = T->get_clade_assignment(bfs[best_j_vec[k]], c, include_self);
+                                    missing_samples[s].clade_assignments[c][k] = clade_assignment;
+                                    if (bfs[best_j_vec[k]]==best_node) {
+                                        missing_samples[s].best_clade_assignment[c] = clade_assignment;
+                                    }
                                 }
+                                std::sort(missing_samples[s].clade_assignments[c].begin(), missing_samples[s].clade_assignments[c].end());
                             }
-                            std::sort(missing_samples[s].clade_assignments[c].begin(), missing_samples[s].clade_assignments[c].end());
                         }
-                    }
 
-                    // Iterate over the number of parsimony-optimal placements
-                    // for which a new tree will be created
-                    for (size_t k = 0; k < num_best; k++) {
-
-                        // best_j is updated using best_j_vec if multiple
-                        // placements are allowed and the number of new trees
-                        // for the given sample is greater than 1. If not, the
-                        // default tie-breaking strategy used in mapper2_body has
-                        // already chosen a single best_j
-                        if ((max_trees > 1) && (num_best > 1)) {
-                            if ((k==0) && (num_best > 1)) {
-                                fprintf (stderr, "Creating %zu additional tree(s) for %zu parsimony-optimal placements.\n", num_best-1, num_best);
-                            }
-                            // If at second placement or higher, a new tree needs to
-                            // be added to optimal_trees and T needs to point to its
-                            // last element. If not, T is already pointing to the
-                            // last element of optimal_trees on which placement will
-                            // be carried out
-                            if (k > 0) {
-                                auto tmp_T = MAT::get_tree_copy(curr_tree);
-                                optimal_trees.emplace_back(std::move(tmp_T));
-                                T = &optimal_trees[optimal_trees.size()-1];
-                                bfs = T->breadth_first_expansion();
-                            }
+                        // Iterate over the number of parsimony-optimal placements
+                        // for which a new tree will be created
+                        for (size_t k = 0; k < num_best; k++) {
+
+                            // best_j is updated using best_j_vec if multiple
+                            // placements are allowed and the number of new trees
+                            // for the given sample is greater than 1. If not, the
+                            // default tie-breaking strategy used in mapper2_body has
+                            // already chosen a single best_j
+                            if ((max_trees > 1) && (num_best > 1)) {
+                                if ((k==0) && (num_best > 1)) {
+                                    fprintf (stderr, "Creating %zu additional tree(s) for %zu parsimony-optimal placements.\n", num_best-1, num_best);
+                                }
+                                // If at second placement or higher, a new tree needs to
+                                // be added to optimal_trees and T needs to point to its
+                                // last element. If not, T is already pointing to the
+                                // last element of optimal_trees on which placement will
+                                // be carried out
+                                if (k > 0) {
+                                    auto tmp_T = MAT::get_tree_copy(curr_tree);
+                                    optimal_trees.emplace_back(std::move(tmp_T));
+                                    T = &optimal_trees[optimal_trees.size()-1];
+                                    bfs = T->breadth_first_expansion();
+                                    // Built on first use, when the new tree is
+                                    // next visited
+                                    ancestral_mutations_caches.resize(optimal_trees.size());
+                                    ancestral_mutations_cache = &ancestral_mutations_caches[optimal_trees.size()-1];
+                                }
 
-                            best_j = best_j_vec[k];
-                            best_node_has_unique = node_has_unique[k];
-                            best_node = bfs[best_j];
-                        }
+                                best_j = best_j_vec[k];
+                                best_node_has_unique = node_has_unique[k];
+                                best_node = bfs[best_j];
+                            }
 
-                        // Add sample to tree unless --no-add or it is already in the tree
-                        if (!no_add && T->get_node(sample) == NULL) {
-                            // Is placement as sibling
-                            if (best_node->is_leaf() || best_node_has_unique) {
-                                std::string nid = T->new_internal_node_id();
-                                T->create_node(nid, best_node->parent->identifier);
-                                T->create_node(sample, nid);
-                                T->move_node(best_node->identifier, nid);
-                                // common_mut stores mutations common to the
-                                // best node branch and the sample, l1_mut
-                                // stores mutations unique to best node branch
-                                // and l2_mut stores mutations unique to the
-                                // sample not in best node branch
-                                std::vector<MAT::Mutation> common_mut, l1_mut, l2_mut;
-                                std::vector<MAT::Mutation> curr_l1_mut;
-
-                                // Compute current best node branch mutations
-                                for (auto m1: best_node->mutations) {
-                                    MAT::Mutation m = m1.copy();
-                                    curr_l1_mut.emplace_back(m);
-                                }
-                                // Clear mutations on the best node branch which
-                                // will be later replaced by l1_mut
-                                best_node->clear_mutations();
-
-                                // Compute l1_mut
-                                for (auto m1: curr_l1_mut) {
-                                    bool found = false;
-                                    for (auto m2: node_excess_mutations[best_j]) {
-                                        if (m1.is_masked()) {
-                                            break;
-                                        }
-                                        if (m1.position == m2.position) {
-                                            if (m1.mut_nuc == m2.mut_nuc) {
-                                                found = true;
+                            // Add sample to tree unless --no-add or it is already in the tree
+                            if (!no_add && T->get_node(sample) == NULL) {
+                                // Is placement as sibling
+                                if (best_node->is_leaf() || best_node_has_unique) {
+                                    std::string nid = T->new_internal_node_id();
+                                    T->create_node(nid, best_node->parent->identifier);
+                                    T->create_node(sample, nid);
+                                    T->move_node(best_node->identifier, nid);
+                                    // common_mut stores mutations common to the
+                                    // best node branch and the sample, l1_mut
+                                    // stores mutations unique to best node branch
+                                    // and l2_mut stores mutations unique to the
+                                    // sample not in best node branch
+                                    std::vector<MAT::Mutation> common_mut, l1_mut, l2_mut;
+                                    std::vector<MAT::Mutation> curr_l1_mut;
+
+                                    // Compute current best node branch mutations
+                                    for (auto m1: best_node->mutations) {
+                                        MAT::Mutation m = m1.copy();
+                                        curr_l1_mut.emplace_back(m);
+                                    }
+                                    // Clear mutations on the best node branch which
+                                    // will be later replaced by l1_mut
+                                    best_node->clear_mutations();
+
+                                    // Compute l1_mut
+                                    for (auto m1: curr_l1_mut) {
+                                        bool found = false;
+                                        for (auto m2: node_excess_mutations[best_j]) {
+                                            if (m1.is_masked()) {
                                                 break;
                                             }
+                                            if (m1.position == m2.position) {
+                                                if (m1.mut_nuc == m2.mut_nuc) {
+                                                    found = true;
+                                                    break;
+                                                }
+                                            }
                                         }
-                                    }
-                                    if (!found) {
-                                        MAT::Mutation m = m1.copy();
-                                        l1_mut.emplace_back(m);
-                                    }
-                                }
-                                // Compute l2_mut
-                                for (auto m1: node_excess_mutations[best_j]) {
-                                    bool found = false;
-                                    for (auto m2: curr_l1_mut) {
-                                        if (m1.is_masked()) {
-                                            break;
+                                        if (!found) {
+                                            MAT::Mutation m = m1.copy();
+                                            l1_mut.emplace_back(m);
                                         }
-                                        if (m1.position == m2.position) {
-                                            if (m1.mut_nuc == m2.mut_nuc) {
-                                                found = true;
-                                                MAT::Mutation m = m1.copy();
-                                                common_mut.emplace_back(m);
+                                    }
+                                    // Compute l2_mut
+                                    for (auto m1: node_excess_mutations[best_j]) {
+                                        bool found = false;
+                                        for (auto m2: curr_l1_mut) {
+                                            if (m1.is_masked()) {
                                                 break;
                                             }
+                                            if (m1.position == m2.position) {
+                                                if (m1.mut_nuc == m2.mut_nuc) {
+                                                    found = true;
+                                                    MAT::Mutation m = m1.copy();
+                                                    common_mut.emplace_back(m);
+                                                    break;
+                                                }
+                                            }
+                                        }
+                                        if (!found) {
+                                            MAT::Mutation m = m1.copy();
+                                            l2_mut.emplace_back(m);
                                         }
                                     }
-                                    if (!found) {
-                                        MAT::Mutation m = m1.copy();
-                                        l2_mut.emplace_back(m);
+
+                                    // Add mutations to new node using common_mut
+                                    for (auto m: common_mut) {
+                                        T->get_node(nid)->add_mutation(m);
+                                    }
+                                    // Add mutations to best node using l1_mut
+                                    for (auto m: l1_mut) {
+                                        T->get_node(best_node->identifier)->add_mutation(m);
+                                    }
+                                    // Add new sample mutations using l2_mut
+                                    for (auto m: l2_mut) {
+                                        T->get_node(sample)->add_mutation(m);
                                     }
-                                }
 
-                                // Add mutations to new node using common_mut
-                                for (auto m: common_mut) {
-                                    T->get_node(nid)->add_mutation(m);
-                                }
-                                // Add mutations to best node using l1_mut
-                                for (auto m: l1_mut) {
-                                    T->get_node(best_node->identifier)->add_mutation(m);
-                                }
-                                // Add new sample mutations using l2_mut
-                                for (auto m: l2_mut) {
-                                    T->get_node(sample)->add_mutation(m);
+                                    // Mutations of best node have changed, which
+                                    // affects the ancestral mutations of its whole
+                                    // subtree
+                                    ancestral_mutations_cache->update_subtree(T->get_node(nid));
                                 }
-                            }
-                            // Else placement as child
-                            else {
-                                T->create_node(sample, best_node->identifier);
-                                MAT::Node* node = T->get_node(sample);
-                                std::vector<MAT::Mutation> node_mut;
+                                // Else placement as child
+                                else {
+                                    T->create_node(sample, best_node->identifier);
+                                    MAT::Node* node = T->get_node(sample);
+                                    std::vector<MAT::Mutation> node_mut;
 
-                                std::vector<MAT::Mutation> curr_l1_mut;
+                                    std::vector<MAT::Mutation> curr_l1_mut;
 
-                                for (auto m1: best_node->mutations) {
-                                    MAT::Mutation m = m1.copy();
-                                    curr_l1_mut.emplace_back(m);
-                                }
+                                    for (auto m1: best_node->mutations) {
+                                        MAT::Mutation m = m1.copy();
+                                        curr_l1_mut.emplace_back(m);
+                                    }
 
-                                for (auto m1: node_excess_mutations[best_j]) {
-                                    bool found = false;
-                                    for (auto m2: curr_l1_mut) {
-                                        if (m1.is_masked()) {
-                                            break;
-                                        }
-                                        if (m1.position == m2.position) {
-                                            if (m1.mut_nuc == m2.mut_nuc) {
-                                                found = true;
+                                    for (auto m1: node_excess_mutations[best_j]) {
+                                        bool found = false;
+                                        for (auto m2: curr_l1_mut) {
+                                            if (m1.is_masked()) {
                                                 break;
                                             }
+                                            if (m1.position == m2.position) {
+                                                if (m1.mut_nuc == m2.mut_nuc) {
+                                                    found = true;
+                                                    break;
+                                                }
+                                            }
+                                        }
+                                        if (!found) {
+                                            MAT::Mutation m = m1.copy();
+                                            node_mut.emplace_back(m);
                                         }
                                     }
-                                    if (!found) {
-                                        MAT::Mutation m = m1.copy();
-                                        node_mut.emplace_back(m);
+                                    for (auto m: node_mut) {
+                                        node->add_mutation(m);
                                     }
                                 }
-                                for (auto m: node_mut) {
-                                    node->add_mutation(m);
-                                }
                             }
-                        }
 
-                        if (node_imputed_mutations[best_j].size() > 0) {
-                            fprintf (stderr, "Imputed mutations:\t");
-                            size_t tot = node_imputed_mutations[best_j].size();
-                            for (size_t curr = 0; curr < tot; curr++) {
-                                MAT::Mutation& mut = node_imputed_mutations[best_j][curr];
-                                if (curr < tot-1) {
-                                    fprintf (stderr, "%i:%c;", mut.position, MAT::get_nuc(mut.mut_nuc));
-                                    fprintf (placement_stats_file, "%i:%c;", mut.position, MAT::get_nuc(mut.mut_nuc));
-                                } else {
-                                    fprintf (stderr, "%i:%c", mut.position, MAT::get_nuc(mut.mut_nuc));
-                                    fprintf (placement_stats_file, "%i:%c", mut.position, MAT::get_nuc(mut.mut_nuc));
+                            if (node_imputed_mutations[best_j].size() > 0) {
+                                fprintf (stderr, "Imputed mutations:\t");
+                                size_t tot = node_imputed_mutations[best_j].size();
+                                for (size_t curr = 0; curr < tot; curr++) {
+                                    MAT::Mutation& mut = node_imputed_mutations[best_j][curr];
+                                    if (curr < tot-1) {
+                                        fprintf (stderr, "%i:%c;", mut.position, MAT::get_nuc(mut.mut_nuc));
+                                        fprintf (placement_stats_file, "%i:%c;", mut.position, MAT::get_nuc(mut.mut_nuc));
+                                    } else {
+                                        fprintf (stderr, "%i:%c", mut.position, MAT::get_nuc(mut.mut_nuc));
+                                        fprintf (placement_stats_file, "%i:%c", mut.position, MAT::get_nuc(mut.mut_nuc));
+                                    }
                                 }
+                                fprintf(stderr, "\n");
                             }
-                            fprintf(stderr, "\n");
-                        }
 
-                        if (max_trees == 1) {
-                            break;
+                            if (max_trees == 1) {
+                                break;
+                            }
                         }
                     }
+                    fputc('\n', placement_stats_file);
+
+                    fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
                 }
-                fputc('\n', placement_stats_file);
+            }
 
-                fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
+            // Genotypes of the batch are no longer needed
+            if (sample_batches != NULL) {
+                for (size_t s=samples_start; s<samples_end; s++) {
+                    std::vector<MAT::Mutation>().swap(missing_samples[s].mutations);
+                }
             }
         }
         fclose(placement_stats_file);
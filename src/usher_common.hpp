@@ -7,6 +7,7 @@
 #include <iostream>
 #include <memory>
 #include <limits>
+#include <thread>
 #include "boost/filesystem.hpp"
 #include "usher_graph.hpp"
 #include "parsimony.pb.h"
@@ -15,8 +16,17 @@
 namespace po = boost::program_options;
 namespace MAT = Mutation_Annotated_Tree;
 
+// Missing samples whose genotypes are read from the VCF one batch at a time
+// during placement, see MAT::read_vcf_missing_samples
+struct VCF_Sample_Batches {
+    std::string vcf_filename;
+    std::vector<size_t> missing_idx;
+    size_t batch_size;
+};
+
 int usher_common(std::string dout_filename, std::string outdir, uint32_t max_trees,
                  uint32_t max_uncertainty, uint32_t max_parsimony, bool sort_before_placement_1, bool sort_before_placement_2, bool sort_before_placement_3,
                  bool reverse_sort, bool collapse_tree, bool collapse_output_tree, bool print_uncondensed_tree, bool print_parsimony_scores,
                  bool retain_original_branch_len, bool no_add, bool detailed_clades, size_t print_subtrees_size, size_t print_subtrees_single,
-                 std::vector<Missing_Sample>& missing_samples, std::vector<std::string>& low_confidence_samples, MAT::Tree* loaded_MAT);
+                 std::vector<Missing_Sample>& missing_samples, std::vector<std::string>& low_confidence_samples, MAT::Tree* loaded_MAT,
+                 const VCF_Sample_Batches* sample_batches = NULL);
@@ -2,6 +2,8 @@
 //#include "tree.hpp"
 #include "mutation_annotated_tree.hpp"
 #include <set>
+#include <stack>
+#include <unordered_map>
 #include <cassert>
 #include <unordered_set>
 #include <mutex>
@@ -70,6 +72,71 @@ struct mapper_body {
     int operator()(mapper_input input);
 };
 
+// For each internal node, the most recent (non-masked) mutation at every
+// position on the path from the root to the node, including its own. The sets
+// are kept in a persistent binary trie over positions: the set of a node only
+// adds the paths to its own mutations to the trie of its parent and shares
+// everything else, so memory stays proportional to the number of mutations in
+// the tree instead of nodes times depth, and lookups need no copy. Entries
+// point into the nodes' mutation vectors, so a subtree must be refreshed with
+// update_subtree whenever mutations in it (or above it) change.
+class Ancestral_Mutations_Cache {
+    struct Trie_Node {
+        // 0 is the empty trie
+        uint32_t children[2];
+        // Only set at the leaves
+        const MAT::Mutation* mutation;
+    };
+    std::vector<Trie_Node> trie;
+    std::unordered_map<const MAT::Node*, uint32_t> node_tries;
+    // Positions have at most num_bits bits
+    int num_bits;
+    // Size of the trie after the last build, the trie nodes replaced by
+    // update_subtree are only reclaimed by rebuilding once it doubled
+    size_t built_size;
+    const MAT::Tree* T;
+    bool built;
+    uint32_t insert(uint32_t root, const MAT::Mutation* m);
+    bool compute(const MAT::Node* node);
+  public:
+    // Mutations inherited by a node from its strict ancestors
+    class Inherited_View {
+        const Ancestral_Mutations_Cache* cache;
+        uint32_t root;
+      public:
+        Inherited_View(const Ancestral_Mutations_Cache* cache = NULL, uint32_t root = 0): cache(cache), root(root) {}
+        // The most recent mutation at position, NULL if there is none
+        const MAT::Mutation* find(int position) const;
+        // Visits the mutations in increasing order of position
+        class Iterator {
+            const Ancestral_Mutations_Cache* cache;
+            // Trie nodes left to visit with their depth, at most two per level
+            std::pair<uint32_t, int> remaining[66];
+            int num_remaining;
+          public:
+            Iterator(const Ancestral_Mutations_Cache* cache, uint32_t root);
+            // NULL once all mutations were visited
+            const MAT::Mutation* next();
+        };
+        Iterator begin() const {
+            return Iterator(cache, root);
+        }
+    };
+    Ancestral_Mutations_Cache() {
+        num_bits = 0;
+        built_size = 0;
+        T = NULL;
+        built = false;
+    }
+    bool is_built() const {
+        return built;
+    }
+    void build(const MAT::Tree* T);
+    void update_subtree(const MAT::Node* node);
+    void clear();
+    Inherited_View get_inherited(const MAT::Node* node) const;
+};
+
 struct mapper2_input {
     std::string missing_sample;
     MAT::Tree* T;
@@ -94,9 +161,19 @@ struct mapper2_input {
     std::vector<MAT::Mutation>* excess_mutations;
     std::vector<MAT::Mutation>* imputed_mutations;
 
+    // Optional, ancestral mutations are computed by walking to the root if NULL
+    const Ancestral_Mutations_Cache* ancestral_mutations_cache;
+
+    // Optional, for scoring every node instead of searching for the best one:
+    // if set, only records whether a placement at node is as its sibling,
+    // without touching the shared best placement
+    bool* node_has_unique_out;
+
     mapper2_input () {
         distance = 0;
         best_distance = &distance;
+        ancestral_mutations_cache = NULL;
+        node_has_unique_out = NULL;
     }
 };
 
@@ -160,6 +160,165 @@ int mapper_body::operator()(mapper_input input) {
     return 1;
 }
 
+// Copies the path to the leaf for the position of m, so the returned trie
+// holds m and shares all other nodes with root
+uint32_t Ancestral_Mutations_Cache::insert(uint32_t root, const MAT::Mutation* m) {
+    uint32_t new_root = trie.size();
+    Trie_Node copied = trie[root];
+    trie.emplace_back(copied);
+    uint32_t curr = new_root;
+    for (int bit = num_bits-1; bit >= 0; bit--) {
+        int child_idx = (m->position >> bit) & 1;
+        uint32_t copy = trie.size();
+        copied = trie[trie[curr].children[child_idx]];
+        trie.emplace_back(copied);
+        trie[curr].children[child_idx] = copy;
+        curr = copy;
+    }
+    trie[curr].mutation = m;
+    return new_root;
+}
+
+// Adds the non-masked mutations of node to the trie of its parent. Leaves are
+// never parents, so no trie is stored for them. Returns false if a position
+// does not fit in the trie
+bool Ancestral_Mutations_Cache::compute(const MAT::Node* node) {
+    if (node->children.empty()) {
+        node_tries.erase(node);
+        return true;
+    }
+    uint32_t root = 0;
+    if (node->parent != NULL) {
+        auto iter = node_tries.find(node->parent);
+        assert(iter != node_tries.end());
+        root = iter->second;
+    }
+    for (const auto& m: node->mutations) {
+        if (!m.is_masked()) {
+            if ((m.position < 0) || ((m.position >> num_bits) != 0)) {
+                return false;
+            }
+            root = insert(root, &m);
+        }
+    }
+    node_tries[node] = root;
+    return true;
+}
+
+void Ancestral_Mutations_Cache::build(const MAT::Tree* tree) {
+    T = tree;
+    int max_position = 0;
+    for (auto n: T->depth_first_expansion()) {
+        for (const auto& m: n->mutations) {
+            max_position = std::max(max_position, m.position);
+        }
+    }
+    // One spare bit, so that samples adding mutations past the end of the
+    // current ones rarely need a rebuild
+    num_bits = 1;
+    while ((num_bits < 31) && ((max_position >> (num_bits-1)) != 0)) {
+        num_bits++;
+    }
+    trie.clear();
+    trie.emplace_back(Trie_Node{{0, 0}, NULL});
+    node_tries.clear();
+    built = true;
+    if (T->root != NULL) {
+        std::stack<const MAT::Node*> s;
+        s.push(T->root);
+        while (!s.empty()) {
+            auto curr = s.top();
+            s.pop();
+            compute(curr);
+            for (auto c: curr->children) {
+                if (!c->children.empty()) {
+                    s.push(c);
+                }
+            }
+        }
+    }
+    built_size = trie.size();
+}
+
+// Recomputes the tries for node and all its descendants in preorder, so that
+// each parent trie is up to date before its children are visited
+void Ancestral_Mutations_Cache::update_subtree(const MAT::Node* node) {
+    if (!built) {
+        return;
+    }
+    std::stack<const MAT::Node*> s;
+    s.push(node);
+    while (!s.empty()) {
+        auto curr = s.top();
+        s.pop();
+        if (!compute(curr)) {
+            build(T);
+            return;
+        }
+        for (auto c: curr->children) {
+            if (!c->children.empty()) {
+                s.push(c);
+            }
+        }
+    }
+    if (trie.size() > 2*built_size) {
+        build(T);
+    }
+}
+
+void Ancestral_Mutations_Cache::clear() {
+    trie.clear();
+    node_tries.clear();
+    built = false;
+}
+
+Ancestral_Mutations_Cache::Inherited_View Ancestral_Mutations_Cache::get_inherited(const MAT::Node* node) const {
+    if (node->parent == NULL) {
+        return Inherited_View(this, 0);
+    }
+    auto iter = node_tries.find(node->parent);
+    assert(iter != node_tries.end());
+    return Inherited_View(this, iter->second);
+}
+
+const MAT::Mutation* Ancestral_Mutations_Cache::Inherited_View::find(int position) const {
+    if ((cache == NULL) || (position < 0) || ((position >> cache->num_bits) != 0)) {
+        return NULL;
+    }
+    uint32_t curr = root;
+    for (int bit = cache->num_bits-1; bit >= 0; bit--) {
+        curr = cache->trie[curr].children[(position >> bit) & 1];
+        if (curr == 0) {
+            return NULL;
+        }
+    }
+    return cache->trie[curr].mutation;
+}
+
+Ancestral_Mutations_Cache::Inherited_View::Iterator::Iterator(const Ancestral_Mutations_Cache* cache, uint32_t root): cache(cache) {
+    num_remaining = 0;
+    if ((cache != NULL) && (root != 0)) {
+        remaining[num_remaining++] = std::make_pair(root, 0);
+    }
+}
+
+const MAT::Mutation* Ancestral_Mutations_Cache::Inherited_View::Iterator::next() {
+    while (num_remaining > 0) {
+        auto curr = remaining[--num_remaining];
+        const auto& trie_node = cache->trie[curr.first];
+        if (curr.second == cache->num_bits) {
+            return trie_node.mutation;
+        }
+        // The lower half of the positions is visited first
+        for (int child_idx = 1; child_idx >= 0; child_idx--) {
+            if (trie_node.children[child_idx] != 0) {
+                remaining[num_remaining++] = std::make_pair(trie_node.children[child_idx], curr.second+1);
+            }
+        }
+    }
+    return NULL;
+}
+
 // Used to do a parallel search for the parsimony-optimal placement node. If
 // compute_parsimony_scores is not set, the function can return early if the
 // parsimony score at the current input node exceeds the smallest parsimony
@@ -175,8 +334,9 @@ void mapper2_body(mapper2_input& input, bool compute_parsimony_scores, bool comp
     // during the parallel search to place the same at some node in the tree
     int best_set_difference = *input.best_set_difference;
 
-    std::vector<int> anc_positions;
-    std::vector<MAT::Mutation> ancestral_mutations;
+    // Pointers into the mutation vectors of the current node and its
+    // ancestors, avoiding copies of each mutation
+    std::vector<const MAT::Mutation*> ancestral_mutations;
 
     // if node has some unique mutations not in new sample, placement should be
     // done as a sibling
@@ -189,7 +349,7 @@ void mapper2_body(mapper2_input& input, bool compute_parsimony_scores, bool comp
     // node not in new sample is found.
     if (!input.node->is_root()) {
         size_t start_index = 0;
-        for (auto m1: input.node->mutations) {
+        for (const auto& m1: input.node->mutations) {
             node_num_mut++;
             auto anc_nuc = m1.mut_nuc;
             // if mutation is masked, treat it as a unique mutation (add as
@@ -212,18 +372,9 @@ void mapper2_body(mapper2_input& input, bool compute_parsimony_scores, bool comp
                     } else {
                         auto nuc = m2.mut_nuc;
                         if ((nuc & anc_nuc) != 0) {
-                            MAT::Mutation m;
-                            m.chrom = m1.chrom;
-                            m.position = m1.position;
-                            m.ref_nuc = m1.ref_nuc;
-                            m.par_nuc = m1.par_nuc;
-                            m.mut_nuc = anc_nuc;
-
-                            ancestral_mutations.emplace_back(m);
-                            anc_positions.emplace_back(m.position);
-                            assert((m.mut_nuc & (m.mut_nuc-1)) == 0);
+                            ancestral_mutations.emplace_back(&m1);
                             if (compute_vecs) {
-                                (*input.excess_mutations).emplace_back(m);
+                                (*input.excess_mutations).emplace_back(m1.copy());
                             }
 
                             // Ambiguous base
@@ -242,18 +393,9 @@ void mapper2_body(mapper2_input& input, bool compute_parsimony_scores, bool comp
             }
             if (!found) {
                 if (!found_pos && (anc_nuc == m1.ref_nuc)) {
-                    MAT::Mutation m;
-                    m.position = m1.position;
-                    m.chrom = m1.chrom;
-                    m.ref_nuc = m1.ref_nuc;
-                    m.par_nuc = m1.par_nuc;
-                    m.mut_nuc = anc_nuc;
-
-                    ancestral_mutations.emplace_back(m);
-                    anc_positions.emplace_back(m.position);
-                    assert((m.mut_nuc & (m.mut_nuc-1)) == 0);
+                    ancestral_mutations.emplace_back(&m1);
                     if (compute_vecs) {
-                        (*input.excess_mutations).emplace_back(m);
+                        (*input.excess_mutations).emplace_back(m1.copy());
                     }
 
                     num_common_mut++;
@@ -263,30 +405,61 @@ void mapper2_body(mapper2_input& input, bool compute_parsimony_scores, bool comp
             }
         }
     } else {
-        for (auto m: input.node->mutations) {
-            ancestral_mutations.emplace_back(m);
-            anc_positions.emplace_back(m.position);
+        for (const auto& m: input.node->mutations) {
+            ancestral_mutations.emplace_back(&m);
         }
     }
 
+    auto by_position = [](const MAT::Mutation* a, const MAT::Mutation* b) {
+        return (a->position < b->position);
+    };
+
     // Add ancestral mutations to ancestral mutations. When multiple mutations
     // at same position are found in the path leading from the root to the
-    // current node, add only the most recent mutation to the vector
-    {
+    // current node, add only the most recent mutation to the vector. With a
+    // cache, only the current node's mutations are in the vector and the
+    // inherited ones are read from the cache.
+    Ancestral_Mutations_Cache::Inherited_View inherited;
+    if (input.ancestral_mutations_cache != NULL) {
+        std::sort(ancestral_mutations.begin(), ancestral_mutations.end(), by_position);
+        inherited = input.ancestral_mutations_cache->get_inherited(input.node);
+    } else {
+        std::unordered_set<int> anc_positions;
+        for (auto m: ancestral_mutations) {
+            anc_positions.insert(m->position);
+        }
         auto n = input.node;
         while (n->parent != NULL) {
             n = n->parent;
-            for (auto m: n->mutations) {
-                if (!m.is_masked() && (std::find(anc_positions.begin(), anc_positions.end(), m.position) == anc_positions.end())) {
-                    ancestral_mutations.emplace_back(m);
-                    anc_positions.emplace_back(m.position);
+            for (const auto& m: n->mutations) {
+                if (!m.is_masked() && (anc_positions.find(m.position) == anc_positions.end())) {
+                    ancestral_mutations.emplace_back(&m);
+                    anc_positions.insert(m.position);
                 }
             }
         }
+
+        // sort by position. This helps speed up the search
+        std::sort(ancestral_mutations.begin(), ancestral_mutations.end(), by_position);
     }
 
-    // sort by position. This helps speed up the search
-    std::sort(ancestral_mutations.begin(), ancestral_mutations.end());
+    // First non-masked ancestral mutation at position, NULL if there is none.
+    // Mutations of the current node hide inherited ones at the same position
+    auto find_ancestral = [&](int position) -> const MAT::Mutation* {
+        auto iter = std::lower_bound(ancestral_mutations.begin(), ancestral_mutations.end(), position,
+        [](const MAT::Mutation* m, int pos) {
+            return (m->position < pos);
+        });
+        if ((iter != ancestral_mutations.end()) && ((*iter)->position == position)) {
+            for (; (iter != ancestral_mutations.end()) && ((*iter)->position == position); iter++) {
+                if (!(*iter)->is_masked()) {
+                    return *iter;
+                }
+            }
+            return NULL;
+        }
+        return inherited.find(position);
+    };
 
     // Iterate over missing sample mutations
     for (auto m1: (*input.missing_sample_mutations)) {
@@ -294,7 +467,6 @@ void mapper2_body(mapper2_input& input, bool compute_parsimony_scores, bool comp
         if (m1.is_missing) {
             continue;
         }
-        size_t start_index = 0;
         bool found_pos = false;
         bool found = false;
         bool has_ref = false;
@@ -302,21 +474,14 @@ void mapper2_body(mapper2_input& input, bool compute_parsimony_scores, bool comp
         if ((m1.mut_nuc & m1.ref_nuc) != 0) {
             has_ref = true;
         }
-        // Check if mutation is found in ancestral_mutations
-        for (size_t k = start_index; k < ancestral_mutations.size(); k++) {
-            auto m2 = ancestral_mutations[k];
-            // Masked mutations don't match anything
-            if (m2.is_masked()) {
-                continue;
-            }
-            start_index = k;
-            if (m1.position == m2.position) {
-                found_pos = true;
-                anc_nuc = m2.mut_nuc;
-                if ((m1.mut_nuc & anc_nuc) != 0) {
-                    found = true;
-                }
-                break;
+        // Check if mutation is found in ancestral mutations. Masked mutations
+        // don't match anything
+        auto m2 = find_ancestral(m1.position);
+        if (m2 != NULL) {
+            found_pos = true;
+            anc_nuc = m2->mut_nuc;
+            if ((m1.mut_nuc & anc_nuc) != 0) {
+                found = true;
             }
         }
         if (found) {
@@ -389,8 +554,24 @@ void mapper2_body(mapper2_input& input, bool compute_parsimony_scores, bool comp
 
     // For loop to add back-mutations for cases in which a mutation from the
     // root to the current node consists of a non-reference allele but no such
-    // variant is found in the missing sample
-    for (auto m1: ancestral_mutations) {
+    // variant is found in the missing sample. Mutations of the current node and
+    // inherited ones are merged by position, the former hiding the latter
+    size_t own_idx = 0;
+    auto inherited_iter = inherited.begin();
+    auto next_inherited = inherited_iter.next();
+    while ((own_idx < ancestral_mutations.size()) || (next_inherited != NULL)) {
+        const MAT::Mutation* anc_mut;
+        if ((next_inherited == NULL) || ((own_idx < ancestral_mutations.size()) &&
+                                         (ancestral_mutations[own_idx]->position <= next_inherited->position))) {
+            anc_mut = ancestral_mutations[own_idx++];
+            if ((next_inherited != NULL) && (anc_mut->position == next_inherited->position)) {
+                next_inherited = inherited_iter.next();
+            }
+        } else {
+            anc_mut = next_inherited;
+            next_inherited = inherited_iter.next();
+        }
+        const auto& m1 = *anc_mut;
         size_t start_index = 0;
         bool found = false;
         bool found_pos = false;
@@ -453,6 +634,10 @@ void mapper2_body(mapper2_input& input, bool compute_parsimony_scores, bool comp
     // if child of internal node, ensure all internal node mutations are present in the sample
     if (input.node->is_root() || ((has_unique && !input.node->is_leaf() && (num_common_mut > 0) && (node_num_mut != num_common_mut)) || \
                                   (input.node->is_leaf() && (num_common_mut > 0)) || (!has_unique && !input.node->is_leaf() && (node_num_mut == num_common_mut)))) {
+        if (input.node_has_unique_out != NULL) {
+            *input.node_has_unique_out = has_unique;
+            return;
+        }
         {
             tbb::rw_mutex::scoped_lock lock(rd_wr_lock, false); // read lock
             if (set_difference > *input.best_set_difference) {
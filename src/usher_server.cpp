@@ -25,6 +25,19 @@ namespace po = boost::program_options;
 namespace MAT = Mutation_Annotated_Tree;
 namespace fs = boost::filesystem;
 
+// usher_common modifies the tree it is given, so each MAT is kept twice: an
+// immutable base tree loaded from disk and a working copy handed to
+// usher_common. After a request, the working copy is replaced by a fresh
+// in-memory copy of the base tree instead of reading the MAT from disk again
+static void restore_working_tree(const MAT::Tree& base_MAT, MAT::Tree& working_MAT, const std::string& MAT_filename) {
+    Timer timer;
+    timer.Start();
+    fprintf(stderr, "Restoring mutation-annotated tree object %s from memory\n", MAT_filename.c_str());
+    MAT::clear_tree(working_MAT);
+    working_MAT = MAT::clone_tree(base_MAT);
+    fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
+}
+
 int main(int argc, char** argv) {
 
     //Variables to load command-line options using Boost program_options
@@ -63,8 +76,9 @@ int main(int argc, char** argv) {
             return 1;
     }
 
-    //slot for a MAT not in the MAT_list file
+    //slot for a MAT not in the MAT_list file, and its immutable base tree
     MAT::Tree loaded_MAT;
+    MAT::Tree loaded_MAT_base;
     //keep track if loaded_MAT is a new copy of MAT and can be used
     bool loaded_MAT_avail = false;
     std::string loaded_MAT_name = "";
@@ -86,8 +100,9 @@ int main(int argc, char** argv) {
 
     //MAT that is used in the iteration
     MAT::Tree *curr_tree;
-    //collection of loaded MATs from the list
+    //collection of loaded MATs from the list, and their immutable base trees
     std::unordered_map<std::string, MAT::Tree> MAT_list;
+    std::unordered_map<std::string, MAT::Tree> MAT_list_base;
     //stores information on whether the MATs in the list are available for use
     std::unordered_map<std::string, bool> MAT_list_avail;
 
@@ -106,7 +121,8 @@ int main(int argc, char** argv) {
             // Load mutation-annotated tree and store it
             timer.Start();
             fprintf(stderr, "Loading existing mutation-annotated tree object from file %s\n", MAT_filename.c_str());
-            MAT_list[MAT_filename] = MAT::load_mutation_annotated_tree(MAT_filename);
+            MAT_list_base[MAT_filename] = MAT::load_mutation_annotated_tree(MAT_filename);
+            MAT_list[MAT_filename] = MAT::clone_tree(MAT_list_base[MAT_filename]);
             MAT_list_avail[MAT_filename] = true;
             fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
         }
@@ -115,26 +131,17 @@ int main(int argc, char** argv) {
 
 
     while(true) {
-        //if there's a MAT loaded in and it's not available to be used, load it in
+        //if there's a MAT loaded in and it's not available to be used, restore it
         if((loaded_MAT_name != "") && (!loaded_MAT_avail)) {
-            timer.Start();
-            fprintf(stderr, "Loading existing mutation-annotated tree object from file %s\n", loaded_MAT_name.c_str());
-            // Load mutation-annotated tree and store it
-            MAT::clear_tree(loaded_MAT);
-            loaded_MAT = MAT::load_mutation_annotated_tree(loaded_MAT_name);
-            fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
+            restore_working_tree(loaded_MAT_base, loaded_MAT, loaded_MAT_name);
             loaded_MAT_avail = true;
         }
-        //iterate through MATs specified by MAT_list file if there are used trees then remove them and load them back in
+        //iterate through MATs specified by MAT_list file if there are used trees then restore them
         for(auto itr = MAT_list_avail.begin(); itr != MAT_list_avail.end(); itr++) {
-            //if a MAT pointed by this iterator is not available, load the MAT
+            //if a MAT pointed by this iterator is not available, restore the MAT
             if(!(itr->second)) {
-                timer.Start();
-                fprintf(stderr, "Loading existing mutation-annotated tree object from file %s\n", (itr->first).c_str());
-                MAT::clear_tree(MAT_list[itr->first]);
-                MAT_list[itr->first] = MAT::load_mutation_annotated_tree(itr->first);
+                restore_working_tree(MAT_list_base[itr->first], MAT_list[itr->first], itr->first);
                 itr->second = true;
-                fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
             }
         }
 
@@ -280,8 +287,10 @@ int main(int argc, char** argv) {
                             //discard them so new version could be loaded in
                             for(auto itr = MAT_list.begin(); itr != MAT_list.end(); itr++) {
                                 MAT::clear_tree(itr->second);
+                                MAT::clear_tree(MAT_list_base[itr->first]);
                             }
                             MAT_list.clear();
+                            MAT_list_base.clear();
                             MAT_list_avail.clear();
                             std::string MAT_filename;
                             MAT::Tree temp_MAT;
@@ -292,7 +301,8 @@ int main(int argc, char** argv) {
                                 // Load mutation-annotated tree and store it
                                 timer.Start();
                                 fprintf(stderr, "Loading existing mutation-annotated tree object from file %s\n", MAT_filename.c_str());
-                                MAT_list[MAT_filename] = MAT::load_mutation_annotated_tree(MAT_filename);
+                                MAT_list_base[MAT_filename] = MAT::load_mutation_annotated_tree(MAT_filename);
+                                MAT_list[MAT_filename] = MAT::clone_tree(MAT_list_base[MAT_filename]);
                                 MAT_list_avail[MAT_filename] = true;
                                 fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
                             }
@@ -315,13 +325,9 @@ int main(int argc, char** argv) {
 
                 //if the MAT is in the list
                 if(MAT_list.count(din_filename) != 0) {
-                    //if the MAT is not available, load it in
+                    //if the MAT is not available, restore it
                     if(!(MAT_list_avail[din_filename])) {
-                        timer.Start();
-                        fprintf(stderr, "Loading existing mutation-annotated tree object from file %s\n", din_filename.c_str());
-                        MAT::clear_tree(MAT_list[din_filename]);
-                        MAT_list[din_filename] = MAT::load_mutation_annotated_tree(din_filename);
-                        fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
+                        restore_working_tree(MAT_list_base[din_filename], MAT_list[din_filename], din_filename);
                     }
                     curr_tree = &MAT_list[din_filename];
                     MAT_list_avail[din_filename] = false;
@@ -333,24 +339,22 @@ int main(int argc, char** argv) {
                     //if there is an existing tree, delete it
                     if(loaded_MAT_name != "") {
                         MAT::clear_tree(loaded_MAT);
+                        MAT::clear_tree(loaded_MAT_base);
                     }
                     // Load mutation-annotated tree and store it
-                    loaded_MAT = MAT::load_mutation_annotated_tree(din_filename);
+                    loaded_MAT_base = MAT::load_mutation_annotated_tree(din_filename);
+                    loaded_MAT = MAT::clone_tree(loaded_MAT_base);
                     loaded_MAT_name = din_filename;
                     curr_tree = &loaded_MAT;
                     loaded_MAT_avail = false;
                     fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
                 }
                 //if the tree is in the loaded MAT slot, but not available,
-                //load the tree that can be used
+                //restore the tree that can be used
                 else if(!loaded_MAT_avail) {
-                    timer.Start();
-                    fprintf(stderr, "Loading existing mutation-annotated tree object from file %s\n", din_filename.c_str());
-                    MAT::clear_tree(loaded_MAT);
-                    loaded_MAT = MAT::load_mutation_annotated_tree(din_filename);
+                    restore_working_tree(loaded_MAT_base, loaded_MAT, din_filename);
                     curr_tree = &loaded_MAT;
                     loaded_MAT_avail = false;
-                    fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
                 }
                 //loaded_MAT can be used
                 else {
@@ -358,114 +362,14 @@ int main(int argc, char** argv) {
                     loaded_MAT_avail = false;
                 }
 
-                // Variables below are used to store the different fields of the input VCF file
-                bool header_found = false;
-                std::vector<std::string> variant_ids;
                 std::vector<Missing_Sample> missing_samples;
 
-                // Vector used to store all tree nodes in breadth-first search (BFS) order
-                std::vector<MAT::Node*> bfs;
-                // Map the node identifier string to index in the BFS traversal
-                std::unordered_map<std::string, size_t> bfs_idx;
-
                 // Vectore to store the names of samples which have a high number of
                 // parsimony-optimal placements
                 std::vector<std::string> low_confidence_samples;
-                fprintf(stderr, "Loading VCF file\n");
                 timer.Start();
 
-                // Boost library used to stream the contents of the input VCF file in
-                // uncompressed or compressed .gz format
-                std::ifstream infile(vcf_filename, std::ios_base::in | std::ios_base::binary);
-                if (!infile) {
-                    fprintf(stderr, "ERROR: Could not open the VCF file: %s!\n", vcf_filename.c_str());
-                    exit(1);
-                }
-                boost::iostreams::filtering_istream instream;
-                try {
-                    if (vcf_filename.find(".gz\0") != std::string::npos) {
-                        instream.push(boost::iostreams::gzip_decompressor());
-                    }
-                    instream.push(infile);
-                } catch(const boost::iostreams::gzip_error& e) {
-                    std::cout << e.what() << '\n';
-                }
-
-                std::vector<size_t> missing_idx;
-                std::string s;
-                // This while loop reads the VCF file line by line and populates
-                // missing_samples and missing_sample_mutations based on the names and
-                // variants of missing samples. If a sample name in the VCF is already
-                // found in the tree, it gets ignored with a warning message
-                while (instream.peek() != EOF) {
-                    std::getline(instream, s);
-                    std::vector<std::string> words;
-                    MAT::string_split(s, words);
-                    if ((not header_found) && (words.size() > 1)) {
-                        if (words[1] == "POS") {
-                            for (size_t j=9; j < words.size(); j++) {
-                                variant_ids.emplace_back(words[j]);
-                                if ((curr_tree->get_node(words[j]) == NULL) && (curr_tree->condensed_leaves.find(words[j]) == curr_tree->condensed_leaves.end())) {
-                                    missing_samples.emplace_back(Missing_Sample(words[j]));
-                                    missing_idx.emplace_back(j);
-                                } else {
-                                    fprintf(stderr, "WARNING: Ignoring sample %s as it is already in the tree.\n", words[j].c_str());
-                                }
-                            }
-                            header_found = true;
-                        }
-                    } else if (header_found) {
-                        if (words.size() != 9+variant_ids.size()) {
-                            fprintf(stderr, "ERROR! Incorrect VCF format. Expected %zu columns but got %zu.\n", 9+variant_ids.size(), words.size());
-                            exit(1);
-                        }
-                        std::vector<std::string> alleles;
-                        alleles.clear();
-                        MAT::string_split(words[4], ',', alleles);
-                        for (size_t k = 0; k < missing_idx.size(); k++) {
-                            size_t j = missing_idx[k];
-                            auto iter = missing_samples.begin();
-                            std::advance(iter, k);
-                            if (iter != missing_samples.end()) {
-                                MAT::Mutation m;
-                                m.chrom = words[0];
-                                m.position = std::stoi(words[1]);
-                                m.ref_nuc = MAT::get_nuc_id(words[3][0]);
-                                assert((m.ref_nuc & (m.ref_nuc-1)) == 0); //check if it is power of 2
-                                m.par_nuc = m.ref_nuc;
-                                // Alleles such as '.' should be treated as missing
-                                // data. if the word is numeric, it is an index to one
-                                // of the alleles
-                                if (isdigit(words[j][0])) {
-                                    int allele_id = std::stoi(words[j]);
-                                    if (allele_id > 0) {
-                                        std::string allele = alleles[allele_id-1];
-                                        if (allele[0] == 'N') {
-                                            m.is_missing = true;
-                                            m.mut_nuc = MAT::get_nuc_id('N');
-                                        } else {
-                                            auto nuc = MAT::get_nuc_id(allele[0]);
-                                            if (nuc == MAT::get_nuc_id('N')) {
-                                                m.is_missing = true;
-                                            } else {
-                                                m.is_missing = false;
-                                            }
-                                            m.mut_nuc = nuc;
-                                        }
-                                        (*iter).mutations.emplace_back(m);
-                                    }
-                                } else {
-                                    m.is_missing = true;
-                                    m.mut_nuc = MAT::get_nuc_id('N');
-                                    (*iter).mutations.emplace_back(m);
-                                }
-                                if ((m.mut_nuc & (m.mut_nuc-1)) !=0) {
-                                    (*iter).num_ambiguous++;
-                                }
-                            }
-                        }
-                    }
-                }
+                MAT::read_vcf(curr_tree, vcf_filename, missing_samples, false);
                 fprintf(stderr, "Completed in %ld msec \n\n", timer.Stop());
 
                 //run usher on the argument